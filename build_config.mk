@@ -0,0 +1,13 @@
+SOURCES=db/builder.cc db/db_impl.cc db/db_iter.cc db/dbformat.cc db/dumpfile.cc db/filename.cc db/log_reader.cc db/log_writer.cc db/memtable.cc db/table_cache.cc db/version_edit.cc db/version_set.cc db/write_batch.cc table/block.cc table/block_builder.cc table/filter_block.cc table/format.cc table/iterator.cc table/merger.cc table/table.cc table/table_builder.cc table/two_level_iterator.cc util/BloomFilter.cc util/MurmurHash3.cc util/arena.cc util/bloom.cc util/cache.cc util/clock_cache.cc util/coding.cc util/comparator.cc util/cpumap.cc util/crc32c.cc util/debug.cc util/env.cc util/env_posix.cc util/filter_policy.cc util/hash.cc util/histogram.cc util/learned_index.cc util/logging.cc util/nvm_block_cache.cc util/options.cc util/read_pool.cc util/status.cc  port/port_posix.cc
+MEMENV_SOURCES=helpers/memenv/memenv.cc
+CC=cc
+CXX=g++
+PLATFORM=OS_LINUX
+PLATFORM_LDFLAGS=-pthread
+PLATFORM_LIBS=-lnuma
+PLATFORM_CCFLAGS= -fno-builtin-memcmp -fpermissive -pthread -DOS_LINUX -DNOVELSM_PLATFORM_POSIX -DMULTILEVEL_IMMUTABLE -DUSE_OFFSETS -DENABLE_RECOVERY -D_ENABLE_PREDICTION -DHAVE_IO_URING
+PLATFORM_CXXFLAGS=-std=c++0x -fno-builtin-memcmp -fpermissive -pthread -DOS_LINUX -DNOVELSM_PLATFORM_POSIX -DMULTILEVEL_IMMUTABLE -DUSE_OFFSETS -DENABLE_RECOVERY -D_ENABLE_PREDICTION -DHAVE_IO_URING
+PLATFORM_SHARED_CFLAGS=-fPIC
+PLATFORM_SHARED_EXT=so
+PLATFORM_SHARED_LDFLAGS=-shared -Wl,-soname -Wl,
+PLATFORM_SHARED_VERSIONED=true
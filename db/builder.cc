@@ -19,13 +19,28 @@ Status BuildTable(const std::string& dbname,
                   const Options& options,
                   TableCache* table_cache,
                   Iterator* iter,
-                  FileMetaData* meta) {
+                  FileMetaData* meta,
+                  const Slice* begin,
+                  const Slice* end) {
   Status s;
   meta->file_size = 0;
-  iter->SeekToFirst();
+  if (begin != NULL) {
+    InternalKey start(*begin, kMaxSequenceNumber, kValueTypeForSeek);
+    iter->Seek(start.Encode());
+  } else {
+    iter->SeekToFirst();
+  }
+
+  // The entries of *end, and the keys after it, sort at or after limit
+  InternalKey limit;
+  if (end != NULL) {
+    limit = InternalKey(*end, kMaxSequenceNumber, kValueTypeForSeek);
+  }
+  const Comparator* icmp = options.comparator;
 
   std::string fname = TableFileName(dbname, meta->number);
-  if (iter->Valid()) {
+  if (iter->Valid() &&
+      (end == NULL || icmp->Compare(iter->key(), limit.Encode()) < 0)) {
     WritableFile* file;
     s = env->NewWritableFile(fname, &file);
     if (!s.ok()) {
@@ -36,6 +51,9 @@ Status BuildTable(const std::string& dbname,
     meta->smallest.DecodeFrom(iter->key());
     for (; iter->Valid(); iter->Next()) {
       Slice key = iter->key();
+      if (end != NULL && icmp->Compare(key, limit.Encode()) >= 0) {
+        break;
+      }
       meta->largest.DecodeFrom(key);
       builder->Add(key, iter->value());
     }
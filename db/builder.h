@@ -5,6 +5,7 @@
 #ifndef STORAGE_NOVELSM_DB_BUILDER_H_
 #define STORAGE_NOVELSM_DB_BUILDER_H_
 
+#include "novelsm/slice.h"
 #include "novelsm/status.h"
 
 namespace novelsm {
@@ -22,12 +23,18 @@ class VersionEdit;
 // *meta will be filled with metadata about the generated table.
 // If no data is present in *iter, meta->file_size will be set to
 // zero, and no Table file will be produced.
+//
+// NoveLSM: If begin is non-NULL, the entries of user keys before *begin
+// are skipped; if end is non-NULL, the table stops before the entries
+// of user key *end.
 extern Status BuildTable(const std::string& dbname,
                          Env* env,
                          const Options& options,
                          TableCache* table_cache,
                          Iterator* iter,
-                         FileMetaData* meta);
+                         FileMetaData* meta,
+                         const Slice* begin = NULL,
+                         const Slice* end = NULL);
 
 }  // namespace novelsm
 
@@ -35,6 +35,8 @@
 //      readseq       -- read N times sequentially
 //      readreverse   -- read N times in reverse order
 //      readrandom    -- read N times in random order
+//      multireadrandom -- read N keys in random order, --multiget_batch
+//                       keys per MultiGet() call
 //      readmissing   -- read N missing keys in random order
 //      readhot       -- read N times in random order from 1% section of DB
 //      seekrandom    -- N random seeks
@@ -93,11 +95,54 @@ static int FLAGS_write_buffer_size = 0;
 static size_t FLAGS_nvm_buffer_size = 0;
 static int FLAGS_num_levels = 1;
 static int FLAGS_num_read_threads=0;
+// Writers of a group insert into the NVM memtable in parallel
+static bool FLAGS_concurrent_nvm_writes = false;
+// Per-writer NVM allocation slab in KB (0 disables slabs)
+static int FLAGS_nvm_slab_size = 0;
+// Full memtables that may wait for compaction before writes stall
+static int FLAGS_num_immutable_memtables = 1;
+// Overwrite same-size values in the NVM memtable in place
+static bool FLAGS_nvm_inplace_updates = false;
+// Hash index for point reads in NVM memtables
+static bool FLAGS_nvm_hash_index = false;
+// Predict memtable hits to skip the parallel SSTable search (-1: default)
+static int FLAGS_nvm_hit_prediction = -1;
+// Read through the zero-copy DB::Get() that returns a PinnedSlice
+static bool FLAGS_pinned_reads = false;
+// Keys per DB::MultiGet() call in multireadrandom
+static int FLAGS_multiget_batch = 100;
+// Learned index over level file bounds and table index blocks
+static bool FLAGS_learned_index = false;
+// Batch the data block reads of one lookup through Env::SubmitReads()
+static bool FLAGS_async_block_reads = false;
+// Size of the NVM block cache tier in MB (0: none)
+static size_t FLAGS_nvm_block_cache_size = 0;
+// Hold index and filter blocks in the block cache
+static bool FLAGS_cache_index_and_filter_blocks = false;
+// Levels whose index and filter blocks stay pinned in the block cache
+static int FLAGS_pin_index_and_filter_levels = 0;
+// Key ranges a compaction is split into and merged in parallel
+static int FLAGS_max_subcompactions = 1;
+// Compactions running at the same time
+static int FLAGS_max_background_compactions = 1;
+// Threads flushing memtables apart from compactions (0: none)
+static int FLAGS_max_background_flushes = 0;
+// Key ranges a memtable flush is split into and built in parallel
+static int FLAGS_flush_partitions = 1;
+// Merge memtable flushes into level 1 while level 0 is empty
+static bool FLAGS_flush_to_level1 = false;
+// 0 for leveled compaction, 1 for universal compaction
+static int FLAGS_compaction_style = 0;
+static int FLAGS_universal_size_ratio = 1;
+static int FLAGS_universal_max_sorted_runs = 4;
 
 // Number of bytes to use as a cache of uncompressed data.
 // Negative means use default settings.
 static int FLAGS_cache_size = -1;
 
+// Use the lock-free CLOCK block cache instead of the sharded LRU cache
+static bool FLAGS_clock_cache = false;
+
 // Maximum number of files to keep open at the same time (use default if == 0)
 static int FLAGS_open_files = 0;
 
@@ -407,7 +452,9 @@ private:
 
 public:
     Benchmark()
-: cache_(FLAGS_cache_size >= 0 ? NewLRUCache(FLAGS_cache_size) : NULL),
+: cache_(FLAGS_clock_cache
+          ? NewClockCache(FLAGS_cache_size >= 0 ? FLAGS_cache_size : 8 << 20)
+          : FLAGS_cache_size >= 0 ? NewLRUCache(FLAGS_cache_size) : NULL),
   filter_policy_(FLAGS_bloom_bits >= 0
           ? NewBloomFilterPolicy(FLAGS_bloom_bits)
                   : NULL),
@@ -498,6 +545,8 @@ public:
                 method = &Benchmark::ReadReverse;
             } else if (name == Slice("readrandom")) {
                 method = &Benchmark::ReadRandom;
+            } else if (name == Slice("multireadrandom")) {
+                method = &Benchmark::MultiReadRandom;
             } else if (name == Slice("readmissing")) {
                 method = &Benchmark::ReadMissing;
             } else if (name == Slice("seekrandom")) {
@@ -725,6 +774,27 @@ private:
         options.reuse_logs = FLAGS_reuse_logs;
         options.num_levels = FLAGS_num_levels;
         options.num_read_threads = FLAGS_num_read_threads;
+        options.concurrent_nvm_writes = FLAGS_concurrent_nvm_writes;
+        options.nvm_slab_size = FLAGS_nvm_slab_size * 1024L;
+        options.num_immutable_memtables = FLAGS_num_immutable_memtables;
+        options.nvm_inplace_updates = FLAGS_nvm_inplace_updates;
+        options.nvm_hash_index = FLAGS_nvm_hash_index;
+        if (FLAGS_nvm_hit_prediction >= 0)
+            options.nvm_hit_prediction = FLAGS_nvm_hit_prediction;
+        options.learned_index = FLAGS_learned_index;
+        options.async_block_reads = FLAGS_async_block_reads;
+        options.nvm_block_cache_size = FLAGS_nvm_block_cache_size;
+        options.cache_index_and_filter_blocks = FLAGS_cache_index_and_filter_blocks;
+        options.pin_index_and_filter_levels = FLAGS_pin_index_and_filter_levels;
+        options.max_subcompactions = FLAGS_max_subcompactions;
+        options.max_background_compactions = FLAGS_max_background_compactions;
+        options.max_background_flushes = FLAGS_max_background_flushes;
+        options.flush_partitions = FLAGS_flush_partitions;
+        options.flush_to_level1 = FLAGS_flush_to_level1;
+        options.compaction_style =
+                static_cast<CompactionStyle>(FLAGS_compaction_style);
+        options.universal_size_ratio = FLAGS_universal_size_ratio;
+        options.universal_max_sorted_runs = FLAGS_universal_max_sorted_runs;
         Status s = DB::Open(options, FLAGS_db_disk, FLAGS_db_mem, &db_);
         if (!s.ok()) {
             fprintf(stderr, "open error: %s\n", s.ToString().c_str());
@@ -831,6 +901,7 @@ private:
 
         ReadOptions options;
         std::string value;
+        PinnedSlice pinned;
         int found = 0;
         int64_t bytes = 0;
 
@@ -849,7 +920,15 @@ private:
             k = thread->rand.Next() % FLAGS_num;
 #endif
             snprintf(key, sizeof(key), "%016d", k);
-            if (db_->Get(options, key, &value).ok()) {
+            if (FLAGS_pinned_reads) {
+                if (db_->Get(options, key, &pinned).ok()) {
+                    bytes += strlen(key) + pinned.size();
+                    found++;
+                } else {
+                    assert(0);
+                }
+                pinned.Release();
+            } else if (db_->Get(options, key, &value).ok()) {
                 bytes += strlen(key) + value.size();
                 //printf("Finished reading %d\n", i);
                 found++;
@@ -881,6 +960,42 @@ private:
     }
 
 
+    void MultiReadRandom(ThreadState* thread) {
+        ReadOptions options;
+        std::vector<std::string> keys(FLAGS_multiget_batch);
+        std::vector<Slice> key_slices(FLAGS_multiget_batch);
+        std::vector<std::string> values;
+        std::vector<Status> statuses;
+        int found = 0;
+        int64_t bytes = 0;
+
+        for (int i = 0; i < reads_; i += FLAGS_multiget_batch) {
+            int n = std::min(FLAGS_multiget_batch, reads_ - i);
+            keys.resize(n);
+            key_slices.resize(n);
+            for (int j = 0; j < n; j++) {
+                char key[100];
+                const int k = thread->rand.Next() % FLAGS_num;
+                snprintf(key, sizeof(key), "%016d", k);
+                keys[j] = key;
+                key_slices[j] = keys[j];
+            }
+            db_->MultiGet(options, key_slices, &values, &statuses);
+            for (int j = 0; j < n; j++) {
+                if (statuses[j].ok()) {
+                    bytes += keys[j].size() + values[j].size();
+                    found++;
+                }
+                thread->stats.FinishedSingleOp();
+            }
+        }
+
+        char msg[100];
+        snprintf(msg, sizeof(msg), "(%d of %d found)", found, reads_);
+        thread->stats.AddBytes(bytes);
+        thread->stats.AddMessage(msg);
+    }
+
     void ReadMissing(ThreadState* thread) {
         ReadOptions options;
         std::string value;
@@ -1060,6 +1175,9 @@ int main(int argc, char** argv) {
             //fprintf(stderr,"FLAGS_nvm_buffer_size %zu\n", FLAGS_nvm_buffer_size);
         } else if (sscanf(argv[i], "--cache_size=%d%c", &n, &junk) == 1) {
             FLAGS_cache_size = n;
+        } else if (sscanf(argv[i], "--clock_cache=%d%c", &n, &junk) == 1 &&
+                (n == 0 || n == 1)) {
+            FLAGS_clock_cache = n;
         } else if (sscanf(argv[i], "--bloom_bits=%d%c", &n, &junk) == 1) {
             FLAGS_bloom_bits = n;
         } else if (sscanf(argv[i], "--open_files=%d%c", &n, &junk) == 1) {
@@ -1072,6 +1190,65 @@ int main(int argc, char** argv) {
             FLAGS_num_levels = n;
         } else if (sscanf(argv[i], "--num_read_threads=%d%c", &n, &junk) == 1) {
             FLAGS_num_read_threads = n;
+        } else if (sscanf(argv[i], "--concurrent_nvm_writes=%d%c", &n, &junk) == 1 &&
+                (n == 0 || n == 1)) {
+            FLAGS_concurrent_nvm_writes = n;
+        } else if (sscanf(argv[i], "--nvm_slab_size=%d%c", &n, &junk) == 1) {
+            FLAGS_nvm_slab_size = n;
+        } else if (sscanf(argv[i], "--num_immutable_memtables=%d%c", &n, &junk) == 1) {
+            FLAGS_num_immutable_memtables = n;
+        } else if (sscanf(argv[i], "--nvm_inplace_updates=%d%c", &n, &junk) == 1 &&
+                (n == 0 || n == 1)) {
+            FLAGS_nvm_inplace_updates = n;
+        } else if (sscanf(argv[i], "--nvm_hash_index=%d%c", &n, &junk) == 1 &&
+                (n == 0 || n == 1)) {
+            FLAGS_nvm_hash_index = n;
+        } else if (sscanf(argv[i], "--nvm_hit_prediction=%d%c", &n, &junk) == 1 &&
+                (n == 0 || n == 1)) {
+            FLAGS_nvm_hit_prediction = n;
+        } else if (sscanf(argv[i], "--pinned_reads=%d%c", &n, &junk) == 1 &&
+                (n == 0 || n == 1)) {
+            FLAGS_pinned_reads = n;
+        } else if (sscanf(argv[i], "--multiget_batch=%d%c", &n, &junk) == 1 &&
+                n > 0) {
+            FLAGS_multiget_batch = n;
+        } else if (sscanf(argv[i], "--learned_index=%d%c", &n, &junk) == 1 &&
+                (n == 0 || n == 1)) {
+            FLAGS_learned_index = n;
+        } else if (sscanf(argv[i], "--async_block_reads=%d%c", &n, &junk) == 1 &&
+                (n == 0 || n == 1)) {
+            FLAGS_async_block_reads = n;
+        } else if (sscanf(argv[i], "--nvm_block_cache_size=%d%c", &n, &junk) == 1 &&
+                n >= 0) {
+            FLAGS_nvm_block_cache_size = n*1024L*1024L;
+        } else if (sscanf(argv[i], "--cache_index_and_filter_blocks=%d%c", &n, &junk) == 1 &&
+                (n == 0 || n == 1)) {
+            FLAGS_cache_index_and_filter_blocks = n;
+        } else if (sscanf(argv[i], "--pin_index_and_filter_levels=%d%c", &n, &junk) == 1 &&
+                n >= 0) {
+            FLAGS_pin_index_and_filter_levels = n;
+        } else if (sscanf(argv[i], "--max_subcompactions=%d%c", &n, &junk) == 1 &&
+                n > 0) {
+            FLAGS_max_subcompactions = n;
+        } else if (sscanf(argv[i], "--max_background_compactions=%d%c", &n, &junk) == 1 &&
+                n > 0) {
+            FLAGS_max_background_compactions = n;
+        } else if (sscanf(argv[i], "--max_background_flushes=%d%c", &n, &junk) == 1 &&
+                n >= 0) {
+            FLAGS_max_background_flushes = n;
+        } else if (sscanf(argv[i], "--flush_partitions=%d%c", &n, &junk) == 1 &&
+                n > 0) {
+            FLAGS_flush_partitions = n;
+        } else if (sscanf(argv[i], "--flush_to_level1=%d%c", &n, &junk) == 1 &&
+                (n == 0 || n == 1)) {
+            FLAGS_flush_to_level1 = n;
+        } else if (sscanf(argv[i], "--compaction_style=%d%c", &n, &junk) == 1 &&
+                (n == 0 || n == 1)) {
+            FLAGS_compaction_style = n;
+        } else if (sscanf(argv[i], "--universal_size_ratio=%d%c", &n, &junk) == 1) {
+            FLAGS_universal_size_ratio = n;
+        } else if (sscanf(argv[i], "--universal_max_sorted_runs=%d%c", &n, &junk) == 1) {
+            FLAGS_universal_max_sorted_runs = n;
         }
         else {
             fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
@@ -33,11 +33,12 @@
 #include "table/merger.h"
 #include "table/two_level_iterator.h"
 #include "util/coding.h"
+#include "util/hash.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
+#include "util/nvm_block_cache.h"
 #include "util/debug.h"
 #include "hoard/heaplayers/wrappers/gnuwrapper.h"
-#include "util/thpool.h"
 #include <inttypes.h>
 #include <string>
 #include <unordered_set>
@@ -49,27 +50,17 @@ using namespace std;
 namespace novelsm {
 
 const int kNumNonTableCacheFiles = 10;
-bool kCheckCond = 0;
+
+//NoveLSM: Smallest memtable share a partition of a flush gets
+static const size_t kMinFlushPartitionBytes = 4 << 20;
+
+//NoveLSM: Marks a SuperVersionSlot whose reference a Get() is using
+static char sv_in_use_marker;
+static void* const kSVInUse = &sv_in_use_marker;
 uint64_t numreqsts=0;
 uint64_t numhits=0;
 int num_read_threads=0;
-int knvmhit = 0;
 
-#ifdef _ENABLE_PREDICTION
-bool predict_on = true;
-#else
-bool predict_on = false;
-#endif
-
-/* TODO:NoveLSM global variables
- * Requries cleanup
- */
-MemTable *g_imm;
-MemTable *g_mem;
-const novelsm::ReadOptions g_options;
-bool mem_found = false;
-bool sstable_found = false;
-bool imm_found = false;
 //Foreground compaction time
 std::chrono::duration<double> fgcompactime;
 uint64_t mem_hits=0;
@@ -85,7 +76,18 @@ struct DBImpl::Writer {
     bool done;
     port::CondVar cv;
 
-    explicit Writer(port::Mutex* mu) : cv(mu) { }
+    //NoveLSM: Concurrent NVM memtable writes. The leader sets "parallel"
+    //and "mem" to let a follower insert its own batch; the leader waits
+    //until its "pending" count of such followers drops to zero. A
+    //writer that "inserted" its own batch keeps the status of its insert.
+    bool parallel;
+    bool inserted;
+    MemTable* mem;
+    Writer* leader;
+    int pending;
+
+    explicit Writer(port::Mutex* mu) : cv(mu), parallel(false),
+            inserted(false), mem(NULL), leader(NULL), pending(0) { }
 };
 
 /* Methods for stats purpose
@@ -105,6 +107,17 @@ void inline incr_imm_hits(void){
 }
 
 
+//NoveLSM: One key range of a memtable flush, built into its own table
+struct DBImpl::FlushPartition {
+    DBImpl* db;
+    MemTable* mem;
+    const Slice* begin;     // NULL means the first key of mem
+    const Slice* end;       // NULL means past the last key of mem
+    FileMetaData meta;
+    Status status;
+    ReadPool::Job job;
+};
+
 struct DBImpl::CompactionState {
     Compaction* const compaction;
 
@@ -128,13 +141,33 @@ struct DBImpl::CompactionState {
 
     uint64_t total_bytes;
 
+    //NoveLSM: Key range of a subcompaction, user keys in [*begin, *end).
+    //NULL means unbounded.
+    const std::string* begin;
+    const std::string* end;
+
+    //NoveLSM: Where this state's walk over the key range is
+    Compaction::Cursor cursor;
+
+    //NoveLSM: Outcome of a subcompaction run on the pool
+    DBImpl* db;
+    Status status;
+    ReadPool::Job job;
+
+    //NoveLSM: Memtable merged with the inputs, or NULL
+    MemTable* mem;
+
     Output* current_output() { return &outputs[outputs.size()-1]; }
 
     explicit CompactionState(Compaction* c)
     : compaction(c),
       outfile(NULL),
       builder(NULL),
-      total_bytes(0) {
+      total_bytes(0),
+      begin(NULL),
+      end(NULL),
+      db(NULL),
+      mem(NULL) {
     }
 };
 
@@ -156,6 +189,24 @@ Options SanitizeOptions(const std::string& dbname,
     //NoveLSM write_buffer_size_fix. Remove the line if all tests succeed
     //ClipToRange(&result.nvm_buffer_size, 64<<10,                      1<<30);
     ClipToRange(&result.block_size,        1<<10,                       4<<20);
+    ClipToRange(&result.num_immutable_memtables, 1,                     NUMEMTABLE_NVM);
+    ClipToRange(&result.max_subcompactions, 1,                          64);
+    ClipToRange(&result.max_background_compactions, 1,                  64);
+    ClipToRange(&result.max_background_flushes, 0,                      64);
+    ClipToRange(&result.flush_partitions, 1,                            64);
+    ClipToRange(&result.universal_size_ratio, 0,                        1000);
+    ClipToRange(&result.universal_max_sorted_runs, 2,
+            config::kL0_SlowdownWritesTrigger);
+    //NoveLSM: The learned index models keys in bytewise order
+    if (icmp->user_comparator() != BytewiseComparator()) {
+        result.learned_index = false;
+    }
+    //NoveLSM: Universal compaction keeps level 1 free for level 0, or
+    //merges level 0 into it as a whole; flushes into it would rewrite
+    //its run on every flush
+    if (result.compaction_style == kCompactionStyleUniversal) {
+        result.flush_to_level1 = false;
+    }
     if (result.info_log == NULL) {
         // Open a log file in the same directory as the db
         src.env->CreateDir(dbname);  // In case it does not exist
@@ -172,6 +223,54 @@ Options SanitizeOptions(const std::string& dbname,
     return result;
 }
 
+MemTable* MultiMem::getCompactionMem() {
+    if (size == 0)
+        return NULL;
+    return mem_[idx_start_];
+}
+
+void MultiMem::RemoveCompactionMem() {
+    assert(size > 0);
+    if (--size == 0) {
+        reset();
+        return;
+    }
+    idx_start_ = (idx_start_ + 1) % num_mem_;
+}
+
+int MultiMem::AssignHeadIndex(MemTable *mem) {
+    if (MemIsFull())
+        return -1;
+    if (size == 0)
+        idx_start_ = idx_end_ = 0;
+    else
+        idx_end_ = (idx_end_ + 1) % num_mem_;
+    mem_[idx_end_] = mem;
+    size++;
+    return idx_end_;
+}
+
+bool MultiMem::MemIsFull() {
+    return size == num_mem_;
+}
+
+bool MultiMem::MemIsEmpty() {
+    return size == 0;
+}
+
+MemTable* MultiMem::getMem(int i) {
+    assert(i >= 0 && i < size);
+    return mem_[(idx_end_ - i + num_mem_) % num_mem_];
+}
+
+int MultiMem::RefMemList(MemTable **list) {
+    for (int i = 0; i < size; i++) {
+        list[i] = getMem(i);
+        list[i]->Ref();
+    }
+    return size;
+}
+
 DBImpl::DBImpl(const Options& raw_options, const std::string& dbname_disk, const std::string& dbname_mem)
 : env_(raw_options.env),
   internal_comparator_(raw_options.comparator),
@@ -186,7 +285,11 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname_disk, const
           shutting_down_(NULL),
           bg_cv_(&mutex_),
           mem_(NULL),
-          imm_(NULL),
+          imm_(options_.num_immutable_memtables),
+          super_version_(NULL),
+          super_version_number_(0),
+          num_live_iterators_(0),
+          inplace_write_active_(false),
           use_multiple_levels(true),
           logfile_(NULL),
           /*NoveLSM: Map number for mmap file */
@@ -195,10 +298,14 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname_disk, const
           log_(NULL),
           seed_(0),
           tmp_batch_(new WriteBatch),
-          bg_compaction_scheduled_(false),
+          bg_compactions_scheduled_(0),
+          bg_flush_scheduled_(false),
+          flush_running_(false),
+          manifest_busy_(false),
           manual_compaction_(NULL) {
 
     has_imm_.Release_Store(NULL);
+    pthread_key_create(&super_version_key_, &ReclaimSuperVersionSlot);
 
     /*NoveLSM specific parameters*/
     num_read_threads = raw_options.num_read_threads;
@@ -208,12 +315,31 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname_disk, const
     // Reserve ten files or so for other uses and give the rest to TableCache.
     const int table_cache_size = options_.max_open_files - kNumNonTableCacheFiles;
     DEBUG_T("dbname_disk_ %s, dbname_mem_ %s \n",dbname_disk_.c_str(), dbname_mem_.c_str());
+
+    //NoveLSM: The NVM block cache tier is mapped by Recover()
+    nvm_block_cache_ = NULL;
     table_cache_ = new TableCache(dbname_disk_, &options_, table_cache_size);
 
     //VersionSet uses dbname to place and locate MANIFEST and CURRENT files, which reside in disk for now
     versions_ = new VersionSet(dbname_disk_, &options_, table_cache_,
             &internal_comparator_);
-    thpool = NULL;
+    read_pool_ = NULL;
+    subcompaction_pool_ = NULL;
+    if (options_.max_subcompactions > 1) {
+        //NoveLSM: Compaction pieces must not take the read threads' cores,
+        //and neither must flush partitions below
+        subcompaction_pool_ = new ReadPool(options_.max_subcompactions - 1,
+                false /* pin_and_spin */);
+    }
+    flush_pool_ = NULL;
+    if (options_.flush_partitions > 1) {
+        flush_pool_ = new ReadPool(options_.flush_partitions - 1,
+                false /* pin_and_spin */);
+    }
+    env_->SetBackgroundThreads(options_.max_background_compactions, Env::kLow);
+    if (options_.max_background_flushes > 0) {
+        env_->SetBackgroundThreads(options_.max_background_flushes, Env::kHigh);
+    }
 }
 
 DBImpl::~DBImpl() {
@@ -226,9 +352,22 @@ DBImpl::~DBImpl() {
     // Wait for background work to finish
     mutex_.Lock();
     shutting_down_.Release_Store(this);  // Any non-NULL value is ok
-    while (bg_compaction_scheduled_) {
+    while (bg_compactions_scheduled_ > 0 || bg_flush_scheduled_) {
         bg_cv_.Wait();
     }
+    // Threads exiting from now on must not touch their slots
+    pthread_key_delete(super_version_key_);
+    for (size_t i = 0; i < super_version_slots_.size(); i++) {
+        SuperVersionSlot* slot = super_version_slots_[i];
+        if (slot->sv != NULL && slot->sv != kSVInUse)
+            UnrefSuperVersion(reinterpret_cast<SuperVersion*>(slot->sv));
+        delete slot;
+    }
+    super_version_slots_.clear();
+    if (super_version_ != NULL) {
+        UnrefSuperVersion(super_version_);
+        super_version_ = NULL;
+    }
     mutex_.Unlock();
 
     if (db_lock_ != NULL) {
@@ -237,11 +376,15 @@ DBImpl::~DBImpl() {
 
     delete versions_;
     if (mem_ != NULL) mem_->Unref();
-    if (imm_ != NULL) imm_->Unref();
+    while (!imm_.MemIsEmpty()) {
+        imm_.getCompactionMem()->Unref();
+        imm_.RemoveCompactionMem();
+    }
     delete tmp_batch_;
     delete log_;
     delete logfile_;
     delete table_cache_;
+    delete nvm_block_cache_;
 
     if (owns_info_log_) {
         delete options_.info_log;
@@ -250,8 +393,9 @@ DBImpl::~DBImpl() {
         delete options_.block_cache;
     }
 
-    if(thpool && NUM_READ_THREADS)
-        thpool_destroy(thpool);
+    delete read_pool_;
+    delete subcompaction_pool_;
+    delete flush_pool_;
 }
 
 Status DBImpl::NewDB() {
@@ -297,6 +441,12 @@ void DBImpl::MaybeIgnoreError(Status* s) const {
 }
 
 void DBImpl::DeleteObsoleteFiles() {
+    //NoveLSM: A MANIFEST write in progress may own a temporary file that
+    //is not live.  The tables of running flushes and compactions are in
+    //pending_outputs_ until their edits are applied.
+    while (manifest_busy_) {
+        bg_cv_.Wait();
+    }
     if (!bg_error_.ok()) {
         // After a background error, we don't know whether a new version may
         // or may not have been committed, so we cannot safely garbage collect.
@@ -344,6 +494,8 @@ void DBImpl::DeleteObsoleteFiles() {
             case kCurrentFile:
             case kDBLockFile:
             case kInfoLogFile:
+            case kNvmBlockCacheFile:
+            case kIdentityFile:
                 keep = true;
                 break;
             }
@@ -365,6 +517,41 @@ void DBImpl::DeleteObsoleteFiles() {
 }
 
 
+Status DBImpl::Identity(uint64_t* id) {
+    const std::string fname = IdentityFileName(dbname_disk_);
+    std::string contents;
+    if (ReadFileToString(env_, fname, &contents).ok()) {
+        Slice in(contents);
+        if (ConsumeDecimalNumber(&in, id) && in == "\n") {
+            return Status::OK();
+        }
+    }
+    *id = env_->NowMicros() ^
+            (static_cast<uint64_t>(Hash(dbname_disk_.data(),
+                                        dbname_disk_.size(), 0)) << 32);
+    return SetIdentityFile(env_, dbname_disk_, *id);
+}
+
+//NoveLSM: The NVM block cache tier is keyed by table file number, which
+//only means something within one db, so it is mapped under the db lock
+//and tied to the db's identity. Being only a cache, the DB runs without
+//it if it cannot be mapped.
+void DBImpl::OpenNvmBlockCache() {
+    mutex_.AssertHeld();
+    uint64_t id;
+    Status s = Identity(&id);
+    if (s.ok()) {
+        s = NvmBlockCache::Open(NvmBlockCacheFileName(dbname_mem_),
+                options_.nvm_block_cache_size, id, &nvm_block_cache_);
+    }
+    if (s.ok()) {
+        table_cache_->SetNvmBlockCache(nvm_block_cache_);
+    } else {
+        Log(options_.info_log, "NVM block cache disabled: %s\n",
+                s.ToString().c_str());
+    }
+}
+
 Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
     mutex_.AssertHeld();
 
@@ -396,12 +583,23 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
         }
     }
 
+    if (options_.nvm_block_cache_size > 0 && nvm_block_cache_ == NULL) {
+        OpenNvmBlockCache();
+    }
+
     s = versions_->Recover(save_manifest);
     if (!s.ok()) {
         return s;
     }
     SequenceNumber max_sequence(0);
 
+    //NoveLSM: Tables numbered from here on were never committed, and
+    //their numbers are handed out again
+    if (nvm_block_cache_ != NULL) {
+        nvm_block_cache_->EraseFiles(versions_->NextFileNumber(),
+                ~static_cast<uint64_t>(0));
+    }
+
     // Recover from all newer log files than the ones named in the
     // descriptor (new log files may have been added by the previous
     // incarnation without registering them in the descriptor).
@@ -459,51 +657,44 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
     // Recover in the order in which the logs were generated
     std::sort(logs.begin(), logs.end());
     std::sort(maps.begin(), maps.end());
-    if (maps.size() > 0 || logs.size() > 0) {
-
-        if (maps.size() == 0) {
-            RecoverLogFile(logs[0], true, save_manifest, edit, &max_sequence);
-            versions_->MarkFileNumberUsed(logs[0]);
-            //NoveLSM: Set the NVM memtable map file with incrementing
-            //log number
-            mapfile_number_ = logfile_number_;
-        }
-        else if (logs.size() == 0) {
-            //NoveLSM: There is only one log file and it is a NVM memtable
-            // Iterate and recover
-            mapfile_number_ = maps[0];
-            for (std::vector<uint64_t>::iterator it = maps.begin(); it != maps.end(); ++it) {
-                uint64_t map_num = *it;
-                RecoverMapFile(map_num, save_manifest, edit, &max_sequence);
-                versions_->MarkFileNumberUsed(map_num);
-            }
-        }
-        else if (logs[0] > maps[0]) {
-            //NoveLSM: The first DRAM log is newwer than NVM memtable file
-            //Recover incrementally
-            mapfile_number_ = maps[0];
-            for (std::vector<uint64_t>::iterator it = maps.begin(); it != maps.end(); ++it) {
-                uint64_t map_num = *it;
-                RecoverMapFile(map_num, save_manifest, edit, &max_sequence);
-                versions_->MarkFileNumberUsed(map_num);
-            }
-            RecoverLogFile(logs[0], true, save_manifest, edit, &max_sequence);
-            versions_->MarkFileNumberUsed(logs[0]);
-        }
-        else {
-            RecoverLogFile(logs[0], true, save_manifest, edit, &max_sequence);
-            versions_->MarkFileNumberUsed(logs[0]);
-
-            //NoveLSM: TODO: Try to make all these blocks of NVM map file recovery
-            //into one block 	
-            mapfile_number_ = maps[0];
-            for (std::vector<uint64_t>::iterator it = maps.begin(); it != maps.end(); ++it) {
-                uint64_t map_num = *it;
-                RecoverMapFile(map_num, save_manifest, edit, &max_sequence);
-                versions_->MarkFileNumberUsed(map_num);
+
+    //NoveLSM: With a ring of immutable memtables several DRAM logs and
+    //NVM map files can be live at once. Replay all of them in creation
+    //order; the memtable of each file is flushed to L0 before the next
+    //one is recovered, so only the newest stays in memory.
+    size_t log_idx = 0, map_idx = 0;
+    while (s.ok() && (log_idx < logs.size() || map_idx < maps.size())) {
+        if (map_idx == maps.size() ||
+                (log_idx < logs.size() && logs[log_idx] < maps[map_idx])) {
+            if (mem_ != NULL) {
+                *save_manifest = true;
+                s = WriteLevel0Table(mem_, edit, NULL);
+                mem_->Unref();
+                mem_ = NULL;
+                if (!s.ok())
+                    break;
             }
+            bool last_file = (log_idx + 1 == logs.size() &&
+                    map_idx == maps.size());
+            s = RecoverLogFile(logs[log_idx], last_file, save_manifest, edit,
+                    &max_sequence);
+            versions_->MarkFileNumberUsed(logs[log_idx]);
+            log_idx++;
+        } else {
+            mapfile_number_ = maps[map_idx];
+            s = RecoverMapFile(maps[map_idx], save_manifest, edit, &max_sequence);
+            versions_->MarkFileNumberUsed(maps[map_idx]);
+            map_idx++;
         }
     }
+    if (maps.size() == 0 && logs.size() > 0) {
+        //NoveLSM: Set the NVM memtable map file with incrementing
+        //log number
+        mapfile_number_ = logfile_number_;
+    }
+    if (!s.ok()) {
+        return s;
+    }
 
     if (versions_->LastSequence() < max_sequence) {
         versions_->SetLastSequence(max_sequence);
@@ -520,6 +711,7 @@ Status DBImpl::RecoverMapFile(uint64_t map_number, bool *save_manifest,
     Status status;
     std::string fname = MapFileName(dbname_mem_, map_number);
     if (mem_ != NULL) {
+        *save_manifest = true;
         status = WriteLevel0Table(mem_, edit, NULL);
         DEBUG_T("%s:%d: Finished NVM WriteLevel0Table write %s \n",
                 __FILE__, __LINE__, fname.c_str());
@@ -530,9 +722,13 @@ Status DBImpl::RecoverMapFile(uint64_t map_number, bool *save_manifest,
     MemTable *mem;
     options_.write_buffer_size = nvmbuff_;
     ArenaNVM *arena= new ArenaNVM(options_.write_buffer_size, &fname, true);
-    mem = new MemTable(internal_comparator_, *arena, true);
+    arena->slab_size_ = NVMSlabSize();
+    mem = new MemTable(internal_comparator_, *arena, true, nvmbuff_);
     mem->Ref();
     mem->isNVMMemtable = true;
+    mem->logfile_number = map_number;
+    mem->RebuildHashIndex();
+    mem->SetPrediction(options_.nvm_hit_prediction);
     *max_sequence = *(uint64_t *)((uint8_t*)arena->getMapStart() + sizeof(size_t));
     mem_ = mem;
 
@@ -616,11 +812,13 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
         }
 
         if (mem_ == NULL) {
-            mem_ = new MemTable(internal_comparator_);
+            mem_ = new MemTable(internal_comparator_, drambuff_);
             mem_->isNVMMemtable = false;
+            mem_->SetPrediction(options_.nvm_hit_prediction);
             mem_->Ref();
             options_.write_buffer_size = drambuff_;
             logfile_number_ = log_number;
+            mem_->logfile_number = log_number;
         }
 
         status = WriteBatchInternal::InsertInto(&batch, mem_);
@@ -638,7 +836,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     delete file;
 
     // See if we should keep reusing the last log file.
-    if (status.ok() && logfile_number_ == log_number) {
+    if (status.ok() && last_log && logfile_number_ == log_number) {
         assert(logfile_ == NULL);
         assert(log_ == NULL);
         uint64_t lfile_size;
@@ -667,49 +865,146 @@ void DBImpl::IterateMemAndPrint(MemTable* mem) {
     return;
 }
 
+void DBImpl::FlushPartitionWork(void* arg) {
+    FlushPartition* part = reinterpret_cast<FlushPartition*>(arg);
+    DBImpl* db = part->db;
+    Iterator* iter = part->mem->NewIterator();
+    part->status = BuildTable(db->dbname_disk_, db->env_, db->options_,
+            db->table_cache_, iter, &part->meta, part->begin, part->end);
+    delete iter;
+}
+
 Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
-        Version* base) {
+        Version* base, std::vector<uint64_t>* outputs) {
     mutex_.AssertHeld();
     const uint64_t start_micros = env_->NowMicros();
-    FileMetaData meta;
-    meta.number = versions_->NewFileNumber();
-    pending_outputs_.insert(meta.number);
-    Iterator* iter = mem->NewIterator();
-    Log(options_.info_log, "Level-0 table #%llu: started",
-            (unsigned long long) meta.number);
 
-    Status s;
+    //NoveLSM: A large memtable is split into key ranges of about the same
+    //size, whose tables are built concurrently. They do not overlap, so
+    //they are installed side by side.
+    std::vector<std::string> split_keys;
+    if (flush_pool_ != NULL) {
+        const size_t usage = mem->ApproximateMemoryUsage();
+        int n = options_.flush_partitions;
+        if (static_cast<size_t>(n) > 1 + usage / kMinFlushPartitionBytes) {
+            n = 1 + usage / kMinFlushPartitionBytes;
+        }
+        if (n > 1) {
+            mem->GetSplitKeys(n, &split_keys);
+        }
+    }
+    const std::vector<Slice> bounds(split_keys.begin(), split_keys.end());
+    const size_t n = bounds.size() + 1;
+    FlushPartition* parts = new FlushPartition[n];
+    for (size_t i = 0; i < n; i++) {
+        parts[i].db = this;
+        parts[i].mem = mem;
+        parts[i].begin = (i > 0) ? &bounds[i - 1] : NULL;
+        parts[i].end = (i + 1 < n) ? &bounds[i] : NULL;
+        parts[i].meta.number = versions_->NewFileNumber();
+        pending_outputs_.insert(parts[i].meta.number);
+        Log(options_.info_log, "Level-0 table #%llu: started",
+                (unsigned long long) parts[i].meta.number);
+    }
+
     {
         mutex_.Unlock();
-        s = BuildTable(dbname_disk_, env_, options_, table_cache_, iter, &meta);
+        for (size_t i = 1; i < n; i++) {
+            flush_pool_->Submit(&parts[i].job, &FlushPartitionWork, &parts[i]);
+        }
+        FlushPartitionWork(&parts[0]);
+        for (size_t i = 1; i < n; i++) {
+            parts[i].job.Wait();
+        }
         mutex_.Lock();
     }
 
-    Log(options_.info_log, "Level-0 table #%llu: %lld bytes %s",
-            (unsigned long long) meta.number,
-            (unsigned long long) meta.file_size,
-            s.ToString().c_str());
-    delete iter;
-    pending_outputs_.erase(meta.number);
-
+    Status s;
+    for (size_t i = 0; i < n; i++) {
+        const FileMetaData& meta = parts[i].meta;
+        Log(options_.info_log, "Level-0 table #%llu: %lld bytes %s",
+                (unsigned long long) meta.number,
+                (unsigned long long) meta.file_size,
+                parts[i].status.ToString().c_str());
+        if (outputs != NULL) {
+            outputs->push_back(meta.number);
+        } else {
+            pending_outputs_.erase(meta.number);
+        }
+        if (s.ok()) {
+            s = parts[i].status;
+        }
+    }
 
     // Note that if file_size is zero, the file has been deleted and
-    // should not be added to the manifest.
+    // should not be added to the manifest.  NoveLSM: The tables of a
+    // failed partitioned flush are left to DeleteObsoleteFiles().
     int level = 0;
-    if (s.ok() && meta.file_size > 0) {
+    CompactionStats stats;
+    stats.micros = env_->NowMicros() - start_micros;
+    for (size_t i = 0; s.ok() && i < n; i++) {
+        const FileMetaData& meta = parts[i].meta;
+        if (meta.file_size == 0) {
+            continue;
+        }
         const Slice min_user_key = meta.smallest.user_key();
         const Slice max_user_key = meta.largest.user_key();
+        int file_level = 0;
         if (base != NULL) {
-            level = base->PickLevelForMemTableOutput(min_user_key, max_user_key);
+            file_level = base->PickLevelForMemTableOutput(min_user_key,
+                    max_user_key);
+        }
+        if (stats.bytes_written == 0 || file_level < level) {
+            level = file_level;
         }
-        edit->AddFile(level, meta.number, meta.file_size,
+        edit->AddFile(file_level, meta.number, meta.file_size,
                 meta.smallest, meta.largest);
+        stats.bytes_written += meta.file_size;
+    }
+    delete[] parts;
+
+    stats_[level].Add(stats);
+    return s;
+}
+
+Status DBImpl::MergeMemTableIntoLevel1(CompactionState* compact) {
+    mutex_.AssertHeld();
+    const uint64_t start_micros = env_->NowMicros();
+    Compaction* c = compact->compaction;
+    Log(options_.info_log, "Merging memtable with %d@1 files",
+            c->num_input_files(1));
+
+    if (snapshots_.empty()) {
+        compact->smallest_snapshot = versions_->LastSequence();
+    } else {
+        compact->smallest_snapshot = snapshots_.oldest()->number_;
     }
+    mutex_.Unlock();
+    Status s = CompactRangeOfInputs(compact, NULL);
+    mutex_.Lock();
 
     CompactionStats stats;
     stats.micros = env_->NowMicros() - start_micros;
-    stats.bytes_written = meta.file_size;
-    stats_[level].Add(stats);
+    for (int i = 0; i < c->num_input_files(1); i++) {
+        stats.bytes_read += c->input(1, i)->file_size;
+    }
+    for (size_t i = 0; i < compact->outputs.size(); i++) {
+        stats.bytes_written += compact->outputs[i].file_size;
+    }
+    stats_[1].Add(stats);
+
+    if (s.ok()) {
+        c->AddInputDeletions(c->edit());
+        for (size_t i = 0; i < compact->outputs.size(); i++) {
+            const CompactionState::Output& out = compact->outputs[i];
+            c->edit()->AddFile(1, out.number, out.file_size,
+                    out.smallest, out.largest);
+        }
+    }
+    Log(options_.info_log, "Merged memtable into %d level-1 files, %lld bytes %s",
+            static_cast<int>(compact->outputs.size()),
+            static_cast<long long>(compact->total_bytes),
+            s.ToString().c_str());
     return s;
 }
 
@@ -717,30 +1012,78 @@ void DBImpl::CompactBottomMemTable() {
 
     mutex_.AssertHeld();
     //NoveLSM: For switching between DRAM and NVM tables
-    assert(imm_ != NULL);
+    //The oldest memtable of the ring is flushed first
+    MemTable* imm = imm_.getCompactionMem();
+    assert(imm != NULL);
+    assert(!flush_running_);
+    __atomic_store_n(&flush_running_, true, __ATOMIC_RELAXED);
+
+    //NoveLSM: Merge the memtable straight into level 1 when it can be
+    Compaction* c = NULL;
+    CompactionState* compact = NULL;
+    if (options_.flush_to_level1) {
+        Iterator* iter = imm->NewIterator();
+        iter->SeekToFirst();
+        if (iter->Valid()) {
+            InternalKey smallest, largest;
+            smallest.DecodeFrom(iter->key());
+            iter->SeekToLast();
+            largest.DecodeFrom(iter->key());
+            c = versions_->MemTableCompaction(smallest, largest);
+        }
+        delete iter;
+    }
 
-    // Save the contents of the memtable as a new Table
-    VersionEdit edit;
-    Version* base = versions_->current();
-    base->Ref();
+    VersionEdit level0_edit;
+    VersionEdit* edit = &level0_edit;
+    std::vector<uint64_t> level0_outputs;
     Status s;
-    int done=0;
-
-    s = WriteLevel0Table(imm_, &edit, base);
-    base->Unref();
+    if (c != NULL) {
+        versions_->RegisterCompaction(c);
+        compact = new CompactionState(c);
+        compact->mem = imm;
+        s = MergeMemTableIntoLevel1(compact);
+        edit = c->edit();
+    } else {
+        // Save the contents of the memtable as a new Table.  NoveLSM:
+        // With concurrent compactions, a level below 0 may be the output
+        // of one that is still running, so the table goes to level 0.
+        Version* base = NULL;
+        if (!ConcurrentBackgroundWork()) {
+            base = versions_->current();
+            base->Ref();
+        }
+        s = WriteLevel0Table(imm, edit, base, &level0_outputs);
+        if (base != NULL) {
+            base->Unref();
+        }
+    }
 
     // Replace immutable memtable with the generated Table
     if (s.ok()) {
-        edit.SetPrevLogNumber(0);
+        edit->SetPrevLogNumber(0);
 #if defined ENABLE_RECOVERY
+        //NoveLSM: Files of the memtables still in the ring are live, so
+        //only the ones older than the next memtable to flush can go
         uint64_t max = (logfile_number_ > mapfile_number_) ? logfile_number_ : mapfile_number_;
-        edit.SetMapNumber(max);
-        edit.SetLogNumber(max);
+        if (imm_.size > 1)
+            max = imm_.getMem(imm_.size - 2)->logfile_number;
+        edit->SetMapNumber(max);
+        edit->SetLogNumber(max);
 #else
-        edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
+        edit->SetLogNumber(logfile_number_);  // Earlier logs no longer needed
 #endif
-        s = versions_->LogAndApply(&edit, &mutex_);
+        s = LogAndApply(edit);
+    }
+    for (size_t i = 0; i < level0_outputs.size(); i++) {
+        pending_outputs_.erase(level0_outputs[i]);
     }
+    if (c != NULL) {
+        CleanupCompaction(compact);
+        versions_->UnregisterCompaction(c);
+        delete c;
+    }
+    __atomic_store_n(&flush_running_, false, __ATOMIC_RELAXED);
 
     if (s.ok() && shutting_down_.Acquire_Load()) {
         s = Status::IOError("Deleting DB during memtable compaction");
@@ -748,9 +1091,10 @@ void DBImpl::CompactBottomMemTable() {
 
     if (s.ok()) {
         // Commit to the new state
-        imm_->Unref();
-        imm_ = NULL;
-        has_imm_.Release_Store(NULL);
+        imm->Unref();
+        imm_.RemoveCompactionMem();
+        has_imm_.Release_Store(imm_.getCompactionMem());
+        InstallSuperVersion();
         DeleteObsoleteFiles();
     }else {
         RecordBackgroundError(s);
@@ -818,10 +1162,10 @@ Status DBImpl::TEST_CompactMemTable() {
     if (s.ok()) {
         // Wait until the compaction completes
         MutexLock l(&mutex_);
-        while (imm_ != NULL && bg_error_.ok()) {
+        while (!imm_.MemIsEmpty() && bg_error_.ok()) {
             bg_cv_.Wait();
         }
-        if (imm_ != NULL) {
+        if (!imm_.MemIsEmpty()) {
             s = bg_error_;
         }
     }
@@ -838,31 +1182,40 @@ void DBImpl::RecordBackgroundError(const Status& s) {
 
 void DBImpl::MaybeScheduleCompaction() {
     mutex_.AssertHeld();
-    if (bg_compaction_scheduled_) {
-        // Already scheduled
-    } else if (shutting_down_.Acquire_Load()) {
+    if (shutting_down_.Acquire_Load()) {
         // DB is being deleted; no more background compactions
+        return;
     } else if (!bg_error_.ok()) {
         // Already got an error; no more changes
+        return;
     }
-    else if (imm_ == NULL &&
+
+    //NoveLSM: Flushes get a thread of their own when there are any
+    const bool flush_pool = options_.max_background_flushes > 0;
+    if (flush_pool && !bg_flush_scheduled_ && !imm_.MemIsEmpty()) {
+        bg_flush_scheduled_ = true;
+        env_->Schedule(&DBImpl::BGFlushWork, this, Env::kHigh);
+    }
+
+    if (bg_compactions_scheduled_ >= options_.max_background_compactions) {
+        // All compaction slots are taken
+    } else if ((flush_pool || imm_.MemIsEmpty()) &&
             manual_compaction_ == NULL &&
             !versions_->NeedsCompaction()) {
         // No work to be done
-    }
-    else {
-        bg_compaction_scheduled_ = true;
-        env_->Schedule(&DBImpl::BGWork, this);
+    } else {
+        bg_compactions_scheduled_++;
+        env_->Schedule(&DBImpl::BGWork, this, Env::kLow);
     }
 }
 
 void DBImpl::ScheduleCompactionNow() {
     mutex_.AssertHeld();
-    if (bg_compaction_scheduled_) {
+    if (bg_compactions_scheduled_ >= options_.max_background_compactions) {
         // Already scheduled
     }else {
-        bg_compaction_scheduled_ = true;
-        env_->Schedule(&DBImpl::BGWork, this);
+        bg_compactions_scheduled_++;
+        env_->Schedule(&DBImpl::BGWork, this, Env::kLow);
     }
 }
 
@@ -872,36 +1225,82 @@ void DBImpl::BGWork(void* db) {
 
 void DBImpl::BackgroundCall() {
     MutexLock l(&mutex_);
-    assert(bg_compaction_scheduled_);
+    assert(bg_compactions_scheduled_ > 0);
+    bool progress = false;
     if (shutting_down_.Acquire_Load()) {
         // No more background work when shutting down.
     } else if (!bg_error_.ok()) {
         // No more background work after a background error.
     } else {
-        BackgroundCompaction();
+        progress = BackgroundCompaction();
     }
 
-    bg_compaction_scheduled_ = false;
+    bg_compactions_scheduled_--;
 
     // Previous compaction may have produced too many files in a level,
-    // so reschedule another compaction if needed.
+    // so reschedule another compaction if needed.  NoveLSM: A thread that
+    // found all remaining work taken by running compactions leaves the
+    // rescheduling to them.
+    if (progress) {
+        MaybeScheduleCompaction();
+    }
+    bg_cv_.SignalAll();
+}
+
+void DBImpl::BGFlushWork(void* db) {
+    reinterpret_cast<DBImpl*>(db)->BackgroundFlushCall();
+}
+
+void DBImpl::BackgroundFlushCall() {
+    MutexLock l(&mutex_);
+    assert(bg_flush_scheduled_);
+    if (shutting_down_.Acquire_Load()) {
+        // No more background work when shutting down.
+    } else if (!bg_error_.ok()) {
+        // No more background work after a background error.
+    } else if (!imm_.MemIsEmpty()) {
+        CompactBottomMemTable();
+    }
+
+    bg_flush_scheduled_ = false;
+
+    // The flush may have made room for a compaction of level 0, and more
+    // memtables may have filled up meanwhile
     MaybeScheduleCompaction();
     bg_cv_.SignalAll();
 }
 
-void DBImpl::BackgroundCompaction() {
+Status DBImpl::LogAndApply(VersionEdit* edit) {
+    mutex_.AssertHeld();
+    while (manifest_busy_) {
+        bg_cv_.Wait();
+    }
+    manifest_busy_ = true;
+    Status s = versions_->LogAndApply(edit, &mutex_);
+    manifest_busy_ = false;
+    bg_cv_.SignalAll();
+    return s;
+}
+
+bool DBImpl::BackgroundCompaction() {
 
     mutex_.AssertHeld();
 
-    if (imm_ != NULL) {
+    if (options_.max_background_flushes == 0 && !imm_.MemIsEmpty() &&
+            !flush_running_) {
         CompactBottomMemTable();
-        return;
+        return true;
     }
 
     Compaction* c;
     bool is_manual = (manual_compaction_ != NULL);
     InternalKey manual_end;
     if (is_manual) {
+        //NoveLSM: A manual compaction runs alone, once the running ones
+        //are done, and no others are picked while it waits
+        if (versions_->NumRunningCompactions() > 0) {
+            return false;
+        }
         ManualCompaction* m = manual_compaction_;
         c = versions_->CompactRange(m->level, m->begin, m->end);
         m->done = (c == NULL);
@@ -916,9 +1315,18 @@ void DBImpl::BackgroundCompaction() {
                 (m->done ? "(end)" : manual_end.DebugString().c_str()));
     } else {
         c = versions_->PickCompaction();
+        if (c == NULL) {
+            return false;
+        }
     }
 
     Status status;
+    if (c != NULL) {
+        //NoveLSM: Keep other compactions off its files, and let another
+        //thread look for work that does not conflict with this one
+        versions_->RegisterCompaction(c);
+        MaybeScheduleCompaction();
+    }
     if (c == NULL) {
         // Nothing to do
     } else if (!is_manual && c->IsTrivialMove()) {
@@ -926,16 +1334,18 @@ void DBImpl::BackgroundCompaction() {
         assert(c->num_input_files(0) == 1);
         FileMetaData* f = c->input(0, 0);
         c->edit()->DeleteFile(c->level(), f->number);
-        c->edit()->AddFile(c->level() + 1, f->number, f->file_size,
+        c->edit()->AddFile(c->output_level(), f->number, f->file_size,
                 f->smallest, f->largest);
-        status = versions_->LogAndApply(c->edit(), &mutex_);
+        status = LogAndApply(c->edit());
         if (!status.ok()) {
             RecordBackgroundError(status);
+        } else {
+            InstallSuperVersion();
         }
         VersionSet::LevelSummaryStorage tmp;
         Log(options_.info_log, "Moved #%lld to level-%d %lld bytes %s: %s\n",
                 static_cast<unsigned long long>(f->number),
-                c->level() + 1,
+                c->output_level(),
                 static_cast<unsigned long long>(f->file_size),
                 status.ToString().c_str(),
                 versions_->LevelSummary(&tmp));
@@ -946,7 +1356,12 @@ void DBImpl::BackgroundCompaction() {
             RecordBackgroundError(status);
         }
         CleanupCompaction(compact);
+    }
+    if (c != NULL) {
+        versions_->UnregisterCompaction(c);
         c->ReleaseInputs();
+        //NoveLSM: Only once c no longer pins its input version can the
+        //files it compacted go
         DeleteObsoleteFiles();
     }
     delete c;
@@ -973,6 +1388,7 @@ void DBImpl::BackgroundCompaction() {
         }
         manual_compaction_ = NULL;
     }
+    return true;
 }
 
 void DBImpl::CleanupCompaction(CompactionState* compact) {
@@ -1070,23 +1486,29 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
 
 Status DBImpl::InstallCompactionResults(CompactionState* compact) {
     mutex_.AssertHeld();
+    Compaction* c = compact->compaction;
+    const int last = c->num_input_levels() - 1;
     Log(options_.info_log,  "Compacted %d@%d + %d@%d files => %lld bytes",
-            compact->compaction->num_input_files(0),
-            compact->compaction->level(),
-            compact->compaction->num_input_files(1),
-            compact->compaction->level() + 1,
+            c->num_input_files(0),
+            c->level(),
+            c->num_input_files(last),
+            c->output_level(),
             static_cast<long long>(compact->total_bytes));
 
     // Add compaction outputs
-    compact->compaction->AddInputDeletions(compact->compaction->edit());
-    const int level = compact->compaction->level();
+    c->AddInputDeletions(c->edit());
+    const int level = c->output_level();
     for (size_t i = 0; i < compact->outputs.size(); i++) {
         const CompactionState::Output& out = compact->outputs[i];
-        compact->compaction->edit()->AddFile(
-                level + 1,
+        c->edit()->AddFile(
+                level,
                 out.number, out.file_size, out.smallest, out.largest);
     }
-    return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+    Status s = LogAndApply(c->edit());
+    if (s.ok()) {
+        InstallSuperVersion();
+    }
+    return s;
 }
 
 
@@ -1094,11 +1516,17 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     const uint64_t start_micros = env_->NowMicros();
     int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
 
+    const int last = compact->compaction->num_input_levels() - 1;
     Log(options_.info_log,  "Compacting %d@%d + %d@%d files",
             compact->compaction->num_input_files(0),
             compact->compaction->level(),
-            compact->compaction->num_input_files(1),
-            compact->compaction->level() + 1);
+            compact->compaction->num_input_files(last),
+            compact->compaction->output_level());
+    if (last > 1) {
+        Log(options_.info_log, "Merging the sorted runs of levels %d to %d",
+                compact->compaction->level(),
+                compact->compaction->output_level());
+    }
 
     assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
     assert(compact->builder == NULL);
@@ -1112,8 +1540,62 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     // Release mutex while we're actually doing the compaction work
     mutex_.Unlock();
 
+    //NoveLSM: Large compactions are split into key ranges merged in parallel
+    std::vector<std::string> boundaries;
+    if (subcompaction_pool_ != NULL) {
+        versions_->SplitCompaction(compact->compaction,
+                options_.max_subcompactions, &boundaries);
+    }
+    //NoveLSM: Flushes are left to their own threads if there are any
+    int64_t* flush_micros =
+            (options_.max_background_flushes > 0) ? NULL : &imm_micros;
+    Status status;
+    if (boundaries.empty()) {
+        status = CompactRangeOfInputs(compact, flush_micros);
+    } else {
+        status = DoSubcompactions(compact, boundaries, flush_micros);
+    }
+
+    CompactionStats stats;
+    stats.micros = env_->NowMicros() - start_micros - imm_micros;
+    for (int which = 0; which <= last; which++) {
+        for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
+            stats.bytes_read += compact->compaction->input(which, i)->file_size;
+        }
+    }
+    for (size_t i = 0; i < compact->outputs.size(); i++) {
+        stats.bytes_written += compact->outputs[i].file_size;
+    }
+
+    mutex_.Lock();
+    stats_[compact->compaction->output_level()].Add(stats);
+
+    if (status.ok()) {
+        status = InstallCompactionResults(compact);
+    }
+    if (!status.ok()) {
+        RecordBackgroundError(status);
+    }
+    VersionSet::LevelSummaryStorage tmp;
+    Log(options_.info_log,
+            "compacted to: %s", versions_->LevelSummary(&tmp));
+    return status;
+}
+
+Status DBImpl::CompactRangeOfInputs(CompactionState* compact,
+        int64_t* imm_micros) {
     Iterator* input = versions_->MakeInputIterator(compact->compaction);
-    input->SeekToFirst();
+    if (compact->mem != NULL) {
+        Iterator* list[2] = { compact->mem->NewIterator(), input };
+        input = NewMergingIterator(&internal_comparator_, list, 2);
+    }
+    if (compact->begin != NULL) {
+        InternalKey start(*compact->begin, kMaxSequenceNumber,
+                kValueTypeForSeek);
+        input->Seek(start.Encode());
+    } else {
+        input->SeekToFirst();
+    }
     Status status;
     ParsedInternalKey ikey;
     std::string current_user_key;
@@ -1122,18 +1604,24 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
 
     for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
         // Prioritize immutable compaction work
-        if (has_imm_.NoBarrier_Load() != NULL) {
+        if (imm_micros != NULL && has_imm_.NoBarrier_Load() != NULL &&
+                !__atomic_load_n(&flush_running_, __ATOMIC_RELAXED)) {
             const uint64_t imm_start = env_->NowMicros();
             mutex_.Lock();
-            if (imm_ != NULL) {
+            if (!imm_.MemIsEmpty() && !flush_running_) {
                 CompactBottomMemTable();
                 bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
             }
             mutex_.Unlock();
-            imm_micros += (env_->NowMicros() - imm_start);
+            *imm_micros += (env_->NowMicros() - imm_start);
         }
         Slice key = input->key();
-        if (compact->compaction->ShouldStopBefore(key) &&
+        if (compact->end != NULL && key.size() >= 8 &&
+                user_comparator()->Compare(ExtractUserKey(key),
+                        Slice(*compact->end)) >= 0) {
+            break;
+        }
+        if (compact->compaction->ShouldStopBefore(key, &compact->cursor) &&
                 compact->builder != NULL) {
             status = FinishCompactionOutputFile(compact, input);
             if (!status.ok()) {
@@ -1163,7 +1651,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
                 drop = true;    // (A)
             } else if (ikey.type == kTypeDeletion &&
                     ikey.sequence <= compact->smallest_snapshot &&
-                    compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
+                    compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                            &compact->cursor)) {
                 // For this user key:
                 // (1) there is no data in higher levels
                 // (2) data in lower levels will have larger sequence numbers
@@ -1213,31 +1702,56 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         status = input->status();
     }
     delete input;
-    input = NULL;
-
-    CompactionStats stats;
-    stats.micros = env_->NowMicros() - start_micros - imm_micros;
-    for (int which = 0; which < 2; which++) {
-        for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
-            stats.bytes_read += compact->compaction->input(which, i)->file_size;
-        }
-    }
-    for (size_t i = 0; i < compact->outputs.size(); i++) {
-        stats.bytes_written += compact->outputs[i].file_size;
-    }
+    return status;
+}
 
-    mutex_.Lock();
-    stats_[compact->compaction->level() + 1].Add(stats);
+void DBImpl::SubcompactionWork(void* arg) {
+    CompactionState* sub = reinterpret_cast<CompactionState*>(arg);
+    sub->status = sub->db->CompactRangeOfInputs(sub, NULL);
+}
 
-    if (status.ok()) {
-        status = InstallCompactionResults(compact);
-    }
-    if (!status.ok()) {
-        RecordBackgroundError(status);
+Status DBImpl::DoSubcompactions(CompactionState* compact,
+        const std::vector<std::string>& boundaries, int64_t* imm_micros) {
+    const size_t n = boundaries.size() + 1;
+    std::vector<CompactionState*> subs(n);
+    for (size_t i = 0; i < n; i++) {
+        subs[i] = new CompactionState(compact->compaction);
+        subs[i]->smallest_snapshot = compact->smallest_snapshot;
+        subs[i]->begin = (i > 0) ? &boundaries[i - 1] : NULL;
+        subs[i]->end = (i + 1 < n) ? &boundaries[i] : NULL;
+        subs[i]->db = this;
+    }
+    Log(options_.info_log, "Compacting in %d subcompactions",
+            static_cast<int>(n));
+
+    // The first range runs here, so that memtable flushes still get done
+    for (size_t i = 1; i < n; i++) {
+        subcompaction_pool_->Submit(&subs[i]->job, &SubcompactionWork,
+                subs[i]);
+    }
+    subs[0]->status = CompactRangeOfInputs(subs[0], imm_micros);
+
+    // Gather the outputs in key order.  Unfinished builders are left to
+    // CleanupCompaction() of compact.
+    Status status;
+    for (size_t i = 0; i < n; i++) {
+        CompactionState* sub = subs[i];
+        if (i > 0) {
+            sub->job.Wait();
+        }
+        if (status.ok() && !sub->status.ok()) {
+            status = sub->status;
+        }
+        if (sub->builder != NULL) {
+            sub->builder->Abandon();
+            delete sub->builder;
+        }
+        delete sub->outfile;
+        compact->outputs.insert(compact->outputs.end(),
+                sub->outputs.begin(), sub->outputs.end());
+        compact->total_bytes += sub->total_bytes;
+        delete sub;
     }
-    VersionSet::LevelSummaryStorage tmp;
-    Log(options_.info_log,
-            "compacted to: %s", versions_->LevelSummary(&tmp));
     return status;
 }
 
@@ -1246,14 +1760,17 @@ struct IterState {
     port::Mutex* mu;
     Version* version;
     MemTable* mem;
-    MemTable* imm;
+    MemTable* imm[NUMEMTABLE_NVM];
+    int num_imm;
+    int* num_live_iterators;
 };
 
 static void CleanupIteratorState(void* arg1, void* arg2) {
     IterState* state = reinterpret_cast<IterState*>(arg1);
     state->mu->Lock();
     state->mem->Unref();
-    if (state->imm != NULL) state->imm->Unref();
+    for (int i = 0; i < state->num_imm; i++) state->imm[i]->Unref();
+    __atomic_sub_fetch(state->num_live_iterators, 1, __ATOMIC_SEQ_CST);
     state->version->Unref();
     state->mu->Unlock();
     delete state;
@@ -1265,15 +1782,18 @@ Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
         uint32_t* seed) {
     IterState* cleanup = new IterState;
     mutex_.Lock();
+    while (inplace_write_active_) {
+        bg_cv_.Wait();
+    }
     *latest_snapshot = versions_->LastSequence();
 
     // Collect together all needed child iterators
     std::vector<Iterator*> list;
     list.push_back(mem_->NewIterator());
     mem_->Ref();
-    if (imm_ != NULL) {
-        list.push_back(imm_->NewIterator());
-        imm_->Ref();
+    cleanup->num_imm = imm_.RefMemList(cleanup->imm);
+    for (int i = 0; i < cleanup->num_imm; i++) {
+        list.push_back(cleanup->imm[i]->NewIterator());
     }
     versions_->current()->AddIterators(options, &list);
     Iterator* internal_iter =
@@ -1282,7 +1802,8 @@ Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
 
     cleanup->mu = &mutex_;
     cleanup->mem = mem_;
-    cleanup->imm = imm_;
+    cleanup->num_live_iterators = &num_live_iterators_;
+    __atomic_add_fetch(&num_live_iterators_, 1, __ATOMIC_SEQ_CST);
     cleanup->version = versions_->current();
     internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, NULL);
 
@@ -1302,74 +1823,193 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
     return versions_->MaxNextLevelOverlappingBytes();
 }
 
-void* DBImpl::read_thread(void *arg) {
-
-    read_struct *str = (read_struct *)(arg);
-    bool ret = false;
-    int val = str->val;
-    std::string *value = str->value;
-    Status *s = str->s;
-    LookupKey *lkey =  str->lkey;
-    Version* current = str->current;
-
-    switch (val) {
-
-    case MEMTBL_THRD:
-        if (!kCheckCond && (ret = g_mem->Get(*lkey, value, s))) {
-            current->SetTerminate();
-            kCheckCond = 1;
-            incr_mem_hits();
-            str->done = true;
-        } else if (!kCheckCond && g_imm != NULL &&
-                (ret = g_imm->Get(*lkey, value, s))) {
-            current->SetTerminate();
-            kCheckCond = 1;
-            incr_imm_hits();
-            str->done = true;
-        }
-        break;
-    case SSTBL_THRD:
-        //Version* current = str->current;
-        Version::GetStats *stats;
-        stats = (Version::GetStats *)str->stats;
-        if(current){
-            Status s = current->Get((const novelsm::ReadOptions&)g_options,
-                    *lkey, value, stats);
-            if(s.ok()) {
-                kCheckCond = 1;
-                ret = true;
-                incr_sstable_hits();
-                str->done = true;
-            }
-            else {
-                ret = false;
-                str->done = false;
+int DBImpl::TEST_NumLevel0Runs() {
+    MutexLock l(&mutex_);
+    return versions_->NumLevel0Runs();
+}
+
+//NoveLSM: Memtable half of a parallel Get(), run by a read thread
+void DBImpl::read_thread(void *arg) {
+
+    LookupContext *ctx = (LookupContext *)(arg);
+    std::string value;
+    Status s;
+    int found = -1;
+
+    for (int i = 0; i < ctx->num_mem; i++) {
+        if (CheckSearchCondition(ctx->mem[i]) &&
+                ctx->mem[i]->Get(*ctx->lkey, &value, &s)) {
+            found = i;
+            ctx->cancel.Release_Store(ctx);
+            break;
+        }
+    }
+
+    ctx->found = found;
+    ctx->value.swap(value);
+    ctx->s = s;
+}
+
+namespace {
+struct UserKeyLess {
+    const Comparator* ucmp;
+    const std::vector<Slice>* keys;
+    bool operator()(size_t a, size_t b) const {
+        return ucmp->Compare((*keys)[a], (*keys)[b]) < 0;
+    }
+};
+}  // namespace
+
+//NoveLSM: Batched lookup. The keys are sorted once; each memtable is
+//then searched with one skiplist finger for the whole batch, and the
+//keys no memtable answered go to the SSTables as one batch per file.
+void DBImpl::MultiGet(const ReadOptions& options,
+        const std::vector<Slice>& keys,
+        std::vector<std::string>* values,
+        std::vector<Status>* statuses) {
+    const size_t n = keys.size();
+    values->resize(n);
+    statuses->assign(n, Status());
+    if (n == 0)
+        return;
+
+    // The sequence is read after the SuperVersion, as in Get()
+    SuperVersion* sv = AcquireSuperVersion();
+    SequenceNumber snapshot;
+    if (options.snapshot != NULL) {
+        snapshot = reinterpret_cast<const SnapshotImpl*>
+        (options.snapshot)->number_;
+    } else {
+        snapshot = versions_->LastSequence();
+    }
+
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; i++) order[i] = i;
+    UserKeyLess less;
+    less.ucmp = user_comparator();
+    less.keys = &keys;
+    std::sort(order.begin(), order.end(), less);
+
+    // Keys not answered yet, in sorted order
+    std::vector<const LookupKey*> pending(n);
+    std::vector<std::string*> pending_values(n);
+    std::vector<Status*> pending_statuses(n);
+    for (size_t i = 0; i < n; i++) {
+        pending[i] = new LookupKey(keys[order[i]], snapshot);
+        pending_values[i] = &(*values)[order[i]];
+        pending_statuses[i] = &(*statuses)[order[i]];
+    }
+    std::vector<const LookupKey*> lkeys(pending);
+
+    MemTable* mem[NUMEMTABLE_NVM + 1];
+    mem[0] = sv->mem;
+    for (int i = 0; i < sv->num_imm; i++) mem[i + 1] = sv->imm[i];
+    bool* found = new bool[n];
+    for (int m = 0; m < 1 + sv->num_imm && !pending.empty(); m++) {
+        if (!CheckSearchCondition(mem[m]))
+            continue;
+        mem[m]->MultiGet(pending.size(), &pending[0], &pending_values[0],
+                &pending_statuses[0], found);
+        size_t kept = 0;
+        for (size_t j = 0; j < pending.size(); j++) {
+            if (!found[j]) {
+                pending[kept] = pending[j];
+                pending_values[kept] = pending_values[j];
+                pending_statuses[kept] = pending_statuses[j];
+                kept++;
             }
-            //*(str->have_stat_update)  = true;
         }
-        break;
-    default:
-        return NULL;
+        pending.resize(kept);
+    }
+    delete[] found;
+
+    if (!pending.empty()) {
+        sv->current->MultiGet(options, pending.size(), &pending[0],
+                &pending_values[0], &pending_statuses[0]);
     }
-    return NULL;
+
+    for (size_t i = 0; i < n; i++) delete lkeys[i];
+    ReleaseSuperVersion(sv);
 }
 
-/*Order should be preserved for
- * incrementing flags
- */
-void DBImpl::IncrementHitFlag(){
+//NoveLSM: Zero-copy lookup. A value found in a memtable is returned as
+//a slice into its arena or NVM mapping and keeps the SuperVersion
+//holding that memtable referenced; one found in an sstable pins its
+//block (see Version::Get). Searches serially, without the read thread
+//pool, and like Get() takes no lock on the common path.
+Status DBImpl::Get(const ReadOptions& options,
+        const Slice& key,
+        PinnedSlice* value) {
+    value->Release();
 
-    if(mem_found == true) {
-        mem_hits++;
-        goto incr_done;
+    // Suspends in-place updates until we know whether a memtable is
+    // pinned. A write already running when the count went up is waited out
+    __atomic_add_fetch(&num_live_iterators_, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&inplace_write_active_, __ATOMIC_SEQ_CST)) {
+        MutexLock l(&mutex_);
+        while (inplace_write_active_) {
+            bg_cv_.Wait();
+        }
     }
-    else if(sstable_found == true) {
-        sstable_hits++;
-        goto incr_done;
+
+    Status s;
+    SuperVersion* sv = AcquireSuperVersion();
+    SequenceNumber snapshot;
+    if (options.snapshot != NULL) {
+        snapshot = reinterpret_cast<const SnapshotImpl*>
+        (options.snapshot)->number_;
+    } else {
+        snapshot = versions_->LastSequence();
     }
 
-    incr_done:
-    return;
+    MemTable* mem[NUMEMTABLE_NVM + 1];
+    mem[0] = sv->mem;
+    for (int i = 0; i < sv->num_imm; i++) mem[i + 1] = sv->imm[i];
+    int num_mem = 1 + sv->num_imm;
+
+    bool have_stat_update = false;
+    Version::GetStats stats;
+    int pinned_mem = -1;
+    LookupKey lkey(key, snapshot);
+    Slice v;
+    for (int i = 0; i < num_mem; i++) {
+        if (CheckSearchCondition(mem[i]) && mem[i]->Get(lkey, &v, &s)) {
+            if (s.ok())
+                pinned_mem = i;
+            break;
+        }
+    }
+    if (pinned_mem < 0 && s.ok()) {
+        s = sv->current->Get(options, lkey, value, &stats);
+        have_stat_update = true;
+    }
+    if (pinned_mem >= 0) {
+        // The value keeps the bundle, and so its memtable, referenced
+        __atomic_add_fetch(&sv->refs, 1, __ATOMIC_RELAXED);
+        value->PinSlice(v, &DBImpl::UnpinSuperVersion, this, sv);
+    } else {
+        __atomic_sub_fetch(&num_live_iterators_, 1, __ATOMIC_SEQ_CST);
+    }
+
+    if (have_stat_update && stats.seek_file != NULL) {
+        MutexLock l(&mutex_);
+        if (sv->current->UpdateStats(stats)) {
+            MaybeScheduleCompaction();
+        }
+    }
+    ReleaseSuperVersion(sv);
+    return s;
+}
+
+void DBImpl::UnpinSuperVersion(void* arg1, void* arg2) {
+    DBImpl* db = reinterpret_cast<DBImpl*>(arg1);
+    SuperVersion* sv = reinterpret_cast<SuperVersion*>(arg2);
+    __atomic_sub_fetch(&db->num_live_iterators_, 1, __ATOMIC_SEQ_CST);
+    // The lock is only needed to free the last reference
+    if (__atomic_sub_fetch(&sv->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        MutexLock l(&db->mutex_);
+        db->FreeSuperVersion(sv);
+    }
 }
 
 bool DBImpl::CheckSearchCondition(MemTable* mem){
@@ -1388,19 +2028,116 @@ bool DBImpl::CheckSearchCondition(MemTable* mem){
 /*Not a must to disable this, the code checks
 for multi-level presence*/ 
 //#ifdef MULTILEVEL_IMMUTABLE
+void DBImpl::InstallSuperVersion() {
+    mutex_.AssertHeld();
+    SuperVersion* sv = new SuperVersion;
+    sv->mem = mem_;
+    sv->mem->Ref();
+    sv->num_imm = imm_.RefMemList(sv->imm);
+    sv->current = versions_->current();
+    sv->current->Ref();
+    sv->number = super_version_number_ + 1;
+    sv->refs = 1;
+
+    SuperVersion* old = super_version_;
+    super_version_ = sv;
+    __atomic_store_n(&super_version_number_, sv->number, __ATOMIC_RELEASE);
+
+    // Take back the references cached by idle readers. A slot in use is
+    // emptied too, its reader then releases the reference itself.
+    for (size_t i = 0; i < super_version_slots_.size(); i++) {
+        void* p = __atomic_exchange_n(&super_version_slots_[i]->sv, (void*)NULL,
+                __ATOMIC_ACQ_REL);
+        if (p != NULL && p != kSVInUse)
+            UnrefSuperVersion(reinterpret_cast<SuperVersion*>(p));
+    }
+    if (old != NULL)
+        UnrefSuperVersion(old);
+}
+
+void DBImpl::UnrefSuperVersion(SuperVersion* sv) {
+    mutex_.AssertHeld();
+    if (__atomic_sub_fetch(&sv->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        FreeSuperVersion(sv);
+    }
+}
+
+void DBImpl::FreeSuperVersion(SuperVersion* sv) {
+    mutex_.AssertHeld();
+    sv->mem->Unref();
+    for (int i = 0; i < sv->num_imm; i++) sv->imm[i]->Unref();
+    sv->current->Unref();
+    delete sv;
+}
+
+DBImpl::SuperVersion* DBImpl::AcquireSuperVersion() {
+    SuperVersionSlot* slot = reinterpret_cast<SuperVersionSlot*>(
+            pthread_getspecific(super_version_key_));
+    SuperVersion* sv = NULL;
+    if (slot != NULL) {
+        sv = reinterpret_cast<SuperVersion*>(
+                __atomic_exchange_n(&slot->sv, kSVInUse, __ATOMIC_ACQ_REL));
+        if (sv != NULL && sv->number ==
+                __atomic_load_n(&super_version_number_, __ATOMIC_ACQUIRE))
+            return sv;
+    }
+
+    // First Get() of this thread, or the cached bundle is outdated
+    MutexLock l(&mutex_);
+    if (slot == NULL) {
+        slot = new SuperVersionSlot;
+        slot->db = this;
+        slot->sv = kSVInUse;
+        super_version_slots_.push_back(slot);
+        pthread_setspecific(super_version_key_, slot);
+    }
+    if (sv != NULL)
+        UnrefSuperVersion(sv);
+    sv = super_version_;
+    __atomic_add_fetch(&sv->refs, 1, __ATOMIC_RELAXED);
+    return sv;
+}
+
+void DBImpl::ReleaseSuperVersion(SuperVersion* sv) {
+    SuperVersionSlot* slot = reinterpret_cast<SuperVersionSlot*>(
+            pthread_getspecific(super_version_key_));
+    void* expected = kSVInUse;
+    if (__atomic_compare_exchange_n(&slot->sv, &expected, (void*)sv, false,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return;
+    // InstallSuperVersion() emptied the slot meanwhile
+    MutexLock l(&mutex_);
+    UnrefSuperVersion(sv);
+}
+
+void DBImpl::ReclaimSuperVersionSlot(void* arg) {
+    SuperVersionSlot* slot = reinterpret_cast<SuperVersionSlot*>(arg);
+    DBImpl* db = slot->db;
+    MutexLock l(&db->mutex_);
+    std::vector<SuperVersionSlot*>& slots = db->super_version_slots_;
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (slots[i] == slot) {
+            slots.erase(slots.begin() + i);
+            break;
+        }
+    }
+    if (slot->sv != NULL && slot->sv != kSVInUse)
+        db->UnrefSuperVersion(reinterpret_cast<SuperVersion*>(slot->sv));
+    delete slot;
+}
+
 Status DBImpl::Get(const ReadOptions& options,
         const Slice& key,
         std::string* value) {
-    Status s, sfail;
-    MutexLock l(&mutex_);
+    Status s;
     SequenceNumber snapshot;
-    Version* current = versions_->current();
     bool have_stat_update = false;
     Version::GetStats stats;
 
-    g_mem = mem_;
-    g_imm = imm_;
-
+    //NoveLSM: The sequence is read after the SuperVersion. Read before,
+    //a compaction installed in between could drop the entries it needs
+    //from the bundle's Version, as no snapshot protects them
+    SuperVersion* sv = AcquireSuperVersion();
     if (options.snapshot != NULL) {
         snapshot = reinterpret_cast<const SnapshotImpl*>
         (options.snapshot)->number_;
@@ -1408,123 +2145,76 @@ Status DBImpl::Get(const ReadOptions& options,
         snapshot = versions_->LastSequence();
     }
 
-    g_mem->Ref();
-    if (g_imm != NULL) g_imm->Ref();
-    current->Ref();
-
-    if(current)
-        current->ResetTerminate();
+    Version* current = sv->current;
+    LookupContext ctx;
+    ctx.mem[0] = sv->mem;
+    for (int i = 0; i < sv->num_imm; i++) ctx.mem[i + 1] = sv->imm[i];
+    ctx.num_mem = 1 + sv->num_imm;
 
-    //Clear global flags
-    mem_found = false;
-    sstable_found = false;
-
-    g_options = options;
-    // Unlock while reading from files and memtables
-    mutex_.Unlock();
     // First look in the memtable, then in the immutable memtable (if any).
     LookupKey lkey(key, snapshot);
-    read_struct str[NUM_READ_THREADS+1];
-    bool done = false;
     int num_threads = num_read_threads;
-    int ret=0;
-
-    if(predict_on)
-        knvmhit = mem_->CheckPredictIndex(&mem_->predict_set,
-                (const uint8_t*)key.data());
-
-    if ((num_threads >= 1) && thpool) {
-        kCheckCond = 0;
-        for (int i = 0; i < num_threads; i++) {
-            if(predict_on && knvmhit)
-                goto no_thread;
-            //str[i].val = SSTBL_THRD;
-            str[i].val = MEMTBL_THRD;
-            str[i].lkey = &lkey;
-            str[i].db = this;
-            str[i].value = value;
-            str[i].done = false;
-            str[i].current = current;
-            str[i].stats = &stats;
-            str[i].have_stat_update = &have_stat_update;
-            str[i].s = &s;
-            thpool_add_work(thpool, read_thread, &str[i]);
-            //read_thread(&str[i]);
-        }
-
-        if ((str[0].val != MEMTBL_THRD)) {
-            if (g_mem && g_mem->Get(lkey, value, &s)) {
-                done =true;
-                kCheckCond = true;
-                mem_found = true;
-                goto pool_wait;
-            }
-            if (g_imm && g_imm->Get(lkey, value, &s)) {
-                done =true;
-                kCheckCond = true;
-                imm_found = true;
-            }
-        }else {
-            s = current->Get(options, lkey, value, &stats);
-            sstable_found = true;
-        }
-        pool_wait:
-        //if(!done)
-        thpool_wait(thpool);
-
-        for (int i = 0; i < num_threads; i++) {
-            //Wait for the thread pool to complete
-            if(str[i].done == true) {
-                done =true;
-                s = Status::OK();
-                if(i > 0)
-                    have_stat_update = false;
-
-                goto found_key;
-            }
-        }
-        if(sstable_found == true){
+    int found = -1;
+
+    //NoveLSM: A key the memtables' prediction index knows about is
+    //looked up in the memtables first, without starting the parallel
+    //SSTable search
+    bool predict_hit = false;
+    if (options_.nvm_hit_prediction && (num_threads >= 1) && read_pool_) {
+        for (int i = 0; !predict_hit && i < ctx.num_mem; i++)
+            predict_hit = ctx.mem[i]->CheckPredictIndex(key);
+    }
+
+    if ((num_threads >= 1) && read_pool_ && !predict_hit) {
+        //NoveLSM: The memtables are searched by a read thread while
+        //this thread searches the SSTables. A memtable entry is newer
+        //than any SSTable one, so a memtable hit cancels the SSTable
+        //search and takes precedence over its result
+        ctx.lkey = &lkey;
+        std::string sst_value;
+        read_pool_->Submit(&ctx.job, &read_thread, &ctx);
+        s = current->Get(options, lkey, &sst_value, &stats, &ctx.cancel);
+        ctx.job.Wait();
+
+        found = ctx.found;
+        if (found >= 0) {
+            s = ctx.s;
+            if (s.ok()) value->swap(ctx.value);
+        } else {
+            if (s.ok()) value->swap(sst_value);
             have_stat_update = true;
-            done  = true;
         }
-        if(done == true)
-            s = Status::OK();
-        else
-            s = Status::NotFound(Slice());
     }
     else {
-
-no_thread:
-        //TODO: Add a macro condition
-        if (CheckSearchCondition(mem_) && mem_->Get(lkey, value, &s)) {
-            done =true;
-            mem_found = true;
+        for (int i = 0; i < ctx.num_mem; i++) {
+            if (CheckSearchCondition(ctx.mem[i]) &&
+                    ctx.mem[i]->Get(lkey, value, &s)) {
+                found = i;
+                break;
+            }
         }
-        else if (CheckSearchCondition(imm_) && imm_->Get(lkey, value, &s)) {
-            done =true;
-            imm_found = true;
-        }else {
+        if (found < 0) {
             s = current->Get(options, lkey, value, &stats);
             have_stat_update = true;
-            sstable_found = true;
         }
-        if(done == true)
-            s = Status::OK();
     }
-    found_key:
-    mutex_.Lock();
 
 #ifdef _ENABLE_STATS
-    //Increment stats counter
-    IncrementHitFlag();
+    if (found == 0)
+        incr_mem_hits();
+    else if (found > 0)
+        incr_imm_hits();
+    else if (s.ok())
+        incr_sstable_hits();
 #endif
-    //fprintf(stderr, "have_stat_update %u \n", have_stat_update);
-    if (have_stat_update && current->UpdateStats(stats)) {
-        MaybeScheduleCompaction();
+    // Seek stats only change when more than one file was read
+    if (have_stat_update && stats.seek_file != NULL) {
+        MutexLock l(&mutex_);
+        if (current->UpdateStats(stats)) {
+            MaybeScheduleCompaction();
+        }
     }
-    g_mem->Unref();
-    if (g_imm != NULL) g_imm->Unref();
-    current->Unref();
+    ReleaseSuperVersion(sv);
     return s;
 }
 
@@ -1549,6 +2239,9 @@ void DBImpl::RecordReadSample(Slice key) {
 
 const Snapshot* DBImpl::GetSnapshot() {
     MutexLock l(&mutex_);
+    while (inplace_write_active_) {
+        bg_cv_.Wait();
+    }
     return snapshots_.New(versions_->LastSequence());
 }
 
@@ -1575,9 +2268,23 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
 
     MutexLock l(&mutex_);
     writers_.push_back(&w);
-    while (!w.done && &w != writers_.front()) {
+    while (!w.done && !w.parallel && &w != writers_.front()) {
         w.cv.Wait();
     }
+    if (w.parallel) {
+        //NoveLSM: Our leader assigned our sequence numbers; insert our
+        //own batch alongside the rest of the group.
+        mutex_.Unlock();
+        w.status = WriteBatchInternal::InsertIntoConcurrently(w.batch, w.mem);
+        mutex_.Lock();
+        w.parallel = false;
+        if (--w.leader->pending == 0) {
+            w.leader->cv.Signal();
+        }
+        while (!w.done) {
+            w.cv.Wait();
+        }
+    }
     if (w.done) {
         return w.status;
     }
@@ -1598,11 +2305,33 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
 
     uint64_t last_sequence = versions_->LastSequence();
     Writer* last_writer = &w;
-    if (status.ok() && my_batch != NULL) {  // NULL batch is for compactions
+    if (status.ok() && my_batch != NULL && options_.concurrent_nvm_writes &&
+            mem_->isNVMMemtable &&
+            ConcurrentInsertBytes(my_batch) <= mem_->ConcurrentInsertRoom()) {
+        status = WriteConcurrentGroup(&w, &last_writer, &last_sequence);
+        versions_->SetLastSequence(last_sequence);
+    }
+    else if (status.ok() && my_batch != NULL) {  // NULL batch is for compactions
         WriteBatch* updates = BuildBatchGroup(&last_writer);
         WriteBatchInternal::SetSequence(updates, last_sequence + 1);
         last_sequence += WriteBatchInternal::Count(updates);
 
+        //NoveLSM: Nothing can observe the values an in-place update
+        //replaces while no snapshot or iterator is live. A pinning Get()
+        //raises the count without mutex_ before it checks the flag, so
+        //either we see its count or it sees our flag and waits
+        bool inplace = options_.nvm_inplace_updates && mem_->isNVMMemtable &&
+                snapshots_.empty();
+        if (inplace) {
+            __atomic_store_n(&inplace_write_active_, true, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&num_live_iterators_, __ATOMIC_SEQ_CST) != 0) {
+                inplace = false;
+                __atomic_store_n(&inplace_write_active_, false,
+                        __ATOMIC_SEQ_CST);
+            }
+        }
+        mem_->SetInPlaceUpdates(inplace);
+
         // Add to log and apply to memtable.  We can release the lock
         // during this phase since &w is currently responsible for logging
         // and protects against concurrent loggers and concurrent writes
@@ -1625,6 +2354,11 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
                 status = WriteBatchInternal::InsertInto(updates, mem_);
             }
             mutex_.Lock();
+            if (inplace) {
+                mem_->SetInPlaceUpdates(false);
+                __atomic_store_n(&inplace_write_active_, false, __ATOMIC_SEQ_CST);
+                bg_cv_.SignalAll();
+            }
             if (sync_error) {
                 // The state of the log file is indeterminate: the log record we
                 // just added may or may not show up when the DB is re-opened.
@@ -1641,7 +2375,9 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
         Writer* ready = writers_.front();
         writers_.pop_front();
         if (ready != &w) {
-            ready->status = status;
+            if (!ready->inserted) {
+                ready->status = status;
+            }
             ready->done = true;
             ready->cv.Signal();
         }
@@ -1653,6 +2389,100 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
         writers_.front()->cv.Signal();
     }
     assert(mem_->GetNumKeys());
+    return w.inserted ? w.status : status;
+}
+
+/* NoveLSM: Applies a group of writes to the NVM memtable in parallel.
+ * The leader picks the group with the same limits as BuildBatchGroup,
+ * assigns every batch its sequence numbers, reserves the arena space
+ * of the whole group, persists the group's last sequence in the
+ * memtable header and then lets each follower insert its own batch
+ * while it inserts its own. Returns once all of them are in the
+ * memtable. Each writer that inserted keeps its own status; the
+ * returned group status, the first failure if any, is for the writers
+ * of the group without a batch. If the reservation fails nothing is
+ * inserted and only w gets the error.
+ * REQUIRES: mutex_ held, w is the front writer, mem_ is an NVM memtable
+ */
+Status DBImpl::WriteConcurrentGroup(Writer* w, Writer** last_writer,
+        uint64_t* last_sequence) {
+    mutex_.AssertHeld();
+    assert(writers_.front() == w);
+    assert(mem_->isNVMMemtable);
+
+    size_t size = WriteBatchInternal::ByteSize(w->batch);
+    size_t max_size = 1 << 20;
+    if (size <= (128<<10)) {
+        max_size = size + (128<<10);
+    }
+
+    // Only take on what the memtable's arena surely has room for
+    MemTable* mem = mem_;
+    size_t room = mem->ConcurrentInsertRoom();
+    size_t needed = ConcurrentInsertBytes(w->batch);
+
+    std::vector<Writer*> followers;
+    const uint64_t first_sequence = *last_sequence;
+    WriteBatchInternal::SetSequence(w->batch, *last_sequence + 1);
+    *last_sequence += WriteBatchInternal::Count(w->batch);
+    *last_writer = w;
+    std::deque<Writer*>::iterator iter = writers_.begin();
+    ++iter;  // Advance past "w"
+    for (; iter != writers_.end(); ++iter) {
+        Writer* f = *iter;
+        if (f->sync && !w->sync) {
+            break;
+        }
+        if (f->batch != NULL) {
+            size += WriteBatchInternal::ByteSize(f->batch);
+            size_t f_needed = ConcurrentInsertBytes(f->batch);
+            if (size > max_size || needed + f_needed > room) {
+                break;
+            }
+            needed += f_needed;
+            WriteBatchInternal::SetSequence(f->batch, *last_sequence + 1);
+            *last_sequence += WriteBatchInternal::Count(f->batch);
+            followers.push_back(f);
+        }
+        *last_writer = f;
+    }
+
+    // Set the group's space aside so that no member can run out of it
+    // halfway through its batch.
+    if (!mem->ReserveConcurrentInserts(needed)) {
+        *last_sequence = first_sequence;
+        *last_writer = w;
+        return Status::IOError("NVM memtable is out of space");
+    }
+
+    // Any node a crash leaves behind must not carry a sequence above
+    // the one recovery restarts from.
+    mem->PersistSequence(*last_sequence);
+
+    w->pending = followers.size();
+    for (size_t i = 0; i < followers.size(); i++) {
+        followers[i]->mem = mem;
+        followers[i]->leader = w;
+        followers[i]->parallel = true;
+        followers[i]->inserted = true;
+        followers[i]->cv.Signal();
+    }
+
+    mutex_.Unlock();
+    w->status = WriteBatchInternal::InsertIntoConcurrently(w->batch, mem);
+    w->inserted = true;
+    mutex_.Lock();
+    while (w->pending > 0) {
+        w->cv.Wait();
+    }
+    mem->FinishConcurrentInserts();
+
+    Status status = w->status;
+    for (size_t i = 0; i < followers.size(); i++) {
+        if (status.ok() && !followers[i]->status.ok()) {
+            status = followers[i]->status;
+        }
+    }
     return status;
 }
 
@@ -1720,12 +2550,37 @@ MemTable* DBImpl::CreateMemTable(void) {
     logfile_ = lfile;
     log_ = new log::Writer(lfile);
 #endif
-    mem = new MemTable(internal_comparator_);
+    mem = new MemTable(internal_comparator_, drambuff_);
     mem->isNVMMemtable = false;
+    mem->SetPrediction(options_.nvm_hit_prediction);
+    mem->logfile_number = logfile_number_;
     assert(mem);
     return mem;
 }
 
+/* Upper bound of the NVM arena bytes that inserting batch with
+ * WriteConcurrentGroup() takes: the encoded entries, a full height
+ * skiplist node with alignment for each, and a fresh slab its writer
+ * may reserve. Moving to a new slab wastes less than the allocation
+ * that caused it, so entries and nodes are counted twice.
+ */
+size_t DBImpl::ConcurrentInsertBytes(const WriteBatch* batch) const {
+    static const size_t kEntryOverhead = 160;
+    static const size_t kSlabAlignment = 64;
+    size_t bytes = WriteBatchInternal::ByteSize(batch) +
+            WriteBatchInternal::Count(batch) * kEntryOverhead;
+    if (NVMSlabSize() > 0)
+        bytes *= 2;
+    return bytes + NVMSlabSize() + kSlabAlignment;
+}
+
+/* Per-thread NVM allocation slabs only pay off with concurrent
+ * inserts; the sequential path keeps using the shared bump pointer.
+ */
+size_t DBImpl::NVMSlabSize() const {
+    return options_.concurrent_nvm_writes ? options_.nvm_slab_size : 0;
+}
+
 /* Creates NVM memtable
  * Also allocates corresponding NVM arena
  * Skip list node allocations are from NVM arena
@@ -1744,8 +2599,22 @@ MemTable* DBImpl::CreateNVMtable(bool assign_map){
 #else
     ArenaNVM *arena= new ArenaNVM();
 #endif
-    mem = new MemTable(internal_comparator_, *arena, false);
+    arena->slab_size_ = NVMSlabSize();
+    if (options_.nvm_inplace_updates)
+        arena->update_slot_size_ = ArenaNVM::kUpdateSlotSize;
+    if (options_.nvm_hash_index) {
+        //One bucket per 64 bytes of memtable
+        size_t buckets = 1;
+        while (buckets < nvmbuff_ / 64)
+            buckets <<= 1;
+        arena->hash_index_buckets_ = buckets;
+    }
+    mem = new MemTable(internal_comparator_, *arena, false, nvmbuff_);
     mem->isNVMMemtable = true;
+    mem->SetPrediction(options_.nvm_hit_prediction);
+#ifdef ENABLE_RECOVERY
+    mem->logfile_number = new_map_number;
+#endif
     assert(mem);
     return mem;
 }
@@ -1794,7 +2663,7 @@ Status DBImpl::MakeRoomForWrite(bool force) {
             break;
         } else if (
                 allow_delay &&
-                versions_->NumLevelFiles(0) >= config::kL0_SlowdownWritesTrigger) {
+                versions_->NumLevel0Runs() >= config::kL0_SlowdownWritesTrigger) {
             // We are getting close to hitting a hard limit on the number of
             // L0 files.  Rather than delaying a single write by several
             // seconds when we hit the hard limit, start delaying each
@@ -1810,13 +2679,13 @@ Status DBImpl::MakeRoomForWrite(bool force) {
             // There is room in current memtable
             break;
         }
-        else if (imm_ != NULL) {
-            // We have filled up the current memtable, but the previous
-            // one is still being compacted, so we wait.
+        else if (imm_.MemIsFull()) {
+            // We have filled up the current memtable, but the ring of
+            // earlier ones is still being compacted, so we wait.
             Log(options_.info_log, "Current memtable full; waiting...\n");
             bg_cv_.Wait();
         }
-        else if (versions_->NumLevelFiles(0) >= config::kL0_StopWritesTrigger) {
+        else if (versions_->NumLevel0Runs() >= config::kL0_StopWritesTrigger) {
             // There are too many level-0 files.
             Log(options_.info_log, "Too many L0 files; waiting...\n");
             bg_cv_.Wait();
@@ -1838,12 +2707,11 @@ Status DBImpl::MakeRoomForWrite(bool force) {
             log_ = new log::Writer(lfile);
 #endif
             MemTable *imm = mem_;
-            if(predict_on)
-                mem_->ClearPredictIndex(&mem_->predict_set);
             SwapMemtables();
-            imm_ = imm;
-            has_imm_.Release_Store(imm_);
+            imm_.AssignHeadIndex(imm);
+            has_imm_.Release_Store(imm_.getCompactionMem());
             mem_->Ref();
+            InstallSuperVersion();
             force = false;   // Do not force another compaction if have room
             MaybeScheduleCompaction();
         }
@@ -1905,8 +2773,8 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
         if (mem_) {
             total_usage += mem_->ApproximateMemoryUsage();
         }
-        if (imm_) {
-            total_usage += imm_->ApproximateMemoryUsage();
+        for (int i = 0; i < imm_.size; i++) {
+            total_usage += imm_.getMem(i)->ApproximateMemoryUsage();
         }
         char buf[50];
         snprintf(buf, sizeof(buf), "%llu",
@@ -1958,8 +2826,62 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
     return Write(opt, &batch);
 }
 
+Status DB::Get(const ReadOptions& options, const Slice& key,
+        PinnedSlice* value) {
+    value->Release();
+    Status s = Get(options, key, value->GetSelf());
+    if (s.ok()) {
+        value->PinSelf();
+    }
+    return s;
+}
+
+void DB::MultiGet(const ReadOptions& options,
+        const std::vector<Slice>& keys,
+        std::vector<std::string>* values,
+        std::vector<Status>* statuses) {
+    values->resize(keys.size());
+    statuses->resize(keys.size());
+    ReadOptions opt = options;
+    const Snapshot* snapshot = NULL;
+    if (opt.snapshot == NULL) {
+        snapshot = GetSnapshot();
+        opt.snapshot = snapshot;
+    }
+    for (size_t i = 0; i < keys.size(); i++) {
+        (*statuses)[i] = Get(opt, keys[i], &(*values)[i]);
+    }
+    if (snapshot != NULL) {
+        ReleaseSnapshot(snapshot);
+    }
+}
+
 DB::~DB() { }
 
+PinnedSlice::PinnedSlice() : cleanup_(NULL), arg1_(NULL), arg2_(NULL) { }
+
+PinnedSlice::~PinnedSlice() {
+    Release();
+}
+
+void PinnedSlice::Release() {
+    if (cleanup_ != NULL) {
+        (*cleanup_)(arg1_, arg2_);
+        cleanup_ = NULL;
+    }
+    data_.clear();
+    buf_.clear();
+}
+
+void PinnedSlice::PinSlice(const Slice& s, CleanupFunction function,
+        void* arg1, void* arg2) {
+    assert(cleanup_ == NULL);
+    data_ = s;
+    cleanup_ = function;
+    arg1_ = arg1;
+    arg2_ = arg2;
+}
+
 Status DB::Open(const Options& options, const std::string& dbname_disk,
         const std::string& dbname_mem, DB** dbptr) {
     *dbptr = NULL;
@@ -1967,14 +2889,10 @@ Status DB::Open(const Options& options, const std::string& dbname_disk,
     impl->mutex_.Lock();
     VersionEdit edit;
 
-    if(num_read_threads && !impl->thpool) {
-	if(num_read_threads > 1) {
-	    //For beta version, we are limiting the 
-	    //read threads to just 2 (one for memtables 
-	    // and one for SSTable
-	    num_read_threads = 1;
-	}
-        impl->thpool = thpool_init(num_read_threads);
+    //NoveLSM: Each Get() hands one memtable search to the pool, so
+    //more read threads serve more concurrent readers
+    if(num_read_threads > 0 && !impl->read_pool_) {
+        impl->read_pool_ = new ReadPool(num_read_threads);
     }
 
     // Recover handles create_if_missing, error_if_exists
@@ -1999,10 +2917,11 @@ Status DB::Open(const Options& options, const std::string& dbname_disk,
                 impl->logfile_ = lfile;
                 impl->log_ = new log::Writer(lfile);
                 if (impl->mem_ == NULL) {
-                    impl->mem_ = new MemTable(impl->internal_comparator_);
+                    impl->mem_ = new MemTable(impl->internal_comparator_, impl->drambuff_);
                     impl->mem_->isNVMMemtable = false;
+                    impl->mem_->SetPrediction(impl->options_.nvm_hit_prediction);
 #if defined(ENABLE_RECOVERY)
-                    impl->logfile_number_ = new_log_number;
+                    impl->mem_->logfile_number = impl->logfile_number_ = new_log_number;
 #else
                     impl->mem_->logfile_number = impl->logfile_number_ = new_log_number;
 #endif
@@ -2023,6 +2942,7 @@ Status DB::Open(const Options& options, const std::string& dbname_disk,
             s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
         }
         if (s.ok()) {
+            impl->InstallSuperVersion();
             impl->DeleteObsoleteFiles();
             impl->MaybeScheduleCompaction();
         }
@@ -2045,12 +2965,13 @@ Status DB::Open(const Options& options, const std::string& dbname_disk,
         std::vector<std::string> filenames_mem;
         // Ignore error in case directory does not exist
         env->GetChildren(dbname_disk, &filenames);
-        if (filenames.empty()) {
-            env->GetChildren(dbname_mem, &filenames_mem);
-            if (filenames_mem.empty()) {
-                return Status::OK();
-            }
+        //NoveLSM: The map files and the NVM block cache in dbname_mem go
+        //too, whether or not dbname_disk still has files
+        env->GetChildren(dbname_mem, &filenames_mem);
+        if (filenames.empty() && filenames_mem.empty()) {
+            return Status::OK();
         }
+        const size_t num_disk = filenames.size();
         filenames.insert(filenames.end(), filenames_mem.begin(), filenames_mem.end());
 
         FileLock* lock;
@@ -2062,11 +2983,8 @@ Status DB::Open(const Options& options, const std::string& dbname_disk,
             for (size_t i = 0; i < filenames.size(); i++) {
                 if (ParseFileName(filenames[i], &number, &type) &&
                         type != kDBLockFile) {  // Lock file will be deleted at end
-                    Status del;
-                    if (find(filenames_mem.begin(), filenames_mem.end(), filenames[i]) != filenames_mem.end())
-                        del = env->DeleteFile(dbname_mem + "/" + filenames[i]);
-                    else
-                        del = env->DeleteFile(dbname_disk + "/" + filenames[i]);
+                    const std::string& dir = (i < num_disk) ? dbname_disk : dbname_mem;
+                    Status del = env->DeleteFile(dir + "/" + filenames[i]);
                     if (result.ok() && !del.ok()) {
                         result = del;
                     }
@@ -7,6 +7,7 @@
 #include <unistd.h>
 #include <deque>
 #include <set>
+#include <vector>
 #include "db/dbformat.h"
 #include "db/log_writer.h"
 #include "db/snapshot.h"
@@ -15,7 +16,7 @@
 #include "port/port.h"
 #include "port/thread_annotations.h"
 #include "db/memtable.h"
-#include "util/thpool.h"
+#include "util/read_pool.h"
 
 #define NUMEMTABLE 0
 #define NUMEMTABLE_NVM 10
@@ -24,11 +25,15 @@
 namespace novelsm {
 
 class MemTable;
+class NvmBlockCache;
 class TableCache;
 class Version;
 class VersionEdit;
 class VersionSet;
 
+//NoveLSM: Ring of immutable memtables waiting to be compacted to L0.
+//New memtables are added at idx_end_ and compaction always takes the
+//oldest one at idx_start_. Callers hold DBImpl::mutex_.
 class MultiMem {
     MemTable **mem_;
 
@@ -44,14 +49,22 @@ public:
         size = 0;
     }
 
+    ~MultiMem() {
+        delete[] mem_;
+    }
+
+    //Oldest memtable in the ring, NULL if empty
     MemTable* getCompactionMem();
+    //Drops the oldest memtable without unreferencing it
+    void RemoveCompactionMem();
+    //Adds mem as the newest entry. Returns its slot or -1 if full
     int AssignHeadIndex(MemTable *);
     bool MemIsFull();
     bool MemIsEmpty();
-    MemTable** getMemList(int *sz) {
-        *sz = size;
-        return mem_;
-    }
+    //i-th newest memtable, 0 being the most recently added
+    MemTable* getMem(int i);
+    //Copies the ring newest first into list and Refs every entry
+    int RefMemList(MemTable **list);
 
     void reset() {
         idx_start_ = idx_end_ = -1;
@@ -68,9 +81,17 @@ public:
     virtual Status Put(const WriteOptions&, const Slice& key, const Slice& value);
     virtual Status Delete(const WriteOptions&, const Slice& key);
     virtual Status Write(const WriteOptions& options, WriteBatch* updates);
+    using DB::Get;
     virtual Status Get(const ReadOptions& options,
             const Slice& key,
             std::string* value);
+    virtual Status Get(const ReadOptions& options,
+            const Slice& key,
+            PinnedSlice* value);
+    virtual void MultiGet(const ReadOptions& options,
+            const std::vector<Slice>& keys,
+            std::vector<std::string>* values,
+            std::vector<Status>* statuses);
     virtual Iterator* NewIterator(const ReadOptions&);
     virtual const Snapshot* GetSnapshot();
     virtual void ReleaseSnapshot(const Snapshot* snapshot);
@@ -95,42 +116,48 @@ public:
     // file at a level >= 1.
     int64_t TEST_MaxNextLevelOverlappingBytes();
 
+    // Return the number of sorted runs in level 0.
+    int TEST_NumLevel0Runs();
+
     // Record a sample of bytes read at the specified internal key.
     // Samples are taken approximately once every config::kReadBytesPeriod
     // bytes.
     void RecordReadSample(Slice key);
     bool search_thread_multilevel (int val, LookupKey *lkey, std::string *value, Status *s);
-    bool CheckSearchCondition(MemTable* mem);
+    static bool CheckSearchCondition(MemTable* mem);
 
     //NoveLSM Mem2 creation
     MemTable* CreateNVMtable(bool assign_map = false);
+    size_t NVMSlabSize() const;
     MemTable* CreateMemTable(void);
 
     void DebugMemTable(MemTable *mem);
 
-    //For hit stats accounting
-    void IncrementHitFlag();
-    //Clearing flags. Should be called before get
-    void ClearThreadFlags();
     //Function to alternate between DRAM and NVM memtable
     int SwapMemtables();
 
-    typedef struct read_struct {
-        int val;
-        LookupKey *lkey;
-        DBImpl *db;
-        //port::CondVar *rt_cv_;
-        //port::Mutex *my_mutex_;
-        //volatile uint64_t *complete;
-        uint64_t *result;
-        std::string *value;
-        Status *s;
-        bool *have_stat_update;
-        bool done;
-        Version* current;
-        void *stats;
-        //const novelsm::ReadOptions *myoptions;
-    }read_struct;
+    //NoveLSM: State of one parallel Get(). A read thread searches the
+    //memtables while the caller searches the SSTables; each request has
+    //its own copy so concurrent Gets do not interfere.
+    struct LookupContext {
+        const LookupKey* lkey;
+        MemTable* mem[NUMEMTABLE_NVM + 1];  // Newest first
+        int num_mem;
+
+        // Memtable search result, valid once done is set
+        int found;                  // Index in mem of the hit, -1 if none
+        std::string value;
+        Status s;
+
+        // Set non-NULL by a memtable hit to stop the SSTable search
+        port::AtomicPointer cancel;
+
+        // Completion handle of the memtable search
+        ReadPool::Job job;
+
+        LookupContext() : lkey(NULL), num_mem(0), found(-1),
+                cancel(NULL) { }
+    };
 
     //NoveLSM Swap/Alternate between NVM and DRAM arena
     size_t drambuff_;
@@ -139,6 +166,7 @@ public:
 private:
     friend class DB;
     struct CompactionState;
+    struct FlushPartition;
     struct Writer;
 
     std::string getDBName(int level);
@@ -153,6 +181,11 @@ private:
 
     Status NewDB();
 
+    //NoveLSM: Read the db's identity, creating it for a new db (or one
+    //from before identities), and map the NVM block cache for it
+    Status Identity(uint64_t* id);
+    void OpenNvmBlockCache() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
     // Recover the descriptor from persistent storage.  May do a significant
     // amount of work to recover recently logged updates.  Any changes to
     // be made to the descriptor are added to *edit.
@@ -171,8 +204,35 @@ private:
 
     void CompactTopMemTable() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
     void CompactTopMemTable_Norelease() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
-    static void *read_thread(void *arg);
-    bool thread_task(read_struct *str, std::string *value);
+    static void read_thread(void *arg);
+
+    //NoveLSM: mem_, imm_ and the current Version as seen by Get(),
+    //published together as one refcounted SuperVersion. Each reader
+    //thread caches a reference in its SuperVersionSlot, so a Get()
+    //normally takes no lock: it swaps the cached pointer out of the
+    //slot, checks that it is still the latest, and puts it back.
+    //InstallSuperVersion() publishes a new bundle and takes back every
+    //cached reference not currently in use; a reader whose slot was
+    //emptied while in use drops its reference itself.
+    struct SuperVersion {
+        MemTable* mem;
+        MemTable* imm[NUMEMTABLE_NVM];  // Newest first
+        int num_imm;
+        Version* current;
+        uint64_t number;
+        int refs;                       // Updated atomically
+    };
+    struct SuperVersionSlot {
+        DBImpl* db;
+        void* sv;                       // SuperVersion*, NULL or kSVInUse
+    };
+    void InstallSuperVersion() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+    SuperVersion* AcquireSuperVersion();
+    void ReleaseSuperVersion(SuperVersion* sv);
+    void UnrefSuperVersion(SuperVersion* sv) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+    void FreeSuperVersion(SuperVersion* sv) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+    static void UnpinSuperVersion(void* arg1, void* arg2);
+    static void ReclaimSuperVersionSlot(void* arg);
 
     Status RecoverLogFile(uint64_t log_number, bool last_log, bool* save_manifest,
             VersionEdit* edit, SequenceNumber* max_sequence)
@@ -182,12 +242,25 @@ private:
             VersionEdit* edit, SequenceNumber* max_sequence)
     EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 #endif
-    Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base)
+    //NoveLSM: If outputs is non-NULL, the new tables stay in
+    //pending_outputs_ and their numbers are appended to *outputs; the
+    //caller erases them once edit has been applied
+    Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base,
+            std::vector<uint64_t>* outputs = NULL)
+    EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+    //NoveLSM: Builds the table of one key range of a partitioned flush
+    static void FlushPartitionWork(void* arg);
+    //NoveLSM: Merges compact->mem with the level 1 inputs of compact and
+    //adds the outcome to its edit, which the caller applies
+    Status MergeMemTableIntoLevel1(CompactionState* compact)
     EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
     Status MakeRoomForWrite(bool force /* compact even if there is room? */)
     EXCLUSIVE_LOCKS_REQUIRED(mutex_);
     WriteBatch* BuildBatchGroup(Writer** last_writer);
+    Status WriteConcurrentGroup(Writer* w, Writer** last_writer,
+            uint64_t* last_sequence) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+    size_t ConcurrentInsertBytes(const WriteBatch* batch) const;
 
     void RecordBackgroundError(const Status& s);
 
@@ -195,11 +268,29 @@ private:
     void ScheduleCompactionNow();
     static void BGWork(void* db);
     void BackgroundCall();
-    void  BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+    //NoveLSM: Returns false if there was nothing it could do
+    bool BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+    //NoveLSM: Memtable flushes on the high priority pool of env_
+    static void BGFlushWork(void* db);
+    void BackgroundFlushCall();
+    //NoveLSM: Whether flushes or compactions may run at the same time
+    bool ConcurrentBackgroundWork() const {
+        return options_.max_background_flushes > 0 ||
+                options_.max_background_compactions > 1;
+    }
+    //NoveLSM: versions_->LogAndApply() for one background thread at a time
+    Status LogAndApply(VersionEdit* edit) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
     void CleanupCompaction(CompactionState* compact)
     EXCLUSIVE_LOCKS_REQUIRED(mutex_);
     Status DoCompactionWork(CompactionState* compact)
     EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+    //NoveLSM: Merge the inputs of compact within its key range into its
+    //outputs. Runs without mutex_. If imm_micros is non-NULL, memtable
+    //flushes are done in between and their time is added to it.
+    Status CompactRangeOfInputs(CompactionState* compact, int64_t* imm_micros);
+    Status DoSubcompactions(CompactionState* compact,
+            const std::vector<std::string>& boundaries, int64_t* imm_micros);
+    static void SubcompactionWork(void* arg);
     void IterateMemAndPrint(MemTable *mem);
     Status OpenCompactionOutputFile(CompactionState* compact);
     Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
@@ -227,6 +318,7 @@ private:
 
     // table_cache_ provides its own synchronization
     TableCache* table_cache_;
+    NvmBlockCache* nvm_block_cache_;  // NULL without nvm_block_cache_size
 
     // Lock over the persistent DB state.  Non-NULL iff successfully acquired.
     FileLock* db_lock_;
@@ -236,8 +328,19 @@ private:
     port::AtomicPointer shutting_down_;
     port::CondVar bg_cv_;          // Signalled when background work finishes
     MemTable* mem_;
-    MemTable* imm_;                // Memtable being compacted
-    port::AtomicPointer has_imm_;  // So bg thread can detect non-NULL imm_
+    MultiMem imm_;                 // Memtables being compacted, oldest first
+    port::AtomicPointer has_imm_;  // So bg thread can detect non-empty imm_
+    SuperVersion* super_version_;
+    uint64_t super_version_number_;  // Also read without mutex_
+    pthread_key_t super_version_key_;
+    std::vector<SuperVersionSlot*> super_version_slots_;
+
+    //NoveLSM: In-place NVM updates are only allowed with no live
+    //iterators, pinned memtable values or snapshots. New ones wait
+    //while such a write runs. Both are updated atomically, as a pinning
+    //Get() changes them without mutex_.
+    int num_live_iterators_;
+    bool inplace_write_active_;
     WritableFile* logfile_;
     uint64_t logfile_number_;
 
@@ -247,7 +350,9 @@ private:
     log::Writer* log_;
     uint32_t seed_;                // For sampling.
     bool use_multiple_levels;
-    threadpool thpool;
+    ReadPool* read_pool_;          // NULL without num_read_threads
+    ReadPool* subcompaction_pool_; // NULL unless max_subcompactions > 1
+    ReadPool* flush_pool_;         // NULL unless flush_partitions > 1
 
     // Queue of writers.
     std::deque<Writer*> writers_;
@@ -259,8 +364,18 @@ private:
     // part of ongoing compactions.
     std::set<uint64_t> pending_outputs_;
 
-    // Has a background compaction been scheduled or is running?
-    bool bg_compaction_scheduled_;
+    // Background compactions that have been scheduled or are running
+    int bg_compactions_scheduled_;
+
+    //NoveLSM: Has a flush been scheduled on the high priority pool?
+    bool bg_flush_scheduled_;
+
+    //NoveLSM: Is a memtable being flushed?  The oldest memtable is
+    //flushed by one thread at a time.  Also read without mutex_.
+    bool flush_running_;
+
+    //NoveLSM: Is a background thread writing to the MANIFEST?
+    bool manifest_busy_;
 
     // Information for a manual compaction
     struct ManualCompaction {
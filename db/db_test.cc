@@ -78,14 +78,55 @@ class SpecialEnv : public EnvWrapper {
   bool count_random_reads_;
   AtomicCounter random_read_counter_;
 
+  // NoveLSM: Random access files read into the caller's scratch, as
+  // pread()-backed ones do, rather than handing out mmapped memory
+  bool copy_random_reads_;
+
+  // NoveLSM: Work scheduled on the low priority pool, i.e. compactions
+  // once flushes have their own pool, waits while this is non-NULL
+  port::AtomicPointer delay_low_pool_;
+
   explicit SpecialEnv(Env* base) : EnvWrapper(base) {
     delay_data_sync_.Release_Store(NULL);
     data_sync_error_.Release_Store(NULL);
     no_space_.Release_Store(NULL);
     non_writable_.Release_Store(NULL);
     count_random_reads_ = false;
+    copy_random_reads_ = false;
     manifest_sync_error_.Release_Store(NULL);
     manifest_write_error_.Release_Store(NULL);
+    delay_low_pool_.Release_Store(NULL);
+  }
+
+  struct DelayedWork {
+    SpecialEnv* env;
+    void (*function)(void*);
+    void* arg;
+  };
+
+  static void RunDelayedWork(void* arg) {
+    DelayedWork* work = reinterpret_cast<DelayedWork*>(arg);
+    while (work->env->delay_low_pool_.Acquire_Load() != NULL) {
+      DelayMilliseconds(100);
+    }
+    (*work->function)(work->arg);
+    delete work;
+  }
+
+  void Schedule(void (*function)(void*), void* arg) {
+    Schedule(function, arg, kLow);
+  }
+
+  void Schedule(void (*function)(void*), void* arg, Priority pri) {
+    if (pri == kLow) {
+      DelayedWork* work = new DelayedWork;
+      work->env = this;
+      work->function = function;
+      work->arg = arg;
+      target()->Schedule(&RunDelayedWork, work, pri);
+    } else {
+      target()->Schedule(function, arg, pri);
+    }
   }
 
   Status NewWritableFile(const std::string& f, WritableFile** r) {
@@ -166,21 +207,28 @@ class SpecialEnv : public EnvWrapper {
      private:
       RandomAccessFile* target_;
       AtomicCounter* counter_;
+      bool copy_;
      public:
-      CountingFile(RandomAccessFile* target, AtomicCounter* counter)
-          : target_(target), counter_(counter) {
+      CountingFile(RandomAccessFile* target, AtomicCounter* counter,
+                   bool copy)
+          : target_(target), counter_(counter), copy_(copy) {
       }
       virtual ~CountingFile() { delete target_; }
       virtual Status Read(uint64_t offset, size_t n, Slice* result,
                           char* scratch) const {
         counter_->Increment();
-        return target_->Read(offset, n, result, scratch);
+        Status s = target_->Read(offset, n, result, scratch);
+        if (s.ok() && copy_ && result->data() != scratch) {
+          memcpy(scratch, result->data(), result->size());
+          *result = Slice(scratch, result->size());
+        }
+        return s;
       }
     };
 
     Status s = target()->NewRandomAccessFile(f, r);
-    if (s.ok() && count_random_reads_) {
-      *r = new CountingFile(*r, &random_read_counter_);
+    if (s.ok() && (count_random_reads_ || copy_random_reads_)) {
+      *r = new CountingFile(*r, &random_read_counter_, copy_random_reads_);
     }
     return s;
   }
@@ -202,6 +250,7 @@ class DBTest {
 
  public:
   std::string dbname_;
+  std::string dbname_mem_;
   SpecialEnv* env_;
   DB* db_;
 
@@ -211,14 +260,15 @@ class DBTest {
              env_(new SpecialEnv(Env::Default())) {
     filter_policy_ = NewBloomFilterPolicy(10);
     dbname_ = test::TmpDir() + "/db_test";
-    DestroyDB(dbname_, Options());
+    dbname_mem_ = test::TmpDir() + "/db_test_mem";
+    DestroyDB(dbname_, dbname_mem_, Options());
     db_ = NULL;
     Reopen();
   }
 
   ~DBTest() {
     delete db_;
-    DestroyDB(dbname_, Options());
+    DestroyDB(dbname_, dbname_mem_, Options());
     delete env_;
     delete filter_policy_;
   }
@@ -271,7 +321,7 @@ class DBTest {
   void DestroyAndReopen(Options* options = NULL) {
     delete db_;
     db_ = NULL;
-    DestroyDB(dbname_, Options());
+    DestroyDB(dbname_, dbname_mem_, Options());
     ASSERT_OK(TryReopen(options));
   }
 
@@ -287,7 +337,7 @@ class DBTest {
     }
     last_options_ = opts;
 
-    return DB::Open(opts, dbname_, &db_);
+    return DB::Open(opts, dbname_, dbname_mem_, &db_);
   }
 
   Status Put(const std::string& k, const std::string& v) {
@@ -1506,21 +1556,129 @@ TEST(DBTest, ManualCompaction) {
   ASSERT_EQ("0,0,1", FilesPerLevel());
 }
 
+// A table as listed by the sstables property
+struct TableInfo {
+  uint64_t number;
+  std::string smallest;         // User keys
+  std::string largest;
+};
+
+static std::vector<TableInfo> TablesAtLevel(DBTest* t, int level) {
+  std::string list = t->DumpSSTableList();
+  std::vector<TableInfo> tables;
+  size_t pos = list.find("--- level " + NumberToString(level) + " ---\n");
+  if (pos == std::string::npos) {
+    return tables;
+  }
+  const size_t end = list.find("--- level", pos + 1);
+  // E.g. " 17:123['a' @ 5 : 1 .. 'd' @ 3 : 1]"
+  while ((pos = list.find("\n ", pos)) < end) {
+    TableInfo info;
+    Slice in(list.data() + pos + 2, list.size() - pos - 2);
+    ConsumeDecimalNumber(&in, &info.number);
+    size_t start = list.find("['", pos) + 2;
+    info.smallest = list.substr(start, list.find("' @", start) - start);
+    start = list.find(".. '", start) + 4;
+    info.largest = list.substr(start, list.find("' @", start) - start);
+    tables.push_back(info);
+    pos = start;
+  }
+  return tables;
+}
+
+// Build a level 2 of several tables, then delete the first key of each
+// of them and compact again, so that the deletions sit where the second
+// compaction may cut its ranges.  Returns every entry the database then
+// holds for the affected keys, and a digest of the rest.
+static std::string CompactAcrossTableStarts(DBTest* t, int max_subcompactions,
+                                            bool hold_snapshot) {
+  Options options = t->CurrentOptions();
+  options.create_if_missing = true;
+  options.compression = kNoCompression;
+  options.write_buffer_size = 100000000;
+  options.max_subcompactions = max_subcompactions;
+  t->DestroyAndReopen(&options);
+
+  // Even keys go to level 2, odd keys to level 1 on top of them
+  const std::string big(1000, 'v');
+  for (int i = 0; i < 12000; i += 2) ASSERT_OK(t->Put(Key(i), big));
+  t->dbfull()->TEST_CompactMemTable();
+  for (int i = 1; i < 12000; i += 2) ASSERT_OK(t->Put(Key(i), big));
+  t->dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("0,1,1", t->FilesPerLevel());
+  t->dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ("0,0", t->FilesPerLevel().substr(0, 3));
+
+  std::vector<TableInfo> tables = TablesAtLevel(t, 2);
+  std::vector<std::string> starts;
+  for (size_t i = 0; i < tables.size(); i++) {
+    starts.push_back(tables[i].smallest);
+  }
+  ASSERT_GT(starts.size(), 3);
+  const Snapshot* snapshot = hold_snapshot ? t->db_->GetSnapshot() : NULL;
+  for (size_t i = 0; i < starts.size(); i++) {
+    ASSERT_OK(t->Delete(starts[i]));
+  }
+  for (int i = 0; i < 12000; i += 100) {
+    ASSERT_OK(t->Put(Key(i), "new" + NumberToString(i)));
+  }
+  t->dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("0,1", t->FilesPerLevel().substr(0, 3));
+  t->dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ("0,0", t->FilesPerLevel().substr(0, 3));
+
+  std::string result;
+  for (size_t i = 0; i < starts.size(); i++) {
+    result += starts[i] + " " + t->AllEntriesFor(starts[i]) + "\n";
+  }
+  Iterator* iter = t->db_->NewIterator(ReadOptions());
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    count++;
+    if (iter->value() != big) {
+      result += iter->key().ToString() + "->" + iter->value().ToString() + " ";
+    }
+  }
+  delete iter;
+  result += "\ncount " + NumberToString(count);
+  if (snapshot != NULL) {
+    t->db_->ReleaseSnapshot(snapshot);
+  }
+  return result;
+}
+
+TEST(DBTest, SubcompactionsMatchSingleRange) {
+  for (int hold_snapshot = 0; hold_snapshot < 2; hold_snapshot++) {
+    const std::string serial = CompactAcrossTableStarts(this, 1, hold_snapshot);
+    const std::string split = CompactAcrossTableStarts(this, 4, hold_snapshot);
+    ASSERT_EQ(serial, split);
+    // A deletion survives only under the snapshot
+    ASSERT_EQ(hold_snapshot != 0, serial.find("DEL") != std::string::npos);
+
+    // The compactions were split
+    std::string log;
+    Close();
+    ASSERT_OK(ReadFileToString(env_, InfoLogFileName(dbname_), &log));
+    ASSERT_TRUE(log.find("subcompactions") != std::string::npos);
+  }
+}
+
 TEST(DBTest, DBOpen_Options) {
   std::string dbname = test::TmpDir() + "/db_options_test";
-  DestroyDB(dbname, Options());
+  std::string dbname_mem = dbname + "_mem";
+  DestroyDB(dbname, dbname_mem, Options());
 
   // Does not exist, and create_if_missing == false: error
   DB* db = NULL;
   Options opts;
   opts.create_if_missing = false;
-  Status s = DB::Open(opts, dbname, &db);
+  Status s = DB::Open(opts, dbname, dbname_mem, &db);
   ASSERT_TRUE(strstr(s.ToString().c_str(), "does not exist") != NULL);
   ASSERT_TRUE(db == NULL);
 
   // Does not exist, and create_if_missing == true: OK
   opts.create_if_missing = true;
-  s = DB::Open(opts, dbname, &db);
+  s = DB::Open(opts, dbname, dbname_mem, &db);
   ASSERT_OK(s);
   ASSERT_TRUE(db != NULL);
 
@@ -1530,14 +1688,14 @@ TEST(DBTest, DBOpen_Options) {
   // Does exist, and error_if_exists == true: error
   opts.create_if_missing = false;
   opts.error_if_exists = true;
-  s = DB::Open(opts, dbname, &db);
+  s = DB::Open(opts, dbname, dbname_mem, &db);
   ASSERT_TRUE(strstr(s.ToString().c_str(), "exists") != NULL);
   ASSERT_TRUE(db == NULL);
 
   // Does exist, and error_if_exists == false: OK
   opts.create_if_missing = true;
   opts.error_if_exists = false;
-  s = DB::Open(opts, dbname, &db);
+  s = DB::Open(opts, dbname, dbname_mem, &db);
   ASSERT_OK(s);
   ASSERT_TRUE(db != NULL);
 
@@ -1547,10 +1705,532 @@ TEST(DBTest, DBOpen_Options) {
 
 TEST(DBTest, Locking) {
   DB* db2 = NULL;
-  Status s = DB::Open(CurrentOptions(), dbname_, &db2);
+  Status s = DB::Open(CurrentOptions(), dbname_, dbname_mem_, &db2);
   ASSERT_TRUE(!s.ok()) << "Locking did not prevent re-opening db";
 }
 
+TEST(DBTest, DestroyDBRemovesMemoryFiles) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 64 << 10;   // Move on to an NVM memtable
+  Reopen(&options);
+  for (int i = 0; i < 200; i++) {
+    ASSERT_OK(Put(Key(i), std::string(1000, 'v')));
+  }
+  std::vector<std::string> files;
+  uint64_t number;
+  FileType type;
+  int map_files = 0;
+  env_->GetChildren(dbname_mem_, &files);
+  for (size_t i = 0; i < files.size(); i++) {
+    if (ParseFileName(files[i], &number, &type) && type == kMapFile) {
+      map_files++;
+    }
+  }
+  ASSERT_GT(map_files, 0);
+
+  // The disk directory still holds files, which used to keep the
+  // memory-side ones from being deleted
+  Close();
+  ASSERT_OK(DestroyDB(dbname_, dbname_mem_, options));
+  env_->GetChildren(dbname_mem_, &files);
+  for (size_t i = 0; i < files.size(); i++) {
+    ASSERT_TRUE(!ParseFileName(files[i], &number, &type)) << files[i];
+  }
+  options.create_if_missing = true;
+  Reopen(&options);
+  ASSERT_EQ("NOT_FOUND", Get(Key(0)));
+}
+
+namespace {
+
+// Table file numbers of the db in dbname
+static std::set<uint64_t> TableNumbers(Env* env, const std::string& dbname) {
+  std::set<uint64_t> result;
+  std::vector<std::string> files;
+  uint64_t number;
+  FileType type;
+  env->GetChildren(dbname, &files);
+  for (size_t i = 0; i < files.size(); i++) {
+    if (ParseFileName(files[i], &number, &type) && type == kTableFile) {
+      result.insert(number);
+    }
+  }
+  return result;
+}
+
+}  // namespace
+
+// NoveLSM: The NVM block cache serves a reopened db, but never a new db
+// in the same place, whose tables reuse the old one's numbers
+TEST(DBTest, NvmBlockCacheAcrossReopenAndRecreate) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.create_if_missing = true;
+  options.nvm_block_cache_size = 2 << 20;
+  env_->copy_random_reads_ = true;
+  env_->count_random_reads_ = true;
+  ReadOptions uncached;
+  uncached.fill_cache = false;
+
+  std::set<uint64_t> first_tables;
+  for (int round = 0; round < 3; round++) {
+    const char c = 'a' + round;
+    DestroyAndReopen(&options);
+    for (int i = 0; i < 100; i++) {
+      ASSERT_OK(Put(Key(i), std::string(100, c)));
+    }
+    dbfull()->TEST_CompactMemTable();
+    // The same steps give the same table numbers and layout each round
+    if (round == 0) {
+      first_tables = TableNumbers(env_, dbname_);
+    } else {
+      ASSERT_TRUE(first_tables == TableNumbers(env_, dbname_));
+    }
+
+    // Blocks read from disk twice are admitted, and read from NVM then
+    std::string value;
+    for (int pass = 0; pass < 3; pass++) {
+      for (int i = 0; i < 100; i++) {
+        ASSERT_OK(db_->Get(uncached, Key(i), &value));
+        ASSERT_EQ(std::string(100, c), value);
+      }
+    }
+    env_->random_read_counter_.Reset();
+    for (int i = 0; i < 100; i++) {
+      ASSERT_OK(db_->Get(uncached, Key(i), &value));
+    }
+    ASSERT_EQ(0, env_->random_read_counter_.Read());
+
+    // A reopened db still finds them
+    Reopen(&options);
+    ASSERT_OK(db_->Get(uncached, Key(0), &value));  // Opens the table
+    env_->random_read_counter_.Reset();
+    for (int i = 0; i < 100; i++) {
+      ASSERT_OK(db_->Get(uncached, Key(i), &value));
+      ASSERT_EQ(std::string(100, c), value);
+    }
+    ASSERT_EQ(0, env_->random_read_counter_.Read());
+    Close();
+
+    if (round == 0) {
+      // Only the disk side is lost; the memory side, BLOCKCACHE included,
+      // is left in place for the next db
+      std::vector<std::string> files;
+      uint64_t number;
+      FileType type;
+      ASSERT_OK(DestroyDB(dbname_, dbname_ + "_no_mem", options));
+      env_->GetChildren(dbname_mem_, &files);
+      for (size_t i = 0; i < files.size(); i++) {
+        if (ParseFileName(files[i], &number, &type) &&
+            type != kNvmBlockCacheFile) {
+          ASSERT_OK(env_->DeleteFile(dbname_mem_ + "/" + files[i]));
+        }
+      }
+      ASSERT_TRUE(env_->FileExists(NvmBlockCacheFileName(dbname_mem_)));
+    } else {
+      ASSERT_OK(DestroyDB(dbname_, dbname_mem_, options));
+      ASSERT_TRUE(!env_->FileExists(NvmBlockCacheFileName(dbname_mem_)));
+    }
+  }
+  env_->copy_random_reads_ = false;
+  env_->count_random_reads_ = false;
+}
+
+// Whether the tables of each level above 0 are disjoint.  Stores the
+// numbers of all tables in *live.
+static bool LevelsDisjoint(DBTest* t, std::set<uint64_t>* live) {
+  live->clear();
+  for (int level = 0; level < config::kNumLevels; level++) {
+    std::vector<TableInfo> tables = TablesAtLevel(t, level);
+    for (size_t i = 0; i < tables.size(); i++) {
+      live->insert(tables[i].number);
+      if (level > 0 && i > 0 &&
+          tables[i - 1].largest.compare(tables[i].smallest) >= 0) {
+        fprintf(stderr, "level %d: #%llu overlaps #%llu\n", level,
+                (unsigned long long) tables[i - 1].number,
+                (unsigned long long) tables[i].number);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+TEST(DBTest, ConcurrentFlushesAndCompactions) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.create_if_missing = true;
+  options.write_buffer_size = 64 << 10;
+  options.nvm_buffer_size = 128 << 10;
+  options.max_background_compactions = 3;
+  options.max_background_flushes = 1;
+  DestroyAndReopen(&options);
+
+  // Overwrites and deletions over a key range that many flushes and
+  // compactions cover at once
+  Random rnd(301);
+  std::map<std::string, std::string> model;
+  std::set<uint64_t> live;
+  for (int i = 0; i < 100000; i++) {
+    if (i % 10000 == 0) {
+      ASSERT_TRUE(LevelsDisjoint(this, &live));
+    }
+    const std::string k = Key(rnd.Uniform(30000));
+    if (rnd.OneIn(8)) {
+      ASSERT_OK(Delete(k));
+      model.erase(k);
+    } else {
+      const std::string v = RandomString(&rnd, 100 + rnd.Uniform(400));
+      ASSERT_OK(Put(k, v));
+      model[k] = v;
+    }
+  }
+
+  ASSERT_TRUE(LevelsDisjoint(this, &live));
+
+  // Obsolete tables go as soon as the compactions that replaced them
+  // are installed; allow for a compaction that is still finishing
+  db_->CompactRange(NULL, NULL);
+  ASSERT_EQ(0, NumTableFilesAtLevel(0));
+  bool no_leaks = false;
+  for (int tries = 0; !no_leaks && tries < 100; tries++) {
+    ASSERT_TRUE(LevelsDisjoint(this, &live));
+    no_leaks = (live == TableNumbers(env_, dbname_));
+    if (!no_leaks) {
+      env_->SleepForMicroseconds(100000);
+    }
+  }
+  ASSERT_TRUE(no_leaks);
+
+  std::string expected;
+  for (std::map<std::string, std::string>::const_iterator it = model.begin();
+       it != model.end(); ++it) {
+    expected += "(" + it->first + "->" + it->second + ")";
+  }
+  ASSERT_EQ(expected, Contents());
+  Reopen(&options);
+  ASSERT_EQ(expected, Contents());
+}
+
+static bool BySmallest(const TableInfo& a, const TableInfo& b) {
+  return a.smallest < b.smallest;
+}
+
+TEST(DBTest, PartitionedFlush) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.write_buffer_size = 64 << 20;
+  options.flush_partitions = 4;
+  DestroyAndReopen(&options);
+
+  // A table over the whole key range keeps the flushed tables in level 0
+  MakeTables(3, "a", "z");
+  ASSERT_EQ("1,1,1", FilesPerLevel());
+  ASSERT_EQ(1, dbfull()->TEST_NumLevel0Runs());
+
+  // Enough for four ranges of the minimum size
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < 20000; i++) {
+    values.push_back(RandomString(&rnd, 1000));
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  dbfull()->TEST_CompactMemTable();
+
+  for (int pass = 0; pass < 2; pass++) {
+    // Four disjoint tables next to the old one, and two runs in all,
+    // which is below the level 0 compaction trigger
+    ASSERT_EQ("5,1,1", FilesPerLevel());
+    ASSERT_EQ(2, dbfull()->TEST_NumLevel0Runs());
+    std::vector<TableInfo> tables = TablesAtLevel(this, 0);
+    std::sort(tables.begin(), tables.end(), BySmallest);
+    ASSERT_EQ("a", tables[0].smallest);
+    ASSERT_EQ(Key(0), tables[1].smallest);
+    ASSERT_EQ(Key(19999), tables[4].largest);
+    for (size_t i = 2; i < tables.size(); i++) {
+      ASSERT_LT(tables[i - 1].largest, tables[i].smallest);
+    }
+
+    ASSERT_EQ("begin", Get("a"));
+    ASSERT_EQ("end", Get("z"));
+    for (int i = 0; i < 20000; i++) {
+      ASSERT_EQ(values[i], Get(Key(i)));
+    }
+    Reopen(&options);
+  }
+}
+
+TEST(DBTest, FlushToLevel1) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.flush_to_level1 = true;
+  DestroyAndReopen(&options);
+
+  // With level 0 empty, flushes merge into level 1
+  ASSERT_OK(Put("a", "va1"));
+  ASSERT_OK(Put("b", "vb1"));
+  ASSERT_OK(Put("c", "vc1"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("0,1", FilesPerLevel());
+
+  // Overwrites and a deletion across flushes, under a snapshot
+  const Snapshot* snapshot = db_->GetSnapshot();
+  ASSERT_OK(Put("a", "va2"));
+  ASSERT_OK(Delete("b"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put("a", "va3"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("0,1", FilesPerLevel());
+  ASSERT_EQ("[ va3, va2, va1 ]", AllEntriesFor("a"));
+  ASSERT_EQ("[ DEL, vb1 ]", AllEntriesFor("b"));
+  ASSERT_EQ("va1", Get("a", snapshot));
+  ASSERT_EQ("vb1", Get("b", snapshot));
+  ASSERT_EQ("va3", Get("a"));
+  ASSERT_EQ("NOT_FOUND", Get("b"));
+
+  // Without the snapshot the next merge drops what it hid
+  db_->ReleaseSnapshot(snapshot);
+  ASSERT_OK(Put("c", "vc2"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("[ va3 ]", AllEntriesFor("a"));
+  ASSERT_EQ("[ ]", AllEntriesFor("b"));
+
+  // Merged tables and the memtable survive a reopen
+  ASSERT_OK(Put("d", "vd1"));
+  Reopen(&options);
+  ASSERT_EQ("va3", Get("a"));
+  ASSERT_EQ("NOT_FOUND", Get("b"));
+  ASSERT_EQ("vc2", Get("c"));
+  ASSERT_EQ("vd1", Get("d"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("0,2", FilesPerLevel());    // "d" overlaps no level 1 table
+  Reopen(&options);
+  ASSERT_EQ("vd1", Get("d"));
+
+  // A table in level 0 holds older entries than the memtable, so flushes
+  // go to level 0 until it has been compacted
+  Options level0_options = options;
+  level0_options.flush_to_level1 = false;
+  Reopen(&level0_options);
+  ASSERT_OK(Put("b", "vb2"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("1,2", FilesPerLevel());
+  Reopen(&options);
+  ASSERT_OK(Put("b", "vb3"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("2,2", FilesPerLevel());
+  ASSERT_EQ("vb3", Get("b"));
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_EQ("0,2", FilesPerLevel());
+  ASSERT_OK(Put("a", "va4"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("0,2", FilesPerLevel());
+
+  Reopen(&options);
+  ASSERT_EQ("va4", Get("a"));
+  ASSERT_EQ("vb3", Get("b"));
+  ASSERT_EQ("vc2", Get("c"));
+  ASSERT_EQ("vd1", Get("d"));
+}
+
+TEST(DBTest, FlushToLevel1OverlapLimit) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.create_if_missing = true;
+  options.compression = kNoCompression;
+  options.write_buffer_size = 100000000;
+  options.max_background_flushes = 1;
+  options.flush_to_level1 = true;
+  DestroyAndReopen(&options);
+
+  // With compactions held back, flushes of new key ranges grow level 1
+  // past what a flush merges with
+  env_->delay_low_pool_.Release_Store(env_);
+  const std::string value(1000, 'v');
+  const int kFlushes = 12;
+  const int kKeysPerFlush = 2000;
+  for (int f = 0; f < kFlushes; f++) {
+    for (int i = 0; i < kKeysPerFlush; i++) {
+      ASSERT_OK(Put(Key(f * kKeysPerFlush + i), value));
+    }
+    dbfull()->TEST_CompactMemTable();
+  }
+  ASSERT_EQ(0, NumTableFilesAtLevel(0));
+  ASSERT_GT(Size("", Key(kFlushes * kKeysPerFlush)), 20 << 20);
+
+  // A flush over a few level 1 tables still merges into them
+  ASSERT_OK(Put(Key(5), "small"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ(0, NumTableFilesAtLevel(0));
+
+  // One over all of them goes to level 0
+  ASSERT_OK(Put(Key(0), "first"));
+  ASSERT_OK(Put(Key(kFlushes * kKeysPerFlush - 1), "last"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ(1, NumTableFilesAtLevel(0));
+
+  env_->delay_low_pool_.Release_Store(NULL);
+  ASSERT_EQ("first", Get(Key(0)));
+  ASSERT_EQ("small", Get(Key(5)));
+  ASSERT_EQ(value, Get(Key(6)));
+  ASSERT_EQ("last", Get(Key(kFlushes * kKeysPerFlush - 1)));
+}
+
+// Level 0 runs and non-empty levels below, as universal compaction
+// counts them
+static int SortedRuns(DBTest* t) {
+  int runs = t->dbfull()->TEST_NumLevel0Runs();
+  for (int level = 1; level < config::kNumLevels; level++) {
+    if (t->NumTableFilesAtLevel(level) > 0) {
+      runs++;
+    }
+  }
+  return runs;
+}
+
+TEST(DBTest, UniversalCompaction) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.create_if_missing = true;
+  options.write_buffer_size = 64 << 10;
+  options.nvm_buffer_size = 128 << 10;
+  options.compaction_style = kCompactionStyleUniversal;
+  options.universal_max_sorted_runs = 4;
+  DestroyAndReopen(&options);
+
+  Random rnd(301);
+  std::map<std::string, std::string> model;
+  std::set<uint64_t> live;
+  for (int i = 0; i < 50000; i++) {
+    const std::string k = Key(rnd.Uniform(10000));
+    if (rnd.OneIn(8)) {
+      ASSERT_OK(Delete(k));
+      model.erase(k);
+    } else {
+      const std::string v = RandomString(&rnd, 100 + rnd.Uniform(400));
+      ASSERT_OK(Put(k, v));
+      model[k] = v;
+    }
+  }
+  std::string expected;
+  for (std::map<std::string, std::string>::const_iterator it = model.begin();
+       it != model.end(); ++it) {
+    expected += "(" + it->first + "->" + it->second + ")";
+  }
+
+  // Once compactions are done there are fewer runs than would start
+  // one, each level a sorted run older than the ones above
+  for (int pass = 0; pass < 2; pass++) {
+    for (int tries = 0;
+         SortedRuns(this) >= options.universal_max_sorted_runs &&
+         tries < 100; tries++) {
+      env_->SleepForMicroseconds(100000);
+    }
+    ASSERT_LT(SortedRuns(this), options.universal_max_sorted_runs);
+    ASSERT_GT(SortedRuns(this), 0);
+    ASSERT_TRUE(LevelsDisjoint(this, &live));
+    ASSERT_EQ(expected, Contents());
+    Reopen(&options);
+  }
+
+  // A manual compaction leaves a single run in the lowest level used
+  db_->CompactRange(NULL, NULL);
+  ASSERT_EQ(0, NumTableFilesAtLevel(0));
+  ASSERT_EQ(1, SortedRuns(this));
+  ASSERT_TRUE(LevelsDisjoint(this, &live));
+  ASSERT_EQ(expected, Contents());
+  Reopen(&options);
+  ASSERT_EQ(1, SortedRuns(this));
+  ASSERT_EQ(expected, Contents());
+}
+
+TEST(DBTest, UniversalIgnoresFlushToLevel1) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.compaction_style = kCompactionStyleUniversal;
+  options.flush_to_level1 = true;
+  DestroyAndReopen(&options);
+
+  // Flushes stay in level 0 and keep level 1 free for it
+  ASSERT_OK(Put("a", "va1"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("1", FilesPerLevel());
+  ASSERT_OK(Put("a", "va2"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("2", FilesPerLevel());
+  ASSERT_EQ("va2", Get("a"));
+  Reopen(&options);
+  ASSERT_EQ("va2", Get("a"));
+}
+
+// Get() of every 37th key of [0, n) and Seek() to every third one, with
+// the two entries each seek lands on.  Sparse enough that the seeks Get()
+// charges to tables start no compaction.
+static std::string ReadAll(DBTest* t, int n) {
+  std::string result;
+  for (int i = 0; i < n; i += 37) {
+    result += t->Get(Key(i)) + ",";
+  }
+  Iterator* iter = t->db_->NewIterator(ReadOptions());
+  for (int i = -1; i < n; i += 3) {
+    iter->Seek((i < 0) ? std::string() : Key(i) + "x");
+    for (int j = 0; j < 2 && iter->Valid(); j++) {
+      result += t->IterStatus(iter) + ",";
+      iter->Next();
+    }
+    result += ";";
+  }
+  delete iter;
+  return result;
+}
+
+TEST(DBTest, LearnedIndex) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.write_buffer_size = 64 << 20;
+  options.block_restart_interval = 1;
+  options.compression = kNoCompression;
+  DestroyAndReopen(&options);
+
+  // Flushes of disjoint ranges: the even keys land in level 2, the odd
+  // ones above them in level 1, and overwrites of a few of both in level
+  // 0, so that levels 1 and 2 have enough tables, and each table enough
+  // index entries and restarts, for a model
+  Random rnd(301);
+  const int kRange = 2000;
+  for (int b = 0; b < 40; b++) {
+    for (int i = b * kRange; i < (b + 1) * kRange; i += 2) {
+      ASSERT_OK(Put(Key(i), RandomString(&rnd, 100)));
+    }
+    dbfull()->TEST_CompactMemTable();
+  }
+  for (int b = 0; b < 30; b++) {
+    for (int i = b * kRange + 1; i < (b + 1) * kRange; i += 2) {
+      ASSERT_OK(Put(Key(i), RandomString(&rnd, 100)));
+    }
+    dbfull()->TEST_CompactMemTable();
+  }
+  for (int b = 0; b < 3; b++) {
+    for (int i = b; i < 300; i += 7) {
+      if (rnd.OneIn(4)) {
+        ASSERT_OK(Delete(Key(i)));
+      } else {
+        ASSERT_OK(Put(Key(i), RandomString(&rnd, 100)));
+      }
+    }
+    dbfull()->TEST_CompactMemTable();
+  }
+  ASSERT_EQ("3,30,40", FilesPerLevel());
+
+  const int n = 41 * kRange;
+  const std::string expected = ReadAll(this, n);
+  options.learned_index = true;
+  Reopen(&options);
+  ASSERT_EQ("3,30,40", FilesPerLevel());
+  ASSERT_EQ(expected, ReadAll(this, n));
+  ASSERT_EQ("3,30,40", FilesPerLevel());
+}
+
 // Check that number of files does not grow when we are out of space
 TEST(DBTest, NoSpace) {
   Options options = CurrentOptions();
@@ -1853,6 +2533,665 @@ TEST(DBTest, MultiThreaded) {
   } while (ChangeOptions());
 }
 
+// Concurrent NVM writes: several writers commit batches while the NVM
+// memtable's arena runs low, so write groups get cut by its room.
+namespace {
+
+static const int kNumBatchWriters = 8;
+static const int kBatchesPerWriter = 200;
+static const int kKeysPerBatch = 20;
+
+struct BatchWriterState {
+  DB* db;
+  int id;
+  port::AtomicPointer done;
+  Status status;
+};
+
+static std::string BatchKey(int writer, int batch, int i) {
+  char buf[40];
+  snprintf(buf, sizeof(buf), "%02d.%04d.%02d", writer, batch, i);
+  return std::string(buf);
+}
+
+static void BatchWriterBody(void* arg) {
+  BatchWriterState* state = reinterpret_cast<BatchWriterState*>(arg);
+  std::string value(100, 'a' + state->id);
+  for (int b = 0; b < kBatchesPerWriter && state->status.ok(); b++) {
+    WriteBatch batch;
+    for (int i = 0; i < kKeysPerBatch; i++) {
+      batch.Put(BatchKey(state->id, b, i), value);
+    }
+    state->status = state->db->Write(WriteOptions(), &batch);
+  }
+  state->done.Release_Store(state);
+}
+
+}  // namespace
+
+// Runs kNumBatchWriters threads committing their batches to db
+static void RunBatchWriters(DBTest* test) {
+  BatchWriterState state[kNumBatchWriters];
+  for (int id = 0; id < kNumBatchWriters; id++) {
+    state[id].db = test->db_;
+    state[id].id = id;
+    state[id].done.Release_Store(NULL);
+    test->env_->StartThread(BatchWriterBody, &state[id]);
+  }
+  for (int id = 0; id < kNumBatchWriters; id++) {
+    while (state[id].done.Acquire_Load() == NULL) {
+      DelayMilliseconds(10);
+    }
+    ASSERT_OK(state[id].status);
+  }
+}
+
+// Checks that every batch of RunBatchWriters() is there as a whole
+static void CheckBatches(DBTest* test) {
+  std::string expected;
+  for (int id = 0; id < kNumBatchWriters; id++) {
+    expected.assign(100, 'a' + id);
+    for (int b = 0; b < kBatchesPerWriter; b++) {
+      for (int i = 0; i < kKeysPerBatch; i++) {
+        ASSERT_EQ(expected, test->Get(BatchKey(id, b, i)));
+      }
+    }
+  }
+}
+
+TEST(DBTest, ConcurrentNVMWritesFillArena) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 64 << 10;
+  options.nvm_buffer_size = 128 << 10;
+  options.concurrent_nvm_writes = true;
+  options.nvm_slab_size = 4096;
+  options.create_if_missing = true;
+  DestroyAndReopen(&options);
+  RunBatchWriters(this);
+  CheckBatches(this);
+}
+
+TEST(DBTest, GroupCommitNVMBatches) {
+  // The batches of a write group go to the NVM memtable behind one
+  // persist barrier and have to survive a reopen from its mapping
+  Options options = CurrentOptions();
+  options.write_buffer_size = 64 << 10;
+  options.create_if_missing = true;
+  DestroyAndReopen(&options);
+  RunBatchWriters(this);
+  CheckBatches(this);
+  Reopen(&options);
+  CheckBatches(this);
+}
+
+TEST(DBTest, InPlaceUpdates) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.nvm_inplace_updates = true;
+  DestroyAndReopen(&options);
+  dbfull()->TEST_CompactMemTable();   // Switch to an NVM memtable
+
+  // Overwrites of the same size replace the newest entry
+  for (int i = 0; i < 100; i++) {
+    ASSERT_OK(Put(Key(i), "v0-" + Key(i)));
+  }
+  for (int r = 1; r <= 3; r++) {
+    for (int i = 0; i < 100; i += r) {
+      char buf[10];
+      snprintf(buf, sizeof(buf), "v%d-", r);
+      ASSERT_OK(Put(Key(i), buf + Key(i)));
+    }
+  }
+  ASSERT_EQ("[ v3-" + Key(0) + " ]", AllEntriesFor(Key(0)));
+  ASSERT_EQ("[ v2-" + Key(2) + " ]", AllEntriesFor(Key(2)));
+  ASSERT_EQ("[ v1-" + Key(1) + " ]", AllEntriesFor(Key(1)));
+  ASSERT_EQ("v3-" + Key(99), Get(Key(99)));
+  ASSERT_EQ("v2-" + Key(98), Get(Key(98)));
+  ASSERT_EQ("v1-" + Key(97), Get(Key(97)));
+
+  // A value of another size, or after a deletion, is appended
+  ASSERT_OK(Put(Key(0), "longer-" + Key(0)));
+  ASSERT_EQ("[ longer-" + Key(0) + ", v3-" + Key(0) + " ]",
+            AllEntriesFor(Key(0)));
+  ASSERT_OK(Delete(Key(1)));
+  ASSERT_OK(Put(Key(1), "v4-" + Key(1)));
+  ASSERT_EQ("[ v4-" + Key(1) + ", DEL, v1-" + Key(1) + " ]",
+            AllEntriesFor(Key(1)));
+  ASSERT_EQ("longer-" + Key(0), Get(Key(0)));
+  ASSERT_EQ("v4-" + Key(1), Get(Key(1)));
+
+  // The updates are durable in the memtable's mapping
+  Reopen(&options);
+  ASSERT_EQ("longer-" + Key(0), Get(Key(0)));
+  ASSERT_EQ("v4-" + Key(1), Get(Key(1)));
+  for (int i = 2; i < 100; i++) {
+    const int r = (i % 3 == 0) ? 3 : (i % 2 == 0) ? 2 : 1;
+    char buf[10];
+    snprintf(buf, sizeof(buf), "v%d-", r);
+    ASSERT_EQ(buf + Key(i), Get(Key(i)));
+  }
+}
+
+TEST(DBTest, InPlaceUpdatesKeepReadersConsistent) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.nvm_inplace_updates = true;
+  DestroyAndReopen(&options);
+  dbfull()->TEST_CompactMemTable();   // Switch to an NVM memtable
+  ASSERT_OK(Put("foo", "v1"));
+  ASSERT_OK(Put("foo", "v2"));
+  ASSERT_EQ("[ v2 ]", AllEntriesFor("foo"));
+
+  // A snapshot still reads the value it saw
+  const Snapshot* snapshot = db_->GetSnapshot();
+  ASSERT_OK(Put("foo", "v3"));
+  ASSERT_EQ("v2", Get("foo", snapshot));
+  ASSERT_EQ("v3", Get("foo"));
+  db_->ReleaseSnapshot(snapshot);
+  ASSERT_EQ("[ v3, v2 ]", AllEntriesFor("foo"));
+
+  // So does an iterator
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  iter->Seek("foo");
+  ASSERT_EQ("foo->v3", IterStatus(iter));
+  ASSERT_OK(Put("foo", "v4"));
+  ASSERT_EQ("foo->v3", IterStatus(iter));
+  iter->SeekToFirst();
+  ASSERT_EQ("foo->v3", IterStatus(iter));
+  delete iter;
+  ASSERT_EQ("[ v4, v3, v2 ]", AllEntriesFor("foo"));
+
+  // And a value pinned in the memtable
+  PinnedSlice value;
+  ASSERT_OK(db_->Get(ReadOptions(), "foo", &value));
+  ASSERT_TRUE(value.pinned());
+  ASSERT_OK(Put("foo", "v5"));
+  ASSERT_EQ("v4", value.ToString());
+  ASSERT_EQ("v5", Get("foo"));
+  value.Release();
+  ASSERT_EQ("[ v5, v4, v3, v2 ]", AllEntriesFor("foo"));
+
+  // With all of them gone, updates go in place again
+  ASSERT_OK(Put("foo", "v6"));
+  ASSERT_EQ("[ v6, v4, v3, v2 ]", AllEntriesFor("foo"));
+  Reopen(&options);
+  ASSERT_EQ("v6", Get("foo"));
+}
+
+// Get() of every key of the model, and of keys the model lacks
+static void CheckModel(DBTest* t, const std::map<std::string, std::string>& model,
+                       int n) {
+  for (int i = 0; i < n; i++) {
+    std::map<std::string, std::string>::const_iterator it = model.find(Key(i));
+    ASSERT_EQ(it == model.end() ? "NOT_FOUND" : it->second, t->Get(Key(i)));
+    ASSERT_EQ("NOT_FOUND", t->Get(Key(i) + "x"));
+  }
+}
+
+TEST(DBTest, NvmHashIndex) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.nvm_hash_index = true;
+  DestroyAndReopen(&options);
+  dbfull()->TEST_CompactMemTable();   // Switch to an NVM memtable
+
+  // Overwrites and deletions leave the index pointing at the newest
+  // entry of each key
+  const int kKeys = 200;
+  std::map<std::string, std::string> model;
+  Random rnd(301);
+  for (int i = 0; i < kKeys; i++) {
+    model[Key(i)] = "v0-" + Key(i);
+    ASSERT_OK(Put(Key(i), model[Key(i)]));
+  }
+  const Snapshot* snapshot = db_->GetSnapshot();
+  for (int i = 0; i < kKeys; i++) {
+    if (rnd.OneIn(4)) {
+      model.erase(Key(i));
+      ASSERT_OK(Delete(Key(i)));
+    } else if (rnd.OneIn(2)) {
+      model[Key(i)] = RandomString(&rnd, 10 + rnd.Uniform(20));
+      ASSERT_OK(Put(Key(i), model[Key(i)]));
+    }
+  }
+  CheckModel(this, model, kKeys + 10);
+
+  // Older entries than the indexed one are found in the skiplist
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_EQ("v0-" + Key(i), Get(Key(i), snapshot));
+  }
+  db_->ReleaseSnapshot(snapshot);
+
+  // The index is rebuilt along with the recovered memtable
+  Reopen(&options);
+  CheckModel(this, model, kKeys + 10);
+  ASSERT_OK(Put(Key(0), "after-reopen"));
+  ASSERT_OK(Delete(Key(1)));
+  model[Key(0)] = "after-reopen";
+  model.erase(Key(1));
+  CheckModel(this, model, kKeys + 10);
+}
+
+TEST(DBTest, NvmHashIndexFull) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.nvm_hash_index = true;
+  options.nvm_buffer_size = 256 << 10;
+  DestroyAndReopen(&options);
+  dbfull()->TEST_CompactMemTable();   // Switch to an NVM memtable
+
+  // More keys than the 4096 buckets can index: the later ones are only
+  // in the skiplist, and misses have to search it
+  const int kKeys = 4000;
+  std::map<std::string, std::string> model;
+  for (int i = 0; i < kKeys; i++) {
+    model[Key(i)] = "v";
+    ASSERT_OK(Put(Key(i), "v"));
+  }
+  ASSERT_OK(Put(Key(kKeys - 1), "w"));
+  model[Key(kKeys - 1)] = "w";
+  ASSERT_OK(Delete(Key(kKeys - 2)));
+  model.erase(Key(kKeys - 2));
+  ASSERT_EQ(0, TotalTableFiles());    // All in the one memtable
+  CheckModel(this, model, kKeys + 10);
+
+  Reopen(&options);
+  CheckModel(this, model, kKeys + 10);
+}
+
+TEST(DBTest, ImmutableMemTableRing) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.write_buffer_size = 64 << 10;
+  options.nvm_buffer_size = 128 << 10;
+  options.num_immutable_memtables = 4;
+  options.create_if_missing = true;
+  DestroyAndReopen(&options);
+
+  // Stall flushes so that full memtables pile up in the ring; each
+  // round of overwrites then lives in a different memtable
+  const int kRounds = 5;
+  const int kKeys = 50;
+  const Snapshot* snapshots[kRounds];
+  env_->delay_data_sync_.Release_Store(env_);
+  for (int r = 0; r < kRounds; r++) {
+    for (int i = 0; i < kKeys; i++) {
+      ASSERT_OK(Put(Key(i), std::string(1000, 'a' + r)));
+    }
+    snapshots[r] = db_->GetSnapshot();
+  }
+  for (int r = 0; r < kRounds; r++) {
+    for (int i = 0; i < kKeys; i++) {
+      ASSERT_EQ(std::string(1000, 'a' + r), Get(Key(i), snapshots[r]));
+    }
+  }
+  ASSERT_EQ(std::string(1000, 'a' + kRounds - 1), Get(Key(0)));
+  ASSERT_EQ(0, NumTableFilesAtLevel(0));
+
+  // Once the ring drains to level 0 the same versions are read there
+  env_->delay_data_sync_.Release_Store(NULL);
+  dbfull()->TEST_CompactMemTable();
+  for (int r = 0; r < kRounds; r++) {
+    for (int i = 0; i < kKeys; i++) {
+      ASSERT_EQ(std::string(1000, 'a' + r), Get(Key(i), snapshots[r]));
+    }
+    db_->ReleaseSnapshot(snapshots[r]);
+  }
+  Reopen(&options);
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_EQ(std::string(1000, 'a' + kRounds - 1), Get(Key(i)));
+  }
+}
+
+// Returns MultiGet()'s answer for keys as a comma-separated list,
+// with NOT_FOUND for missing keys
+static std::string MultiGetAll(DB* db, const std::vector<Slice>& keys,
+                               const Snapshot* snapshot = NULL) {
+  ReadOptions options;
+  options.snapshot = snapshot;
+  std::vector<std::string> values;
+  std::vector<Status> statuses;
+  db->MultiGet(options, keys, &values, &statuses);
+  std::string result;
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (i > 0) result += ",";
+    if (statuses[i].ok()) {
+      result += values[i];
+    } else if (statuses[i].IsNotFound()) {
+      result += "NOT_FOUND";
+    } else {
+      result += statuses[i].ToString();
+    }
+  }
+  return result;
+}
+
+TEST(DBTest, MultiGet) {
+  do {
+    // a..d in level 2, b and a deletion of c in level 1, and b and e in
+    // level 0, which overlaps level 1 and so is not pushed down
+    ASSERT_OK(Put("a", "a1"));
+    ASSERT_OK(Put("b", "b1"));
+    ASSERT_OK(Put("c", "c1"));
+    ASSERT_OK(Put("d", "d1"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_OK(Put("b", "b2"));
+    ASSERT_OK(Delete("c"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_OK(Put("b", "b3"));
+    ASSERT_OK(Put("e", "e3"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_EQ("1,1,1", FilesPerLevel());
+    const Snapshot* snapshot = db_->GetSnapshot();
+
+    // a, a deletion of b, and f in the memtable
+    ASSERT_OK(Put("a", "a4"));
+    ASSERT_OK(Delete("b"));
+    ASSERT_OK(Put("f", "f4"));
+
+    std::vector<Slice> keys;
+    keys.push_back("d");
+    keys.push_back("a");
+    keys.push_back("b");
+    keys.push_back("c");
+    keys.push_back("e");
+    keys.push_back("f");
+    keys.push_back("g");
+    keys.push_back("a");
+    keys.push_back("d");
+    ASSERT_EQ("d1,a4,NOT_FOUND,NOT_FOUND,e3,f4,NOT_FOUND,a4,d1",
+              MultiGetAll(db_, keys));
+    ASSERT_EQ("d1,a1,b3,NOT_FOUND,e3,NOT_FOUND,NOT_FOUND,a1,d1",
+              MultiGetAll(db_, keys, snapshot));
+
+    // Every answer agrees with Get()
+    std::vector<std::string> values;
+    std::vector<Status> statuses;
+    db_->MultiGet(ReadOptions(), keys, &values, &statuses);
+    ASSERT_EQ(keys.size(), values.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      ASSERT_EQ(Get(keys[i].ToString()),
+                statuses[i].ok() ? values[i] : "NOT_FOUND");
+    }
+
+    keys.clear();
+    ASSERT_EQ("", MultiGetAll(db_, keys));
+    db_->ReleaseSnapshot(snapshot);
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, AsyncBlockReads) {
+  // Round r rewrites the keys with i % 5 >= r, so key i's newest value
+  // is from round i % 5: in level 2, level 1, or one of three level-0
+  // tables, newest last
+  Options options = CurrentOptions();
+  options.async_block_reads = true;
+  options.create_if_missing = true;
+  DestroyAndReopen(&options);
+  char buf[20];
+  for (int r = 0; r < 5; r++) {
+    for (int i = 0; i < 100; i++) {
+      if (i % 5 < r) continue;
+      snprintf(buf, sizeof(buf), "%d.%d", r, i);
+      ASSERT_OK(Put(Key(i), buf));
+    }
+    dbfull()->TEST_CompactMemTable();
+  }
+  ASSERT_EQ("3,1,1", FilesPerLevel());
+
+  for (int pass = 0; pass < 2; pass++) {
+    std::vector<std::string> key_strs;
+    std::string expected;
+    for (int i = 0; i < 100; i++) {
+      snprintf(buf, sizeof(buf), "%d.%d", i % 5, i);
+      ASSERT_EQ(buf, Get(Key(i)));
+      key_strs.push_back(Key(i));
+      if (i > 0) expected += ",";
+      expected += buf;
+    }
+    ASSERT_EQ("NOT_FOUND", Get(Key(100)));
+    std::vector<Slice> keys(key_strs.begin(), key_strs.end());
+    ASSERT_EQ(expected, MultiGetAll(db_, keys));
+
+    // Again, with the blocks now in the block cache
+  }
+}
+
+// SuperVersion: readers keep reading while the writer switches
+// memtables and compacts.  A reader must never see a key go back to an
+// older value or miss one, which would mean it read a stale SuperVersion
+// or one whose compactions dropped the entries its sequence needed.
+namespace {
+
+static const int kSVReaders = 4;
+static const int kSVKeys = 200;
+
+struct SVState {
+  DB* db;
+  port::AtomicPointer round;    // Last round fully written
+  port::AtomicPointer stop;
+};
+
+struct SVReader {
+  SVState* state;
+  port::AtomicPointer done;
+  Status status;
+  int reads;
+};
+
+static void SVReaderBody(void* arg) {
+  SVReader* r = reinterpret_cast<SVReader*>(arg);
+  std::vector<int> seen(kSVKeys, 0);
+  std::string value;
+  r->reads = 0;
+  while (r->state->stop.Acquire_Load() == NULL && r->status.ok()) {
+    for (int i = 0; i < kSVKeys && r->status.ok(); i++) {
+      uintptr_t limit = reinterpret_cast<uintptr_t>(
+          r->state->round.Acquire_Load());
+      r->status = r->state->db->Get(ReadOptions(), Key(i), &value);
+      if (!r->status.ok()) break;
+      int round = atoi(value.c_str());
+      if (round < seen[i]) {
+        r->status = Status::Corruption(Key(i), "went back to an older value");
+      } else if (static_cast<uintptr_t>(round) < limit) {
+        r->status = Status::Corruption(Key(i), "missed a completed round");
+      }
+      seen[i] = round;
+      r->reads++;
+    }
+  }
+  r->done.Release_Store(r);
+}
+
+}  // namespace
+
+TEST(DBTest, SuperVersionReadsAcrossSwitches) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 64 << 10;
+  options.nvm_buffer_size = 128 << 10;
+  options.create_if_missing = true;
+  DestroyAndReopen(&options);
+
+  char buf[20];
+  for (int i = 0; i < kSVKeys; i++) {
+    snprintf(buf, sizeof(buf), "%d.", 0);
+    ASSERT_OK(Put(Key(i), std::string(buf) + std::string(500, 'x')));
+  }
+
+  SVState state;
+  state.db = db_;
+  state.round.Release_Store(0);
+  state.stop.Release_Store(NULL);
+  SVReader readers[kSVReaders];
+  for (int id = 0; id < kSVReaders; id++) {
+    readers[id].state = &state;
+    readers[id].done.Release_Store(NULL);
+    env_->StartThread(SVReaderBody, &readers[id]);
+  }
+
+  const int kRounds = 30;
+  for (uintptr_t r = 1; r <= kRounds; r++) {
+    for (int i = 0; i < kSVKeys; i++) {
+      snprintf(buf, sizeof(buf), "%d.", static_cast<int>(r));
+      ASSERT_OK(Put(Key(i), std::string(buf) + std::string(500, 'x')));
+    }
+    state.round.Release_Store(reinterpret_cast<void*>(r));
+    if (r % 10 == 0) {
+      db_->CompactRange(NULL, NULL);
+    }
+  }
+  state.stop.Release_Store(&state);
+  for (int id = 0; id < kSVReaders; id++) {
+    while (readers[id].done.Acquire_Load() == NULL) {
+      DelayMilliseconds(10);
+    }
+    ASSERT_OK(readers[id].status);
+    ASSERT_GT(readers[id].reads, 0);
+  }
+
+  // Reader threads have exited; this thread's own slot is reclaimed
+  // when the DB is closed
+  snprintf(buf, sizeof(buf), "%d.", kRounds);
+  ASSERT_EQ(std::string(buf) + std::string(500, 'x'), Get(Key(0)));
+  Reopen(&options);
+  ASSERT_EQ(std::string(buf) + std::string(500, 'x'), Get(Key(kSVKeys - 1)));
+}
+
+TEST(DBTest, GetPinned) {
+  do {
+    ReadOptions ropts;
+    PinnedSlice value;
+    ASSERT_OK(Put("foo", "v1"));
+    ASSERT_OK(db_->Get(ropts, "foo", &value));
+    ASSERT_TRUE(value.pinned());
+    ASSERT_EQ("v1", value.ToString());
+
+    // The pinned memtable value survives an overwrite and a flush
+    const Snapshot* snapshot = db_->GetSnapshot();
+    ASSERT_OK(Put("foo", "v2"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_EQ("v1", value.ToString());
+    value.Release();
+    ASSERT_TRUE(!value.pinned());
+    ASSERT_EQ(0, value.size());
+
+    // Values found in a table pin its block
+    ASSERT_OK(db_->Get(ropts, "foo", &value));
+    ASSERT_TRUE(value.pinned());
+    ASSERT_EQ("v2", value.ToString());
+    ropts.snapshot = snapshot;
+    ASSERT_OK(db_->Get(ropts, "foo", &value));
+    ASSERT_EQ("v1", value.ToString());
+    db_->ReleaseSnapshot(snapshot);
+    ropts.snapshot = NULL;
+
+    ASSERT_OK(Delete("foo"));
+    ASSERT_TRUE(db_->Get(ropts, "foo", &value).IsNotFound());
+    ASSERT_TRUE(!value.pinned());
+    ASSERT_TRUE(db_->Get(ropts, "missing", &value).IsNotFound());
+  } while (ChangeOptions());
+}
+
+// Read pool: with num_read_threads the memtables are searched by a pool
+// worker while the caller searches the tables.  Concurrent readers must
+// get the memtable entry when there is one and the table entry otherwise.
+namespace {
+
+static const int kRPReaders = 3;
+static const int kRPKeys = 300;
+
+struct RPReader {
+  DB* db;
+  port::AtomicPointer done;
+  Status status;
+};
+
+// Keys below 100 were overwritten in the memtable, 100..149 deleted there
+static std::string RPExpected(int i) {
+  char buf[20];
+  if (i < 100) {
+    snprintf(buf, sizeof(buf), "m%d", i);
+  } else if (i < 150) {
+    return "NOT_FOUND";
+  } else {
+    snprintf(buf, sizeof(buf), "t%d", i);
+  }
+  return buf;
+}
+
+static void RPReaderBody(void* arg) {
+  RPReader* r = reinterpret_cast<RPReader*>(arg);
+  std::string value;
+  for (int pass = 0; pass < 5 && r->status.ok(); pass++) {
+    for (int i = 0; i < kRPKeys; i++) {
+      Status s = r->db->Get(ReadOptions(), Key(i), &value);
+      std::string got = s.ok() ? value :
+          (s.IsNotFound() ? "NOT_FOUND" : s.ToString());
+      if (got != RPExpected(i)) {
+        r->status = Status::Corruption(Key(i), got);
+        break;
+      }
+    }
+  }
+  std::vector<std::string> key_strs;
+  for (int i = 0; i < kRPKeys; i++) key_strs.push_back(Key(i));
+  std::vector<Slice> keys(key_strs.begin(), key_strs.end());
+  std::vector<std::string> values;
+  std::vector<Status> statuses;
+  r->db->MultiGet(ReadOptions(), keys, &values, &statuses);
+  for (int i = 0; i < kRPKeys && r->status.ok(); i++) {
+    std::string got = statuses[i].ok() ? values[i] :
+        (statuses[i].IsNotFound() ? "NOT_FOUND" : statuses[i].ToString());
+    if (got != RPExpected(i)) r->status = Status::Corruption(Key(i), got);
+  }
+  r->done.Release_Store(r);
+}
+
+}  // namespace
+
+TEST(DBTest, ReadPoolGets) {
+  for (int predict = 0; predict < 2; predict++) {
+    Options options = CurrentOptions();
+    options.num_read_threads = 2;
+    options.nvm_hit_prediction = (predict == 1);
+    options.create_if_missing = true;
+    DestroyAndReopen(&options);
+
+    char buf[20];
+    for (int i = 0; i < kRPKeys; i++) {
+      snprintf(buf, sizeof(buf), "t%d", i);
+      ASSERT_OK(Put(Key(i), buf));
+    }
+    dbfull()->TEST_CompactMemTable();
+    for (int i = 0; i < 100; i++) {
+      snprintf(buf, sizeof(buf), "m%d", i);
+      ASSERT_OK(Put(Key(i), buf));
+    }
+    for (int i = 100; i < 150; i++) {
+      ASSERT_OK(Delete(Key(i)));
+    }
+
+    RPReader readers[kRPReaders];
+    for (int id = 0; id < kRPReaders; id++) {
+      readers[id].db = db_;
+      readers[id].done.Release_Store(NULL);
+      env_->StartThread(RPReaderBody, &readers[id]);
+    }
+    for (int id = 0; id < kRPReaders; id++) {
+      while (readers[id].done.Acquire_Load() == NULL) {
+        env_->SleepForMicroseconds(1000);
+      }
+      ASSERT_OK(readers[id].status);
+    }
+
+    // The pool is rebuilt on reopen
+    Reopen(&options);
+    for (int i = 0; i < kRPKeys; i++) {
+      ASSERT_EQ(RPExpected(i), Get(Key(i)));
+    }
+  }
+}
+
 namespace {
 typedef std::map<std::string, std::string> KVMap;
 }
@@ -1872,6 +3211,7 @@ class ModelDB: public DB {
   virtual Status Delete(const WriteOptions& o, const Slice& key) {
     return DB::Delete(o, key);
   }
+  using DB::Get;
   virtual Status Get(const ReadOptions& options,
                      const Slice& key, std::string* value) {
     assert(false);      // Not implemented
@@ -2093,12 +3433,13 @@ std::string MakeKey(unsigned int num) {
 
 void BM_LogAndApply(int iters, int num_base_files) {
   std::string dbname = test::TmpDir() + "/novelsm_test_benchmark";
-  DestroyDB(dbname, Options());
+  std::string dbname_mem = dbname + "_mem";
+  DestroyDB(dbname, dbname_mem, Options());
 
   DB* db = NULL;
   Options opts;
   opts.create_if_missing = true;
-  Status s = DB::Open(opts, dbname, &db);
+  Status s = DB::Open(opts, dbname, dbname_mem, &db);
   ASSERT_OK(s);
   ASSERT_TRUE(db != NULL);
 
@@ -60,6 +60,14 @@ std::string LockFileName(const std::string& dbname) {
   return dbname + "/LOCK";
 }
 
+std::string NvmBlockCacheFileName(const std::string& dbname) {
+  return dbname + "/BLOCKCACHE";
+}
+
+std::string IdentityFileName(const std::string& dbname) {
+  return dbname + "/IDENTITY";
+}
+
 std::string TempFileName(const std::string& dbname, uint64_t number) {
   assert(number > 0);
   return MakeFileName(dbname, number, "dbtmp");
@@ -78,6 +86,8 @@ std::string OldInfoLogFileName(const std::string& dbname) {
 // Owned filenames have the form:
 //    dbname/CURRENT
 //    dbname/LOCK
+//    dbname/BLOCKCACHE
+//    dbname/IDENTITY
 //    dbname/LOG
 //    dbname/LOG.old
 //    dbname/MANIFEST-[0-9]+
@@ -92,6 +102,12 @@ bool ParseFileName(const std::string& fname,
   } else if (rest == "LOCK") {
     *number = 0;
     *type = kDBLockFile;
+  } else if (rest == "BLOCKCACHE") {
+    *number = 0;
+    *type = kNvmBlockCacheFile;
+  } else if (rest == "IDENTITY") {
+    *number = 0;
+    *type = kIdentityFile;
   } else if (rest == "LOG" || rest == "LOG.old") {
     *number = 0;
     *type = kInfoLogFile;
@@ -148,4 +164,11 @@ Status SetCurrentFile(Env* env, const std::string& dbname,
   return s;
 }
 
+Status SetIdentityFile(Env* env, const std::string& dbname, uint64_t id) {
+  // A torn write leaves a file that does not parse, and a new identity
+  // is made on the next open
+  return WriteStringToFileSync(env, NumberToString(id) + "\n",
+                               IdentityFileName(dbname));
+}
+
 }  // namespace novelsm
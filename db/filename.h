@@ -25,7 +25,9 @@ enum FileType {
   kCurrentFile,
   kTempFile,
   kInfoLogFile,  // Either the current one, or an old one
-  kMapFile
+  kMapFile,
+  kNvmBlockCacheFile,
+  kIdentityFile
 };
 
 // Return the name of the log file with the specified number
@@ -69,6 +71,13 @@ extern std::string LockFileName(const std::string& dbname);
 // The result will be prefixed with "dbname".
 extern std::string TempFileName(const std::string& dbname, uint64_t number);
 
+// NoveLSM: Return the name of the NVM block cache file for "dbname".
+extern std::string NvmBlockCacheFileName(const std::string& dbname);
+
+// NoveLSM: Return the name of the file holding the identity of the db
+// named "dbname", which tells it from earlier dbs of the same name.
+extern std::string IdentityFileName(const std::string& dbname);
+
 // Return the name of the info log file for "dbname".
 extern std::string InfoLogFileName(const std::string& dbname);
 
@@ -87,6 +96,10 @@ extern bool ParseFileName(const std::string& filename,
 extern Status SetCurrentFile(Env* env, const std::string& dbname,
                              uint64_t descriptor_number);
 
+// NoveLSM: Record "id" as the identity of the db named "dbname".
+extern Status SetIdentityFile(Env* env, const std::string& dbname,
+                              uint64_t id);
+
 
 }  // namespace novelsm
 
@@ -30,6 +30,8 @@ TEST(FileNameTest, Parse) {
     { "0.ldb",              0,     kTableFile },
     { "CURRENT",            0,     kCurrentFile },
     { "LOCK",               0,     kDBLockFile },
+    { "BLOCKCACHE",         0,     kNvmBlockCacheFile },
+    { "IDENTITY",           0,     kIdentityFile },
     { "MANIFEST-2",         2,     kDescriptorFile },
     { "MANIFEST-7",         7,     kDescriptorFile },
     { "LOG",                0,     kInfoLogFile },
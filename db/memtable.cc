@@ -8,12 +8,12 @@
 #include "novelsm/env.h"
 #include "novelsm/iterator.h"
 #include "util/coding.h"
+#include "util/hash.h"
 #include "db/skiplist.h"
 #include "port/cache_flush.h"
 #include <cstdio>
 #include <gnuwrapper.h>
 #include <string>
-#include <unordered_set>
 
 
 namespace novelsm {
@@ -25,21 +25,12 @@ static Slice GetLengthPrefixedSlice(const char* data) {
     return Slice(p, len);
 }
 
-void MemTable::AddPredictIndex
-                (std::unordered_set<std::string> *set,
-                        const uint8_t* data) {
-    this->bloom_.add(data, strlen((const char*)data));
+void MemTable::AddPredictIndex(const Slice& key) {
+    bloom_.add((const uint8_t *)key.data(), key.size());
 }
 
-int MemTable::CheckPredictIndex
-            (std::unordered_set<std::string> *set,
-                    const uint8_t* data) {
-    return this->bloom_.possiblyContains(data,
-            (size_t)strlen((const char*)data));
-}
-
-//TODO: Implement prediction clear
-void MemTable::ClearPredictIndex(std::unordered_set<std::string> *set) {
+bool MemTable::CheckPredictIndex(const Slice& key) {
+    return bloom_.possiblyContains((const uint8_t *)key.data(), key.size());
 }
 
 void* MemTable::operator new(std::size_t sz) {
@@ -54,22 +45,37 @@ void MemTable::operator delete(void* ptr)
     free(ptr);
 }
 
-MemTable::MemTable(const InternalKeyComparator& cmp)
+MemTable::MemTable(const InternalKeyComparator& cmp, size_t buffer_size)
 : comparator_(cmp),
   refs_(0),
   logfile_number(0),
+  isNVMMemtable(false),
   numkeys_(0),
-  bloom_(BLOOMSIZE, BLOOMHASH),
+  staged_seq_(0),
+  inplace_updates_(false),
+  update_seq_(0),
+  predict_(false),
+  hash_used_(0),
+  hash_complete_(true),
+  bloom_(BloomFilter::KeysForBuffer(buffer_size)),
   table_(comparator_, &arena_) {
 }
 
-MemTable::MemTable(const InternalKeyComparator& cmp, ArenaNVM& arena, bool recovery)
+MemTable::MemTable(const InternalKeyComparator& cmp, ArenaNVM& arena, bool recovery,
+        size_t buffer_size)
 : comparator_(cmp),
   refs_(0),
   logfile_number(0),
   arena_(arena),
+  isNVMMemtable(arena.nvmarena_),
   numkeys_(0),
-  bloom_(BLOOMSIZE, BLOOMHASH),
+  staged_seq_(0),
+  inplace_updates_(false),
+  update_seq_(0),
+  predict_(false),
+  hash_used_(0),
+  hash_complete_(true),
+  bloom_(BloomFilter::KeysForBuffer(buffer_size)),
   table_(comparator_, &arena_, recovery){
     arena_.nvmarena_ = arena.nvmarena_;
 }
@@ -177,9 +183,9 @@ void* MemTable::GeTableoffset(){
     return table_.head_offset_;
 }
 
-void MemTable::Add(SequenceNumber s, ValueType type,
+char* MemTable::EncodeEntry(SequenceNumber s, ValueType type,
         const Slice& key,
-        const Slice& value) {
+        const Slice& value, bool concurrent) {
     // Format of an entry is concatenation of:
     //  key_size     : varint32 of internal_key.size()
     //  key bytes    : char[internal_key.size()]
@@ -195,50 +201,65 @@ void MemTable::Add(SequenceNumber s, ValueType type,
 
     if(arena_.nvmarena_) {
         ArenaNVM *nvm_arena = (ArenaNVM *)&arena_;
-        buf = nvm_arena->Allocate(encoded_len);
+        if (concurrent)
+            buf = nvm_arena->AllocateConcurrent(encoded_len, 1);
+        else
+            buf = nvm_arena->Allocate(encoded_len);
     }else {
         buf = arena_.Allocate(encoded_len);
     }
     if(!buf){
+        //NoveLSM: Concurrent inserts report a full arena to the writer
+        if (concurrent)
+            return NULL;
         perror("Memory allocation failed");
         exit(-1);
     }
 
     char* p = EncodeVarint32(buf, internal_key_size);
 
-    //TODO: Disabling the STM transaction library in this beta
-    //Some performance issues if cores are not rightly pinned
-    //to NUMA nodes. Simply adding the memory copy persist
-    //Will be re-enabled in next version soon.
-    if (this->isNVMMemtable == true) {
-        memcpy_persist(p, key.data(), key_size);
-    }else{
-        memcpy(p, key.data(), key_size);
-    }
+    memcpy(p, key.data(), key_size);
 
-#ifdef _ENABLE_PREDICTION
-    char *keystr = (char*)key.data();
-    keystr[key_size]=0;
-    AddPredictIndex(&predict_set, (const char *)keystr);
-#endif
+    if (predict_) {
+        if (concurrent)
+            bloom_.addConcurrently((const uint8_t *)key.data(), key.size());
+        else
+            AddPredictIndex(key);
+    }
 
     p += key_size;
     EncodeFixed64(p, (s << 8) | type);
     p += 8;
     p = EncodeVarint32(p, val_size);
 
+    memcpy(p, value.data(), val_size);
+    assert((p + val_size) - buf == encoded_len);
+
+    //TODO: Disabling the STM transaction library in this beta
+    //Some performance issues if cores are not rightly pinned
+    //to NUMA nodes. Simply writing back the entry.
+    //NoveLSM: The whole encoded entry (lengths and tag included) is
+    //flushed without a fence; SkipList::Insert issues the single
+    //fence that orders it before the node is linked.
     if (this->isNVMMemtable == true) {
-          memcpy_persist(p, value.data(), val_size);
-    }else{
-          memcpy(p, value.data(), val_size);
+        flush_range(buf, encoded_len);
     }
-    assert((p + val_size) - buf == encoded_len);
+
+    return buf;
+}
+
+void MemTable::Add(SequenceNumber s, ValueType type,
+        const Slice& key,
+        const Slice& value) {
+    char* buf = EncodeEntry(s, type, key, value);
 
 #ifdef ENABLE_RECOVERY
     table_.Insert(buf, s);
 #else
     table_.Insert(buf);
 #endif
+    if (arena_.hash_index_ != NULL)
+        IndexEntry(buf);
 
     //NoveLSM: We keep track of the number of keys inserted
     //into each memtable
@@ -246,13 +267,219 @@ void MemTable::Add(SequenceNumber s, ValueType type,
     this->IncrKeys();
 }
 
+//NoveLSM: Overwrite the value of the newest entry for key if it is a
+//value of the same size. Only tried before anything of the current
+//batch is staged, as a staged entry for the same key would be newer.
+bool MemTable::UpdateInPlace(SequenceNumber s, const Slice& key,
+        const Slice& value) {
+    LookupKey lkey(key, kMaxSequenceNumber);
+    Table::Iterator iter(&table_);
+    iter.Seek(lkey.memtable_key().data());
+    if (!iter.Valid())
+        return false;
+#if defined(USE_OFFSETS)
+    const char* entry = reinterpret_cast<const char *>((intptr_t)iter.node_ - (intptr_t)iter.key_offset());
+#else
+    const char* entry = iter.key();
+#endif
+    uint32_t key_length;
+    const char* key_ptr = GetVarint32Ptr(entry, entry+5, &key_length);
+    if (comparator_.comparator.user_comparator()->Compare(
+            Slice(key_ptr, key_length - 8), key) != 0)
+        return false;
+    const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
+    if (static_cast<ValueType>(tag & 0xff) != kTypeValue)
+        return false;
+    Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
+    if (v.size() != value.size())
+        return false;
+
+    ArenaNVM *nvm_arena = (ArenaNVM *)&arena_;
+    bool done;
+    __atomic_add_fetch(&update_seq_, 1, __ATOMIC_ACQ_REL);
+    done = nvm_arena->UpdateInPlace(const_cast<char*>(v.data()),
+            value.data(), value.size());
+    __atomic_add_fetch(&update_seq_, 1, __ATOMIC_RELEASE);
+    if (done)
+        table_.PersistSequence(s);
+    return done;
+}
+
+void MemTable::StageAdd(SequenceNumber s, ValueType type,
+        const Slice& key,
+        const Slice& value) {
+    if (inplace_updates_ && type == kTypeValue && staged_.empty() &&
+            UpdateInPlace(s, key, value))
+        return;
+    staged_.push_back(EncodeEntry(s, type, key, value));
+    staged_seq_ = s;
+}
+
+bool MemTable::AddConcurrently(SequenceNumber s, ValueType type,
+        const Slice& key,
+        const Slice& value) {
+    assert(arena_.nvmarena_);
+    char* buf = EncodeEntry(s, type, key, value, true);
+    if (buf == NULL || !table_.InsertConcurrently(buf))
+        return false;
+    if (arena_.hash_index_ != NULL)
+        IndexEntry(buf);
+    __atomic_fetch_add(&numkeys_, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+bool MemTable::ReserveConcurrentInserts(size_t bytes) {
+    return ((ArenaNVM *)&arena_)->ReserveConcurrent(bytes);
+}
+
+size_t MemTable::ConcurrentInsertRoom() const {
+    return ((const ArenaNVM *)&arena_)->AllocRemConcurrent();
+}
+
+void MemTable::PersistSequence(SequenceNumber s) {
+    table_.PersistSequence(s);
+}
+
+void MemTable::FinishConcurrentInserts() {
+    ((ArenaNVM *)&arena_)->SyncConcurrent();
+}
+
+void MemTable::CommitBatch() {
+    if (staged_.empty())
+        return;
+    table_.InsertBatch(&staged_[0], staged_.size(), staged_seq_);
+    numkeys_ += staged_.size();
+    if (arena_.hash_index_ != NULL) {
+        for (size_t i = 0; i < staged_.size(); i++)
+            IndexEntry(staged_[i]);
+    }
+    staged_.clear();
+}
 
-bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
+
+//NoveLSM: Buckets are probed linearly from the user key's hash. A
+//bucket moves only from empty to an entry and then to newer entries of
+//the same user key, so readers need no lock.
+void MemTable::IndexEntry(const char* entry) {
+    uint64_t* buckets = arena_.hash_index_;
+    const size_t mask = arena_.hash_index_buckets_ - 1;
+    Slice ikey = GetLengthPrefixedSlice(entry);
+    Slice ukey = ExtractUserKey(ikey);
+    const uint64_t seq = DecodeFixed64(ikey.data() + ikey.size() - 8) >> 8;
+    const uint64_t offset = entry - (const char *)arena_.map_start_;
+    const Comparator* ucmp = comparator_.comparator.user_comparator();
+
+    size_t i = Hash(ukey.data(), ukey.size(), 0) & mask;
+    for (size_t probes = 0; probes <= mask; probes++, i = (i + 1) & mask) {
+        uint64_t cur = __atomic_load_n(&buckets[i], __ATOMIC_ACQUIRE);
+        while (true) {
+            if (cur == 0) {
+                if (__atomic_load_n(&hash_used_, __ATOMIC_RELAXED) >= (mask + 1) / 4 * 3) {
+                    __atomic_store_n(&hash_complete_, false, __ATOMIC_RELEASE);
+                    return;
+                }
+                if (__atomic_compare_exchange_n(&buckets[i], &cur, offset, false,
+                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+                    __atomic_fetch_add(&hash_used_, 1, __ATOMIC_RELAXED);
+                    return;
+                }
+                continue;
+            }
+            Slice other = GetLengthPrefixedSlice((const char *)arena_.map_start_ + cur);
+            if (ucmp->Compare(ExtractUserKey(other), ukey) != 0)
+                break;
+            if ((DecodeFixed64(other.data() + other.size() - 8) >> 8) >= seq)
+                return;
+            if (__atomic_compare_exchange_n(&buckets[i], &cur, offset, false,
+                    __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+                return;
+        }
+    }
+    __atomic_store_n(&hash_complete_, false, __ATOMIC_RELEASE);
+}
+
+//Newest entry for user_key, or NULL if it is not indexed
+const char* MemTable::LookupHashIndex(const Slice& user_key) {
+    uint64_t* buckets = arena_.hash_index_;
+    const size_t mask = arena_.hash_index_buckets_ - 1;
+    const Comparator* ucmp = comparator_.comparator.user_comparator();
+
+    size_t i = Hash(user_key.data(), user_key.size(), 0) & mask;
+    for (size_t probes = 0; probes <= mask; probes++, i = (i + 1) & mask) {
+        uint64_t cur = __atomic_load_n(&buckets[i], __ATOMIC_ACQUIRE);
+        if (cur == 0)
+            return NULL;
+        const char* entry = (const char *)arena_.map_start_ + cur;
+        if (ucmp->Compare(ExtractUserKey(GetLengthPrefixedSlice(entry)), user_key) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+void MemTable::RebuildHashIndex() {
+    if (arena_.hash_index_ == NULL)
+        return;
+    memset(arena_.hash_index_, 0, arena_.hash_index_buckets_ * sizeof(uint64_t));
+    hash_used_ = 0;
+    hash_complete_ = true;
+    Table::Iterator iter(&table_);
+    for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+#if defined(USE_OFFSETS)
+        IndexEntry(reinterpret_cast<const char *>((intptr_t)iter.node_ - (intptr_t)iter.key_offset()));
+#else
+        IndexEntry(iter.key());
+#endif
+    }
+}
+
+void MemTable::GetSplitKeys(int n, std::vector<std::string>* user_keys) {
+    user_keys->clear();
+    std::vector<const char*> samples;
+    table_.SampleKeys(n - 1, &samples);
+    for (size_t i = 0; i < samples.size(); i++) {
+        Slice user_key = ExtractUserKey(GetLengthPrefixedSlice(samples[i]));
+        if (user_keys->empty() ||
+                comparator_.comparator.user_comparator()->Compare(
+                        user_key, user_keys->back()) > 0) {
+            user_keys->push_back(user_key.ToString());
+        }
+    }
+}
+
+//NoveLSM: Entry Get() answers from, i.e. the newest entry of the user
+//key visible at the lookup sequence, or NULL if there is none
+const char* MemTable::FindEntry(const LookupKey& key, Table::FingerSearch* finger) {
 
     Slice memkey = key.memtable_key();
+    const char* entry = NULL;
+    //NoveLSM: The hash index only knows the newest entry of a key, so
+    //it answers reads that this entry is visible to
+    if (arena_.hash_index_ != NULL) {
+        entry = LookupHashIndex(key.user_key());
+        if (entry != NULL) {
+            Slice ikey = GetLengthPrefixedSlice(entry);
+            Slice lookup = key.internal_key();
+            if ((DecodeFixed64(ikey.data() + ikey.size() - 8) >> 8) >
+                    (DecodeFixed64(lookup.data() + lookup.size() - 8) >> 8))
+                entry = NULL;
+        } else if (__atomic_load_n(&hash_complete_, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+    }
     Table::Iterator iter(&table_);
-    iter.Seek(memkey.data());
-    if (iter.Valid()) {
+    if (entry == NULL && finger != NULL) {
+        finger->Seek(memkey.data(), &entry);
+    } else if (entry == NULL) {
+        iter.Seek(memkey.data());
+        if (iter.Valid()) {
+#if defined(USE_OFFSETS)
+            entry = reinterpret_cast<const char *>((intptr_t)iter.node_ - (intptr_t)iter.key_offset());
+#else
+            entry = iter.key();
+#endif
+        }
+    }
+    if (entry != NULL) {
         // entry format is:
         //    klength  varint32
         //    userkey  char[klength]
@@ -262,30 +489,71 @@ bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
         // Check that it belongs to same user key.  We do not check the
         // sequence number since the Seek() call above should have skipped
         // all entries with overly large sequence numbers.
-#if defined(USE_OFFSETS)
-        const char* entry = reinterpret_cast<const char *>((intptr_t)iter.node_ - (intptr_t)iter.key_offset());
-#else
-        const char* entry = iter.key();
-#endif
         uint32_t key_length;
         const char* key_ptr = GetVarint32Ptr(entry, entry+5, &key_length);
         if (comparator_.comparator.user_comparator()->Compare(
                 Slice(key_ptr, key_length - 8),
                 key.user_key()) == 0) {
-            // Correct user key
-            const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
-            switch (static_cast<ValueType>(tag & 0xff)) {
-            case kTypeValue: {
-                Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
-                value->assign(v.data(), v.size());
-                return true;
-            }
-            case kTypeDeletion:
-                *s = Status::NotFound(Slice());
-                return true;
-            }
+            return entry;
         }
     }
+    return NULL;
+}
+
+bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
+    return ReadEntry(FindEntry(key), value, s);
+}
+
+void MemTable::MultiGet(int n, const LookupKey* const* keys,
+        std::string* const* values, Status* const* s, bool* found) {
+    Table::FingerSearch finger(&table_);
+    for (int i = 0; i < n; i++) {
+        found[i] = ReadEntry(FindEntry(*keys[i], &finger), values[i], s[i]);
+    }
+}
+
+bool MemTable::ReadEntry(const char* entry, std::string* value, Status* s) {
+
+    if (entry == NULL)
+        return false;
+    uint32_t key_length;
+    const char* key_ptr = GetVarint32Ptr(entry, entry+5, &key_length);
+    const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
+    switch (static_cast<ValueType>(tag & 0xff)) {
+    case kTypeValue: {
+        Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
+        uint64_t seq;
+        do {
+            while ((seq = __atomic_load_n(&update_seq_, __ATOMIC_ACQUIRE)) & 1)
+                ;
+            value->assign(v.data(), v.size());
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while (__atomic_load_n(&update_seq_, __ATOMIC_RELAXED) != seq);
+        return true;
+    }
+    case kTypeDeletion:
+        *s = Status::NotFound(Slice());
+        return true;
+    }
+    return false;
+}
+
+bool MemTable::Get(const LookupKey& key, Slice* value, Status* s) {
+
+    const char* entry = FindEntry(key);
+    if (entry == NULL)
+        return false;
+    uint32_t key_length;
+    const char* key_ptr = GetVarint32Ptr(entry, entry+5, &key_length);
+    const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
+    switch (static_cast<ValueType>(tag & 0xff)) {
+    case kTypeValue:
+        *value = GetLengthPrefixedSlice(key_ptr + key_length);
+        return true;
+    case kTypeDeletion:
+        *s = Status::NotFound(Slice());
+        return true;
+    }
     return false;
 }
 
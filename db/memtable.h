@@ -13,7 +13,7 @@
 #include "util/BloomFilter.h"
 
 #include <string>
-#include <unordered_set>
+#include <vector>
 
 namespace novelsm {
 
@@ -31,8 +31,10 @@ public:
 
 	// MemTables are reference counted.  The initial reference count
 	// is zero and the caller must call Ref() at least once.
-	explicit MemTable(const InternalKeyComparator& comparator);
-	explicit MemTable(const InternalKeyComparator& cmp, ArenaNVM&  arena, bool recovery);
+	// buffer_size sizes the prediction filter (0: a small default).
+	explicit MemTable(const InternalKeyComparator& comparator, size_t buffer_size = 0);
+	explicit MemTable(const InternalKeyComparator& cmp, ArenaNVM&  arena, bool recovery,
+			size_t buffer_size = 0);
 
 	// Increase reference count.
 	void Ref() {
@@ -81,6 +83,51 @@ public:
 			const Slice& key,
 			const Slice& value);
 
+	//NoveLSM: Group commit for NVM memtables. StageAdd() writes the
+	//entry to the arena and writes it back without a fence; the staged
+	//entries become visible, durable and counted on CommitBatch(), which
+	//issues one fence for the whole group.
+	void StageAdd(SequenceNumber seq, ValueType type,
+			const Slice& key,
+			const Slice& value);
+	void CommitBatch();
+
+	//NoveLSM: Concurrent inserts into an NVM memtable (see
+	//Options::concurrent_nvm_writes). Several threads may call
+	//AddConcurrently() at once; the caller assigns the sequence numbers,
+	//persists the largest one with PersistSequence() beforehand and calls
+	//FinishConcurrentInserts() once all of them have returned.
+	//Before anything is added, ReserveConcurrentInserts() sets aside an
+	//upper bound of the group's bytes (false if the arena has less than
+	//that left); AddConcurrently() returns false, adding nothing, once
+	//the reservation is used up. ConcurrentInsertRoom() tells how much
+	//the arena has left.
+	bool AddConcurrently(SequenceNumber seq, ValueType type,
+			const Slice& key,
+			const Slice& value);
+	bool ReserveConcurrentInserts(size_t bytes);
+	size_t ConcurrentInsertRoom() const;
+	void PersistSequence(SequenceNumber s);
+	void FinishConcurrentInserts();
+
+	//NoveLSM: In-place updates (see Options::nvm_inplace_updates). While
+	//enabled, a StageAdd() of a value whose size matches the newest entry
+	//for the same user key overwrites that entry's value bytes through
+	//the arena's redo slot instead of appending a node. The entry keeps
+	//its old sequence number, so the caller enables this only when no
+	//snapshot or iterator can still observe the old value.
+	void SetInPlaceUpdates(bool enable) { inplace_updates_ = enable; }
+
+	//NoveLSM: Optional hash index of user key to newest entry in the NVM
+	//mapping (see Options::nvm_hash_index), used by Get() for reads at
+	//the latest sequence. A recovered memtable must call this before use.
+	void RebuildHashIndex();
+
+	//NoveLSM: Store in *user_keys up to n-1 distinct user keys, in
+	//increasing order, that split the memtable into n key ranges of
+	//about the same number of entries.
+	void GetSplitKeys(int n, std::vector<std::string>* user_keys);
+
 	//NoveLSM:TODO: To purge
 	//void AddSpecial(const Slice& key, const Slice& value, char *keybuf);
 
@@ -90,6 +137,18 @@ public:
 	// Else, return false.
 	bool Get(const LookupKey& key, std::string* value, Status* s);
 
+	//NoveLSM: Same as above, but *value points at the value bytes in the
+	//arena or NVM mapping. The caller keeps a reference on the memtable
+	//and suspends in-place updates while it uses *value.
+	bool Get(const LookupKey& key, Slice* value, Status* s);
+
+	//NoveLSM: Get() for keys[0..n-1], which must be sorted by user key
+	//and share one sequence number. Sets found[i] to what Get() would
+	//return, filling *values[i] and *s[i] likewise. The skiplist search
+	//for each key resumes where the previous one ended.
+	void MultiGet(int n, const LookupKey* const* keys,
+			std::string* const* values, Status* const* s, bool* found);
+
 	void SetMemTableHead(void *ptr);
 
 	void* GeTableoffset();
@@ -104,11 +163,13 @@ public:
 	//NoveLSM Swap/Alternate between nvm and DRAM arena
 	bool isNVMMemtable;
 
+       //NoveLSM: Prediction index of the user keys added while enabled
+       //(see Options::nvm_hit_prediction). It may report keys that were
+       //never added but never misses one that was.
        BloomFilter bloom_;
-       std::unordered_set<std::string> predict_set;
-       void AddPredictIndex(std::unordered_set<std::string> *set, const uint8_t*);
-       int  CheckPredictIndex(std::unordered_set<std::string> *set, const uint8_t*);
-       void ClearPredictIndex(std::unordered_set<std::string> *set);
+       void SetPrediction(bool enable) { predict_ = enable; }
+       void AddPredictIndex(const Slice& key);
+       bool CheckPredictIndex(const Slice& key);
 
 private:
 	~MemTable();  // Private since only Unref() should be used to delete it
@@ -126,9 +187,37 @@ private:
 	KeyComparator comparator_;
 	int refs_;
 
+	// Encode an entry into the arena; for NVM it is also written back
+	char* EncodeEntry(SequenceNumber s, ValueType type,
+			const Slice& key, const Slice& value,
+			bool concurrent = false);
+
 	//NoveLSM: Num memtable enteries
 	unsigned int numkeys_;
 
+	//NoveLSM: Entries staged by StageAdd() and the last staged sequence
+	std::vector<const char*> staged_;
+	SequenceNumber staged_seq_;
+
+	//NoveLSM: In-place updates. update_seq_ is odd while value bytes are
+	//being overwritten; Get() retries its copy if it changed meanwhile.
+	bool inplace_updates_;
+	uint64_t update_seq_;
+
+	// Add keys to bloom_ as they are inserted
+	bool predict_;
+	bool UpdateInPlace(SequenceNumber s, const Slice& key, const Slice& value);
+
+	//NoveLSM: Hash index. Entries stop being indexed once hash_used_
+	//reaches 3/4 of the buckets; hash_complete_ is then cleared and
+	//misses fall back to the skiplist.
+	size_t hash_used_;
+	bool hash_complete_;
+	void IndexEntry(const char* entry);
+	const char* LookupHashIndex(const Slice& user_key);
+	const char* FindEntry(const LookupKey& key, Table::FingerSearch* finger = NULL);
+	bool ReadEntry(const char* entry, std::string* value, Status* s);
+
 	//NoveLSM: Making them public for easier debugging
 	//TODO: Revert back to private mode
 	//Arena arena_;
@@ -29,6 +29,8 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <vector>
 #include "port/port.h"
 #include "util/arena.h"
 #include "util/random.h"
@@ -59,9 +61,34 @@ public:
     void Insert(const Key& key);
 #endif
 
+    //NoveLSM: Insert n keys as one group. On an NVM arena all nodes are
+    //written back and ordered by a single fence, and the persisted header
+    //is advanced once to sequence s. Keys need not be sorted.
+    // REQUIRES: no two keys compare equal, nor to a key already in the list.
+    void InsertBatch(const Key* keys, size_t n, uint64_t s);
+
+    //NoveLSM: Lock-free insert for NVM arenas; may run concurrently with
+    //other InsertConcurrently() calls and with readers, but not with
+    //Insert()/InsertBatch(). Nodes are linked bottom-up with CAS and each
+    //node is persisted before it becomes reachable. The persisted
+    //sequence is not touched; see PersistSequence(). Returns false,
+    //inserting nothing, if the arena has no room left for the node.
+    // REQUIRES: nothing that compares equal to key is in the list.
+    bool InsertConcurrently(const Key& key);
+
+    //NoveLSM: Durably raise the persisted sequence to at least s. Called
+    //before a group of concurrent inserts whose sequences are <= s.
+    void PersistSequence(uint64_t s);
+
     // Returns true iff an entry that compares equal to key is in the list.
     bool Contains(const Key& key) const;
 
+    //NoveLSM: Store in *keys n keys spread over the list, in order. They
+    //are taken from the highest level with enough nodes, so the spacing
+    //is only about even, and fewer distinct keys come back from a short
+    //list.
+    void SampleKeys(int n, std::vector<Key>* keys) const;
+
     void SetHead(void *ptr);
 
     // Iteration over the contents of a skip list
@@ -79,6 +106,7 @@ public:
 
 #ifdef USE_OFFSETS
         const Key& key_offset() const;
+        Key key() const;
 #else
         const Key& key() const;
 #endif
@@ -110,8 +138,16 @@ public:
         // Intentionally copyable
     };
 
+    //NoveLSM: Searches for a non-decreasing sequence of targets, each
+    //search resuming from the predecessors found by the previous one
+    //instead of from the head. Defined below.
+    class FingerSearch;
+
 private:
     enum { kMaxHeight = 12 };
+    //NoveLSM: Map header ahead of the head node: alloc_rem, sequence,
+    //height and the arena's region layout
+    enum { kHeaderSize = ArenaNVM::kLayoutOffset + sizeof(ArenaNVM::Layout) };
 
     // Immutable after construction
     Comparator const compare_;
@@ -133,8 +169,10 @@ private:
     // Read/written only by Insert().
     Random rnd_;
 
-    Node* NewNode(const Key& key, int height, bool head_alloc);
+    Node* NewNode(const Key& key, int height, bool head_alloc,
+            bool concurrent = false);
     int RandomHeight();
+    int RandomHeightConcurrent();
     bool Equal(const Key& a, const Key& b) const { return (compare_(a, b) == 0); }
 
     // Return true if key is greater than the data stored in "n"
@@ -147,6 +185,30 @@ private:
     // node at "level" for every level in [0..max_height_-1].
     Node* FindGreaterOrEqual(const Key& key, Node** prev) const;
 
+    //NoveLSM: With offsets a node stores its distance from its key. The
+    //C-style casts also accept integral keys, as used by skiplist_test.
+    Key NodeKey(Node* n) const {
+#if defined(USE_OFFSETS)
+        return (Key)((intptr_t)n - (intptr_t)n->key_offset);
+#else
+        return n->key;
+#endif
+    }
+
+    // Orders indices into a batch of keys by key
+    struct BatchKeyLess {
+        const SkipList* list;
+        const Key* keys;
+        BatchKeyLess(const SkipList* l, const Key* k) : list(l), keys(k) { }
+        bool operator()(size_t a, size_t b) const {
+            return list->compare_(keys[a], keys[b]) < 0;
+        }
+    };
+
+    // Link x at levels [0..height-1] after prev[] and, for NVM arenas,
+    // write back each distinct predecessor link line once (no fence).
+    void LinkNode(Node* x, int height, Node** prev);
+
     // Return the latest node with a key < key.
     // Return head_ if there is no such node.
     Node* FindLessThan(const Key& key) const;
@@ -172,7 +234,7 @@ public:
 template<typename Key, class Comparator>
 struct SkipList<Key,Comparator>::Node {
 #ifdef USE_OFFSETS
-    explicit Node(const Key& k, const Key& mem) : key_offset(reinterpret_cast<const Key>(mem - k)) { }
+    explicit Node(const Key& k, const char* mem) : key_offset((Key)((intptr_t)mem - (intptr_t)k)) { }
 
     Key const key_offset;
 #else
@@ -224,6 +286,21 @@ struct SkipList<Key,Comparator>::Node {
 #endif
     }
 
+    bool CASNext(int n, Node* expected, Node* x) {
+        assert(n >= 0);
+#if defined(USE_OFFSETS)
+        void* e = (expected != NULL) ? reinterpret_cast<void*>((intptr_t)this - (intptr_t)expected) : NULL;
+        return next_[n].CompareAndSwap(e, reinterpret_cast<void*>((intptr_t)this - (intptr_t)x));
+#else
+        return next_[n].CompareAndSwap(expected, x);
+#endif
+    }
+
+    // Address of the level-n link, used to write back just that slot
+    const void* NextAddr(int n) const {
+        return &next_[n];
+    }
+
 private:
     // Array of length equal to the node height.  next_[0] is lowest level link.
     port::AtomicPointer next_[1];
@@ -231,14 +308,22 @@ private:
 
 template<typename Key, class Comparator>
 typename SkipList<Key,Comparator>::Node*
-SkipList<Key,Comparator>::NewNode(const Key& key, int height, bool head_alloc) {
+SkipList<Key,Comparator>::NewNode(const Key& key, int height, bool head_alloc,
+        bool concurrent) {
     char* mem;
     bool return_special = head_alloc && arena_->nvmarena_;
     if(arena_->nvmarena_) {
         ArenaNVM *nvm_arena = (ArenaNVM *)arena_;
-        if (head_alloc == true)
+        if (concurrent) {
+            mem = nvm_arena->AllocateConcurrent(
+                    sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1), 8);
+            if (mem == NULL) {
+                return NULL;
+            }
+        }
+        else if (head_alloc == true)
             mem = nvm_arena->AllocateAlignedNVM(
-                    sizeof(size_t) + sizeof (uint64_t) + sizeof(int) + sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1));
+                    kHeaderSize + sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1));
         else
             mem = nvm_arena->AllocateAlignedNVM(
                     sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1));
@@ -251,7 +336,7 @@ SkipList<Key,Comparator>::NewNode(const Key& key, int height, bool head_alloc) {
 #else
 #ifdef ENABLE_RECOVERY
     if (return_special) {
-        char *offset_mem = mem + sizeof(size_t) + sizeof (uint64_t) + sizeof(int);
+        char *offset_mem = mem + kHeaderSize;
         return new (offset_mem) Node(key, mem);
     } else {
         return new (mem) Node(key, mem);
@@ -262,6 +347,84 @@ SkipList<Key,Comparator>::NewNode(const Key& key, int height, bool head_alloc) {
 #endif
 }
 
+template<typename Key, class Comparator>
+class SkipList<Key,Comparator>::FingerSearch {
+public:
+    explicit FingerSearch(const SkipList* list) : list_(list) {
+        for (int i = 0; i < kMaxHeight; i++) {
+            finger_[i] = list->head_;
+        }
+    }
+
+    // Find the earliest key >= target and store it in *key. Returns
+    // false if there is none.
+    // REQUIRES: target >= the target of the previous Seek()
+    bool Seek(const Key& target, Key* key) {
+        Node* x = list_->head_;
+        int level = list_->GetMaxHeight() - 1;
+        while (true) {
+            // Both x and the finger precede target; resume from whichever
+            // is further along
+            Node* f = finger_[level];
+            if (f != x && f != list_->head_ &&
+                    (x == list_->head_ ||
+                     list_->compare_(list_->NodeKey(x), list_->NodeKey(f)) < 0)) {
+                x = f;
+            }
+            Node* next = x->Next(level);
+            if (list_->KeyIsAfterNode(target, next)) {
+                x = next;
+            } else {
+                finger_[level] = x;
+                if (level == 0) {
+                    if (next == NULL)
+                        return false;
+                    *key = list_->NodeKey(next);
+                    return true;
+                }
+                level--;
+            }
+        }
+    }
+
+private:
+    const SkipList* list_;
+    Node* finger_[kMaxHeight];
+};
+
+template<typename Key, class Comparator>
+void SkipList<Key,Comparator>::SampleKeys(int n, std::vector<Key>* keys) const {
+    keys->clear();
+    if (n <= 0) {
+        return;
+    }
+    // A level holds about a quarter of the nodes of the one below it, so
+    // the first level from the top with 512n nodes is walked in O(n).
+    // That many keep the ranges within a few percent of each other.
+    const size_t wanted = 512 * static_cast<size_t>(n);
+    int level = GetMaxHeight() - 1;
+    for (; level > 0; level--) {
+        size_t count = 0;
+        for (Node* x = head_->Next(level); x != NULL && count < wanted;
+                x = x->Next(level)) {
+            count++;
+        }
+        if (count >= wanted) {
+            break;
+        }
+    }
+    std::vector<Node*> nodes;
+    for (Node* x = head_->Next(level); x != NULL; x = x->Next(level)) {
+        nodes.push_back(x);
+    }
+    if (nodes.empty()) {
+        return;
+    }
+    for (int i = 1; i <= n; i++) {
+        keys->push_back(NodeKey(nodes[i * nodes.size() / (n + 1)]));
+    }
+}
+
 template<typename Key, class Comparator>
 inline SkipList<Key,Comparator>::Iterator::Iterator(const SkipList* list) {
     list_ = list;
@@ -288,6 +451,14 @@ inline const Key& SkipList<Key,Comparator>::Iterator::key_offset() const {
 #endif
     }
 
+#ifdef USE_OFFSETS
+    template<typename Key, class Comparator>
+    inline Key SkipList<Key,Comparator>::Iterator::key() const {
+        assert(Valid());
+        return list_->NodeKey(node_);
+    }
+#endif
+
     template<typename Key, class Comparator>
     inline void SkipList<Key,Comparator>::Iterator::Next() {
         assert(Valid());
@@ -300,7 +471,7 @@ inline const Key& SkipList<Key,Comparator>::Iterator::key_offset() const {
         // last node that falls before key.
         assert(Valid());
 #if defined(USE_OFFSETS)
-        node_ = list_->FindLessThan(reinterpret_cast<Key>((intptr_t)node_ - (intptr_t)node_->key_offset));
+        node_ = list_->FindLessThan(list_->NodeKey(node_));
 #else
         node_ = list_->FindLessThan(node_->key);
 #endif
@@ -345,11 +516,31 @@ inline void SkipList<Key,Comparator>::Iterator::SetHead(void *ptr) {
         return height;
     }
 
+    template<typename Key, class Comparator>
+    int SkipList<Key,Comparator>::RandomHeightConcurrent() {
+        // rnd_ belongs to the single writer; concurrent inserters each
+        // draw from their own generator.
+        static const unsigned int kBranching = 4;
+        static __thread uint32_t seed = 0;
+        if (seed == 0) {
+            seed = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&seed) >> 4) | 1;
+        }
+        Random rnd(seed);
+        int height = 1;
+        while (height < kMaxHeight && ((rnd.Next() % kBranching) == 0)) {
+            height++;
+        }
+        seed = rnd.Next();
+        assert(height > 0);
+        assert(height <= kMaxHeight);
+        return height;
+    }
+
     template<typename Key, class Comparator>
     bool SkipList<Key,Comparator>::KeyIsAfterNode(const Key& key, Node* n) const {
         // NULL n is considered infinite
 #if defined(USE_OFFSETS)
-        return (n != NULL) && (compare_(reinterpret_cast<Key>((intptr_t)n - (intptr_t)n->key_offset), key) < 0);
+        return (n != NULL) && (compare_(NodeKey(n), key) < 0);
 #else
         return (n != NULL) && (compare_(n->key, key) < 0);
 #endif
@@ -384,13 +575,13 @@ inline void SkipList<Key,Comparator>::Iterator::SetHead(void *ptr) {
         int level = GetMaxHeight() - 1;
         while (true) {
 #if defined(USE_OFFSETS)
-            assert(x == head_ || compare_(reinterpret_cast<Key>((intptr_t)x - (intptr_t)x->key_offset), key) < 0);
+            assert(x == head_ || compare_(NodeKey(x), key) < 0);
 #else
             assert(x == head_ || compare_(x->key, key) < 0);
 #endif
             Node* next = x->Next(level);
 #if defined(USE_OFFSETS)
-            if (next == NULL || compare_(reinterpret_cast<Key>((intptr_t)next - (intptr_t)next->key_offset), key) >= 0) {
+            if (next == NULL || compare_(NodeKey(next), key) >= 0) {
 #else
                 if (next == NULL || compare_(next->key, key) >= 0) {
 #endif
@@ -436,7 +627,7 @@ inline void SkipList<Key,Comparator>::Iterator::SetHead(void *ptr) {
 #ifdef ENABLE_RECOVERY
             if (recovery) {
                 ArenaNVM *arena_nvm = (ArenaNVM*) arena;
-                head_ = (Node*)((uint8_t*)arena_nvm->getMapStart() + sizeof(size_t) + sizeof(uint64_t) + sizeof(int));
+                head_ = (Node*)((uint8_t*)arena_nvm->getMapStart() + kHeaderSize);
                 alloc_rem = (size_t *)arena_nvm->getMapStart();
                 sequence = (uint64_t *)((uint8_t*)arena_nvm->getMapStart() + sizeof(size_t));
                 m_height = (int *)((uint8_t*)arena_nvm->getMapStart() + sizeof(size_t) + sizeof(uint64_t));
@@ -464,6 +655,8 @@ inline void SkipList<Key,Comparator>::Iterator::SetHead(void *ptr) {
                 m_height = (int *)((uint8_t*)arena_->getMapStart() + sizeof(size_t) + sizeof(uint64_t));
                 *m_height = GetMaxHeight();
 		flush_cache(m_height, CACHE_LINE_SIZE);
+
+                arena_nvm->InitLayout();
             }
 #endif
 
@@ -471,6 +664,24 @@ inline void SkipList<Key,Comparator>::Iterator::SetHead(void *ptr) {
             head_offset_ = (reinterpret_cast<void*>(arena_->CalculateOffset(static_cast<void*>(head_))));
             //head_offset_ = (size_t)(arena_->CalculateOffset(static_cast<void*>(head_)));
 
+            //NoveLSM: The slab table, in-place update slot and hash index
+            //follow the head in this order, each only if enabled
+            if (arena_->nvmarena_) {
+                ArenaNVM *arena_nvm = (ArenaNVM*) arena_;
+                char* where = reinterpret_cast<char*>(head_) + sizeof(Node) +
+                        sizeof(port::AtomicPointer) * (kMaxHeight - 1);
+                if (arena_->slab_size_ > 0 || recovery)
+                    arena_nvm->InitSlabs(where, recovery);
+                if (arena_->slab_table_ != NULL)
+                    where = reinterpret_cast<char*>(arena_->slab_table_) + ArenaNVM::SlabTableSize();
+                if (arena_->update_slot_size_ > 0 || recovery)
+                    arena_nvm->InitUpdateSlot(where, recovery);
+                if (arena_->update_slot_ != NULL)
+                    where = reinterpret_cast<char*>(arena_->update_slot_) + arena_->update_slot_size_;
+                if (arena_->hash_index_buckets_ > 0 || recovery)
+                    arena_nvm->InitHashIndex(where, recovery);
+            }
+
             if (!recovery) {
                 for (int i = 0; i < kMaxHeight; i++) {
                     head_->SetNext(i, NULL);
@@ -490,16 +701,9 @@ inline void SkipList<Key,Comparator>::Iterator::SetHead(void *ptr) {
                 Node* prev[kMaxHeight];
                 Node* x = FindGreaterOrEqual(key, prev);
 
-                // Update sequence number before updating data
-#ifdef ENABLE_RECOVERY
-                if (arena_->nvmarena_) {
-                    *sequence = s;
-                }
-#endif
-
                 // Our data structure does not allow duplicate insertion
 #if defined(USE_OFFSETS)
-                assert(x == NULL || !Equal(key, reinterpret_cast<Key>((intptr_t)x - (intptr_t)x->key_offset)));
+                assert(x == NULL || !Equal(key, NodeKey(x)));
 #else
                 assert(x == NULL || !Equal(key, x->key));
 #endif
@@ -526,19 +730,235 @@ inline void SkipList<Key,Comparator>::Iterator::SetHead(void *ptr) {
                     // NoBarrier_SetNext() suffices since we will add a barrier when
                     // we publish a pointer to "x" in prev[i].
                     x->NoBarrier_SetNext(i, prev[i]->NoBarrier_Next(i));
-                    prev[i]->SetNext(i, x);
-                    if (arena_->nvmarena_ == true) {
-                        flush_cache((void *)x, sizeof(Node));
-                        flush_cache((void *)prev[i], sizeof(Node));
-                    }
                 }
+
+                if (arena_->nvmarena_ == true) {
+                    //NoveLSM: The node (and the entry MemTable::Add flushed
+                    //before calling us) is written back and fenced before
+                    //it becomes reachable, so a crash never exposes a torn
+                    //node. The links and the header are fenced below,
+                    //before the write is acknowledged.
+                    flush_range(x, sizeof(Node) +
+                            sizeof(port::AtomicPointer) * (height - 1));
 #ifdef ENABLE_RECOVERY
-                if (arena_->nvmarena_) {
                     *alloc_rem = arena_->getAllocRem();
+                    flush_range(alloc_rem, sizeof(size_t) + sizeof(uint64_t) + sizeof(int));
+#endif
+                    persist_fence();
+                }
+
+                LinkNode(x, height, prev);
+                if (arena_->nvmarena_) {
+#ifdef ENABLE_RECOVERY
                     // Set max_height after insertion to ensure correctness.
                     // If NovelSM crashes before updating this, it would just
                     // lead to inefficient lookups (O(n) vs O(logn)).
+                    // The sequence number only covers reachable entries.
+                    *sequence = s;
                     *m_height = GetMaxHeight();
+                    flush_range(sequence, sizeof(uint64_t) + sizeof(int));
+#endif
+                    persist_fence();
+                }
+            }
+
+            template<typename Key, class Comparator>
+            void SkipList<Key,Comparator>::LinkNode(Node* x, int height, Node** prev) {
+                uintptr_t last_line = 0;
+                for (int i = 0; i < height; i++) {
+                    prev[i]->SetNext(i, x);
+                    if (arena_->nvmarena_ == true) {
+                        // Levels linked from the same predecessor usually
+                        // share a cache line; write each line back once.
+                        uintptr_t line = (uintptr_t)prev[i]->NextAddr(i) &
+                                ~((uintptr_t)CACHE_LINE_SIZE - 1);
+                        if (line != last_line) {
+                            flush_range(prev[i]->NextAddr(i), sizeof(port::AtomicPointer));
+                            last_line = line;
+                        }
+                    }
+                }
+            }
+
+            template<typename Key, class Comparator>
+            void SkipList<Key,Comparator>::InsertBatch(const Key* keys, size_t n, uint64_t s) {
+                if (!arena_->nvmarena_) {
+                    for (size_t k = 0; k < n; k++) {
+#ifdef ENABLE_RECOVERY
+                        Insert(keys[k], s);
+#else
+                        Insert(keys[k]);
+#endif
+                    }
+                    return;
+                }
+                if (n == 0)
+                    return;
+
+                //NoveLSM: Plan the whole group against the list as it is
+                //before any link changes, walking the keys from largest to
+                //smallest. A new node's successor at level i is then either
+                //the smallest already planned node of that height or the
+                //old successor, whichever comes first.
+                std::vector<size_t> order(n);
+                for (size_t k = 0; k < n; k++) {
+                    order[k] = k;
+                }
+                std::sort(order.begin(), order.end(), BatchKeyLess(this, keys));
+
+                std::vector<Node*> nodes(n);
+                std::vector<int> heights(n);
+                std::vector<Node*> prevs(n * kMaxHeight);
+                Node* pending[kMaxHeight] = { NULL };
+                int max_height = GetMaxHeight();
+                for (size_t j = n; j-- > 0; ) {
+                    size_t k = order[j];
+                    Node** prev = &prevs[k * kMaxHeight];
+                    FindGreaterOrEqual(keys[k], prev);
+                    int height = RandomHeight();
+                    for (int i = GetMaxHeight(); i < height; i++) {
+                        prev[i] = head_;
+                    }
+                    Node* x = NewNode(keys[k], height, false);
+                    for (int i = 0; i < height; i++) {
+                        Node* next = prev[i]->NoBarrier_Next(i);
+                        if (pending[i] != NULL && (next == NULL ||
+                                compare_(NodeKey(pending[i]), NodeKey(next)) < 0)) {
+                            next = pending[i];
+                        }
+                        x->NoBarrier_SetNext(i, next);
+                        pending[i] = x;
+                    }
+                    flush_range(x, sizeof(Node) +
+                            sizeof(port::AtomicPointer) * (height - 1));
+                    nodes[k] = x;
+                    heights[k] = height;
+                    if (height > max_height)
+                        max_height = height;
+                }
+#ifdef ENABLE_RECOVERY
+                *alloc_rem = arena_->getAllocRem();
+                flush_range(alloc_rem, sizeof(size_t) + sizeof(uint64_t) + sizeof(int));
+#endif
+                // The new nodes are durable before any of them is linked
+                persist_fence();
+
+                // See the comment in Insert() on racing readers
+                if (max_height > GetMaxHeight()) {
+                    max_height_.NoBarrier_Store(reinterpret_cast<void*>(max_height));
+                }
+
+                // Publish from largest to smallest so that a predecessor
+                // shared by several new nodes ends up at the smallest one.
+                // Every intermediate state is a valid list whose new nodes
+                // were all persisted by the fence above.
+                for (size_t j = n; j-- > 0; ) {
+                    size_t k = order[j];
+                    LinkNode(nodes[k], heights[k], &prevs[k * kMaxHeight]);
+                }
+                // Commit point for the whole group: the links are durable
+                // before the sequence number that claims them
+#ifdef ENABLE_RECOVERY
+                *m_height = GetMaxHeight();
+                flush_range(m_height, sizeof(int));
+#endif
+                persist_fence();
+#ifdef ENABLE_RECOVERY
+                *sequence = s;
+                flush_range(sequence, sizeof(uint64_t));
+                persist_fence();
+#endif
+            }
+
+            template<typename Key, class Comparator>
+            bool SkipList<Key,Comparator>::InsertConcurrently(const Key& key) {
+                assert(arena_->nvmarena_);
+                int height = RandomHeightConcurrent();
+                Node* x = NewNode(key, height, false, true);
+                if (x == NULL) {
+                    return false;
+                }
+
+                int max_height = GetMaxHeight();
+                while (height > max_height) {
+                    if (max_height_.CompareAndSwap(reinterpret_cast<void*>(max_height),
+                            reinterpret_cast<void*>(height))) {
+                        max_height = height;
+                        break;
+                    }
+                    max_height = GetMaxHeight();
+                }
+
+                // max_height_ >= height now, so every level we link gets a
+                // predecessor (head_ at levels nobody used yet).
+                Node* prev[kMaxHeight];
+                FindGreaterOrEqual(key, prev);
+                for (int i = 0; i < height; i++) {
+                    x->NoBarrier_SetNext(i, prev[i]->Next(i));
+                }
+
+                //NoveLSM: Persist the node and make sure the persisted
+                //alloc_rem covers it (it only ever shrinks, so racing
+                //inserters keep the smallest value), then fence once.
+                //With slabs the persisted slab table already covers it.
+                flush_range(x, sizeof(Node) +
+                        sizeof(port::AtomicPointer) * (height - 1));
+#ifdef ENABLE_RECOVERY
+                if (arena_->slab_slots_ == NULL) {
+                    size_t rem = ((ArenaNVM*)arena_)->AllocRemConcurrent();
+                    size_t cur = __atomic_load_n(alloc_rem, __ATOMIC_RELAXED);
+                    while (rem < cur && !__atomic_compare_exchange_n(alloc_rem, &cur, rem,
+                            true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                    }
+                    flush_range(alloc_rem, sizeof(size_t) + sizeof(uint64_t) + sizeof(int));
+                }
+#endif
+                persist_fence();
+
+                // Link bottom-up. A racing insert may have changed the
+                // neighbourhood since the search, so walk forward from
+                // prev[i] and retry the CAS until it sticks. Upper level
+                // links of x may go stale (they still point forward to a
+                // valid node), but level 0 must be durable before x is
+                // published there or a crash could unlink a racing node.
+                Node* persisted_next = x->NoBarrier_Next(0);
+                for (int i = 0; i < height; i++) {
+                    while (true) {
+                        Node* next = prev[i]->Next(i);
+                        while (KeyIsAfterNode(key, next)) {
+                            prev[i] = next;
+                            next = next->Next(i);
+                        }
+                        x->NoBarrier_SetNext(i, next);
+                        if (i == 0 && next != persisted_next) {
+                            flush_range(x->NextAddr(0), sizeof(port::AtomicPointer));
+                            persist_fence();
+                            persisted_next = next;
+                        }
+                        if (prev[i]->CASNext(i, next, x)) {
+                            break;
+                        }
+                    }
+                    flush_range(prev[i]->NextAddr(i), sizeof(port::AtomicPointer));
+                }
+#ifdef ENABLE_RECOVERY
+                int h = __atomic_load_n(m_height, __ATOMIC_RELAXED);
+                while (height > h && !__atomic_compare_exchange_n(m_height, &h, height,
+                        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                }
+                flush_range(m_height, sizeof(int));
+#endif
+                persist_fence();
+                return true;
+            }
+
+            template<typename Key, class Comparator>
+            void SkipList<Key,Comparator>::PersistSequence(uint64_t s) {
+#ifdef ENABLE_RECOVERY
+                if (arena_->nvmarena_ && *sequence < s) {
+                    *sequence = s;
+                    flush_range(sequence, sizeof(uint64_t));
+                    persist_fence();
                 }
 #endif
             }
@@ -547,7 +967,7 @@ inline void SkipList<Key,Comparator>::Iterator::SetHead(void *ptr) {
             bool SkipList<Key,Comparator>::Contains(const Key& key) const {
                 Node* x = FindGreaterOrEqual(key, NULL);
 #if defined(USE_OFFSETS)
-                if (x != NULL && Equal(key, reinterpret_cast<Key>((intptr_t)x - (intptr_t)x->key_offset))) {
+                if (x != NULL && Equal(key, NodeKey(x))) {
 #else
                     if (x != NULL && Equal(key, x->key)) {
 #endif
@@ -3,7 +3,9 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include "db/skiplist.h"
+#include <algorithm>
 #include <set>
+#include <vector>
 #include "novelsm/env.h"
 #include "util/arena.h"
 #include "util/hash.h"
@@ -122,6 +124,111 @@ TEST(SkipTest, InsertAndLookup) {
   }
 }
 
+TEST(SkipTest, FingerSearchMatchesSeek) {
+  const int N = 2000;
+  const int R = 5000;
+  Random rnd(301);
+  std::set<Key> keys;
+  Arena arena;
+  Comparator cmp;
+  SkipList<Key, Comparator> list(cmp, &arena);
+  for (int i = 0; i < N; i++) {
+    Key key = rnd.Next() % R;
+    if (keys.insert(key).second) {
+      list.Insert(key);
+    }
+  }
+
+  for (int run = 0; run < 20; run++) {
+    // Non-decreasing targets with repeats, some past the last key
+    std::vector<Key> targets;
+    for (int i = 0; i < 200; i++) {
+      targets.push_back(rnd.Next() % (R + 100));
+    }
+    std::sort(targets.begin(), targets.end());
+    targets.push_back(targets.back());
+
+    SkipList<Key, Comparator>::FingerSearch finger(&list);
+    SkipList<Key, Comparator>::Iterator iter(&list);
+    for (size_t i = 0; i < targets.size(); i++) {
+      // Keys inserted ahead of the finger must be found as well
+      if (i % 50 == 25) {
+        Key key = targets[i] + rnd.Uniform(10);
+        if (keys.insert(key).second) {
+          list.Insert(key);
+        }
+      }
+      Key found;
+      bool valid = finger.Seek(targets[i], &found);
+      iter.Seek(targets[i]);
+      ASSERT_EQ(iter.Valid(), valid);
+      if (valid) {
+        ASSERT_EQ(iter.key(), found);
+        ASSERT_EQ(*keys.lower_bound(targets[i]), found);
+      } else {
+        ASSERT_TRUE(keys.lower_bound(targets[i]) == keys.end());
+      }
+    }
+  }
+}
+
+TEST(SkipTest, SampleKeys) {
+  Arena arena;
+  Comparator cmp;
+  SkipList<Key, Comparator> list(cmp, &arena);
+  std::vector<Key> samples;
+  list.SampleKeys(3, &samples);
+  ASSERT_TRUE(samples.empty());
+
+  // Keys 0..N-1 in random order, so that a key is its own rank
+  const int N = 200000;
+  std::vector<Key> order;
+  for (int i = 0; i < N; i++) {
+    order.push_back(i);
+  }
+  Random rnd(301);
+  for (int i = N - 1; i > 0; i--) {
+    std::swap(order[i], order[rnd.Uniform(i + 1)]);
+  }
+  for (int i = 0; i < N; i++) {
+    list.Insert(order[i]);
+  }
+
+  list.SampleKeys(0, &samples);
+  ASSERT_TRUE(samples.empty());
+  const int kCounts[] = { 1, 2, 3, 7, 15 };
+  for (size_t c = 0; c < sizeof(kCounts) / sizeof(kCounts[0]); c++) {
+    const int n = kCounts[c];
+    list.SampleKeys(n, &samples);
+    ASSERT_EQ(n, samples.size());
+    // Ranges of about the same size, in order
+    const Key range = N / (n + 1);
+    Key prev = 0;
+    for (int i = 0; i <= n; i++) {
+      Key next = (i < n) ? samples[i] : N;
+      ASSERT_GT(next, prev);
+      ASSERT_GT(next - prev, range * 9 / 10);
+      ASSERT_LT(next - prev, range * 11 / 10);
+      prev = next;
+    }
+  }
+
+  // A short list still yields n keys in order, though not distinct ones
+  Arena short_arena;
+  SkipList<Key, Comparator> short_list(cmp, &short_arena);
+  for (Key k = 0; k < 5; k++) {
+    short_list.Insert(k * 10);
+  }
+  short_list.SampleKeys(7, &samples);
+  ASSERT_EQ(7, samples.size());
+  for (size_t i = 0; i < samples.size(); i++) {
+    ASSERT_TRUE(short_list.Contains(samples[i]));
+    if (i > 0) {
+      ASSERT_LE(samples[i - 1], samples[i]);
+    }
+  }
+}
+
 // We want to make sure that with a single writer and multiple
 // concurrent readers (with no synchronization other than when a
 // reader's iterator is created), the reader always observes all the
@@ -4,10 +4,12 @@
 
 #include "db/table_cache.h"
 
+#include <vector>
 #include "db/filename.h"
 #include "novelsm/env.h"
 #include "novelsm/table.h"
 #include "util/coding.h"
+#include "util/nvm_block_cache.h"
 
 namespace novelsm {
 
@@ -35,7 +37,9 @@ TableCache::TableCache(const std::string& dbname_disk,
     : env_(options->env),
       dbname_disk_(dbname_disk),
       options_(options),
-      cache_(NewLRUCache(entries)) {
+      cache_(NewLRUCache(entries)),
+      nvm_cache_(NULL),
+      meta_cache_id_(options->block_cache ? options->block_cache->NewId() : 0) {
 }
 
 TableCache::~TableCache() {
@@ -61,7 +65,8 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
       }
     }
     if (s.ok()) {
-      s = Table::Open(*options_, file, file_size, &table);
+      s = Table::Open(*options_, file, file_size, meta_cache_id_, file_number,
+                      &table);
     }
 
     if (!s.ok()) {
@@ -70,6 +75,9 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
       // We do not cache error results so that if the error is transient,
       // or somebody repairs the file, we recover automatically.
     } else {
+      if (nvm_cache_ != NULL) {
+        table->SetNvmBlockCache(nvm_cache_, file_number);
+      }
       TableAndFile* tf = new TableAndFile;
       tf->file = file;
       tf->table = table;
@@ -102,26 +110,116 @@ Iterator* TableCache::NewIterator(const ReadOptions& options,
   return result;
 }
 
+// The table of a FindTable() handle, with its index and filter blocks
+// pinned if it is in one of the pinned levels
+Table* TableCache::PinnedTable(Cache::Handle* handle, int level) {
+  Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+  if (level >= 0 && level < options_->pin_index_and_filter_levels) {
+    t->PinMetaBlocks();
+  }
+  return t;
+}
+
 Status TableCache::Get(const ReadOptions& options,
                        uint64_t file_number,
                        uint64_t file_size,
                        const Slice& k,
                        void* arg,
-                       void (*saver)(void*, const Slice&, const Slice&)) {
+                       void (*saver)(void*, const Slice&, const Slice&),
+                       Iterator** pin,
+                       int level) {
   Cache::Handle* handle = NULL;
   Status s = FindTable(file_number, file_size, &handle);
   if (s.ok()) {
-    Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
-    s = t->InternalGet(options, k, arg, saver);
+    Table* t = PinnedTable(handle, level);
+    Iterator* block_iter = NULL;
+    s = t->InternalGet(options, k, arg, saver,
+                       pin != NULL ? &block_iter : NULL);
+    if (block_iter != NULL) {
+      // The block may live in the table's file mapping, so the table
+      // stays referenced for as long as the block is pinned
+      block_iter->RegisterCleanup(&UnrefEntry, cache_, handle);
+      *pin = block_iter;
+    } else {
+      cache_->Release(handle);
+    }
+  }
+  return s;
+}
+
+Status TableCache::MultiGet(const ReadOptions& options,
+                            uint64_t file_number,
+                            uint64_t file_size,
+                            int n,
+                            const Slice* keys,
+                            void* const* args,
+                            void (*saver)(void*, const Slice&, const Slice&),
+                            int level) {
+  Cache::Handle* handle = NULL;
+  Status s = FindTable(file_number, file_size, &handle);
+  if (s.ok()) {
+    Table* t = PinnedTable(handle, level);
+    s = t->InternalMultiGet(options, n, keys, args, saver);
     cache_->Release(handle);
   }
   return s;
 }
 
+void TableCache::Prefetch(const ReadOptions& options,
+                          const BlockFetch* fetches, int n) {
+  std::vector<Cache::Handle*> handles;
+  std::vector<Table*> tables;
+  std::vector<ReadRequest> reqs;
+  handles.reserve(n);
+  tables.reserve(n);
+  reqs.reserve(n);
+  for (int i = 0; i < n; i++) {
+    Cache::Handle* handle = NULL;
+    if (!FindTable(fetches[i].file_number, fetches[i].file_size,
+                   &handle).ok()) {
+      continue;
+    }
+    handles.push_back(handle);
+    Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+    ReadRequest req;
+    if (!t->PrepareBlockRead(options, fetches[i].key, &req)) {
+      continue;
+    }
+    // Several keys may share a block
+    bool dup = false;
+    for (size_t j = 0; j < reqs.size() && !dup; j++) {
+      dup = (tables[j] == t && reqs[j].offset == req.offset);
+    }
+    if (dup) {
+      delete[] req.scratch;
+      continue;
+    }
+    tables.push_back(t);
+    reqs.push_back(req);
+  }
+
+  if (!reqs.empty()) {
+    env_->SubmitReads(&reqs[0], reqs.size());
+    env_->WaitForReads(&reqs[0], reqs.size());
+    for (size_t j = 0; j < reqs.size(); j++) {
+      tables[j]->FinishBlockRead(options, &reqs[j]);
+    }
+  }
+  for (size_t i = 0; i < handles.size(); i++) {
+    cache_->Release(handles[i]);
+  }
+}
+
 void TableCache::Evict(uint64_t file_number) {
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
   cache_->Erase(Slice(buf, sizeof(buf)));
+  if (meta_cache_id_ != 0 && options_->cache_index_and_filter_blocks) {
+    Table::EraseMetaBlocks(options_->block_cache, meta_cache_id_, file_number);
+  }
+  if (nvm_cache_ != NULL) {
+    nvm_cache_->EraseFiles(file_number, file_number + 1);
+  }
 }
 
 }  // namespace novelsm
@@ -17,12 +17,19 @@
 namespace novelsm {
 
 class Env;
+class NvmBlockCache;
 
 class TableCache {
  public:
-  TableCache(const std::string& dbname_disk, const Options* options, int entries);
+  TableCache(const std::string& dbname_disk, const Options* options,
+             int entries);
   ~TableCache();
 
+  // NoveLSM: Tables read their data blocks through nvm_cache, a second
+  // cache tier, which must outlive the TableCache.
+  // REQUIRES: No table has been opened yet
+  void SetNvmBlockCache(NvmBlockCache* nvm_cache) { nvm_cache_ = nvm_cache; }
+
   // Return an iterator for the specified file number (the corresponding
   // file length must be exactly "file_size" bytes).  If "tableptr" is
   // non-NULL, also sets "*tableptr" to point to the Table object
@@ -37,14 +44,50 @@ class TableCache {
 
   // If a seek to internal key "k" in specified file finds an entry,
   // call (*handle_result)(arg, found_key, found_value).
+  //
+  // If "pin" is non-NULL, *pin may be set to an iterator that keeps the
+  // found entry's block and table alive until it is deleted.
+  //
+  // NoveLSM: "level" is the level of the file, or -1 if unknown.  The
+  // index and filter blocks of files in levels below
+  // options.pin_index_and_filter_levels are pinned in the block cache.
   Status Get(const ReadOptions& options,
              uint64_t file_number,
              uint64_t file_size,
              const Slice& k,
              void* arg,
-             void (*handle_result)(void*, const Slice&, const Slice&));
+             void (*handle_result)(void*, const Slice&, const Slice&),
+             Iterator** pin = NULL,
+             int level = -1);
+
+  // Get() for keys[0..n-1], sorted in ascending order, calling
+  // (*handle_result)(args[i], ...) for each key found.  "level" is as
+  // for Get().
+  Status MultiGet(const ReadOptions& options,
+                  uint64_t file_number,
+                  uint64_t file_size,
+                  int n,
+                  const Slice* keys,
+                  void* const* args,
+                  void (*handle_result)(void*, const Slice&, const Slice&),
+                  int level = -1);
+
+  // NoveLSM: One data block that a following Get() is likely to read
+  struct BlockFetch {
+    uint64_t file_number;
+    uint64_t file_size;
+    Slice key;                  // Internal key to look up
+  };
+
+  // Read the data blocks named by fetches[0..n-1] into the block cache
+  // as one batch of Env::SubmitReads(), so that their I/O overlaps.
+  // Blocks that are cached already, or ruled out by a filter, are
+  // skipped.  Errors are ignored; the Get() that follows reports them.
+  void Prefetch(const ReadOptions& options, const BlockFetch* fetches, int n);
 
-  // Evict any entry for the specified file number
+  // Evict any entry for the specified file number, along with its
+  // index and filter blocks in the block cache and its blocks in the
+  // NVM block cache
   void Evict(uint64_t file_number);
 
  private:
@@ -53,8 +96,13 @@ class TableCache {
   const std::string dbname_secndry_disk_;
   const Options* options_;
   Cache* cache_;
+  NvmBlockCache* nvm_cache_;
+  // NoveLSM: Block cache key prefix of the index and filter blocks of
+  // this DB's tables; 0 when there is no block cache
+  const uint64_t meta_cache_id_;
 
   Status FindTable(uint64_t file_number, uint64_t file_size, Cache::Handle**);
+  Table* PinnedTable(Cache::Handle* handle, int level);
 };
 
 }  // namespace novelsm
@@ -0,0 +1,191 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/table_cache.h"
+
+#include "db/filename.h"
+#include "novelsm/cache.h"
+#include "novelsm/env.h"
+#include "novelsm/filter_policy.h"
+#include "novelsm/table_builder.h"
+#include "util/testharness.h"
+
+namespace novelsm {
+
+static std::string Key(int i) {
+  char buf[100];
+  snprintf(buf, sizeof(buf), "key%06d", i);
+  return buf;
+}
+
+static void SaveValue(void* arg, const Slice& key, const Slice& value) {
+  reinterpret_cast<std::string*>(arg)->assign(value.data(), value.size());
+}
+
+static const int kNumKeys = 1000;
+
+class TableCacheTest {
+ public:
+  std::string dbname_;
+  const FilterPolicy* filter_policy_;
+  Options options_;
+  TableCache* table_cache_;
+  uint64_t file_size_[3];
+
+  TableCacheTest() : table_cache_(NULL) {
+    dbname_ = test::TmpDir() + "/table_cache_test";
+    Env::Default()->CreateDir(dbname_);
+    filter_policy_ = NewBloomFilterPolicy(10);
+    options_.filter_policy = filter_policy_;
+    options_.block_cache = NewLRUCache(8 << 20);
+    options_.block_size = 256;
+    options_.cache_index_and_filter_blocks = true;
+    for (uint64_t number = 1; number <= 2; number++) {
+      BuildTable(number);
+    }
+  }
+
+  ~TableCacheTest() {
+    delete table_cache_;
+    for (uint64_t number = 1; number <= 2; number++) {
+      Env::Default()->DeleteFile(TableFileName(dbname_, number));
+    }
+    Env::Default()->DeleteDir(dbname_);
+    delete options_.block_cache;
+    delete filter_policy_;
+  }
+
+  void BuildTable(uint64_t number) {
+    WritableFile* file;
+    ASSERT_OK(Env::Default()->NewWritableFile(TableFileName(dbname_, number),
+                                              &file));
+    TableBuilder builder(options_, file);
+    for (int i = 0; i < kNumKeys; i++) {
+      builder.Add(Key(i), "value" + Key(i));
+    }
+    ASSERT_OK(builder.Finish());
+    ASSERT_OK(file->Close());
+    file_size_[number] = builder.FileSize();
+    delete file;
+  }
+
+  void Open() {
+    delete table_cache_;
+    table_cache_ = new TableCache(dbname_, &options_, 10);
+  }
+
+  // Reads leave the data blocks out of the block cache, which so only
+  // holds index blocks and filters
+  std::string Get(uint64_t number, int i, int level = -1) {
+    ReadOptions options;
+    options.fill_cache = false;
+    std::string value = "NOT_FOUND";
+    Status s = table_cache_->Get(options, number, file_size_[number], Key(i),
+                                 &value, &SaveValue, NULL, level);
+    if (!s.ok()) {
+      return s.ToString();
+    }
+    return value;
+  }
+
+  size_t Charge() const { return options_.block_cache->TotalCharge(); }
+};
+
+TEST(TableCacheTest, ChargedToBlockCache) {
+  Open();
+  ASSERT_EQ(0, Charge());
+  ASSERT_EQ("value" + Key(7), Get(1, 7));
+  const size_t one_table = Charge();
+  ASSERT_GT(one_table, 0);
+  ASSERT_EQ("value" + Key(8), Get(1, 8));
+  ASSERT_EQ(one_table, Charge());
+  ASSERT_EQ("value" + Key(9), Get(2, 9));
+  ASSERT_EQ(2 * one_table, Charge());
+
+  // Without the option the table holds them itself
+  options_.cache_index_and_filter_blocks = false;
+  Open();
+  options_.block_cache->Prune();
+  ASSERT_EQ("value" + Key(7), Get(1, 7));
+  ASSERT_EQ(0, Charge());
+}
+
+TEST(TableCacheTest, LearnedIndexCharged) {
+  Open();
+  ASSERT_EQ("value" + Key(7), Get(1, 7));
+  const size_t plain = Charge();
+  table_cache_->Evict(1);
+  ASSERT_EQ(0, Charge());
+
+  // The model of the index block counts along with the block
+  options_.learned_index = true;
+  Open();
+  ASSERT_EQ("value" + Key(7), Get(1, 7));
+  ASSERT_GT(Charge(), plain);
+}
+
+TEST(TableCacheTest, ReloadedAfterEviction) {
+  Open();
+  ASSERT_EQ("value" + Key(7), Get(1, 7));
+  const size_t one_table = Charge();
+
+  // Dropped while the table stays open, and read again when needed
+  options_.block_cache->Prune();
+  ASSERT_EQ(0, Charge());
+  ASSERT_EQ("value" + Key(500), Get(1, 500));
+  ASSERT_EQ("NOT_FOUND", Get(1, kNumKeys + 1));
+  ASSERT_EQ(one_table, Charge());
+  for (int i = 0; i < kNumKeys; i += 37) {
+    options_.block_cache->Prune();
+    ASSERT_EQ("value" + Key(i), Get(1, i));
+  }
+}
+
+TEST(TableCacheTest, EvictErasesMetaBlocks) {
+  Open();
+  ASSERT_EQ("value" + Key(7), Get(1, 7));
+  ASSERT_EQ("value" + Key(7), Get(2, 7));
+  const size_t one_table = Charge() / 2;
+
+  // A deleted table's index block and filter leave the cache with it
+  table_cache_->Evict(1);
+  ASSERT_EQ(one_table, Charge());
+  table_cache_->Evict(2);
+  ASSERT_EQ(0, Charge());
+  ASSERT_EQ("value" + Key(7), Get(1, 7));
+  ASSERT_EQ(one_table, Charge());
+}
+
+TEST(TableCacheTest, PinnedLevels) {
+  options_.pin_index_and_filter_levels = 2;
+  Open();
+  ASSERT_EQ("value" + Key(7), Get(1, 7, 1));   // Level 1 is pinned
+  ASSERT_EQ("value" + Key(7), Get(2, 7, 2));   // Level 2 is not
+  const size_t one_table = Charge() / 2;
+
+  // The pinned table keeps its handles through a purge of the cache
+  options_.block_cache->Prune();
+  ASSERT_EQ(one_table, Charge());
+  ASSERT_EQ("value" + Key(8), Get(1, 8, 1));
+  ASSERT_EQ("value" + Key(8), Get(2, 8, 2));
+  ASSERT_EQ(2 * one_table, Charge());
+  options_.block_cache->Prune();
+  ASSERT_EQ(one_table, Charge());
+
+  // And lets them go once the table is closed
+  table_cache_->Evict(1);
+  ASSERT_EQ(0, Charge());
+  ASSERT_EQ("value" + Key(9), Get(1, 9, 1));
+  ASSERT_EQ(one_table, Charge());
+  delete table_cache_;
+  table_cache_ = NULL;
+  options_.block_cache->Prune();
+  ASSERT_EQ(0, Charge());
+}
+
+}  // namespace novelsm
+
+int main(int argc, char** argv) {
+  return novelsm::test::RunAllTests();
+}
@@ -26,11 +26,19 @@ static const int kTargetFileSize = 2 * 1048576;
 // stop building a single file in a level->level+1 compaction.
 static const int64_t kMaxGrandParentOverlapBytes = 10L * kTargetFileSize;
 
+// NoveLSM: Maximum bytes of level 1 a memtable flush merges with.  A
+// flush over more would rewrite far more than it adds; it goes to
+// level 0 instead.
+static const int64_t kMaxMemTableMergeBytes = 10L * kTargetFileSize;
+
 // Maximum number of bytes in all compacted files.  We avoid expanding
 // the lower level file set of a compaction if it would make the
 // total compaction cover more than this many bytes.
 static const int64_t kExpandedCompactionByteSizeLimit = 25L * kTargetFileSize;
 
+// Most level-0 block reads a Get() batches with async_block_reads
+static const int kMaxLevel0Fetches = 16;
+
 static double MaxBytesForLevel(int level) {
   // Note: the result for level zero is not really used since we set
   // the level-0 compaction threshold based on number of files.
@@ -76,9 +84,27 @@ Version::~Version() {
 
 int FindFile(const InternalKeyComparator& icmp,
              const std::vector<FileMetaData*>& files,
-             const Slice& key) {
+             const Slice& key,
+             const LearnedIndex* index) {
   uint32_t left = 0;
   uint32_t right = files.size();
+
+  //NoveLSM: Search only the predicted window when the files on either
+  //side of it show that it holds the answer
+  if (index != NULL && !index->empty()) {
+    uint32_t lo, hi;
+    index->Predict(key, &lo, &hi);
+    if ((lo == 0 ||
+         icmp.InternalKeyComparator::Compare(files[lo - 1]->largest.Encode(),
+                                             key) < 0) &&
+        (hi == files.size() ||
+         icmp.InternalKeyComparator::Compare(files[hi]->largest.Encode(),
+                                             key) >= 0)) {
+      left = lo;
+      right = hi;
+    }
+  }
+
   while (left < right) {
     uint32_t mid = (left + right) / 2;
     const FileMetaData* f = files[mid];
@@ -255,6 +281,7 @@ struct Saver {
   const Comparator* ucmp;
   Slice user_key;
   std::string* value;
+  Slice* pinned_value;  // Set instead of copying when value is NULL
 };
 }
 static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
@@ -266,7 +293,11 @@ static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
     if (s->ucmp->Compare(parsed_key.user_key, s->user_key) == 0) {
       s->state = (parsed_key.type == kTypeValue) ? kFound : kDeleted;
       if (s->state == kFound) {
-        s->value->assign(v.data(), v.size());
+        if (s->value != NULL) {
+          s->value->assign(v.data(), v.size());
+        } else {
+          *s->pinned_value = v;
+        }
       }
     }
   }
@@ -276,6 +307,109 @@ static bool NewestFirst(FileMetaData* a, FileMetaData* b) {
   return a->number > b->number;
 }
 
+namespace {
+struct UserKeyLess {
+  const Comparator* ucmp;
+  bool operator()(const Slice& a, const Slice& b) const {
+    return ucmp->Compare(a, b) < 0;
+  }
+};
+}  // namespace
+
+void Version::BuildLevel0Index() {
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  level0_newest_ = files_[0];
+  std::sort(level0_newest_.begin(), level0_newest_.end(), NewestFirst);
+
+  level0_bounds_.clear();
+  level0_offsets_.clear();
+  level0_overlaps_.clear();
+  if (files_[0].empty()) return;
+
+  level0_bounds_.reserve(2 * files_[0].size());
+  for (size_t i = 0; i < files_[0].size(); i++) {
+    level0_bounds_.push_back(files_[0][i]->smallest.user_key());
+    level0_bounds_.push_back(files_[0][i]->largest.user_key());
+  }
+  UserKeyLess less;
+  less.ucmp = ucmp;
+  std::sort(level0_bounds_.begin(), level0_bounds_.end(), less);
+  size_t distinct = 1;
+  for (size_t i = 1; i < level0_bounds_.size(); i++) {
+    if (ucmp->Compare(level0_bounds_[i], level0_bounds_[distinct - 1]) != 0) {
+      level0_bounds_[distinct++] = level0_bounds_[i];
+    }
+  }
+  level0_bounds_.resize(distinct);
+
+  // Every file boundary is a bound, so a file covers a whole region or
+  // none of it.  Regions before the first and after the last bound are
+  // always empty.
+  const size_t num_regions = 2 * level0_bounds_.size() + 1;
+  level0_offsets_.reserve(num_regions + 1);
+  for (size_t r = 0; r < num_regions; r++) {
+    level0_offsets_.push_back(level0_overlaps_.size());
+    if (r == 0 || r == num_regions - 1) continue;
+    const Slice& lo = level0_bounds_[(r - 1) / 2];
+    const Slice& hi = level0_bounds_[r / 2];
+    for (size_t i = 0; i < level0_newest_.size(); i++) {
+      FileMetaData* f = level0_newest_[i];
+      if (ucmp->Compare(f->smallest.user_key(), lo) <= 0 &&
+          ucmp->Compare(f->largest.user_key(), hi) >= 0) {
+        level0_overlaps_.push_back(f);
+      }
+    }
+  }
+  level0_offsets_.push_back(level0_overlaps_.size());
+}
+
+void Version::BuildFileIndexes() {
+  if (!vset_->options_->learned_index) return;
+  std::vector<Slice> keys;
+  for (int level = 1; level < config::kNumLevels; level++) {
+    keys.clear();
+    for (size_t i = 0; i < files_[level].size(); i++) {
+      keys.push_back(files_[level][i]->largest.Encode());
+    }
+    file_index_[level].Build(keys, 8);  // Drop the sequence/type tag
+  }
+}
+
+void Version::Level0Overlapping(const Slice& user_key,
+                                FileMetaData* const** files,
+                                size_t* num) const {
+  *files = NULL;
+  *num = 0;
+  if (level0_bounds_.empty()) return;
+
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  uint32_t left = 0;
+  uint32_t right = level0_bounds_.size();
+  uint32_t region = 0;
+  bool exact = false;
+  while (left < right) {
+    uint32_t mid = (left + right) / 2;
+    int c = ucmp->Compare(level0_bounds_[mid], user_key);
+    if (c < 0) {
+      left = mid + 1;
+    } else if (c > 0) {
+      right = mid;
+    } else {
+      region = 2 * mid + 1;
+      exact = true;
+      break;
+    }
+  }
+  if (!exact) region = 2 * left;
+
+  uint32_t begin = level0_offsets_[region];
+  uint32_t end = level0_offsets_[region + 1];
+  if (begin < end) {
+    *files = &level0_overlaps_[begin];
+    *num = end - begin;
+  }
+}
+
 void Version::ForEachOverlapping(Slice user_key, Slice internal_key,
                                  void* arg,
                                  bool (*func)(void*, int, FileMetaData*)) {
@@ -283,21 +417,12 @@ void Version::ForEachOverlapping(Slice user_key, Slice internal_key,
   const Comparator* ucmp = vset_->icmp_.user_comparator();
 
   // Search level-0 in order from newest to oldest.
-  std::vector<FileMetaData*> tmp;
-  tmp.reserve(files_[0].size());
-  for (uint32_t i = 0; i < files_[0].size(); i++) {
-    FileMetaData* f = files_[0][i];
-    if (ucmp->Compare(user_key, f->smallest.user_key()) >= 0 &&
-        ucmp->Compare(user_key, f->largest.user_key()) <= 0) {
-      tmp.push_back(f);
-    }
-  }
-  if (!tmp.empty()) {
-    std::sort(tmp.begin(), tmp.end(), NewestFirst);
-    for (uint32_t i = 0; i < tmp.size(); i++) {
-      if (!(*func)(arg, 0, tmp[i])) {
-        return;
-      }
+  FileMetaData* const* level0_files;
+  size_t num_level0_files;
+  Level0Overlapping(user_key, &level0_files, &num_level0_files);
+  for (size_t i = 0; i < num_level0_files; i++) {
+    if (!(*func)(arg, 0, level0_files[i])) {
+      return;
     }
   }
 
@@ -307,7 +432,8 @@ void Version::ForEachOverlapping(Slice user_key, Slice internal_key,
     if (num_files == 0) continue;
 
     // Binary search to find earliest index whose largest key >= internal_key.
-    uint32_t index = FindFile(vset_->icmp_, files_[level], internal_key);
+    uint32_t index = FindFile(vset_->icmp_, files_[level], internal_key,
+                              &file_index_[level]);
     if (index < num_files) {
       FileMetaData* f = files_[level][index];
       if (ucmp->Compare(user_key, f->smallest.user_key()) < 0) {
@@ -321,18 +447,31 @@ void Version::ForEachOverlapping(Slice user_key, Slice internal_key,
   }
 }
 
-void Version::SetTerminate(){
-  stop_search=1;
+static void DeleteIterator(void* arg1, void* arg2) {
+  delete reinterpret_cast<Iterator*>(arg1);
 }
 
-void Version::ResetTerminate(){
-  stop_search=0;
+Status Version::Get(const ReadOptions& options,
+                    const LookupKey& k,
+                    std::string* value,
+                    GetStats* stats,
+                    const port::AtomicPointer* cancel) {
+  return GetInternal(options, k, value, NULL, stats, cancel);
 }
 
 Status Version::Get(const ReadOptions& options,
                     const LookupKey& k,
-                    std::string* value,
+                    PinnedSlice* value,
                     GetStats* stats) {
+  return GetInternal(options, k, NULL, value, stats, NULL);
+}
+
+Status Version::GetInternal(const ReadOptions& options,
+                            const LookupKey& k,
+                            std::string* value,
+                            PinnedSlice* pinned,
+                            GetStats* stats,
+                            const port::AtomicPointer* cancel) {
   Slice ikey = k.internal_key();
   Slice user_key = k.user_key();
   const Comparator* ucmp = vset_->icmp_.user_comparator();
@@ -346,37 +485,26 @@ Status Version::Get(const ReadOptions& options,
   // We can search level-by-level since entries never hop across
   // levels.  Therefore we are guaranteed that if we find data
   // in an smaller level, later levels are irrelevant.
-  std::vector<FileMetaData*> tmp;
   FileMetaData* tmp2;
   for (int level = 0; level < config::kNumLevels; level++) {
     size_t num_files = files_[level].size();
     if (num_files == 0) continue;
 
-    //NoveLSM changes
-    if(stop_search) 
-      return Status::NotFound(Slice());	    
+    //NoveLSM: Stop once a memtable hit made this search pointless
+    if (cancel != NULL && cancel->Acquire_Load() != NULL)
+      return Status::NotFound(Slice());
 
     // Get the list of files to search in this level
     FileMetaData* const* files = &files_[level][0];
     if (level == 0) {
       // Level-0 files may overlap each other.  Find all files that
       // overlap user_key and process them in order from newest to oldest.
-      tmp.reserve(num_files);
-      for (uint32_t i = 0; i < num_files; i++) {
-        FileMetaData* f = files[i];
-        if (ucmp->Compare(user_key, f->smallest.user_key()) >= 0 &&
-            ucmp->Compare(user_key, f->largest.user_key()) <= 0) {
-          tmp.push_back(f);
-        }
-      }
-      if (tmp.empty()) continue;
-
-      std::sort(tmp.begin(), tmp.end(), NewestFirst);
-      files = &tmp[0];
-      num_files = tmp.size();
+      Level0Overlapping(user_key, &files, &num_files);
+      if (num_files == 0) continue;
     } else {
       // Binary search to find earliest index whose largest key >= ikey.
-      uint32_t index = FindFile(vset_->icmp_, files_[level], ikey);
+      uint32_t index = FindFile(vset_->icmp_, files_[level], ikey,
+                                &file_index_[level]);
       if (index >= num_files) {
         files = NULL;
         num_files = 0;
@@ -393,12 +521,22 @@ Status Version::Get(const ReadOptions& options,
       }
     }
 
-    //NoveLSM changes
-    if(stop_search) 
-      return Status::NotFound(Slice());	    
-
-
     for (uint32_t i = 0; i < num_files; ++i) {
+      //NoveLSM: Once the newest overlapping level-0 file has missed, read
+      //the candidate blocks of the older ones at once rather than one per
+      //probe. A hit in the newest file, the common case, reads nothing more
+      if (level == 0 && i == 1 && vset_->options_->async_block_reads) {
+        TableCache::BlockFetch fetches[kMaxLevel0Fetches];
+        int n = 0;
+        for (uint32_t j = i; j < num_files && n < kMaxLevel0Fetches; j++) {
+          fetches[n].file_number = files[j]->number;
+          fetches[n].file_size = files[j]->file_size;
+          fetches[n].key = ikey;
+          n++;
+        }
+        if (n > 1) vset_->table_cache_->Prefetch(options, fetches, n);
+      }
+
       if (last_file_read != NULL && stats->seek_file == NULL) {
         // We have had more than one seek for this read.  Charge the 1st file.
         stats->seek_file = last_file_read;
@@ -414,13 +552,20 @@ Status Version::Get(const ReadOptions& options,
       saver.ucmp = ucmp;
       saver.user_key = user_key;
       saver.value = value;
+      Slice pinned_value;
+      saver.pinned_value = &pinned_value;
+      Iterator* pin = NULL;
 
-    //NoveLSM changes
-    if(stop_search) 
-      return Status::NotFound(Slice());	    
+      if (cancel != NULL && cancel->Acquire_Load() != NULL)
+        return Status::NotFound(Slice());
 
       s = vset_->table_cache_->Get(options, f->number, f->file_size,
-                                   ikey, &saver, SaveValue);
+                                   ikey, &saver, SaveValue,
+                                   pinned != NULL ? &pin : NULL, level);
+      if (pin != NULL && (!s.ok() || saver.state != kFound)) {
+        delete pin;
+        pin = NULL;
+      }
       if (!s.ok()) {
         return s;
       }
@@ -428,6 +573,9 @@ Status Version::Get(const ReadOptions& options,
         case kNotFound:
           break;      // Keep searching in other files
         case kFound:
+          if (pinned != NULL) {
+            pinned->PinSlice(pinned_value, &DeleteIterator, pin, NULL);
+          }
           return s;
         case kDeleted:
           s = Status::NotFound(Slice());  // Use empty error message for speed
@@ -442,6 +590,160 @@ Status Version::Get(const ReadOptions& options,
   return Status::NotFound(Slice());  // Use an empty error message for speed
 }
 
+void Version::MultiGet(const ReadOptions& options, int n,
+                       const LookupKey* const* keys,
+                       std::string* const* values,
+                       Status* const* statuses) {
+  const InternalKeyComparator& icmp = vset_->icmp_;
+  const Comparator* ucmp = icmp.user_comparator();
+
+  std::vector<Saver> savers(n);
+  std::vector<int> pending(n);
+  for (int i = 0; i < n; i++) {
+    savers[i].state = kNotFound;
+    savers[i].ucmp = ucmp;
+    savers[i].user_key = keys[i]->user_key();
+    savers[i].value = values[i];
+    savers[i].pinned_value = NULL;
+    *statuses[i] = Status::OK();
+    pending[i] = i;
+  }
+
+  // Keys, saver arguments and indices of the batch sent to one file
+  std::vector<Slice> batch_keys;
+  std::vector<void*> batch_args;
+  std::vector<int> batch;
+  batch_keys.reserve(n);
+  batch_args.reserve(n);
+  batch.reserve(n);
+
+  for (int level = 0; level < config::kNumLevels && !pending.empty();
+       level++) {
+    size_t num_files = files_[level].size();
+    if (num_files == 0) continue;
+
+    // Files of this level to probe, each with the pending keys it may hold
+    std::vector<std::pair<FileMetaData*, std::vector<int> > > probes;
+    if (level == 0) {
+      // Level-0 files may overlap each other; probe them newest first
+      const std::vector<FileMetaData*>& tmp = level0_newest_;
+      for (size_t f = 0; f < tmp.size(); f++) {
+        std::vector<int> in_range;
+        for (size_t j = 0; j < pending.size(); j++) {
+          const Slice& user_key = savers[pending[j]].user_key;
+          if (ucmp->Compare(user_key, tmp[f]->smallest.user_key()) >= 0 &&
+              ucmp->Compare(user_key, tmp[f]->largest.user_key()) <= 0) {
+            in_range.push_back(pending[j]);
+          }
+        }
+        if (!in_range.empty()) {
+          probes.push_back(std::make_pair(tmp[f], in_range));
+        }
+      }
+    } else {
+      // Sorted keys map to non-decreasing files, so one binary search
+      // places a whole run of keys
+      size_t j = 0;
+      while (j < pending.size()) {
+        Slice ikey = keys[pending[j]]->internal_key();
+        uint32_t index = FindFile(icmp, files_[level], ikey,
+                                  &file_index_[level]);
+        if (index >= num_files) break;  // All remaining keys are past it
+        FileMetaData* f = files_[level][index];
+        if (index + 1 < num_files) {
+          __builtin_prefetch(files_[level][index + 1]);
+        }
+        std::vector<int> in_file;
+        for (; j < pending.size(); j++) {
+          int k = pending[j];
+          if (icmp.Compare(keys[k]->internal_key(), f->largest.Encode()) > 0)
+            break;
+          if (ucmp->Compare(savers[k].user_key, f->smallest.user_key()) >= 0)
+            in_file.push_back(k);
+        }
+        if (!in_file.empty()) {
+          probes.push_back(std::make_pair(f, in_file));
+        }
+      }
+    }
+
+    //NoveLSM: Issue the block reads of the probes of this level together.
+    //A key is answered by the newest level-0 file holding it, so there
+    //they wait until the newest file has been probed and leave out the
+    //keys it answered
+    const size_t first_fetch = (level == 0) ? 1 : 0;
+    for (size_t p = 0; p < probes.size(); p++) {
+      if (p == first_fetch && vset_->options_->async_block_reads) {
+        std::vector<TableCache::BlockFetch> fetches;
+        for (size_t q = p; q < probes.size(); q++) {
+          TableCache::BlockFetch fetch;
+          fetch.file_number = probes[q].first->number;
+          fetch.file_size = probes[q].first->file_size;
+          for (size_t j = 0; j < probes[q].second.size(); j++) {
+            int k = probes[q].second[j];
+            if (savers[k].state != kNotFound || !statuses[k]->ok()) continue;
+            fetch.key = keys[k]->internal_key();
+            fetches.push_back(fetch);
+          }
+        }
+        if (!fetches.empty()) {
+          vset_->table_cache_->Prefetch(options, &fetches[0], fetches.size());
+        }
+      }
+
+      FileMetaData* f = probes[p].first;
+      const std::vector<int>& keys_in_file = probes[p].second;
+      batch_keys.clear();
+      batch_args.clear();
+      batch.clear();
+      for (size_t j = 0; j < keys_in_file.size(); j++) {
+        int k = keys_in_file[j];
+        // An older level-0 file cannot override a newer one's answer
+        if (savers[k].state != kNotFound || !statuses[k]->ok()) continue;
+        batch_keys.push_back(keys[k]->internal_key());
+        batch_args.push_back(&savers[k]);
+        batch.push_back(k);
+      }
+      if (batch.empty()) continue;
+      Status s = vset_->table_cache_->MultiGet(options, f->number,
+                                               f->file_size, batch.size(),
+                                               &batch_keys[0], &batch_args[0],
+                                               SaveValue, level);
+      if (!s.ok()) {
+        for (size_t j = 0; j < batch.size(); j++) {
+          *statuses[batch[j]] = s;
+        }
+      }
+    }
+
+    // Keys answered at this level are done
+    size_t kept = 0;
+    for (size_t j = 0; j < pending.size(); j++) {
+      int k = pending[j];
+      if (savers[k].state == kNotFound && statuses[k]->ok()) {
+        pending[kept++] = k;
+      }
+    }
+    pending.resize(kept);
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (!statuses[i]->ok()) continue;
+    switch (savers[i].state) {
+      case kFound:
+        break;
+      case kNotFound:
+      case kDeleted:
+        *statuses[i] = Status::NotFound(Slice());
+        break;
+      case kCorrupt:
+        *statuses[i] = Status::Corruption("corrupted key for ",
+                                          savers[i].user_key);
+        break;
+    }
+  }
+}
+
 bool Version::UpdateStats(const GetStats& stats) {
   FileMetaData* f = stats.seek_file;
   if (f != NULL) {
@@ -517,6 +819,11 @@ int Version::PickLevelForMemTableOutput(
     const Slice& smallest_user_key,
     const Slice& largest_user_key) {
   int level = 0;
+  // NoveLSM: Universal compaction merges level 0 into the levels below
+  // as whole runs, and keeps a level free for that above the newest one
+  if (vset_->options_->compaction_style == kCompactionStyleUniversal) {
+    return level;
+  }
   if (!OverlapInLevel(0, &smallest_user_key, &largest_user_key)) {
     // Push to next level if there is no overlap in next level,
     // and the #bytes overlapping in the level after that are limited.
@@ -771,6 +1078,8 @@ class VersionSet::Builder {
       }
 #endif
     }
+    v->BuildLevel0Index();
+    v->BuildFileIndexes();
   }
 
   void MaybeAddFile(Version* v, int level, FileMetaData* f) {
@@ -1114,7 +1423,55 @@ void VersionSet::MarkFileNumberUsed(uint64_t number) {
   }
 }
 
+// NoveLSM: Sorted runs of level 0.  Without partitioned flushes every
+// table is one.  With them, it is the most tables that overlap at one
+// key, which bounds what a read checks, but at least one per
+// "partitions" tables, so that disjoint tables still get compacted.
+static int Level0Runs(const Comparator* ucmp,
+                      const std::vector<FileMetaData*>& files,
+                      int partitions) {
+  const int num_files = files.size();
+  if (partitions <= 1) {
+    return num_files;
+  }
+  int depth = 0;
+  for (int i = 0; i < num_files; i++) {
+    // The deepest overlap is found at the smallest key of some table
+    const Slice key = files[i]->smallest.user_key();
+    int overlapping = 0;
+    for (int j = 0; j < num_files; j++) {
+      if (ucmp->Compare(files[j]->smallest.user_key(), key) <= 0 &&
+          ucmp->Compare(files[j]->largest.user_key(), key) >= 0) {
+        overlapping++;
+      }
+    }
+    depth = std::max(depth, overlapping);
+  }
+  return std::max(depth, (num_files + partitions - 1) / partitions);
+}
+
 void VersionSet::Finalize(Version* v) {
+  // NoveLSM: The tables of a partitioned flush do not overlap and count
+  // as one run.
+  v->level0_runs_ = Level0Runs(icmp_.user_comparator(), v->files_[0],
+                               options_->flush_partitions);
+
+  if (options_->compaction_style == kCompactionStyleUniversal) {
+    // NoveLSM: Level 0 and every non-empty level below it are sorted
+    // runs, and a compaction is due once there are too many of them
+    int runs = v->level0_runs_;
+    for (int level = 0; level < config::kNumLevels; level++) {
+      v->level_scores_[level] = 0;
+      if (level > 0 && !v->files_[level].empty()) {
+        runs++;
+      }
+    }
+    v->compaction_level_ = 0;
+    v->compaction_score_ =
+        runs / static_cast<double>(options_->universal_max_sorted_runs);
+    return;
+  }
+
   // Precomputed best level for next compaction
   int best_level = -1;
   double best_score = -1;
@@ -1133,7 +1490,7 @@ void VersionSet::Finalize(Version* v) {
       // file size is small (perhaps because of a small write-buffer
       // setting, or very high compression ratios, or lots of
       // overwrites/deletions).
-      score = v->files_[level].size() /
+      score = v->level0_runs_ /
           static_cast<double>(config::kL0_CompactionTrigger);
     } else {
       // Compute the ratio of current size to size limit.
@@ -1141,11 +1498,13 @@ void VersionSet::Finalize(Version* v) {
       score = static_cast<double>(level_bytes) / MaxBytesForLevel(level);
     }
 
+    v->level_scores_[level] = score;
     if (score > best_score) {
       best_level = level;
       best_score = score;
     }
   }
+  v->level_scores_[config::kNumLevels - 1] = 0;
 
   v->compaction_level_ = best_level;
   v->compaction_score_ = best_score;
@@ -1315,10 +1674,11 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
   // Level-0 files have to be merged together.  For other levels,
   // we will make a concatenating iterator per level.
   // TODO(opt): use concatenating iterator for level-0 if there is no overlap
-  const int space = (c->level() == 0 ? c->inputs_[0].size() + 1 : 2);
+  const int space = (c->level() == 0 ? c->inputs_[0].size() : 1) +
+                    c->num_input_levels_ - 1;
   Iterator** list = new Iterator*[space];
   int num = 0;
-  for (int which = 0; which < 2; which++) {
+  for (int which = 0; which < c->num_input_levels_; which++) {
     if (!c->inputs_[which].empty()) {
       if (c->level() + which == 0) {
         const std::vector<FileMetaData*>& files = c->inputs_[which];
@@ -1340,66 +1700,376 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
   return result;
 }
 
+void VersionSet::SplitCompaction(Compaction* c, int n,
+                                 std::vector<std::string>* boundaries) {
+  boundaries->clear();
+  uint64_t total = 0;
+  for (int which = 0; which < c->num_input_levels_; which++) {
+    total += TotalFileSize(c->inputs_[which]);
+  }
+  // Every piece should fill at least one output file
+  const uint64_t max_pieces = total / c->MaxOutputFileSize();
+  if (max_pieces < static_cast<uint64_t>(n)) {
+    n = static_cast<int>(max_pieces);
+  }
+  if (n <= 1) {
+    return;
+  }
+
+  // Cut candidates are the user keys at which input files start.  All
+  // entries of a user key then fall into the same piece, which the
+  // dropping of obsolete entries relies on.
+  const Comparator* ucmp = icmp_.user_comparator();
+  std::vector<Slice> candidates;
+  for (int which = 0; which < c->num_input_levels_; which++) {
+    for (size_t i = 0; i < c->inputs_[which].size(); i++) {
+      candidates.push_back(c->inputs_[which][i]->smallest.user_key());
+    }
+  }
+  UserKeyLess less = { ucmp };
+  std::sort(candidates.begin(), candidates.end(), less);
+  std::vector<InternalKey> cuts;
+  for (size_t k = 1; k < candidates.size(); k++) {
+    if (ucmp->Compare(candidates[k], candidates[k - 1]) != 0) {
+      cuts.push_back(InternalKey(candidates[k], kMaxSequenceNumber,
+                                 kValueTypeForSeek));
+    }
+  }
+
+  // Input bytes before the first entry of each cut.  A file is opened
+  // once, for all the cuts that fall inside it.
+  ReadOptions options;
+  options.fill_cache = false;
+  std::vector<uint64_t> before(cuts.size(), 0);
+  for (int which = 0; which < c->num_input_levels_; which++) {
+    const std::vector<FileMetaData*>& files = c->inputs_[which];
+    for (size_t i = 0; i < files.size(); i++) {
+      Iterator* iter = NULL;
+      Table* tableptr = NULL;
+      for (size_t k = 0; k < cuts.size(); k++) {
+        if (icmp_.Compare(files[i]->largest, cuts[k]) < 0) {
+          before[k] += files[i]->file_size;
+        } else if (icmp_.Compare(files[i]->smallest, cuts[k]) < 0) {
+          if (iter == NULL) {
+            iter = table_cache_->NewIterator(
+                options, files[i]->number, files[i]->file_size, &tableptr);
+          }
+          if (tableptr != NULL) {
+            before[k] += tableptr->ApproximateOffsetOf(cuts[k].Encode());
+          }
+        }
+      }
+      delete iter;
+    }
+  }
+
+  uint64_t last_cut = 0;
+  for (size_t k = 0; k < cuts.size(); k++) {
+    const uint64_t target = total / n * (boundaries->size() + 1);
+    if (before[k] >= target && before[k] > last_cut && before[k] < total) {
+      boundaries->push_back(cuts[k].user_key().ToString());
+      last_cut = before[k];
+      if (boundaries->size() + 1 == static_cast<size_t>(n)) {
+        break;
+      }
+    }
+  }
+}
+
+Compaction* VersionSet::PickLevelCompaction(int level) {
+  assert(level >= 0);
+  assert(level+1 < config::kNumLevels);
+  const std::vector<FileMetaData*>& files = current_->files_[level];
+
+  // Pick the first file that comes after compact_pointer_[level] and is
+  // not being compacted, wrapping around to the beginning of the key
+  // space
+  FileMetaData* picked = NULL;
+  for (size_t i = 0; i < files.size(); i++) {
+    FileMetaData* f = files[i];
+    if (f->being_compacted) {
+      continue;
+    }
+    if (compact_pointer_[level].empty() ||
+        icmp_.Compare(f->largest.Encode(), compact_pointer_[level]) > 0) {
+      picked = f;
+      break;
+    }
+    if (picked == NULL) {
+      picked = f;
+    }
+  }
+  if (picked == NULL) {
+    return NULL;
+  }
+  Compaction* c = new Compaction(level);
+  c->inputs_[0].push_back(picked);
+  return c;
+}
+
 Compaction* VersionSet::PickCompaction() {
-  Compaction* c;
-  int level;
+  if (options_->compaction_style == kCompactionStyleUniversal) {
+    return PickUniversalCompaction();
+  }
 
   // We prefer compactions triggered by too much data in a level over
-  // the compactions triggered by seeks.
-  const bool size_compaction = (current_->compaction_score_ >= 1);
-  const bool seek_compaction = (current_->file_to_compact_ != NULL);
-  if (size_compaction) {
-    level = current_->compaction_level_;
-    assert(level >= 0);
-    assert(level+1 < config::kNumLevels);
-    c = new Compaction(level);
-
-    // Pick the first file that comes after compact_pointer_[level]
-    for (size_t i = 0; i < current_->files_[level].size(); i++) {
-      FileMetaData* f = current_->files_[level][i];
-      if (compact_pointer_[level].empty() ||
-          icmp_.Compare(f->largest.Encode(), compact_pointer_[level]) > 0) {
-        c->inputs_[0].push_back(f);
-        break;
+  // the compactions triggered by seeks.  NoveLSM: The levels that are
+  // due are tried by decreasing score, as the first ones may be busy.
+  int levels[config::kNumLevels];
+  int num_levels = 0;
+  for (int level = 0; level + 1 < config::kNumLevels; level++) {
+    if (current_->level_scores_[level] >= 1) {
+      int i = num_levels++;
+      while (i > 0 && current_->level_scores_[levels[i - 1]] <
+                          current_->level_scores_[level]) {
+        levels[i] = levels[i - 1];
+        i--;
       }
+      levels[i] = level;
+    }
+  }
+
+  for (int i = 0; i <= num_levels; i++) {
+    Compaction* c;
+    int level;
+    if (i < num_levels) {
+      level = levels[i];
+      c = PickLevelCompaction(level);
+    } else if (current_->file_to_compact_ != NULL &&
+               !current_->file_to_compact_->being_compacted) {
+      level = current_->file_to_compact_level_;
+      c = new Compaction(level);
+      c->inputs_[0].push_back(current_->file_to_compact_);
+    } else {
+      break;
     }
-    if (c->inputs_[0].empty()) {
-      // Wrap-around to the beginning of the key space
-      c->inputs_[0].push_back(current_->files_[level][0]);
+    if (c == NULL) {
+      continue;
     }
-  } else if (seek_compaction) {
-    level = current_->file_to_compact_level_;
-    c = new Compaction(level);
-    c->inputs_[0].push_back(current_->file_to_compact_);
-  } else {
+
+    c->input_version_ = current_;
+    c->input_version_->Ref();
+
+    // Files in level 0 may overlap each other, so pick up all overlapping ones
+    if (level == 0) {
+      InternalKey smallest, largest;
+      GetRange(c->inputs_[0], &smallest, &largest);
+      // Note that the next call will discard the file we placed in
+      // c->inputs_[0] earlier and replace it with an overlapping set
+      // which will include the picked file.
+      current_->GetOverlappingInputs(0, &smallest, &largest, &c->inputs_[0]);
+      assert(!c->inputs_[0].empty());
+    }
+
+    SetupOtherInputs(c);
+
+    if (CanRunConcurrently(c)) {
+      return c;
+    }
+    delete c;
+  }
+  return NULL;
+}
+
+// NoveLSM: Universal compaction sees level 0 and each non-empty level
+// below it as sorted runs, newest first, and merges neighbouring runs of
+// similar size into the level of the oldest of them.  Level 0 is only
+// ever merged as a whole, and never written, so the level 0 tables keep
+// their order by age and every level stays older than the ones above.
+Compaction* VersionSet::PickUniversalCompaction() {
+  if (current_->compaction_score_ < 1 || !running_compactions_.empty()) {
     return NULL;
   }
 
+  // The runs of each non-empty level, newest first
+  int levels[config::kNumLevels];
+  int64_t bytes[config::kNumLevels];
+  int runs[config::kNumLevels];
+  int n = 0;
+  int total_runs = 0;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    if (!current_->files_[level].empty()) {
+      levels[n] = level;
+      bytes[n] = TotalFileSize(current_->files_[level]);
+      runs[n] = (level == 0) ? current_->level0_runs_ : 1;
+      total_runs += runs[n];
+      n++;
+    }
+  }
+
+  // Take the first stretch of at least two runs in which no run is more
+  // than size_ratio percent larger than the newer ones together
+  const int64_t ratio = 100 + options_->universal_size_ratio;
+  int first = -1;
+  int last = -1;
+  for (int i = 0; i < n && first < 0; i++) {
+    int64_t sum = bytes[i];
+    int merged = runs[i];
+    int j = i + 1;
+    while (j < n && bytes[j] * 100 <= sum * ratio) {
+      sum += bytes[j];
+      merged += runs[j];
+      j++;
+    }
+    if (merged >= 2) {
+      first = i;
+      last = j - 1;
+    }
+  }
+  if (first < 0) {
+    // Otherwise merge the newest runs, enough of them to end up below
+    // the limit
+    first = last = 0;
+    int merged = runs[0];
+    while (last + 1 < n &&
+           total_runs - merged + 1 >= options_->universal_max_sorted_runs) {
+      last++;
+      merged += runs[last];
+    }
+  }
+
+  // Level 0 on its own goes to the free level just above the next run
+  int output_level = levels[last];
+  if (output_level == 0) {
+    if (last + 1 == n) {
+      output_level = config::kNumLevels - 1;
+    } else if (levels[last + 1] > 1) {
+      output_level = levels[last + 1] - 1;
+    } else {
+      last++;
+      output_level = 1;
+    }
+  }
+
+  Compaction* c = new Compaction(levels[first]);
+  c->num_input_levels_ = output_level - c->level_ + 1;
+  std::vector<FileMetaData*> all;
+  for (int which = 0; which < c->num_input_levels_; which++) {
+    c->inputs_[which] = current_->files_[c->level_ + which];
+    all.insert(all.end(), c->inputs_[which].begin(), c->inputs_[which].end());
+  }
   c->input_version_ = current_;
   c->input_version_->Ref();
-
-  // Files in level 0 may overlap each other, so pick up all overlapping ones
-  if (level == 0) {
+  if (output_level + 1 < config::kNumLevels) {
     InternalKey smallest, largest;
-    GetRange(c->inputs_[0], &smallest, &largest);
-    // Note that the next call will discard the file we placed in
-    // c->inputs_[0] earlier and replace it with an overlapping set
-    // which will include the picked file.
-    current_->GetOverlappingInputs(0, &smallest, &largest, &c->inputs_[0]);
-    assert(!c->inputs_[0].empty());
+    GetRange(all, &smallest, &largest);
+    current_->GetOverlappingInputs(output_level + 1, &smallest, &largest,
+                                   &c->grandparents_);
   }
+  return c;
+}
 
-  SetupOtherInputs(c);
+bool VersionSet::CanRunConcurrently(Compaction* c) {
+  for (int which = 0; which < c->num_input_levels_; which++) {
+    for (size_t i = 0; i < c->inputs_[which].size(); i++) {
+      if (c->inputs_[which][i]->being_compacted) {
+        return false;
+      }
+    }
+  }
+  if (running_compactions_.empty()) {
+    return true;
+  }
 
-  return c;
+  // Two compactions into the same level must not write overlapping files.
+  // A memtable compaction may have no input files, and then its range is
+  // not known here.
+  const Comparator* ucmp = icmp_.user_comparator();
+  const bool no_inputs = c->inputs_[0].empty() && c->inputs_[1].empty();
+  InternalKey smallest, largest;
+  if (!no_inputs) {
+    GetRange2(c->inputs_[0], c->inputs_[1], &smallest, &largest);
+  }
+  for (size_t i = 0; i < running_compactions_.size(); i++) {
+    Compaction* r = running_compactions_[i];
+    // A universal compaction rewrites whole levels
+    if (r->num_input_levels_ > 2 || c->num_input_levels_ > 2) {
+      return false;
+    }
+    if (r->level() != c->level()) {
+      continue;
+    }
+    if (no_inputs || (r->inputs_[0].empty() && r->inputs_[1].empty())) {
+      return false;
+    }
+    InternalKey r_smallest, r_largest;
+    GetRange2(r->inputs_[0], r->inputs_[1], &r_smallest, &r_largest);
+    if (ucmp->Compare(smallest.user_key(), r_largest.user_key()) <= 0 &&
+        ucmp->Compare(r_smallest.user_key(), largest.user_key()) <= 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void VersionSet::RegisterCompaction(Compaction* c) {
+  for (int which = 0; which < c->num_input_levels_; which++) {
+    for (size_t i = 0; i < c->inputs_[which].size(); i++) {
+      assert(!c->inputs_[which][i]->being_compacted);
+      c->inputs_[which][i]->being_compacted = true;
+    }
+  }
+  running_compactions_.push_back(c);
+}
+
+void VersionSet::UnregisterCompaction(Compaction* c) {
+  for (int which = 0; which < c->num_input_levels_; which++) {
+    for (size_t i = 0; i < c->inputs_[which].size(); i++) {
+      c->inputs_[which][i]->being_compacted = false;
+    }
+  }
+  running_compactions_.erase(std::find(running_compactions_.begin(),
+                                       running_compactions_.end(), c));
+}
+
+// NoveLSM: A compaction output may end in the middle of the entries of
+// a user key, so the older entries of that key start the next file of
+// the level.  Compacting the first file without the next one would move
+// the newest entry below the older ones, where reads no longer see it.
+// Adds to "*files" the files of "level_files" that continue a user key
+// the last of "*files" ends with.
+static void AddBoundaryInputs(const InternalKeyComparator& icmp,
+                              const std::vector<FileMetaData*>& level_files,
+                              std::vector<FileMetaData*>* files) {
+  if (files->empty()) {
+    return;
+  }
+  InternalKey largest = (*files)[0]->largest;
+  for (size_t i = 1; i < files->size(); i++) {
+    if (icmp.Compare((*files)[i]->largest, largest) > 0) {
+      largest = (*files)[i]->largest;
+    }
+  }
+  const Comparator* ucmp = icmp.user_comparator();
+  for (;;) {
+    // The file of the level that starts right after "largest" with the
+    // same user key, if any
+    FileMetaData* boundary = NULL;
+    for (size_t i = 0; i < level_files.size(); i++) {
+      FileMetaData* f = level_files[i];
+      if (icmp.Compare(f->smallest, largest) > 0 &&
+          ucmp->Compare(f->smallest.user_key(), largest.user_key()) == 0 &&
+          (boundary == NULL ||
+           icmp.Compare(f->smallest, boundary->smallest) < 0)) {
+        boundary = f;
+      }
+    }
+    if (boundary == NULL) {
+      break;
+    }
+    files->push_back(boundary);
+    largest = boundary->largest;
+  }
 }
 
 void VersionSet::SetupOtherInputs(Compaction* c) {
   const int level = c->level();
   InternalKey smallest, largest;
+  AddBoundaryInputs(icmp_, current_->files_[level], &c->inputs_[0]);
   GetRange(c->inputs_[0], &smallest, &largest);
 
   current_->GetOverlappingInputs(level+1, &smallest, &largest, &c->inputs_[1]);
+  AddBoundaryInputs(icmp_, current_->files_[level+1], &c->inputs_[1]);
 
   // Get entire range covered by compaction
   InternalKey all_start, all_limit;
@@ -1410,6 +2080,7 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
   if (!c->inputs_[1].empty()) {
     std::vector<FileMetaData*> expanded0;
     current_->GetOverlappingInputs(level, &all_start, &all_limit, &expanded0);
+    AddBoundaryInputs(icmp_, current_->files_[level], &expanded0);
     const int64_t inputs0_size = TotalFileSize(c->inputs_[0]);
     const int64_t inputs1_size = TotalFileSize(c->inputs_[1]);
     const int64_t expanded0_size = TotalFileSize(expanded0);
@@ -1420,6 +2091,7 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
       std::vector<FileMetaData*> expanded1;
       current_->GetOverlappingInputs(level+1, &new_start, &new_limit,
                                      &expanded1);
+      AddBoundaryInputs(icmp_, current_->files_[level+1], &expanded1);
       if (expanded1.size() == c->inputs_[1].size()) {
         Log(options_->info_log,
             "Expanding@%d %d+%d (%ld+%ld bytes) to %d+%d (%ld+%ld bytes)\n",
@@ -1461,6 +2133,46 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
   c->edit_.SetCompactPointer(level, largest);
 }
 
+Compaction* VersionSet::MemTableCompaction(const InternalKey& smallest,
+                                       const InternalKey& largest) {
+  if (!current_->files_[0].empty()) {
+    // Level 0 holds older data than the memtable for the same keys
+    return NULL;
+  }
+  Compaction* c = new Compaction(0);
+  c->input_version_ = current_;
+  c->input_version_->Ref();
+  current_->GetOverlappingInputs(1, &smallest, &largest, &c->inputs_[1]);
+  AddBoundaryInputs(icmp_, current_->files_[1], &c->inputs_[1]);
+  if (TotalFileSize(c->inputs_[1]) > kMaxMemTableMergeBytes) {
+    delete c;
+    return NULL;
+  }
+
+  InternalKey all_start = smallest;
+  InternalKey all_limit = largest;
+  if (!c->inputs_[1].empty()) {
+    InternalKey start, limit;
+    GetRange(c->inputs_[1], &start, &limit);
+    if (icmp_.Compare(start, all_start) < 0) {
+      all_start = start;
+    }
+    if (icmp_.Compare(limit, all_limit) > 0) {
+      all_limit = limit;
+    }
+  }
+  if (config::kNumLevels > 2) {
+    current_->GetOverlappingInputs(2, &all_start, &all_limit,
+                                   &c->grandparents_);
+  }
+
+  if (!CanRunConcurrently(c)) {
+    delete c;
+    return NULL;
+  }
+  return c;
+}
+
 Compaction* VersionSet::CompactRange(
     int level,
     const InternalKey* begin,
@@ -1498,13 +2210,17 @@ Compaction* VersionSet::CompactRange(
 
 Compaction::Compaction(int level)
     : level_(level),
+      num_input_levels_(2),
       max_output_file_size_(MaxFileSizeForLevel(level)),
-      input_version_(NULL),
-      grandparent_index_(0),
-      seen_key_(false),
-      overlapped_bytes_(0) {
+      input_version_(NULL) {
+}
+
+Compaction::Cursor::Cursor()
+    : grandparent_index(0),
+      seen_key(false),
+      overlapped_bytes(0) {
   for (int i = 0; i < config::kNumLevels; i++) {
-    level_ptrs_[i] = 0;
+    level_ptrs[i] = 0;
   }
 }
 
@@ -1518,26 +2234,36 @@ bool Compaction::IsTrivialMove() const {
   // Avoid a move if there is lots of overlapping grandparent data.
   // Otherwise, the move could create a parent file that will require
   // a very expensive merge later on.
-  return (num_input_files(0) == 1 &&
-          num_input_files(1) == 0 &&
-          TotalFileSize(grandparents_) <= kMaxGrandParentOverlapBytes);
+  if (num_input_files(0) != 1) {
+    return false;
+  }
+  for (int which = 1; which < num_input_levels_; which++) {
+    if (num_input_files(which) != 0) {
+      return false;
+    }
+  }
+  return TotalFileSize(grandparents_) <= kMaxGrandParentOverlapBytes;
 }
 
 void Compaction::AddInputDeletions(VersionEdit* edit) {
-  for (int which = 0; which < 2; which++) {
+  for (int which = 0; which < num_input_levels_; which++) {
     for (size_t i = 0; i < inputs_[which].size(); i++) {
       edit->DeleteFile(level_ + which, inputs_[which][i]->number);
     }
   }
 }
 
-bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
+bool Compaction::IsBaseLevelForKey(const Slice& user_key, Cursor* cursor) {
+  if (cursor == NULL) {
+    cursor = &cursor_;
+  }
+  size_t* level_ptrs = cursor->level_ptrs;
   // Maybe use binary search to find right entry instead of linear search?
   const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
-  for (int lvl = level_ + 2; lvl < config::kNumLevels; lvl++) {
+  for (int lvl = output_level() + 1; lvl < config::kNumLevels; lvl++) {
     const std::vector<FileMetaData*>& files = input_version_->files_[lvl];
-    for (; level_ptrs_[lvl] < files.size(); ) {
-      FileMetaData* f = files[level_ptrs_[lvl]];
+    for (; level_ptrs[lvl] < files.size(); ) {
+      FileMetaData* f = files[level_ptrs[lvl]];
       if (user_cmp->Compare(user_key, f->largest.user_key()) <= 0) {
         // We've advanced far enough
         if (user_cmp->Compare(user_key, f->smallest.user_key()) >= 0) {
@@ -1546,28 +2272,32 @@ bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
         }
         break;
       }
-      level_ptrs_[lvl]++;
+      level_ptrs[lvl]++;
     }
   }
   return true;
 }
 
-bool Compaction::ShouldStopBefore(const Slice& internal_key) {
+bool Compaction::ShouldStopBefore(const Slice& internal_key, Cursor* cursor) {
+  if (cursor == NULL) {
+    cursor = &cursor_;
+  }
   // Scan to find earliest grandparent file that contains key.
   const InternalKeyComparator* icmp = &input_version_->vset_->icmp_;
-  while (grandparent_index_ < grandparents_.size() &&
+  while (cursor->grandparent_index < grandparents_.size() &&
       icmp->Compare(internal_key,
-                    grandparents_[grandparent_index_]->largest.Encode()) > 0) {
-    if (seen_key_) {
-      overlapped_bytes_ += grandparents_[grandparent_index_]->file_size;
+                    grandparents_[cursor->grandparent_index]->largest.Encode()) > 0) {
+    if (cursor->seen_key) {
+      cursor->overlapped_bytes +=
+          grandparents_[cursor->grandparent_index]->file_size;
     }
-    grandparent_index_++;
+    cursor->grandparent_index++;
   }
-  seen_key_ = true;
+  cursor->seen_key = true;
 
-  if (overlapped_bytes_ > kMaxGrandParentOverlapBytes) {
+  if (cursor->overlapped_bytes > kMaxGrandParentOverlapBytes) {
     // Too much overlap for current output; start new output
-    overlapped_bytes_ = 0;
+    cursor->overlapped_bytes = 0;
     return true;
   } else {
     return false;
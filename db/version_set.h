@@ -22,6 +22,7 @@
 #include "db/version_edit.h"
 #include "port/port.h"
 #include "port/thread_annotations.h"
+#include "util/learned_index.h"
 
 namespace novelsm {
 
@@ -38,10 +39,13 @@ class WritableFile;
 
 // Return the smallest index i such that files[i]->largest >= key.
 // Return files.size() if there is no such file.
+// If "index" is non-NULL and was built over the largest keys of "files",
+// the search starts from its prediction.
 // REQUIRES: "files" contains a sorted list of non-overlapping files.
 extern int FindFile(const InternalKeyComparator& icmp,
                     const std::vector<FileMetaData*>& files,
-                    const Slice& key);
+                    const Slice& key,
+                    const LearnedIndex* index = NULL);
 
 // Returns true iff some file in "files" overlaps the user key range
 // [*smallest,*largest].
@@ -63,16 +67,33 @@ class Version {
   // REQUIRES: This version has been saved (see VersionSet::SaveTo)
   void AddIterators(const ReadOptions&, std::vector<Iterator*>* iters);
 
-  // Lookup the value for key.  If found, store it in *val and
-  // return OK.  Else return a non-OK status.  Fills *stats.
-  // REQUIRES: lock is not held
   struct GetStats {
     FileMetaData* seek_file;
     int seek_file_level;
   };
+
+  // Lookup the value for key.  If found, store it in *val and
+  // return OK.  Else return a non-OK status.  Fills *stats.
+  // REQUIRES: lock is not held
+  //
+  // If "cancel" is non-NULL, the search gives up and returns NotFound
+  // once *cancel holds a non-NULL value.
   Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
+             GetStats* stats, const port::AtomicPointer* cancel = NULL);
+
+  // Same as above, but pins the block holding the value in *val instead
+  // of copying it.
+  Status Get(const ReadOptions&, const LookupKey& key, PinnedSlice* val,
              GetStats* stats);
 
+  // Get() for keys[0..n-1], which are sorted by user key and share one
+  // sequence number, storing the outcome in *values[i] and *statuses[i].
+  // Each file is probed once for all the keys it may hold.  Does not
+  // charge seeks to files.
+  // REQUIRES: lock is not held
+  void MultiGet(const ReadOptions&, int n, const LookupKey* const* keys,
+                std::string* const* values, Status* const* statuses);
+
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
   // REQUIRES: lock is held
@@ -113,12 +134,6 @@ class Version {
   // Return a human readable string that describes this version's contents.
   std::string DebugString() const;
 
-  //NoveLSM
-  void SetTerminate();
-  void ResetTerminate();
-  int stop_search;
-
-
  private:
   friend class Compaction;
   friend class VersionSet;
@@ -126,6 +141,12 @@ class Version {
   class LevelFileNumIterator;
   Iterator* NewConcatenatingIterator(const ReadOptions&, int level) const;
 
+  // Shared body of the Get() variants; exactly one of value and pinned
+  // is non-NULL.
+  Status GetInternal(const ReadOptions&, const LookupKey& key,
+                     std::string* value, PinnedSlice* pinned,
+                     GetStats* stats, const port::AtomicPointer* cancel);
+
   // Call func(arg, level, f) for every file that overlaps user_key in
   // order from newest to oldest.  If an invocation of func returns
   // false, makes no more calls.
@@ -135,6 +156,17 @@ class Version {
                           void* arg,
                           bool (*func)(void*, int, FileMetaData*));
 
+  // Fill the level-0 search structures below from files_[0], and the
+  // file_index_ models if enabled.  Called once the file lists of a new
+  // Version are complete.
+  void BuildLevel0Index();
+  void BuildFileIndexes();
+
+  // Store in *files and *num the level-0 files whose range includes
+  // user_key, newest first.  Neither allocates nor sorts.
+  void Level0Overlapping(const Slice& user_key,
+                         FileMetaData* const** files, size_t* num) const;
+
   VersionSet* vset_;            // VersionSet to which this Version belongs
   Version* next_;               // Next version in linked list
   Version* prev_;               // Previous version in linked list
@@ -143,6 +175,24 @@ class Version {
   // List of files per level
   std::vector<FileMetaData*> files_[config::kNumLevels];
 
+  // Level-0 files ordered from newest to oldest
+  std::vector<FileMetaData*> level0_newest_;
+
+  // Interval index over level 0.  level0_bounds_ holds the distinct
+  // smallest and largest user keys of the level-0 files in order.  Region
+  // 2*i+1 is the key level0_bounds_[i] itself and region 2*i the keys
+  // strictly between level0_bounds_[i-1] and level0_bounds_[i].  The files
+  // overlapping region r are level0_overlaps_[level0_offsets_[r]] up to
+  // level0_overlaps_[level0_offsets_[r+1]], newest first.  The bounds
+  // point into the FileMetaData keys, which this Version keeps alive.
+  std::vector<Slice> level0_bounds_;
+  std::vector<uint32_t> level0_offsets_;
+  std::vector<FileMetaData*> level0_overlaps_;
+
+  // NoveLSM: With Options::learned_index, a model of the largest keys of
+  // each level >= 1 for FindFile().  Empty for short levels.
+  LearnedIndex file_index_[config::kNumLevels];
+
   // Next file to compact based on seek stats.
   FileMetaData* file_to_compact_;
   int file_to_compact_level_;
@@ -153,12 +203,23 @@ class Version {
   double compaction_score_;
   int compaction_level_;
 
+  // NoveLSM: Score of every level, so that PickCompaction() can move on
+  // to the next most urgent level when one is busy
+  double level_scores_[config::kNumLevels];
+
+  // NoveLSM: Sorted runs in level 0, computed by Finalize()
+  int level0_runs_;
+
   explicit Version(VersionSet* vset)
       : vset_(vset), next_(this), prev_(this), refs_(0),
         file_to_compact_(NULL),
         file_to_compact_level_(-1),
         compaction_score_(-1),
-        compaction_level_(-1) {
+        compaction_level_(-1),
+        level0_runs_(0) {
+    for (int level = 0; level < config::kNumLevels; level++) {
+      level_scores_[level] = 0;
+    }
   }
 
   ~Version();
@@ -196,6 +257,9 @@ class VersionSet {
   // Allocate and return a new file number
   uint64_t NewFileNumber() { return next_file_number_++; }
 
+  // NoveLSM: Return the number NewFileNumber() hands out next
+  uint64_t NextFileNumber() const { return next_file_number_; }
+
   // Arrange to reuse "file_number" unless a newer file number has
   // already been allocated.
   // REQUIRES: "file_number" was returned by a call to NewFileNumber().
@@ -208,16 +272,23 @@ class VersionSet {
   // Return the number of Table files at the specified level.
   int NumLevelFiles(int level) const;
 
+  // NoveLSM: Return the number of sorted runs in level 0, which the
+  // level 0 triggers are compared with.  See Options::flush_partitions.
+  int NumLevel0Runs() const { return current_->level0_runs_; }
+
   // Return the combined file size of all files at the specified level.
   int64_t NumLevelBytes(int level) const;
 
   // Return the last sequence number.
-  uint64_t LastSequence() const { return last_sequence_; }
+  // May be called without the DB mutex held (see DBImpl::Get).
+  uint64_t LastSequence() const {
+    return __atomic_load_n(&last_sequence_, __ATOMIC_ACQUIRE);
+  }
 
   // Set the last sequence number to s.
   void SetLastSequence(uint64_t s) {
     assert(s >= last_sequence_);
-    last_sequence_ = s;
+    __atomic_store_n(&last_sequence_, s, __ATOMIC_RELEASE);
   }
 
   // Mark the specified file number as used.
@@ -237,8 +308,32 @@ class VersionSet {
   // Returns NULL if there is no compaction to be done.
   // Otherwise returns a pointer to a heap-allocated object that
   // describes the compaction.  Caller should delete the result.
+  //
+  // NoveLSM: Compactions that could not run alongside the registered
+  // ones are passed over.
   Compaction* PickCompaction();
 
+  // NoveLSM: Note that "*c" is running until UnregisterCompaction(c).
+  // Its inputs are marked as being compacted, and no compaction picked
+  // meanwhile reads them or writes into its key range of level+1.
+  // REQUIRES: "*c" does not conflict with the running compactions.
+  void RegisterCompaction(Compaction* c);
+  void UnregisterCompaction(Compaction* c);
+
+  // NoveLSM: Whether "*c" could run alongside the registered compactions
+  bool CanRunConcurrently(Compaction* c);
+
+  int NumRunningCompactions() const { return running_compactions_.size(); }
+
+  // NoveLSM: Return a compaction of level 0 with no level 0 inputs, to
+  // merge a memtable holding the keys in [smallest,largest] with the
+  // files of level 1 it overlaps.  The memtable is not an input; the
+  // caller merges it in.  Returns NULL if level 0 holds any file, if
+  // the level 1 files add up to too many bytes, or if the compaction
+  // could not run alongside the registered ones.
+  Compaction* MemTableCompaction(const InternalKey& smallest,
+                                 const InternalKey& largest);
+
   // Return a compaction object for compacting the range [begin,end] in
   // the specified level.  Returns NULL if there is nothing in that
   // level that overlaps the specified range.  Caller should delete
@@ -256,10 +351,20 @@ class VersionSet {
   // The caller should delete the iterator when no longer needed.
   Iterator* MakeInputIterator(Compaction* c);
 
+  // NoveLSM: Split the key range of "*c" into at most n pieces holding
+  // about the same number of input bytes, for subcompactions.  Stores
+  // the user keys at which the pieces after the first one start in
+  // *boundaries, in ascending order; leaves it empty if "*c" is not
+  // worth splitting.  Cuts only fall on input file boundaries.
+  void SplitCompaction(Compaction* c, int n,
+                       std::vector<std::string>* boundaries);
+
   // Returns true iff some level needs a compaction.
   bool NeedsCompaction() const {
     Version* v = current_;
-    return (v->compaction_score_ >= 1) || (v->file_to_compact_ != NULL);
+    return (v->compaction_score_ >= 1) ||
+           (v->file_to_compact_ != NULL &&
+            options_->compaction_style == kCompactionStyleLeveled);
   }
 
   // Add all files listed in any live version to *live.
@@ -298,6 +403,12 @@ class VersionSet {
 
   void SetupOtherInputs(Compaction* c);
 
+  // NoveLSM: Size compaction of "level", or NULL if all its files are busy
+  Compaction* PickLevelCompaction(int level);
+
+  // NoveLSM: PickCompaction() with Options::compaction_style universal
+  Compaction* PickUniversalCompaction();
+
   // Save current contents to *log
   Status WriteSnapshot(log::Writer* log);
 
@@ -327,6 +438,9 @@ class VersionSet {
   // Either an empty string, or a valid InternalKey.
   std::string compact_pointer_[config::kNumLevels];
 
+  // NoveLSM: Compactions in progress, see RegisterCompaction()
+  std::vector<Compaction*> running_compactions_;
+
   // No copying allowed
   VersionSet(const VersionSet&);
   void operator=(const VersionSet&);
@@ -339,36 +453,64 @@ class Compaction {
 
   // Return the level that is being compacted.  Inputs from "level"
   // and "level+1" will be merged to produce a set of "level+1" files.
+  // NoveLSM: A universal compaction merges all files of the levels from
+  // "level" to output_level() into a set of output_level() files.
   int level() const { return level_; }
 
+  // NoveLSM: Level of the files built, level()+1 unless universal
+  int output_level() const { return level_ + num_input_levels_ - 1; }
+
+  // NoveLSM: Number of levels read, from level() to output_level()
+  int num_input_levels() const { return num_input_levels_; }
+
   // Return the object that holds the edits to the descriptor done
   // by this compaction.
   VersionEdit* edit() { return &edit_; }
 
-  // "which" must be either 0 or 1
+  // "which" must be in [0,num_input_levels())
   int num_input_files(int which) const { return inputs_[which].size(); }
 
-  // Return the ith input file at "level()+which" ("which" must be 0 or 1).
+  // Return the ith input file at "level()+which" ("which" must be in
+  // [0,num_input_levels())).
   FileMetaData* input(int which, int i) const { return inputs_[which][i]; }
 
   // Maximum size of files to build during this compaction.
   uint64_t MaxOutputFileSize() const { return max_output_file_size_; }
 
   // Is this a trivial compaction that can be implemented by just
-  // moving a single input file to the next level (no merging or splitting)
+  // moving a single input file to the output level (no merging or
+  // splitting)
   bool IsTrivialMove() const;
 
   // Add all inputs to this compaction as delete operations to *edit.
   void AddInputDeletions(VersionEdit* edit);
 
+  // NoveLSM: Position of IsBaseLevelForKey() and ShouldStopBefore() in
+  // the key space, which they only walk forward.  Subcompactions over
+  // disjoint key ranges each keep their own, so that they can run
+  // concurrently.
+  struct Cursor {
+    size_t grandparent_index;   // Index in grandparents_
+    bool seen_key;              // Some output key has been seen
+    int64_t overlapped_bytes;   // Bytes of overlap between current output
+                                // and grandparent files
+
+    // Indices into input_version_->files_ for all levels below the
+    // output level
+    size_t level_ptrs[config::kNumLevels];
+
+    Cursor();
+  };
+
   // Returns true if the information we have available guarantees that
-  // the compaction is producing data in "level+1" for which no data exists
-  // in levels greater than "level+1".
-  bool IsBaseLevelForKey(const Slice& user_key);
+  // the compaction is producing data in output_level() for which no data
+  // exists in levels greater than output_level().  Uses *cursor if non-NULL, and the
+  // compaction's own cursor otherwise.
+  bool IsBaseLevelForKey(const Slice& user_key, Cursor* cursor = NULL);
 
   // Returns true iff we should stop building the current output
   // before processing "internal_key".
-  bool ShouldStopBefore(const Slice& internal_key);
+  bool ShouldStopBefore(const Slice& internal_key, Cursor* cursor = NULL);
 
   // Release the input version for the compaction, once the compaction
   // is successful.
@@ -381,28 +523,25 @@ class Compaction {
   explicit Compaction(int level);
 
   int level_;
+  int num_input_levels_;
   uint64_t max_output_file_size_;
   Version* input_version_;
   VersionEdit edit_;
 
-  // Each compaction reads inputs from "level_" and "level_+1"
-  std::vector<FileMetaData*> inputs_[2];      // The two sets of inputs
+  // Each compaction reads inputs from "level_" and "level_+1", or
+  // NoveLSM: up to output_level() if universal
+  std::vector<FileMetaData*> inputs_[config::kNumLevels];
 
   // State used to check for number of of overlapping grandparent files
-  // (parent == level_ + 1, grandparent == level_ + 2)
+  // (parent == output level, grandparent == output level + 1)
   std::vector<FileMetaData*> grandparents_;
-  size_t grandparent_index_;  // Index in grandparent_starts_
-  bool seen_key_;             // Some output key has been seen
-  int64_t overlapped_bytes_;  // Bytes of overlap between current output
-                              // and grandparent files
-
-  // State for implementing IsBaseLevelForKey
-
-  // level_ptrs_ holds indices into input_version_->levels_: our state
-  // is that we are positioned at one of the file ranges for each
-  // higher level than the ones involved in this compaction (i.e. for
-  // all L >= level_ + 2).
-  size_t level_ptrs_[config::kNumLevels];
+
+  // State for implementing IsBaseLevelForKey and ShouldStopBefore when
+  // the caller does not pass its own cursor.  The level pointers say
+  // that we are positioned at one of the file ranges for each higher
+  // level than the ones involved in this compaction (i.e. for all
+  // L > output_level()).
+  Cursor cursor_;
 };
 
 }  // namespace novelsm
@@ -3,6 +3,8 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include "db/version_set.h"
+#include "db/table_cache.h"
+#include "novelsm/env.h"
 #include "util/logging.h"
 #include "util/testharness.h"
 #include "util/testutil.h"
@@ -172,6 +174,194 @@ TEST(FindFileTest, OverlappingFiles) {
   ASSERT_TRUE(Overlaps("600", "700"));
 }
 
+class UniversalCompactionTest {
+ public:
+  std::string dbname_;
+  Options options_;
+  InternalKeyComparator icmp_;
+  TableCache* table_cache_;
+  VersionSet* vset_;
+  port::Mutex mu_;
+  uint64_t next_seq_;
+
+  UniversalCompactionTest()
+      : icmp_(BytewiseComparator()),
+        next_seq_(1000) {
+    dbname_ = test::TmpDir() + "/universal_compaction_test";
+    DeleteFiles();
+    Env::Default()->CreateDir(dbname_);
+    options_.compaction_style = kCompactionStyleUniversal;
+    options_.universal_max_sorted_runs = 4;
+    table_cache_ = new TableCache(dbname_, &options_, 100);
+    vset_ = new VersionSet(dbname_, &options_, table_cache_, &icmp_);
+  }
+
+  ~UniversalCompactionTest() {
+    delete vset_;
+    delete table_cache_;
+    DeleteFiles();
+  }
+
+  void DeleteFiles() {
+    std::vector<std::string> children;
+    Env::Default()->GetChildren(dbname_, &children);
+    for (size_t i = 0; i < children.size(); i++) {
+      Env::Default()->DeleteFile(dbname_ + "/" + children[i]);
+    }
+    Env::Default()->DeleteDir(dbname_);
+  }
+
+  // Level 0 files are added oldest first, with newer sequence numbers
+  void Add(int level, const char* smallest, const char* largest,
+           uint64_t file_size) {
+    VersionEdit edit;
+    edit.AddFile(level, vset_->NewFileNumber(), file_size,
+                 InternalKey(smallest, next_seq_, kTypeValue),
+                 InternalKey(largest, next_seq_, kTypeValue));
+    next_seq_++;
+    mu_.Lock();
+    ASSERT_OK(vset_->LogAndApply(&edit, &mu_));
+    mu_.Unlock();
+  }
+
+  // "files at level 0,files at level 1,..." of the inputs of *c
+  std::string Inputs(Compaction* c) {
+    std::string result;
+    for (int which = 0; which < c->num_input_levels(); which++) {
+      char buf[100];
+      snprintf(buf, sizeof(buf), "%s%d", (which ? "," : ""),
+               c->num_input_files(which));
+      result += buf;
+    }
+    return result;
+  }
+};
+
+static const uint64_t kMB = 1048576;
+
+TEST(UniversalCompactionTest, BelowLimit) {
+  Add(0, "a", "z", kMB);
+  Add(0, "a", "z", kMB);
+  Add(3, "a", "z", 10 * kMB);
+  ASSERT_TRUE(vset_->PickCompaction() == NULL);
+}
+
+TEST(UniversalCompactionTest, Level0Alone) {
+  // With nothing below, level 0 goes to the last level
+  for (int i = 0; i < 4; i++) {
+    Add(0, "a", "z", kMB);
+  }
+  Compaction* c = vset_->PickCompaction();
+  ASSERT_TRUE(c != NULL);
+  ASSERT_EQ(0, c->level());
+  ASSERT_EQ(config::kNumLevels - 1, c->output_level());
+  ASSERT_EQ(config::kNumLevels, c->num_input_levels());
+  ASSERT_EQ("4,0,0,0,0,0,0", Inputs(c));
+  ASSERT_TRUE(!c->IsTrivialMove());
+  ASSERT_TRUE(c->IsBaseLevelForKey("a"));
+  ASSERT_TRUE(c->IsBaseLevelForKey("z"));
+  delete c;
+}
+
+TEST(UniversalCompactionTest, Level0AboveOlderRun) {
+  // Level 0 goes to the free level just above the much larger run
+  for (int i = 0; i < 4; i++) {
+    Add(0, "a", "z", kMB);
+  }
+  Add(6, "k", "p", 100 * kMB);
+  Compaction* c = vset_->PickCompaction();
+  ASSERT_TRUE(c != NULL);
+  ASSERT_EQ(0, c->level());
+  ASSERT_EQ(5, c->output_level());
+  ASSERT_EQ(6, c->num_input_levels());
+  ASSERT_EQ("4,0,0,0,0,0", Inputs(c));
+
+  // Keys within the older run are not at their base level; asked in
+  // increasing order, as a compaction does
+  ASSERT_TRUE(c->IsBaseLevelForKey("a"));
+  ASSERT_TRUE(c->IsBaseLevelForKey("j"));
+  ASSERT_TRUE(!c->IsBaseLevelForKey("k"));
+  ASSERT_TRUE(!c->IsBaseLevelForKey("m"));
+  ASSERT_TRUE(!c->IsBaseLevelForKey("p"));
+  ASSERT_TRUE(c->IsBaseLevelForKey("q"));
+  ASSERT_TRUE(c->IsBaseLevelForKey("z"));
+
+  // A cursor of its own starts over
+  Compaction::Cursor cursor;
+  ASSERT_TRUE(!c->IsBaseLevelForKey("m", &cursor));
+  ASSERT_TRUE(c->IsBaseLevelForKey("z", &cursor));
+  delete c;
+}
+
+TEST(UniversalCompactionTest, Level0MergesIntoLevel1) {
+  // No free level above level 1: level 0 merges with it
+  for (int i = 0; i < 3; i++) {
+    Add(0, "a", "z", kMB);
+  }
+  Add(1, "a", "z", 100 * kMB);
+  Compaction* c = vset_->PickCompaction();
+  ASSERT_TRUE(c != NULL);
+  ASSERT_EQ(0, c->level());
+  ASSERT_EQ(1, c->output_level());
+  ASSERT_EQ(2, c->num_input_levels());
+  ASSERT_EQ("3,1", Inputs(c));
+  delete c;
+}
+
+TEST(UniversalCompactionTest, SimilarRuns) {
+  // The two 10MB runs are merged; level 0 is left alone
+  Add(0, "a", "z", kMB);
+  Add(2, "a", "m", 10 * kMB);
+  Add(3, "a", "z", 10 * kMB);
+  Add(6, "a", "z", 100 * kMB);
+  Compaction* c = vset_->PickCompaction();
+  ASSERT_TRUE(c != NULL);
+  ASSERT_EQ(2, c->level());
+  ASSERT_EQ(3, c->output_level());
+  ASSERT_EQ(2, c->num_input_levels());
+  ASSERT_EQ("1,1", Inputs(c));
+  ASSERT_TRUE(!c->IsBaseLevelForKey("a"));
+  delete c;
+}
+
+TEST(UniversalCompactionTest, NewestRuns) {
+  // Each run is far larger than the newer ones: the newest two are
+  // merged, which leaves fewer runs than the limit
+  Add(0, "a", "z", kMB);
+  Add(1, "a", "z", 10 * kMB);
+  Add(2, "a", "z", 100 * kMB);
+  Add(3, "a", "z", 1000 * kMB);
+  Compaction* c = vset_->PickCompaction();
+  ASSERT_TRUE(c != NULL);
+  ASSERT_EQ(0, c->level());
+  ASSERT_EQ(1, c->output_level());
+  ASSERT_EQ("1,1", Inputs(c));
+  delete c;
+}
+
+TEST(UniversalCompactionTest, ManualCompactRange) {
+  // A manual compaction merges one level into the next, as with
+  // leveled compaction, which keeps every level older than those above
+  Add(0, "a", "z", kMB);
+  Add(0, "a", "z", kMB);
+  Add(3, "a", "z", 10 * kMB);
+  Compaction* c = vset_->CompactRange(0, NULL, NULL);
+  ASSERT_TRUE(c != NULL);
+  ASSERT_EQ(0, c->level());
+  ASSERT_EQ(1, c->output_level());
+  ASSERT_EQ(2, c->num_input_levels());
+  ASSERT_EQ("2,0", Inputs(c));
+  ASSERT_TRUE(!c->IsBaseLevelForKey("m"));
+  delete c;
+
+  c = vset_->CompactRange(3, NULL, NULL);
+  ASSERT_TRUE(c != NULL);
+  ASSERT_EQ(4, c->output_level());
+  ASSERT_TRUE(c->IsTrivialMove());
+  ASSERT_TRUE(c->IsBaseLevelForKey("m"));
+  delete c;
+}
+
 }  // namespace novelsm
 
 int main(int argc, char** argv) {
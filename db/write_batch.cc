@@ -124,16 +124,72 @@ class MemTableInserter : public WriteBatch::Handler {
     sequence_++;
   }
 };
+
+// NoveLSM: Stages the whole batch (a single write or a group built by
+// BuildBatchGroup) so an NVM memtable persists it with one fence.
+class MemTableStager : public WriteBatch::Handler {
+ public:
+  SequenceNumber sequence_;
+  MemTable* mem_;
+
+  virtual void Put(const Slice& key, const Slice& value) {
+    mem_->StageAdd(sequence_, kTypeValue, key, value);
+    sequence_++;
+  }
+  virtual void Delete(const Slice& key) {
+    mem_->StageAdd(sequence_, kTypeDeletion, key, Slice());
+    sequence_++;
+  }
+};
+
+class MemTableConcurrentInserter : public WriteBatch::Handler {
+ public:
+  SequenceNumber sequence_;
+  MemTable* mem_;
+  Status status_;
+
+  virtual void Put(const Slice& key, const Slice& value) {
+    Add(kTypeValue, key, value);
+  }
+  virtual void Delete(const Slice& key) {
+    Add(kTypeDeletion, key, Slice());
+  }
+
+ private:
+  void Add(ValueType type, const Slice& key, const Slice& value) {
+    if (status_.ok() && !mem_->AddConcurrently(sequence_, type, key, value)) {
+      status_ = Status::IOError("NVM memtable is out of space");
+    }
+    sequence_++;
+  }
+};
 }  // namespace
 
 Status WriteBatchInternal::InsertInto(const WriteBatch* b,
                                       MemTable* memtable) {
+  if (memtable->isNVMMemtable) {
+    MemTableStager stager;
+    stager.sequence_ = WriteBatchInternal::Sequence(b);
+    stager.mem_ = memtable;
+    Status s = b->Iterate(&stager);
+    memtable->CommitBatch();
+    return s;
+  }
   MemTableInserter inserter;
   inserter.sequence_ = WriteBatchInternal::Sequence(b);
   inserter.mem_ = memtable;
   return b->Iterate(&inserter);
 }
 
+Status WriteBatchInternal::InsertIntoConcurrently(const WriteBatch* b,
+                                                  MemTable* memtable) {
+  MemTableConcurrentInserter inserter;
+  inserter.sequence_ = WriteBatchInternal::Sequence(b);
+  inserter.mem_ = memtable;
+  Status s = b->Iterate(&inserter);
+  return s.ok() ? inserter.status_ : s;
+}
+
 void WriteBatchInternal::SetContents(WriteBatch* b, const Slice& contents) {
   assert(contents.size() >= kHeader);
   b->rep_.assign(contents.data(), contents.size());
@@ -41,6 +41,11 @@ class WriteBatchInternal {
 
   static Status InsertInto(const WriteBatch* batch, MemTable* memtable);
 
+  // NoveLSM: Like InsertInto() but safe to run alongside other
+  // InsertIntoConcurrently() calls on the same NVM memtable.
+  static Status InsertIntoConcurrently(const WriteBatch* batch,
+                                       MemTable* memtable);
+
   static void Append(WriteBatch* dst, const WriteBatch* src);
 };
 
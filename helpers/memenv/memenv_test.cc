@@ -191,6 +191,58 @@ TEST(MemEnvTest, LargeWrite) {
   delete [] scratch;
 }
 
+TEST(MemEnvTest, SubmitAndWaitForReads) {
+  // NoveLSM: A batch submitted with SubmitReads() reads the same bytes,
+  // with the same statuses, as RandomAccessFile::Read() would
+  const int kFileSize = 10000;
+  std::string data;
+  for (int i = 0; i < kFileSize; i++) data.push_back('a' + i % 26);
+
+  WritableFile* writable_file;
+  ASSERT_OK(env_->CreateDir("/dir"));
+  ASSERT_OK(env_->NewWritableFile("/dir/f", &writable_file));
+  ASSERT_OK(writable_file->Append(data));
+  delete writable_file;
+
+  RandomAccessFile* rand_file;
+  ASSERT_OK(env_->NewRandomAccessFile("/dir/f", &rand_file));
+
+  const uint64_t offsets[] = {0, 5000, 9950, kFileSize, kFileSize + 10};
+  const size_t lengths[] = {100, 200, 100, 10, 10};
+  const int n = sizeof(offsets) / sizeof(offsets[0]);
+  ReadRequest reqs[n];
+  std::vector<std::string> scratch(n);
+  for (int i = 0; i < n; i++) {
+    scratch[i].resize(lengths[i]);
+    reqs[i].file = rand_file;
+    reqs[i].offset = offsets[i];
+    reqs[i].n = lengths[i];
+    reqs[i].scratch = &scratch[i][0];
+  }
+  env_->SubmitReads(reqs, n);
+  env_->WaitForReads(reqs, n);
+
+  for (int i = 0; i < n; i++) {
+    char buf[200];
+    Slice expected;
+    Status s = rand_file->Read(offsets[i], lengths[i], &expected, buf);
+    ASSERT_EQ(s.ToString(), reqs[i].status.ToString());
+    if (s.ok()) {
+      ASSERT_EQ(expected.ToString(), reqs[i].result.ToString());
+    }
+  }
+  ASSERT_EQ(data.substr(5000, 200), reqs[1].result.ToString());
+  ASSERT_EQ(50, reqs[2].result.size());
+  ASSERT_EQ(0, reqs[3].result.size());
+  ASSERT_TRUE(!reqs[4].status.ok());
+
+  // The requests can be submitted again once waited for
+  env_->SubmitReads(reqs, 1);
+  env_->WaitForReads(reqs, 1);
+  ASSERT_EQ(data.substr(0, 100), reqs[0].result.ToString());
+  delete rand_file;
+}
+
 TEST(MemEnvTest, DBTest) {
   Options options;
   options.create_if_missing = true;
@@ -200,7 +252,17 @@ TEST(MemEnvTest, DBTest) {
   const Slice keys[] = {Slice("aaa"), Slice("bbb"), Slice("ccc")};
   const Slice vals[] = {Slice("foo"), Slice("bar"), Slice("baz")};
 
-  ASSERT_OK(DB::Open(options, "/dir/db", &db));
+  // NoveLSM: The NVM memtables are mapped from real files, so their
+  // directory lives on the default Env
+  const std::string dbname_mem = test::TmpDir() + "/memenv_db_mem";
+  std::vector<std::string> stale;
+  Env::Default()->GetChildren(dbname_mem, &stale);
+  for (size_t i = 0; i < stale.size(); i++) {
+    Env::Default()->DeleteFile(dbname_mem + "/" + stale[i]);
+  }
+  Env::Default()->CreateDir(dbname_mem);
+
+  ASSERT_OK(DB::Open(options, "/dir/db", dbname_mem, &db));
   for (size_t i = 0; i < 3; ++i) {
     ASSERT_OK(db->Put(WriteOptions(), keys[i], vals[i]));
   }
@@ -10,8 +10,8 @@
 // length strings, may use the length of the string as the charge for
 // the string.
 //
-// A builtin cache implementation with a least-recently-used eviction
-// policy is provided.  Clients may use their own implementations if
+// Builtin cache implementations with least-recently-used and CLOCK
+// eviction policies are provided.  Clients may use their own implementations if
 // they want something more sophisticated (like scan-resistance, a
 // custom eviction policy, variable cache sizing, etc.)
 
@@ -29,6 +29,13 @@ class Cache;
 // of Cache uses a least-recently-used eviction policy.
 extern Cache* NewLRUCache(size_t capacity);
 
+// NoveLSM: Create a new cache with a fixed size capacity that evicts by
+// CLOCK.  Lookup() and Release() are lock-free, so readers on many
+// threads do not contend on shard mutexes.  Its hash table is sized
+// for entries of about 4KB; a cache of much smaller entries is limited
+// by the table rather than the capacity.
+extern Cache* NewClockCache(size_t capacity);
+
 class Cache {
  public:
   Cache() { }
@@ -52,6 +59,22 @@ class Cache {
   virtual Handle* Insert(const Slice& key, void* value, size_t charge,
                          void (*deleter)(const Slice& key, void* value)) = 0;
 
+  // NoveLSM: Eviction priority of an entry.  kHigh entries, such as
+  // index and filter blocks, are evicted only after the kLow ones,
+  // unless they fill more than half of the cache.
+  enum Priority {
+    kLow,
+    kHigh
+  };
+
+  // Like Insert() above, with an eviction priority.  The default
+  // implementation ignores the priority.
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value),
+                         Priority priority) {
+    return Insert(key, value, charge, deleter);
+  }
+
   // If the cache has no mapping for "key", returns NULL.
   //
   // Else return a handle that corresponds to the mapping.  The caller
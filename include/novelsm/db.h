@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <vector>
 #include "novelsm/iterator.h"
 #include "novelsm/options.h"
 
@@ -38,6 +39,53 @@ struct Range {
   Range(const Slice& s, const Slice& l) : start(s), limit(l) { }
 };
 
+// A value returned by DB::Get() without copying it out of the DB.
+// data() either points straight into DB-owned memory (a DRAM or NVM
+// memtable, or an sstable block), which then stays pinned until
+// Release() is called or the handle is destroyed, or into a buffer
+// owned by the handle itself.
+//
+// A pinned value must be released before the DB is deleted.  While a
+// memtable value is pinned, NVM in-place updates are suspended.
+class PinnedSlice {
+ public:
+  PinnedSlice();
+  ~PinnedSlice();
+
+  const Slice& data() const { return data_; }
+  size_t size() const { return data_.size(); }
+  std::string ToString() const { return data_.ToString(); }
+
+  // Return true iff data() refers to memory owned by the DB.
+  bool pinned() const { return cleanup_ != NULL; }
+
+  // Drop the pin (if any) and empty the value.
+  void Release();
+
+  // The methods below are for DB implementations.
+  //
+  // Point at "s" and invoke (*function)(arg1, arg2) once it is released.
+  typedef void (*CleanupFunction)(void* arg1, void* arg2);
+  void PinSlice(const Slice& s, CleanupFunction function,
+                void* arg1, void* arg2);
+
+  // Buffer to copy a value into that cannot be pinned, followed by
+  // PinSelf() to make data() refer to it.
+  std::string* GetSelf() { return &buf_; }
+  void PinSelf() { data_ = buf_; }
+
+ private:
+  Slice data_;
+  std::string buf_;
+  CleanupFunction cleanup_;
+  void* arg1_;
+  void* arg2_;
+
+  // No copying allowed
+  PinnedSlice(const PinnedSlice&);
+  void operator=(const PinnedSlice&);
+};
+
 // A DB is a persistent ordered map from keys to values.
 // A DB is safe for concurrent access from multiple threads without
 // any external synchronization.
@@ -84,6 +132,26 @@ class DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key, std::string* value) = 0;
 
+  // Same as above, but on success *value refers to the stored bytes
+  // without copying them (see PinnedSlice).  Any value previously held
+  // by *value is released first.
+  //
+  // The default implementation copies into the handle's own buffer.
+  virtual Status Get(const ReadOptions& options,
+                     const Slice& key, PinnedSlice* value);
+
+  // Look up every keys[i] as Get() would, storing the value in
+  // (*values)[i] and the outcome in (*statuses)[i].  Both vectors are
+  // resized to keys.size().  All keys are read from the same state of
+  // the DB.
+  //
+  // The default implementation calls Get() for each key under a
+  // snapshot.
+  virtual void MultiGet(const ReadOptions& options,
+                        const std::vector<Slice>& keys,
+                        std::vector<std::string>* values,
+                        std::vector<Status>* statuses);
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
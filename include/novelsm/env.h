@@ -28,6 +28,25 @@ class SequentialFile;
 class Slice;
 class WritableFile;
 
+// NoveLSM: One read of a batch handed to Env::SubmitReads()
+struct ReadRequest {
+  RandomAccessFile* file;
+  uint64_t offset;
+  size_t n;
+  char* scratch;          // At least n bytes, live until completion
+
+  // Outcome, valid once Env::WaitForReads() has returned.  As with
+  // RandomAccessFile::Read(), result may point into scratch.
+  Slice result;
+  Status status;
+
+  // Private to the Env while the read is in flight
+  void* env_state;
+
+  ReadRequest()
+      : file(NULL), offset(0), n(0), scratch(NULL), env_state(NULL) { }
+};
+
 class Env {
  public:
   Env() { }
@@ -140,6 +159,28 @@ class Env {
       void (*function)(void* arg),
       void* arg) = 0;
 
+  // NoveLSM: Background thread pools.  kLow runs long work such as
+  // compactions and is the pool of the Schedule() above; kHigh runs
+  // short, urgent work such as memtable flushes, so that it never waits
+  // behind the kLow work.
+  enum Priority {
+    kLow,
+    kHigh
+  };
+
+  // Arrange to run "(*function)(arg)" once in a thread of the pool of
+  // the given priority.
+  //
+  // The default implementation ignores the priority.
+  virtual void Schedule(void (*function)(void* arg), void* arg,
+                        Priority pri);
+
+  // Let the pool of the given priority run up to "number" functions at
+  // once, if it runs fewer.  Pools start out with one thread.
+  //
+  // The default implementation does nothing.
+  virtual void SetBackgroundThreads(int number, Priority pri);
+
   // Start a new thread, invoking "function(arg)" within the new thread.
   // When "function(arg)" returns, the thread will be destroyed.
   virtual void StartThread(void (*function)(void* arg), void* arg) = 0;
@@ -160,6 +201,19 @@ class Env {
   // Sleep/delay the thread for the prescribed number of micro-seconds.
   virtual void SleepForMicroseconds(int micros) = 0;
 
+  // NoveLSM: Start the reads in reqs[0..n-1] and return without waiting
+  // for them, so that they proceed concurrently.  The same thread must
+  // pass the same requests to WaitForReads() before it submits again or
+  // frees them.
+  //
+  // The default implementation only calls RandomAccessFile::Prefetch()
+  // here and reads in WaitForReads().
+  virtual void SubmitReads(ReadRequest* reqs, int n);
+
+  // NoveLSM: Wait for the reads started by SubmitReads(reqs, n) and fill
+  // in their result and status.
+  virtual void WaitForReads(ReadRequest* reqs, int n);
+
  private:
   // No copying allowed
   Env(const Env&);
@@ -215,6 +269,12 @@ class RandomAccessFile {
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                       char* scratch) const = 0;
 
+  // NoveLSM: Hint that [offset, offset+n) will be read soon, so that the
+  // data can be fetched in the background.  The default does nothing.
+  //
+  // Safe for concurrent use by multiple threads.
+  virtual void Prefetch(uint64_t offset, size_t n) const { }
+
  private:
   // No copying allowed
   RandomAccessFile(const RandomAccessFile&);
@@ -327,6 +387,12 @@ class EnvWrapper : public Env {
   void Schedule(void (*f)(void*), void* a) {
     return target_->Schedule(f, a);
   }
+  void Schedule(void (*f)(void*), void* a, Priority pri) {
+    return target_->Schedule(f, a, pri);
+  }
+  void SetBackgroundThreads(int number, Priority pri) {
+    return target_->SetBackgroundThreads(number, pri);
+  }
   void StartThread(void (*f)(void*), void* a) {
     return target_->StartThread(f, a);
   }
@@ -342,6 +408,12 @@ class EnvWrapper : public Env {
   void SleepForMicroseconds(int micros) {
     target_->SleepForMicroseconds(micros);
   }
+  void SubmitReads(ReadRequest* reqs, int n) {
+    target_->SubmitReads(reqs, n);
+  }
+  void WaitForReads(ReadRequest* reqs, int n) {
+    target_->WaitForReads(reqs, n);
+  }
  private:
   Env* target_;
 };
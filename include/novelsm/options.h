@@ -27,6 +27,16 @@ enum CompressionType {
   kSnappyCompression = 0x1
 };
 
+// NoveLSM: How tables are merged down the levels
+enum CompactionStyle {
+  // Each level is a sorted run about ten times larger than the one
+  // above, and parts of it are merged into the next level
+  kCompactionStyleLeveled = 0,
+  // Level 0 and every non-empty level below it are sorted runs of any
+  // size, and whole runs of similar size are merged together
+  kCompactionStyleUniversal = 1
+};
+
 // Options to control the behavior of a database (passed to DB::Open)
 struct Options {
   // -------------------
@@ -149,6 +159,172 @@ struct Options {
   //Secondary disk path
   const char *sec_diskpath;
 
+  //NoveLSM: Let every writer of a batch group insert its own batch
+  //into the NVM memtable in parallel (lock-free skiplist linking and
+  //allocation) instead of the leader applying the whole group.
+  //Sequence numbers are still assigned up front by the leader.
+  //
+  // Default: false
+  bool concurrent_nvm_writes;
+
+  //NoveLSM: With concurrent_nvm_writes, give each writer thread its own
+  //allocation slab of this many bytes in the NVM memtable instead of
+  //bumping one shared pointer per allocation. Slabs are reserved from
+  //the memtable's space, so keep this well below nvm_buffer_size.
+  //
+  // Default: 0 (no slabs)
+  size_t nvm_slab_size;
+
+  //NoveLSM: Number of full memtables that may wait for compaction to L0
+  //before writes stall. Full memtables are kept in a ring, searched by
+  //Get and iterators, and flushed oldest first, so bursts of writes keep
+  //going into a fresh memtable while earlier ones are being compacted.
+  //Values are clipped to [1, 10].
+  //
+  // Default: 1
+  int num_immutable_memtables;
+
+  //NoveLSM: Let a Put into the NVM memtable overwrite the value of the
+  //newest entry for the same key in place when both values have the
+  //same size, instead of appending a new entry. The update is
+  //crash-atomic (redo slot in the memtable's map file). It is skipped
+  //while any snapshot or iterator is live, with concurrent_nvm_writes,
+  //and for values larger than about 4KB.
+  //
+  // Default: false
+  bool nvm_inplace_updates;
+
+  //NoveLSM: Keep a hash index of user key to newest entry inside each
+  //NVM memtable's mapping, so point reads skip the skiplist search. It
+  //takes about nvm_buffer_size/8 bytes of the mapping and is rebuilt
+  //from the skiplist when a memtable is recovered.
+  //
+  // Default: false
+  bool nvm_hash_index;
+
+  //NoveLSM: Track the keys of every memtable in a Bloom filter.
+  //With num_read_threads, a Get for a key the filters know about then
+  //searches the memtables first instead of starting the parallel
+  //SSTable search. Works with arbitrary binary keys. Each filter is
+  //sized for one key per 64 bytes of its memtable's buffer at 10 bits
+  //per key, so it takes about 1/50 of write_buffer_size (DRAM
+  //memtables) or nvm_buffer_size (NVM memtables) of DRAM, e.g. 800KB
+  //for the default 40MB NVM buffer, for as long as the memtable lives.
+  //
+  // Default: true if built with _ENABLE_PREDICTION, false otherwise
+  bool nvm_hit_prediction;
+
+  //NoveLSM: Fit a piecewise-linear model over the file bounds of each
+  //level and over the index block of each open table. FindFile() and
+  //index block seeks then search a small predicted window, falling back
+  //to the full binary search when the window misses. Needs the default
+  //bytewise comparator and is ignored with any other.
+  //
+  // Default: false
+  bool learned_index;
+
+  //NoveLSM: When a Get() has to probe several level-0 tables, or a
+  //MultiGet() several tables of one level, read the candidate data
+  //blocks into the block cache as one batch through Env::SubmitReads()
+  //first. With io_uring the reads then run concurrently instead of one
+  //after another. Level-0 batches start only after the newest table
+  //missed, so a hit there reads no other table's blocks.
+  //
+  // Default: false
+  bool async_block_reads;
+
+  //NoveLSM: Size of a second block cache tier kept in a file mapped
+  //from the NVM path. Data blocks that keep being read from the table
+  //files are stored there and read back before going to disk. The tier
+  //persists across restarts. Only pays off for tables that are read
+  //with pread rather than through mmap. 0 disables it.
+  //
+  // Default: 0
+  size_t nvm_block_cache_size;
+
+  //NoveLSM: Keep the index block and filter of each table in block_cache
+  //as high priority entries instead of on the heap of the open table, so
+  //that their memory is bounded by the cache capacity. Ignored without a
+  //block_cache.
+  //
+  // Default: false
+  bool cache_index_and_filter_blocks;
+
+  //NoveLSM: With cache_index_and_filter_blocks, the index blocks and
+  //filters of tables in levels below this one stay pinned in the cache
+  //once read, for as long as the table is open. 2 pins level 0 and 1.
+  //
+  // Default: 0
+  int pin_index_and_filter_levels;
+
+  //NoveLSM: Split a compaction into up to this many key ranges of about
+  //the same input size, and merge them concurrently on a pool of
+  //max_subcompactions-1 threads plus the background thread. The outputs
+  //of all ranges are installed together. 1 keeps compactions serial.
+  //
+  // Default: 1
+  int max_subcompactions;
+
+  //NoveLSM: Compactions that may run at the same time on the low
+  //priority threads of env. Compactions that read the same files or
+  //write into overlapping key ranges of a level never run together.
+  //
+  // Default: 1
+  int max_background_compactions;
+
+  //NoveLSM: Threads of env, at high priority, that flush immutable
+  //memtables, so a flush never waits behind a compaction. 0 leaves the
+  //flushes to the compaction threads. Memtables are still flushed one at
+  //a time, oldest first. While flushes or compactions run concurrently,
+  //memtables are always flushed into level 0.
+  //
+  // Default: 0
+  int max_background_flushes;
+
+  //NoveLSM: Split a memtable flush into up to this many key ranges of
+  //about the same size, and build their level-0 tables concurrently on
+  //a pool of flush_partitions-1 threads plus the flushing thread. The
+  //tables do not overlap, so level 0 compaction and write stalls count
+  //the sorted runs of level 0 rather than its files. Each range holds
+  //at least a few MB of the memtable. 1 builds one table per flush.
+  //
+  // Default: 1
+  int flush_partitions;
+
+  //NoveLSM: Flush an immutable memtable by merging it with the level 1
+  //files it overlaps, in one pass that writes level 1 tables, instead of
+  //writing it to level 0 for a later compaction to merge down. Only done
+  //while level 0 is empty and those level 1 files are not being
+  //compacted, and if they hold at most about 20MB; otherwise the
+  //memtable goes to level 0 as usual, and later flushes merge again once
+  //level 0 has been compacted. Ignored with kCompactionStyleUniversal.
+  //
+  // Default: false
+  bool flush_to_level1;
+
+  //NoveLSM: With kCompactionStyleUniversal, data is written about once
+  //per merge of runs of similar size instead of about ten times per
+  //level, at the cost of more sorted runs for reads to check and of
+  //space held by overwritten keys until their runs get merged. Reads
+  //probe at most universal_max_sorted_runs runs plus the level 0 tables
+  //of a partitioned flush; a filter_policy keeps most probes off disk.
+  //
+  // Default: kCompactionStyleLeveled
+  CompactionStyle compaction_style;
+
+  //NoveLSM: Universal compaction merges a run with the newer ones when
+  //it is at most this many percent larger than all of them together.
+  //
+  // Default: 1
+  int universal_size_ratio;
+
+  //NoveLSM: Universal compaction starts once there are this many sorted
+  //runs, counting each level 0 table that overlaps another as a run.
+  //Values are clipped to [2, 8], as writes slow down at 8 level 0 runs.
+  //
+  // Default: 4
+  int universal_max_sorted_runs;
+
   // Create an Options object with default values for all fields.
   Options();
 };
@@ -179,7 +355,8 @@ struct ReadOptions {
   ReadOptions()
       : verify_checksums(false),
         fill_cache(true),
-        snapshot(NULL) {
+        snapshot(NULL),
+        num_read_threads(0) {
   }
 };
 
@@ -6,16 +6,21 @@
 #define STORAGE_NOVELSM_INCLUDE_TABLE_H_
 
 #include <stdint.h>
+#include "novelsm/cache.h"
 #include "novelsm/iterator.h"
 
 namespace novelsm {
 
 class Block;
+struct BlockContents;
 class BlockHandle;
+class FilterBlockReader;
 class Footer;
+class NvmBlockCache;
 struct Options;
 class RandomAccessFile;
 struct ReadOptions;
+struct ReadRequest;
 class TableCache;
 
 // A Table is a sorted map from strings to strings.  Tables are
@@ -62,15 +67,73 @@ class Table {
   explicit Table(Rep* rep) { rep_ = rep; }
   static Iterator* BlockReader(void*, const ReadOptions&, const Slice&);
 
+  // NoveLSM: Open() for TableCache.  With
+  // options.cache_index_and_filter_blocks the index block and filter
+  // are kept in the block cache under cache_owner and file_number, so
+  // they are found again when the same file is reopened.
+  static Status Open(const Options& options,
+                     RandomAccessFile* file,
+                     uint64_t file_size,
+                     uint64_t cache_owner,
+                     uint64_t file_number,
+                     Table** table);
+
+  // The index block and filter of the table.  If they live in the block
+  // cache, *handle is set to the entry, which must be passed to
+  // ReleaseMeta() once done; otherwise it is set to NULL.  GetFilter()
+  // returns NULL if the table has no usable filter.
+  Status GetIndexBlock(Block** block, Cache::Handle** handle) const;
+  FilterBlockReader* GetFilter(Cache::Handle** handle) const;
+  void ReleaseMeta(Cache::Handle* handle) const;
+
+  // Keep the cached index block and filter referenced until the table
+  // is closed, so the block cache cannot evict them.
+  void PinMetaBlocks();
+
+  // Drop the cached index block and filter of a deleted table
+  static void EraseMetaBlocks(Cache* cache, uint64_t cache_owner,
+                              uint64_t file_number);
+
   // Calls (*handle_result)(arg, ...) with the entry found after a call
   // to Seek(key).  May not make such a call if filter policy says
   // that key is not present.
+  //
+  // If "pin" is non-NULL and such a call was made, the block iterator
+  // holding the entry is stored in *pin instead of being deleted, so the
+  // slices passed to handle_result stay valid until *pin is deleted.
   friend class TableCache;
   Status InternalGet(
       const ReadOptions&, const Slice& key,
       void* arg,
+      void (*handle_result)(void* arg, const Slice& k, const Slice& v),
+      Iterator** pin = NULL);
+
+  // InternalGet() for keys[0..n-1], sorted in ascending order, calling
+  // (*handle_result)(args[i], ...) for keys[i].  The index block is walked
+  // forward once and keys falling into the same data block share one
+  // block read.
+  Status InternalMultiGet(
+      const ReadOptions&, int n, const Slice* keys, void* const* args,
       void (*handle_result)(void* arg, const Slice& k, const Slice& v));
 
+  // NoveLSM: Split block read for TableCache::Prefetch().  If the data
+  // block that may hold key is worth reading into the block cache, i.e.
+  // it passes the filter, is not cached yet and options.fill_cache is
+  // set, fill *req for it and return true.
+  bool PrepareBlockRead(const ReadOptions&, const Slice& key,
+                        ReadRequest* req);
+
+  // Check, uncompress and cache the block read for *req by
+  // Env::WaitForReads().  Frees req->scratch.
+  void FinishBlockRead(const ReadOptions&, ReadRequest* req);
+
+  // NoveLSM: Serve data block reads from the NVM block cache tier, in
+  // which this table's blocks are stored under file_number.
+  void SetNvmBlockCache(NvmBlockCache* cache, uint64_t file_number);
+
+  // Read a data block, from the NVM block cache tier if it has it
+  Status ReadDataBlock(const ReadOptions&, const BlockHandle&,
+                       BlockContents*) const;
 
   void ReadMeta(const Footer& footer);
   void ReadFilter(const Slice& filter_handle_value);
@@ -140,6 +140,12 @@ class AtomicPointer {
     MemoryBarrier();
     rep_ = v;
   }
+#if defined(__GNUC__)
+  // Full barrier; true iff the value was "expected" and is now "v"
+  inline bool CompareAndSwap(void* expected, void* v) {
+    return __sync_bool_compare_and_swap(&rep_, expected, v);
+  }
+#endif
 };
 
 // AtomicPointer based on <cstdatomic>
@@ -162,6 +168,9 @@ class AtomicPointer {
   inline void NoBarrier_Store(void* v) {
     rep_.store(v, std::memory_order_relaxed);
   }
+  inline bool CompareAndSwap(void* expected, void* v) {
+    return rep_.compare_exchange_strong(expected, v);
+  }
 };
 
 // Atomic pointer based on sparc memory barriers
@@ -3,6 +3,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
 
 #ifdef _ENABLE_PMEMIO
 #include "pmdk/src/include/libpmem.h"
@@ -24,6 +29,93 @@ static inline void mfence()
     return;
 }
 
+static inline void sfence()
+{
+    asm volatile("sfence":::"memory");
+    return;
+}
+
+//NoveLSM: Weakly ordered flush instructions. clflushopt and clwb are
+//only ordered by sfence, so a whole range of lines can be written back
+//in parallel and drained by a single fence. The encodings are spelled
+//out so that older assemblers without the mnemonics still build.
+static inline void clflushopt(volatile char* __p)
+{
+    asm volatile(".byte 0x66; clflush %0" : "+m" (*__p));
+}
+
+static inline void clwb(volatile char* __p)
+{
+    asm volatile(".byte 0x66; xsaveopt %0" : "+m" (*__p));
+}
+
+enum {
+    kFlushClflush = 0,
+    kFlushClflushopt = 1,
+    kFlushClwb = 2
+};
+
+//Pick the cheapest flush instruction the CPU supports
+//(CPUID.(EAX=7,ECX=0):EBX bit 24 clwb, bit 23 clflushopt)
+static inline int detect_flush_instruction()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        if (ebx & (1U << 24))
+            return kFlushClwb;
+        if (ebx & (1U << 23))
+            return kFlushClflushopt;
+    }
+#endif
+    return kFlushClflush;
+}
+
+//Resolved once at startup, in port_posix.cc
+extern const int g_flush_instruction;
+
+//Write back every cache line covering [ptr, ptr + size) without
+//fencing. Callers must issue persist_fence() before relying on the
+//data being durable.
+static inline void flush_range(const void *ptr, size_t size){
+
+    if (size == 0)
+        return;
+#ifdef _ENABLE_PMEMIO
+    pmem_flush(ptr, size);
+#else
+    uintptr_t addr = (uintptr_t)ptr & ~((uintptr_t)CACHE_LINE_SIZE - 1);
+    uintptr_t end = (uintptr_t)ptr + size;
+
+    switch (g_flush_instruction) {
+    case kFlushClwb:
+        for (; addr < end; addr += CACHE_LINE_SIZE)
+            clwb((volatile char*)addr);
+        break;
+    case kFlushClflushopt:
+        for (; addr < end; addr += CACHE_LINE_SIZE)
+            clflushopt((volatile char*)addr);
+        break;
+    default:
+        for (; addr < end; addr += CACHE_LINE_SIZE)
+            clflush((volatile char*)addr);
+        break;
+    }
+#endif
+}
+
+//Order all preceding flush_range() calls: once this returns the
+//flushed lines are durable.
+static inline void persist_fence(){
+
+#ifdef _ENABLE_PMEMIO
+    pmem_drain();
+#else
+    sfence();
+#endif
+}
+
 static inline void flush_cache(void *ptr, size_t size){
 
 #ifdef _ENABLE_PMEMIO
@@ -60,4 +152,12 @@ static inline void memcpy_persist
 #endif
 
 }
+
+//Copy and write back without fencing; see flush_range()
+static inline void memcpy_flush
+                    (void *dest, const void *src, size_t size){
+
+    memcpy(dest, src, size);
+    flush_range(dest, size);
+}
 #endif
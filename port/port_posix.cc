@@ -7,6 +7,10 @@
 #include <cstdlib>
 #include <stdio.h>
 #include <string.h>
+#include "port/cache_flush.h"
+
+//NoveLSM: Flush instruction used by flush_range()
+extern const int g_flush_instruction = detect_flush_instruction();
 
 namespace novelsm {
 namespace port {
@@ -11,6 +11,7 @@
 #include "novelsm/comparator.h"
 #include "table/format.h"
 #include "util/coding.h"
+#include "util/learned_index.h"
 #include "util/logging.h"
 
 namespace novelsm {
@@ -23,7 +24,8 @@ inline uint32_t Block::NumRestarts() const {
 Block::Block(const BlockContents& contents)
     : data_(contents.data.data()),
       size_(contents.data.size()),
-      owned_(contents.heap_allocated) {
+      owned_(contents.heap_allocated),
+      learned_index_(NULL) {
   if (size_ < sizeof(uint32_t)) {
     size_ = 0;  // Error marker
   } else {
@@ -41,6 +43,15 @@ Block::~Block() {
   if (owned_) {
     delete[] data_;
   }
+  delete learned_index_;
+}
+
+size_t Block::ApproximateMemoryUsage() const {
+  size_t usage = size_;
+  if (learned_index_ != NULL) {
+    usage += sizeof(LearnedIndex) + learned_index_->ApproximateMemoryUsage();
+  }
+  return usage;
 }
 
 // Helper routine: decode the next block entry starting at "p",
@@ -76,6 +87,7 @@ static inline const char* DecodeEntry(const char* p, const char* limit,
 class Block::Iter : public Iterator {
  private:
   const Comparator* const comparator_;
+  const LearnedIndex* const learned_index_;  // NULL if the block has no model
   const char* const data_;      // underlying block contents
   uint32_t const restarts_;     // Offset of restart array (list of fixed32)
   uint32_t const num_restarts_; // Number of uint32_t entries in restart array
@@ -101,6 +113,17 @@ class Block::Iter : public Iterator {
     return DecodeFixed32(data_ + restarts_ + index * sizeof(uint32_t));
   }
 
+  // Store in *key the full key at restart point index.
+  bool GetRestartKey(uint32_t index, Slice* key) {
+    uint32_t shared, non_shared, value_length;
+    const char* key_ptr = DecodeEntry(data_ + GetRestartPoint(index),
+                                      data_ + restarts_,
+                                      &shared, &non_shared, &value_length);
+    if (key_ptr == NULL || shared != 0) return false;
+    *key = Slice(key_ptr, non_shared);
+    return true;
+  }
+
   void SeekToRestartPoint(uint32_t index) {
     key_.clear();
     restart_index_ = index;
@@ -113,10 +136,12 @@ class Block::Iter : public Iterator {
 
  public:
   Iter(const Comparator* comparator,
+       const LearnedIndex* learned_index,
        const char* data,
        uint32_t restarts,
        uint32_t num_restarts)
       : comparator_(comparator),
+        learned_index_(learned_index),
         data_(data),
         restarts_(restarts),
         num_restarts_(num_restarts),
@@ -167,6 +192,21 @@ class Block::Iter : public Iterator {
     // with a key < target
     uint32_t left = 0;
     uint32_t right = num_restarts_ - 1;
+
+    //NoveLSM: Search only the model's window when the restart keys on
+    //either side of it show that it holds the first key >= target
+    if (learned_index_ != NULL) {
+      uint32_t lo, hi;
+      Slice k;
+      learned_index_->Predict(target, &lo, &hi);
+      if ((lo == 0 || (GetRestartKey(lo - 1, &k) && Compare(k, target) < 0)) &&
+          (hi == num_restarts_ ||
+           (GetRestartKey(hi, &k) && Compare(k, target) >= 0))) {
+        left = (lo > 0) ? lo - 1 : 0;
+        right = (hi > 0) ? hi - 1 : 0;
+      }
+    }
+
     while (left < right) {
       uint32_t mid = (left + right + 1) / 2;
       uint32_t region_offset = GetRestartPoint(mid);
@@ -261,7 +301,34 @@ Iterator* Block::NewIterator(const Comparator* cmp) {
   if (num_restarts == 0) {
     return NewEmptyIterator();
   } else {
-    return new Iter(cmp, data_, restart_offset_, num_restarts);
+    return new Iter(cmp, learned_index_, data_, restart_offset_,
+                    num_restarts);
+  }
+}
+
+void Block::BuildLearnedIndex(size_t suffix_len) {
+  if (size_ < sizeof(uint32_t) || learned_index_ != NULL) return;
+  const uint32_t num_restarts = NumRestarts();
+  const char* limit = data_ + restart_offset_;
+  std::vector<Slice> keys;
+  keys.reserve(num_restarts);
+  for (uint32_t i = 0; i < num_restarts; i++) {
+    uint32_t offset = DecodeFixed32(limit + i * sizeof(uint32_t));
+    uint32_t shared, non_shared, value_length;
+    const char* key_ptr = DecodeEntry(data_ + offset, limit,
+                                      &shared, &non_shared, &value_length);
+    if (key_ptr == NULL || shared != 0) {
+      return;  // Corrupt blocks are left to the ordinary search
+    }
+    keys.push_back(Slice(key_ptr, non_shared));
+  }
+
+  LearnedIndex* index = new LearnedIndex;
+  index->Build(keys, suffix_len);
+  if (index->empty()) {
+    delete index;
+  } else {
+    learned_index_ = index;
   }
 }
 
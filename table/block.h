@@ -13,6 +13,7 @@ namespace novelsm {
 
 struct BlockContents;
 class Comparator;
+class LearnedIndex;
 
 class Block {
  public:
@@ -24,6 +25,14 @@ class Block {
   size_t size() const { return size_; }
   Iterator* NewIterator(const Comparator* comparator);
 
+  // NoveLSM: Fit a LearnedIndex over the restart keys, with their last
+  // suffix_len bytes dropped, that iterators then use to narrow Seek().
+  // Only valid when the keys are in bytewise order once trimmed.
+  void BuildLearnedIndex(size_t suffix_len);
+
+  // NoveLSM: Bytes held by the block, including its learned index
+  size_t ApproximateMemoryUsage() const;
+
  private:
   uint32_t NumRestarts() const;
 
@@ -31,6 +40,7 @@ class Block {
   size_t size_;
   uint32_t restart_offset_;     // Offset in data_ of restart array
   bool owned_;                  // Block owns data_[]
+  LearnedIndex* learned_index_; // NULL unless BuildLearnedIndex() fitted one
 
   // No copying allowed
   Block(const Block&);
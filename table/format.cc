@@ -81,6 +81,20 @@ Status ReadBlock(RandomAccessFile* file,
     delete[] buf;
     return s;
   }
+  return DecodeBlock(options, handle, buf, contents, result);
+}
+
+Status DecodeBlock(const ReadOptions& options,
+                   const BlockHandle& handle,
+                   char* buf,
+                   const Slice& contents,
+                   BlockContents* result) {
+  result->data = Slice();
+  result->cachable = false;
+  result->heap_allocated = false;
+
+  Status s;
+  size_t n = static_cast<size_t>(handle.size());
   if (contents.size() != n + kBlockTrailerSize) {
     delete[] buf;
     return Status::Corruption("truncated block read");
@@ -96,6 +96,16 @@ extern Status ReadBlock(RandomAccessFile* file,
                         const BlockHandle& handle,
                         BlockContents* result);
 
+// NoveLSM: Second half of ReadBlock(), for reads issued elsewhere: check
+// and uncompress "contents", the outcome of reading handle.size() +
+// kBlockTrailerSize bytes at handle.offset() into "buf".  Takes ownership
+// of buf, which must come from new[].
+extern Status DecodeBlock(const ReadOptions& options,
+                          const BlockHandle& handle,
+                          char* buf,
+                          const Slice& contents,
+                          BlockContents* result);
+
 // Implementation details follow.  Clients should ignore,
 
 inline BlockHandle::BlockHandle()
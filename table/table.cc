@@ -14,14 +14,21 @@
 #include "table/format.h"
 #include "table/two_level_iterator.h"
 #include "util/coding.h"
+#include "util/mutexlock.h"
+#include "util/nvm_block_cache.h"
 
 namespace novelsm {
 
 struct Table::Rep {
   ~Rep() {
-    delete filter;
-    delete [] filter_data;
-    delete index_block;
+    if (meta_in_cache) {
+      if (index_pin != NULL) options.block_cache->Release(index_pin);
+      if (filter_pin != NULL) options.block_cache->Release(filter_pin);
+    } else {
+      delete filter;
+      delete [] filter_data;
+      delete index_block;
+    }
   }
 
   Options options;
@@ -33,12 +40,80 @@ struct Table::Rep {
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
   Block* index_block;
+
+  // NoveLSM: NVM block cache tier, NULL without one or once the file
+  // turned out to serve reads from memory of its own
+  NvmBlockCache* nvm_cache;
+  uint64_t file_number;
+
+  // NoveLSM: With options.cache_index_and_filter_blocks the index block
+  // and filter are block cache entries keyed by meta_owner and
+  // file_number.  index_block and filter then stay NULL until
+  // PinMetaBlocks() sets them along with the pinned entries.
+  bool meta_in_cache;
+  uint64_t meta_owner;
+  BlockHandle index_handle;
+  BlockHandle filter_handle;
+  bool has_filter;
+  port::Mutex pin_mutex;
+  bool pinned;                  // Read without pin_mutex
+  Cache::Handle* index_pin;
+  Cache::Handle* filter_pin;
+};
+
+// NoveLSM: Block cache key of a table's index block or filter.  One byte
+// longer than data block keys, so the two never clash.
+static const size_t kMetaKeySize = 17;
+enum MetaKind {
+  kIndexMeta = 0,
+  kFilterMeta = 1
+};
+
+static Slice MetaKey(uint64_t owner, uint64_t file_number, MetaKind kind,
+                     char* buf) {
+  EncodeFixed64(buf, owner);
+  EncodeFixed64(buf + 8, file_number);
+  buf[16] = static_cast<char>(kind);
+  return Slice(buf, kMetaKeySize);
+}
+
+// A filter held by the block cache
+struct CachedFilter {
+  FilterBlockReader* reader;
+  const char* data;             // Heap copy of the filter
 };
 
+// Cached index and filter blocks outlive the table and so its file
+// mapping: move a block that points into the mapping to the heap.
+static void CopyToHeap(BlockContents* contents) {
+  if (!contents->heap_allocated) {
+    char* buf = new char[contents->data.size()];
+    memcpy(buf, contents->data.data(), contents->data.size());
+    contents->data = Slice(buf, contents->data.size());
+    contents->heap_allocated = true;
+  }
+}
+
+static void DeleteCachedFilter(const Slice& key, void* value) {
+  CachedFilter* filter = reinterpret_cast<CachedFilter*>(value);
+  delete filter->reader;
+  delete[] filter->data;
+  delete filter;
+}
+
 Status Table::Open(const Options& options,
                    RandomAccessFile* file,
                    uint64_t size,
                    Table** table) {
+  return Open(options, file, size, 0, 0, table);
+}
+
+Status Table::Open(const Options& options,
+                   RandomAccessFile* file,
+                   uint64_t size,
+                   uint64_t cache_owner,
+                   uint64_t file_number,
+                   Table** table) {
   *table = NULL;
   if (size < Footer::kEncodedLength) {
     return Status::Corruption("file is too short to be an sstable");
@@ -54,10 +129,12 @@ Status Table::Open(const Options& options,
   s = footer.DecodeFrom(&footer_input);
   if (!s.ok()) return s;
 
-  // Read the index block
+  // Read the index block, unless the block cache is to hold it
+  const bool meta_in_cache =
+      options.cache_index_and_filter_blocks && options.block_cache != NULL;
   BlockContents contents;
   Block* index_block = NULL;
-  if (s.ok()) {
+  if (s.ok() && !meta_in_cache) {
     ReadOptions opt;
     if (options.paranoid_checks) {
       opt.verify_checksums = true;
@@ -65,6 +142,10 @@ Status Table::Open(const Options& options,
     s = ReadBlock(file, opt, footer.index_handle(), &contents);
     if (s.ok()) {
       index_block = new Block(contents);
+      // NoveLSM: Index keys are internal keys; the model drops their tag
+      if (options.learned_index) {
+        index_block->BuildLearnedIndex(8);
+      }
     }
   }
 
@@ -79,8 +160,29 @@ Status Table::Open(const Options& options,
     rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
     rep->filter_data = NULL;
     rep->filter = NULL;
+    rep->nvm_cache = NULL;
+    rep->file_number = file_number;
+    rep->meta_in_cache = meta_in_cache;
+    rep->meta_owner = (cache_owner != 0) ? cache_owner : rep->cache_id;
+    rep->index_handle = footer.index_handle();
+    rep->has_filter = false;
+    rep->pinned = false;
+    rep->index_pin = NULL;
+    rep->filter_pin = NULL;
     *table = new Table(rep);
     (*table)->ReadMeta(footer);
+
+    if (meta_in_cache) {
+      // Find or load the index now, so that a broken table fails to open
+      Cache::Handle* handle;
+      s = (*table)->GetIndexBlock(&index_block, &handle);
+      if (s.ok()) {
+        (*table)->ReleaseMeta(handle);
+      } else {
+        delete *table;
+        *table = NULL;
+      }
+    }
   } else {
     if (index_block) delete index_block;
   }
@@ -123,6 +225,11 @@ void Table::ReadFilter(const Slice& filter_handle_value) {
   if (!filter_handle.DecodeFrom(&v).ok()) {
     return;
   }
+  rep_->filter_handle = filter_handle;
+  rep_->has_filter = true;
+  if (rep_->meta_in_cache) {
+    return;  // GetFilter() loads it into the block cache when needed
+  }
 
   // We might want to unify with ReadBlock() if we start
   // requiring checksum verification in Table::Open.
@@ -186,7 +293,7 @@ Iterator* Table::BlockReader(void* arg,
       if (cache_handle != NULL) {
         block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
       } else {
-        s = ReadBlock(table->rep_->file, options, handle, &contents);
+        s = table->ReadDataBlock(options, handle, &contents);
         if (s.ok()) {
           block = new Block(contents);
           if (contents.cachable && options.fill_cache) {
@@ -196,7 +303,7 @@ Iterator* Table::BlockReader(void* arg,
         }
       }
     } else {
-      s = ReadBlock(table->rep_->file, options, handle, &contents);
+      s = table->ReadDataBlock(options, handle, &contents);
       if (s.ok()) {
         block = new Block(contents);
       }
@@ -217,21 +324,266 @@ Iterator* Table::BlockReader(void* arg,
   return iter;
 }
 
+void Table::SetNvmBlockCache(NvmBlockCache* cache, uint64_t file_number) {
+  rep_->nvm_cache = cache;
+  rep_->file_number = file_number;
+}
+
+Status Table::ReadDataBlock(const ReadOptions& options,
+                            const BlockHandle& handle,
+                            BlockContents* contents) const {
+  NvmBlockCache* nvm_cache =
+      __atomic_load_n(&rep_->nvm_cache, __ATOMIC_RELAXED);
+  if (nvm_cache == NULL) {
+    return ReadBlock(rep_->file, options, handle, contents);
+  }
+
+  const size_t n = static_cast<size_t>(handle.size()) + kBlockTrailerSize;
+  char* buf = new char[n];
+  if (nvm_cache->Lookup(rep_->file_number, handle.offset(), n, buf)) {
+    // The copy may predate a crash, so its checksum is always verified
+    ReadOptions verify = options;
+    verify.verify_checksums = true;
+    Status s = DecodeBlock(verify, handle, buf, Slice(buf, n), contents);
+    if (s.ok()) {
+      return s;
+    }
+    buf = new char[n];  // DecodeBlock() freed the bad copy
+  }
+
+  Slice raw;
+  Status s = rep_->file->Read(handle.offset(), n, &raw, buf);
+  if (!s.ok()) {
+    delete[] buf;
+    return s;
+  }
+  if (raw.data() != buf) {
+    // The file hands out its own memory, which NVM would not beat
+    __atomic_store_n(&rep_->nvm_cache, static_cast<NvmBlockCache*>(NULL),
+                     __ATOMIC_RELAXED);
+  } else if (raw.size() == n) {
+    nvm_cache->Admit(rep_->file_number, handle.offset(), raw);
+  }
+  return DecodeBlock(options, handle, buf, raw, contents);
+}
+
+bool Table::PrepareBlockRead(const ReadOptions& options, const Slice& k,
+                             ReadRequest* req) {
+  Cache* block_cache = rep_->options.block_cache;
+  if (block_cache == NULL || !options.fill_cache) return false;
+
+  Block* index_block;
+  Cache::Handle* index_handle;
+  if (!GetIndexBlock(&index_block, &index_handle).ok()) return false;
+  Cache::Handle* filter_handle;
+  FilterBlockReader* filter = GetFilter(&filter_handle);
+  Iterator* iiter = index_block->NewIterator(rep_->options.comparator);
+  iiter->Seek(k);
+  BlockHandle handle;
+  bool wanted = false;
+  if (iiter->Valid()) {
+    Slice handle_value = iiter->value();
+    wanted = handle.DecodeFrom(&handle_value).ok() &&
+             (filter == NULL || filter->KeyMayMatch(handle.offset(), k));
+  }
+  delete iiter;
+  ReleaseMeta(filter_handle);
+  ReleaseMeta(index_handle);
+
+  if (wanted) {
+    char cache_key_buffer[16];
+    EncodeFixed64(cache_key_buffer, rep_->cache_id);
+    EncodeFixed64(cache_key_buffer+8, handle.offset());
+    Cache::Handle* cache_handle =
+        block_cache->Lookup(Slice(cache_key_buffer, sizeof(cache_key_buffer)));
+    if (cache_handle != NULL) {
+      block_cache->Release(cache_handle);
+      wanted = false;
+    }
+  }
+  if (wanted) {
+    req->file = rep_->file;
+    req->offset = handle.offset();
+    req->n = static_cast<size_t>(handle.size()) + kBlockTrailerSize;
+    req->scratch = new char[req->n];
+  }
+  return wanted;
+}
+
+void Table::FinishBlockRead(const ReadOptions& options, ReadRequest* req) {
+  BlockHandle handle;
+  handle.set_offset(req->offset);
+  handle.set_size(req->n - kBlockTrailerSize);
+  if (!req->status.ok()) {
+    delete[] req->scratch;
+    req->scratch = NULL;
+    return;
+  }
+
+  // DecodeBlock() owns the scratch buffer from here on
+  BlockContents contents;
+  Status s = DecodeBlock(options, handle, req->scratch, req->result,
+                         &contents);
+  req->scratch = NULL;
+  if (!s.ok()) {
+    return;  // BlockReader() will read the block again and report it
+  }
+  Block* block = new Block(contents);
+  if (!contents.cachable) {
+    // Served from the file's own memory; the read warmed it up
+    delete block;
+    return;
+  }
+  Cache* block_cache = rep_->options.block_cache;
+  char cache_key_buffer[16];
+  EncodeFixed64(cache_key_buffer, rep_->cache_id);
+  EncodeFixed64(cache_key_buffer+8, handle.offset());
+  Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+  block_cache->Release(block_cache->Insert(key, block, block->size(),
+                                           &DeleteCachedBlock));
+}
+
+Status Table::GetIndexBlock(Block** block, Cache::Handle** handle) const {
+  *handle = NULL;
+  if (!rep_->meta_in_cache || __atomic_load_n(&rep_->pinned, __ATOMIC_ACQUIRE)) {
+    *block = rep_->index_block;
+    return Status::OK();
+  }
+
+  Cache* block_cache = rep_->options.block_cache;
+  char key_buffer[kMetaKeySize];
+  Slice key = MetaKey(rep_->meta_owner, rep_->file_number, kIndexMeta,
+                      key_buffer);
+  *handle = block_cache->Lookup(key);
+  if (*handle != NULL) {
+    *block = reinterpret_cast<Block*>(block_cache->Value(*handle));
+    return Status::OK();
+  }
+
+  ReadOptions opt;
+  if (rep_->options.paranoid_checks) {
+    opt.verify_checksums = true;
+  }
+  BlockContents contents;
+  Status s = ReadBlock(rep_->file, opt, rep_->index_handle, &contents);
+  if (!s.ok()) {
+    return s;
+  }
+  CopyToHeap(&contents);
+  Block* index_block = new Block(contents);
+  if (rep_->options.learned_index) {
+    index_block->BuildLearnedIndex(8);
+  }
+  *handle = block_cache->Insert(key, index_block,
+                                index_block->ApproximateMemoryUsage(),
+                                &DeleteCachedBlock, Cache::kHigh);
+  *block = index_block;
+  return s;
+}
+
+FilterBlockReader* Table::GetFilter(Cache::Handle** handle) const {
+  *handle = NULL;
+  if (!rep_->meta_in_cache || __atomic_load_n(&rep_->pinned, __ATOMIC_ACQUIRE)) {
+    return rep_->filter;
+  }
+  if (!rep_->has_filter) {
+    return NULL;
+  }
+
+  Cache* block_cache = rep_->options.block_cache;
+  char key_buffer[kMetaKeySize];
+  Slice key = MetaKey(rep_->meta_owner, rep_->file_number, kFilterMeta,
+                      key_buffer);
+  *handle = block_cache->Lookup(key);
+  if (*handle != NULL) {
+    return reinterpret_cast<CachedFilter*>(block_cache->Value(*handle))->reader;
+  }
+
+  ReadOptions opt;
+  if (rep_->options.paranoid_checks) {
+    opt.verify_checksums = true;
+  }
+  BlockContents block;
+  if (!ReadBlock(rep_->file, opt, rep_->filter_handle, &block).ok()) {
+    return NULL;  // Lookups go on without the filter, as in ReadFilter()
+  }
+  CopyToHeap(&block);
+  CachedFilter* filter = new CachedFilter;
+  filter->data = block.data.data();
+  filter->reader = new FilterBlockReader(rep_->options.filter_policy,
+                                         block.data);
+  *handle = block_cache->Insert(key, filter, block.data.size(),
+                                &DeleteCachedFilter, Cache::kHigh);
+  return filter->reader;
+}
+
+void Table::ReleaseMeta(Cache::Handle* handle) const {
+  if (handle != NULL) {
+    rep_->options.block_cache->Release(handle);
+  }
+}
+
+void Table::PinMetaBlocks() {
+  if (!rep_->meta_in_cache || __atomic_load_n(&rep_->pinned, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+  MutexLock l(&rep_->pin_mutex);
+  if (rep_->pinned) {
+    return;
+  }
+  Block* index_block;
+  Cache::Handle* index_pin;
+  if (!GetIndexBlock(&index_block, &index_pin).ok()) {
+    return;  // Tried again next time
+  }
+  Cache::Handle* filter_pin;
+  FilterBlockReader* filter = GetFilter(&filter_pin);
+  rep_->index_block = index_block;
+  rep_->index_pin = index_pin;
+  rep_->filter = filter;
+  rep_->filter_pin = filter_pin;
+  __atomic_store_n(&rep_->pinned, true, __ATOMIC_RELEASE);
+}
+
+void Table::EraseMetaBlocks(Cache* cache, uint64_t cache_owner,
+                            uint64_t file_number) {
+  char key_buffer[kMetaKeySize];
+  cache->Erase(MetaKey(cache_owner, file_number, kIndexMeta, key_buffer));
+  cache->Erase(MetaKey(cache_owner, file_number, kFilterMeta, key_buffer));
+}
+
 Iterator* Table::NewIterator(const ReadOptions& options) const {
-  return NewTwoLevelIterator(
-      rep_->index_block->NewIterator(rep_->options.comparator),
-      &Table::BlockReader, const_cast<Table*>(this), options);
+  Block* index_block;
+  Cache::Handle* index_handle;
+  Status s = GetIndexBlock(&index_block, &index_handle);
+  if (!s.ok()) {
+    return NewErrorIterator(s);
+  }
+  Iterator* index_iter = index_block->NewIterator(rep_->options.comparator);
+  if (index_handle != NULL) {
+    index_iter->RegisterCleanup(&ReleaseBlock, rep_->options.block_cache,
+                                index_handle);
+  }
+  return NewTwoLevelIterator(index_iter, &Table::BlockReader,
+                             const_cast<Table*>(this), options);
 }
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k,
                           void* arg,
-                          void (*saver)(void*, const Slice&, const Slice&)) {
-  Status s;
-  Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
+                          void (*saver)(void*, const Slice&, const Slice&),
+                          Iterator** pin) {
+  Block* index_block;
+  Cache::Handle* index_handle;
+  Status s = GetIndexBlock(&index_block, &index_handle);
+  if (!s.ok()) {
+    return s;
+  }
+  Cache::Handle* filter_handle;
+  FilterBlockReader* filter = GetFilter(&filter_handle);
+  Iterator* iiter = index_block->NewIterator(rep_->options.comparator);
   iiter->Seek(k);
   if (iiter->Valid()) {
     Slice handle_value = iiter->value();
-    FilterBlockReader* filter = rep_->filter;
     BlockHandle handle;
     if (filter != NULL &&
         handle.DecodeFrom(&handle_value).ok() &&
@@ -240,24 +592,93 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k,
     } else {
       Iterator* block_iter = BlockReader(this, options, iiter->value());
       block_iter->Seek(k);
+      bool handled = false;
       if (block_iter->Valid()) {
         (*saver)(arg, block_iter->key(), block_iter->value());
+        handled = true;
       }
       s = block_iter->status();
-      delete block_iter;
+      if (handled && pin != NULL && s.ok()) {
+        *pin = block_iter;
+      } else {
+        delete block_iter;
+      }
     }
   }
   if (s.ok()) {
     s = iiter->status();
   }
   delete iiter;
+  ReleaseMeta(filter_handle);
+  ReleaseMeta(index_handle);
   return s;
 }
 
 
+Status Table::InternalMultiGet(const ReadOptions& options, int n,
+                               const Slice* keys, void* const* args,
+                               void (*saver)(void*, const Slice&,
+                                             const Slice&)) {
+  const Comparator* cmp = rep_->options.comparator;
+  Block* index_block;
+  Cache::Handle* index_handle;
+  Status s = GetIndexBlock(&index_block, &index_handle);
+  if (!s.ok()) {
+    return s;
+  }
+  Cache::Handle* filter_handle;
+  FilterBlockReader* filter = GetFilter(&filter_handle);
+  Iterator* iiter = index_block->NewIterator(cmp);
+  Iterator* block_iter = NULL;
+  std::string block_handle;
+  for (int i = 0; i < n && s.ok(); i++) {
+    if (i + 1 < n) {
+      __builtin_prefetch(keys[i + 1].data());
+    }
+    // The index entry found for the previous key is still the first one
+    // at or past this key unless this key lies beyond it
+    if (i == 0 || (iiter->Valid() && cmp->Compare(iiter->key(), keys[i]) < 0)) {
+      iiter->Seek(keys[i]);
+    }
+    if (!iiter->Valid()) {
+      break;  // This and all later keys are past the last block
+    }
+    Slice handle_value = iiter->value();
+    BlockHandle handle;
+    if (filter != NULL &&
+        handle.DecodeFrom(&handle_value).ok() &&
+        !filter->KeyMayMatch(handle.offset(), keys[i])) {
+      continue;  // Not found
+    }
+    if (block_iter == NULL || iiter->value() != Slice(block_handle)) {
+      delete block_iter;
+      block_iter = BlockReader(this, options, iiter->value());
+      block_handle = iiter->value().ToString();
+    }
+    block_iter->Seek(keys[i]);
+    if (block_iter->Valid()) {
+      (*saver)(args[i], block_iter->key(), block_iter->value());
+    }
+    s = block_iter->status();
+  }
+  delete block_iter;
+  if (s.ok()) {
+    s = iiter->status();
+  }
+  delete iiter;
+  ReleaseMeta(filter_handle);
+  ReleaseMeta(index_handle);
+  return s;
+}
+
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
+  Block* index_block;
+  Cache::Handle* index_handle;
+  if (!GetIndexBlock(&index_block, &index_handle).ok()) {
+    return rep_->metaindex_handle.offset();
+  }
   Iterator* index_iter =
-      rep_->index_block->NewIterator(rep_->options.comparator);
+      index_block->NewIterator(rep_->options.comparator);
   index_iter->Seek(key);
   uint64_t result;
   if (index_iter->Valid()) {
@@ -279,6 +700,7 @@ uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
     result = rep_->metaindex_handle.offset();
   }
   delete index_iter;
+  ReleaseMeta(index_handle);
   return result;
 }
 
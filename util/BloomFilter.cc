@@ -1,53 +1,113 @@
 #include "BloomFilter.h"
 #include "MurmurHash3.h"
 
-#include <algorithm>
-#include <set>
-#include <string>
 #include <stdint.h>
 #include <stdio.h>
-#include <vector>
-#include <iostream>
-#include <array>
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
-BloomFilter::BloomFilter(uint64_t size, uint8_t numHashes)
-      : m_bits(size),
-        m_numHashes(numHashes) {}
+//32-bit words per block
+static const int kBlockWords = 8;
 
-BloomFilter::BloomFilter(){
+//Odd multipliers that pick one bit in each word of a block
+static const uint32_t kSalt[kBlockWords] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U };
+
+BloomFilter::BloomFilter(uint64_t expectedKeys) {
+  init(expectedKeys);
+}
+
+BloomFilter::BloomFilter() {
+  init(BLOOM_DEFAULT_KEYS);
+}
+
+BloomFilter::~BloomFilter() {
+  free(m_blocks);
+}
+
+uint64_t BloomFilter::KeysForBuffer(size_t bufferSize) {
+  if (bufferSize == 0)
+    return BLOOM_DEFAULT_KEYS;
+  return bufferSize / BLOOM_BYTES_PER_KEY;
+}
+
+void BloomFilter::init(uint64_t expectedKeys) {
+  uint64_t bits = expectedKeys * BLOOM_BITS_PER_KEY;
+  m_numBlocks = (bits + kBlockWords * 32 - 1) / (kBlockWords * 32);
+  if (m_numBlocks == 0)
+    m_numBlocks = 1;
+  void *blocks = NULL;
+  size_t bytes = m_numBlocks * kBlockWords * sizeof(uint32_t);
+  if (posix_memalign(&blocks, 64, bytes) != 0) {
+    perror("posix_memalign failed");
+    exit(-1);
+  }
+  memset(blocks, 0, bytes);
+  m_blocks = (uint32_t *)blocks;
 }
 
-std::array<uint64_t, 2> hash(const uint8_t *data,
-                             size_t len) {
-  std::array<uint64_t, 2> hashValue;
-  MurmurHash3_x64_128(data, len, 0, hashValue.data());
+static inline uint64_t hash(const uint8_t *data, size_t len) {
+  uint64_t hashValue[2];
+  MurmurHash3_x64_128(data, len, 0, hashValue);
+  return hashValue[0];
+}
 
-  return hashValue;
+//Upper hash bits pick the block, without a division
+static inline uint64_t blockIndex(uint64_t h, uint64_t numBlocks) {
+  return (uint64_t)(((unsigned __int128)(h >> 32) * numBlocks) >> 32);
 }
 
-inline uint64_t nthHash(uint8_t n,
-                        uint64_t hashA,
-                        uint64_t hashB,
-                        uint64_t filterSize) {
-    return (hashA + n * hashB) % filterSize;
+#ifdef __AVX2__
+static inline __m256i blockMask(uint32_t key) {
+  const __m256i salt = _mm256_loadu_si256((const __m256i *)kSalt);
+  __m256i bits = _mm256_mullo_epi32(_mm256_set1_epi32(key), salt);
+  bits = _mm256_srli_epi32(bits, 27);
+  return _mm256_sllv_epi32(_mm256_set1_epi32(1), bits);
 }
+#endif
 
 void BloomFilter::add(const uint8_t *data, size_t len) {
-  auto hashValues = hash(data, len);
+  uint64_t h = hash(data, len);
+  uint32_t *block = m_blocks + blockIndex(h, m_numBlocks) * kBlockWords;
+#ifdef __AVX2__
+  __m256i *p = (__m256i *)block;
+  _mm256_store_si256(p, _mm256_or_si256(_mm256_load_si256(p), blockMask((uint32_t)h)));
+#else
+  for (int i = 0; i < kBlockWords; i++)
+    block[i] |= 1U << ((uint32_t(h) * kSalt[i]) >> 27);
+#endif
+}
 
-  for (int n = 0; n < m_numHashes; n++) {
-      m_bits[nthHash(n, hashValues[0], hashValues[1], m_bits.size())] = true;
+//One atomic OR per word; readers may see a key's bits appear one word
+//at a time, which only delays when it is reported
+void BloomFilter::addConcurrently(const uint8_t *data, size_t len) {
+  uint64_t h = hash(data, len);
+  uint32_t *block = m_blocks + blockIndex(h, m_numBlocks) * kBlockWords;
+  for (int i = 0; i < kBlockWords; i++) {
+    uint32_t bit = 1U << ((uint32_t(h) * kSalt[i]) >> 27);
+    if (!(__atomic_load_n(&block[i], __ATOMIC_RELAXED) & bit))
+      __atomic_fetch_or(&block[i], bit, __ATOMIC_RELAXED);
   }
 }
 
 bool BloomFilter::possiblyContains(const uint8_t *data, size_t len) const {
-  auto hashValues = hash(data, len);
-
-  for (int n = 0; n < m_numHashes; n++) {
-      if (!m_bits[nthHash(n, hashValues[0], hashValues[1], m_bits.size())]) {
-          return false;
-      }
+  uint64_t h = hash(data, len);
+  const uint32_t *block = m_blocks + blockIndex(h, m_numBlocks) * kBlockWords;
+#ifdef __AVX2__
+  return _mm256_testc_si256(_mm256_load_si256((const __m256i *)block),
+                            blockMask((uint32_t)h));
+#else
+  for (int i = 0; i < kBlockWords; i++) {
+    if (!(block[i] & (1U << ((uint32_t(h) * kSalt[i]) >> 27))))
+      return false;
   }
-
   return true;
+#endif
+}
+
+size_t BloomFilter::memoryUsage() const {
+  return m_numBlocks * kBlockWords * sizeof(uint32_t);
 }
@@ -2,25 +2,43 @@
 #define BLOOMFILTER_H_
 
 #include <stdlib.h>
-#include <vector>
 #include <stdint.h>
 
-//13MB Bloom filter
-#define BLOOMSIZE 13631488
-#define BLOOMHASH 13
-
+//NoveLSM: Bits per expected key and the memtable bytes assumed per key
+//when a filter is sized from a memtable buffer size
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_BYTES_PER_KEY 64
+//Keys assumed when no buffer size is known
+#define BLOOM_DEFAULT_KEYS 65536
 
+//NoveLSM: Blocked Bloom filter. A key maps to one 32-byte block (never
+//straddling a cache line) and sets or tests one bit in each of its eight
+//32-bit words, so a probe touches a single line and is evaluated with
+//AVX2 where available.
 class BloomFilter {
 
 public:
-  BloomFilter(uint64_t size, uint8_t numHashes);
+  explicit BloomFilter(uint64_t expectedKeys);
   BloomFilter();
+  ~BloomFilter();
+  // Filter sized for a memtable of bufferSize bytes
+  static uint64_t KeysForBuffer(size_t bufferSize);
   void add(const uint8_t *data, size_t len);
+  // Same as add() but safe against other addConcurrently() callers
+  void addConcurrently(const uint8_t *data, size_t len);
   bool possiblyContains(const uint8_t *data, size_t len) const;
+  // Bytes of filter memory
+  size_t memoryUsage() const;
 
 private:
-  uint8_t m_numHashes;
-  std::vector<bool> m_bits;
+  void init(uint64_t expectedKeys);
+
+  uint32_t *m_blocks;
+  uint64_t m_numBlocks;
+
+  // No copying allowed
+  BloomFilter(const BloomFilter&);
+  void operator=(const BloomFilter&);
 };
 
 #endif
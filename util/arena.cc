@@ -10,6 +10,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <string.h>
+#include "port/cache_flush.h"
 
 
 static const long kBlockSize = 4096;
@@ -27,6 +29,15 @@ Arena::Arena()
     nvmarena_ = false;
     fd = -1;
     kSize = kBlockSize;
+    slab_size_ = 0;
+    slab_slots_ = NULL;
+    slab_table_ = NULL;
+    update_slot_size_ = 0;
+    update_slot_ = NULL;
+    hash_index_buckets_ = 0;
+    hash_index_ = NULL;
+    reserved_ptr_ = NULL;
+    reserved_end_ = NULL;
 }
 
 
@@ -48,6 +59,7 @@ Arena::~Arena() {
         delete[] blocks_[i];
     }
 #endif
+    free(slab_slots_);
 }
 
 void* Arena:: operator new(size_t size)
@@ -303,6 +315,325 @@ char* ArenaNVM::AllocateAlignedNVM(size_t bytes) {
 #endif
 }
 
+//Layout record magic. A map without it predates the record and is
+//treated as holding none of the optional regions.
+static const uint64_t kLayoutMagic = 0x4e4f564c41594f55ull;
+
+void ArenaNVM::InitLayout() {
+    Layout* layout = GetLayout();
+    memset(layout, 0, sizeof(Layout));
+    layout->magic = kLayoutMagic;
+    flush_range(layout, sizeof(Layout));
+    persist_fence();
+}
+
+//Publish a freshly initialized region in the Layout. Its contents are
+//fenced first so a recorded region is never half written; the caller
+//persists alloc_rem and fences afterwards.
+static void RecordRegion(void* map_start, uint64_t* field, const void* region) {
+#ifdef ENABLE_RECOVERY
+    persist_fence();
+    *field = (const char *)region - (const char *)map_start;
+    flush_range(field, sizeof(uint64_t));
+#endif
+}
+
+//NoveLSM: One writer's slab. Padded to a cache line so that slots of
+//different threads never share one.
+struct SlabSlot {
+    volatile int lock;
+    char* cur;
+    char* end;
+    char pad[CACHE_LINE_SIZE - sizeof(int) - 2 * sizeof(char*)];
+};
+
+//Slot of the calling thread, handed out round robin
+static int ThreadSlabSlot() {
+    static int next_slot = 0;
+    static __thread int slot = -1;
+    if (slot < 0) {
+        slot = __atomic_fetch_add(&next_slot, 1, __ATOMIC_RELAXED) %
+                ArenaNVM::kNumSlabSlots;
+    }
+    return slot;
+}
+
+//Persisted slab table: a magic word followed by the [start, end)
+//offsets (from map_start_) of the slab last reserved by each slot
+static const uint64_t kSlabTableMagic = 0x4e4f56534c414253ull;
+
+size_t ArenaNVM::SlabTableSize() {
+    return sizeof(uint64_t) * (1 + 2 * kNumSlabSlots);
+}
+
+void ArenaNVM::InitSlabs(char* where, bool recovery) {
+    uintptr_t table = (reinterpret_cast<uintptr_t>(where) + CACHE_LINE_SIZE - 1) &
+            ~((uintptr_t)CACHE_LINE_SIZE - 1);
+    if (!recovery) {
+        assert(slab_size_ > 0);
+        // Only valid right after the skiplist head was allocated
+        assert(alloc_ptr_ <= reinterpret_cast<char*>(table));
+        size_t needed = (table - reinterpret_cast<uintptr_t>(alloc_ptr_)) + SlabTableSize();
+        assert(needed <= alloc_bytes_remaining_);
+        alloc_ptr_ += needed;
+        alloc_bytes_remaining_ -= needed;
+        slab_table_ = reinterpret_cast<uint64_t*>(table);
+        memset(slab_table_, 0, SlabTableSize());
+        slab_table_[0] = kSlabTableMagic;
+        flush_range(slab_table_, SlabTableSize());
+        RecordRegion(map_start_, &GetLayout()->slab_table, slab_table_);
+        // Keep the table below the persisted frontier even if nothing
+        // gets inserted before a crash
+        *(size_t *)map_start_ = alloc_bytes_remaining_;
+        flush_range(map_start_, sizeof(size_t));
+        persist_fence();
+    } else if (GetLayout()->magic == kLayoutMagic && GetLayout()->slab_table != 0) {
+        // Slabs are carved off the shared frontier in order, so the
+        // furthest recorded end bounds everything handed out, whether
+        // or not slabs stay enabled from here on.
+        slab_table_ = reinterpret_cast<uint64_t*>(
+                (char *)map_start_ + GetLayout()->slab_table);
+        assert(slab_table_[0] == kSlabTableMagic);
+        uint64_t frontier = kSize - alloc_bytes_remaining_;
+        for (int i = 0; i < kNumSlabSlots; i++) {
+            if (slab_table_[2 + 2 * i] > frontier)
+                frontier = slab_table_[2 + 2 * i];
+        }
+        alloc_bytes_remaining_ = kSize - frontier;
+        alloc_ptr_ = (char *)map_start_ + frontier;
+        memory_usage_.NoBarrier_Store(reinterpret_cast<void *>(frontier));
+    } else {
+        // Written without slabs, so there is no table to record new ones
+        slab_size_ = 0;
+    }
+    if (slab_size_ == 0)
+        return;
+
+    void* slots = NULL;
+    if (posix_memalign(&slots, CACHE_LINE_SIZE, sizeof(SlabSlot) * kNumSlabSlots) != 0) {
+        perror("posix_memalign failed");
+        exit(-1);
+    }
+    memset(slots, 0, sizeof(SlabSlot) * kNumSlabSlots);
+    slab_slots_ = reinterpret_cast<SlabSlot*>(slots);
+}
+
+//Persisted redo slot: a magic word, the slot's data capacity, the
+//commit word (offset from map_start_ of the bytes being updated, 0 when
+//idle) and the length, followed by the new bytes
+static const uint64_t kUpdateSlotMagic = 0x4e4f565550445453ull;
+enum { kSlotMagic, kSlotCapacity, kSlotTarget, kSlotLength, kSlotHeader };
+
+void ArenaNVM::InitUpdateSlot(char* where, bool recovery) {
+    uintptr_t slot = (reinterpret_cast<uintptr_t>(where) + CACHE_LINE_SIZE - 1) &
+            ~((uintptr_t)CACHE_LINE_SIZE - 1);
+    uint64_t* words = reinterpret_cast<uint64_t*>(slot);
+    if (!recovery) {
+        assert(update_slot_size_ > kSlotHeader * sizeof(uint64_t));
+        assert(alloc_ptr_ <= reinterpret_cast<char*>(slot));
+        size_t needed = (slot - reinterpret_cast<uintptr_t>(alloc_ptr_)) + update_slot_size_;
+        assert(needed <= alloc_bytes_remaining_);
+        alloc_ptr_ += needed;
+        alloc_bytes_remaining_ -= needed;
+        words[kSlotCapacity] = update_slot_size_ - kSlotHeader * sizeof(uint64_t);
+        words[kSlotTarget] = 0;
+        words[kSlotLength] = 0;
+        words[kSlotMagic] = kUpdateSlotMagic;
+        flush_range(words, kSlotHeader * sizeof(uint64_t));
+        RecordRegion(map_start_, &GetLayout()->update_slot, words);
+        *(size_t *)map_start_ = alloc_bytes_remaining_;
+        flush_range(map_start_, sizeof(size_t));
+        persist_fence();
+        update_slot_ = words;
+        return;
+    }
+    if (GetLayout()->magic != kLayoutMagic || GetLayout()->update_slot == 0) {
+        update_slot_size_ = 0;
+        return;
+    }
+    words = reinterpret_cast<uint64_t*>((char *)map_start_ + GetLayout()->update_slot);
+    assert(words[kSlotMagic] == kUpdateSlotMagic);
+    update_slot_ = words;
+    update_slot_size_ = words[kSlotCapacity] + kSlotHeader * sizeof(uint64_t);
+    if (words[kSlotTarget] != 0) {
+        // The update was committed but maybe not applied; redo it
+        char* dst = (char *)map_start_ + words[kSlotTarget];
+        memcpy(dst, &words[kSlotHeader], words[kSlotLength]);
+        flush_range(dst, words[kSlotLength]);
+        persist_fence();
+        words[kSlotTarget] = 0;
+        flush_range(&words[kSlotTarget], sizeof(uint64_t));
+        persist_fence();
+    }
+}
+
+bool ArenaNVM::UpdateInPlace(char* dst, const char* src, size_t n) {
+    uint64_t* words = update_slot_;
+    if (words == NULL || n > words[kSlotCapacity])
+        return false;
+    char* data = reinterpret_cast<char*>(&words[kSlotHeader]);
+    memcpy(data, src, n);
+    words[kSlotLength] = n;
+    flush_range(&words[kSlotLength], sizeof(uint64_t) + n);
+    persist_fence();
+
+    // Commit point: a single 8-byte store
+    words[kSlotTarget] = dst - (char *)map_start_;
+    flush_range(&words[kSlotTarget], sizeof(uint64_t));
+    persist_fence();
+
+    memcpy(dst, src, n);
+    flush_range(dst, n);
+    persist_fence();
+
+    words[kSlotTarget] = 0;
+    flush_range(&words[kSlotTarget], sizeof(uint64_t));
+    persist_fence();
+    return true;
+}
+
+//Hash index region: a cache line holding a magic word and the bucket
+//count, followed by the buckets
+static const uint64_t kHashIndexMagic = 0x4e4f5648494e4458ull;
+
+size_t ArenaNVM::HashIndexSize(size_t buckets) {
+    return CACHE_LINE_SIZE + buckets * sizeof(uint64_t);
+}
+
+void ArenaNVM::InitHashIndex(char* where, bool recovery) {
+    uintptr_t region = (reinterpret_cast<uintptr_t>(where) + CACHE_LINE_SIZE - 1) &
+            ~((uintptr_t)CACHE_LINE_SIZE - 1);
+    uint64_t* words = reinterpret_cast<uint64_t*>(region);
+    if (!recovery) {
+        assert(hash_index_buckets_ > 0);
+        assert((hash_index_buckets_ & (hash_index_buckets_ - 1)) == 0);
+        assert(alloc_ptr_ <= reinterpret_cast<char*>(region));
+        size_t needed = (region - reinterpret_cast<uintptr_t>(alloc_ptr_)) +
+                HashIndexSize(hash_index_buckets_);
+        if (needed > alloc_bytes_remaining_ / 2) {
+            // Never let the index take most of the memtable
+            hash_index_buckets_ = 0;
+            return;
+        }
+        alloc_ptr_ += needed;
+        alloc_bytes_remaining_ -= needed;
+        hash_index_ = reinterpret_cast<uint64_t*>(region + CACHE_LINE_SIZE);
+        memset(hash_index_, 0, hash_index_buckets_ * sizeof(uint64_t));
+        words[1] = hash_index_buckets_;
+        words[0] = kHashIndexMagic;
+        flush_range(words, 2 * sizeof(uint64_t));
+        RecordRegion(map_start_, &GetLayout()->hash_index, words);
+        *(size_t *)map_start_ = alloc_bytes_remaining_;
+        flush_range(map_start_, sizeof(size_t));
+        persist_fence();
+        return;
+    }
+    if (GetLayout()->magic != kLayoutMagic || GetLayout()->hash_index == 0) {
+        hash_index_buckets_ = 0;
+        return;
+    }
+    words = reinterpret_cast<uint64_t*>((char *)map_start_ + GetLayout()->hash_index);
+    region = reinterpret_cast<uintptr_t>(words);
+    assert(words[0] == kHashIndexMagic);
+    hash_index_buckets_ = words[1];
+    hash_index_ = reinterpret_cast<uint64_t*>(region + CACHE_LINE_SIZE);
+}
+
+char* ArenaNVM::AllocateConcurrent(size_t bytes, size_t align) {
+    assert((align & (align-1)) == 0);
+    if (slab_slots_ == NULL)
+        return AllocateShared(bytes, align);
+
+    int idx = ThreadSlabSlot();
+    SlabSlot* slot = &slab_slots_[idx];
+    while (__sync_lock_test_and_set(&slot->lock, 1)) {
+        while (slot->lock) {
+        }
+    }
+    uintptr_t p = (reinterpret_cast<uintptr_t>(slot->cur) + align - 1) & ~((uintptr_t)align - 1);
+    if (slot->cur == NULL || p + bytes > reinterpret_cast<uintptr_t>(slot->end)) {
+        // Reserve a new slab; near the end of the region, or for objects
+        // larger than a slab, reserve just what this request needs.
+        size_t want = slab_size_ > bytes + align ? slab_size_ : bytes + align;
+        char* slab = AllocateShared(want, CACHE_LINE_SIZE);
+        if (slab == NULL && want != bytes + align) {
+            want = bytes + align;
+            slab = AllocateShared(want, CACHE_LINE_SIZE);
+        }
+        if (slab == NULL) {
+            __sync_lock_release(&slot->lock);
+            return NULL;
+        }
+        slot->cur = slab;
+        slot->end = slab + want;
+        // Durable with the caller's next fence, which precedes any use
+        // of this memory becoming reachable.
+        slab_table_[1 + 2 * idx] = slab - (char *)map_start_;
+        slab_table_[2 + 2 * idx] = slot->end - (char *)map_start_;
+        flush_range(&slab_table_[1 + 2 * idx], 2 * sizeof(uint64_t));
+        p = (reinterpret_cast<uintptr_t>(slot->cur) + align - 1) & ~((uintptr_t)align - 1);
+    }
+    slot->cur = reinterpret_cast<char*>(p + bytes);
+    __sync_lock_release(&slot->lock);
+    return reinterpret_cast<char*>(p);
+}
+
+char* ArenaNVM::AllocateShared(size_t bytes, size_t align) {
+    assert((align & (align-1)) == 0);
+    assert(map_start_ != NULL);
+    if (reserved_end_ != NULL) {
+        char* cur = __atomic_load_n(&reserved_ptr_, __ATOMIC_RELAXED);
+        while (true) {
+            uintptr_t ptr = reinterpret_cast<uintptr_t>(cur);
+            size_t slop = (align - (ptr & (align-1))) & (align-1);
+            if (bytes + slop > static_cast<size_t>(reserved_end_ - cur))
+                return NULL;
+            if (__atomic_compare_exchange_n(&reserved_ptr_, &cur,
+                    cur + slop + bytes, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                return cur + slop;
+        }
+    }
+    size_t rem = __atomic_load_n(&alloc_bytes_remaining_, __ATOMIC_RELAXED);
+    while (true) {
+        //NoveLSM: The next free byte always sits at
+        //map_start_ + (kSize - alloc_bytes_remaining_)
+        uintptr_t ptr = reinterpret_cast<uintptr_t>(map_start_) + (kSize - rem);
+        size_t slop = (align - (ptr & (align-1))) & (align-1);
+        size_t needed = bytes + slop;
+        if (needed > rem)
+            return NULL;
+        if (__atomic_compare_exchange_n(&alloc_bytes_remaining_, &rem,
+                rem - needed, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return reinterpret_cast<char*>(ptr + slop);
+    }
+}
+
+bool ArenaNVM::ReserveConcurrent(size_t bytes) {
+    assert(reserved_end_ == NULL);
+    char* start = AllocateShared(bytes, 1);
+    if (start == NULL)
+        return false;
+    reserved_ptr_ = start;
+    reserved_end_ = start + bytes;
+    return true;
+}
+
+void ArenaNVM::SyncConcurrent() {
+    if (map_start_ == NULL)
+        return;
+    if (reserved_end_ != NULL) {
+        // Nothing was carved off the region past the reservation, so its
+        // unused tail is simply the start of the free space again. The
+        // persisted alloc_rem may stay below it, which only wastes it
+        // after a crash.
+        alloc_bytes_remaining_ += reserved_end_ - reserved_ptr_;
+        reserved_ptr_ = reserved_end_ = NULL;
+    }
+    alloc_ptr_ = (char *)map_start_ + (kSize - alloc_bytes_remaining_);
+    memory_usage_.NoBarrier_Store(
+            reinterpret_cast<void *>(kSize - alloc_bytes_remaining_));
+}
+
 //TODO: This method just implements virtual function
 char* ArenaNVM::AllocateAligned(size_t bytes) {
     return NULL;
@@ -16,6 +16,8 @@ namespace novelsm {
 //Overprovision
 #define MEM_THRESH 1.5
 
+struct SlabSlot;
+
 class Arena {
 public:
     Arena();
@@ -58,6 +60,26 @@ public:
 
     // Array of new[] allocated memory blocks
     std::vector<char*> blocks_;
+
+    //NoveLSM: Per-thread NVM allocation slabs, see ArenaNVM::InitSlabs.
+    //Kept in the base class so they survive MemTable's Arena copy.
+    size_t slab_size_;
+    SlabSlot* slab_slots_;
+    uint64_t* slab_table_;
+
+    //NoveLSM: Redo slot for in-place value updates, see
+    //ArenaNVM::InitUpdateSlot. Same copy rule as the slab fields.
+    size_t update_slot_size_;
+    uint64_t* update_slot_;
+
+    //NoveLSM: Hash index buckets, see ArenaNVM::InitHashIndex
+    size_t hash_index_buckets_;
+    uint64_t* hash_index_;
+
+    //NoveLSM: Reservation of a concurrent insert group, see
+    //ArenaNVM::ReserveConcurrent. Same copy rule as the slab fields.
+    char* reserved_ptr_;
+    char* reserved_end_;
 protected:
     // Total memory usage of the arena.
     port::AtomicPointer memory_usage_;
@@ -102,6 +124,86 @@ public:
     void* CalculateOffset(void* ptr);
     void* getMapStart();
 
+    //NoveLSM: Persisted record of the optional regions below (slab
+    //table, update slot, hash index) held by the map, as offsets from
+    //map_start_ with 0 meaning absent. It lives in the map header right
+    //after the skiplist's alloc_rem, sequence and height words, and is
+    //the only thing recovery consults to find the regions.
+    struct Layout {
+        uint64_t magic;
+        uint64_t slab_table;
+        uint64_t update_slot;
+        uint64_t hash_index;
+    };
+    enum { kLayoutOffset = 24 };
+    Layout* GetLayout() {
+        return reinterpret_cast<Layout*>((char *)map_start_ + kLayoutOffset);
+    }
+    // Start an empty record. REQUIRES: the map header was allocated
+    void InitLayout();
+
+    //NoveLSM: Thread-safe bump allocation for concurrent inserts. Space
+    //is carved from the already mapped region by atomically shrinking
+    //alloc_bytes_remaining_, or from the calling thread's slab once
+    //InitSlabs() ran; returns NULL once the region is exhausted (no
+    //fallback mapping is made). align must be a power of 2.
+    char* AllocateConcurrent(size_t bytes, size_t align);
+    // Shared bump pointer behind AllocateConcurrent()
+    char* AllocateShared(size_t bytes, size_t align);
+    size_t AllocRemConcurrent() const {
+        return __atomic_load_n(&alloc_bytes_remaining_, __ATOMIC_ACQUIRE);
+    }
+    // Bring alloc_ptr_ and memory_usage_ up to date after concurrent
+    // allocations, giving back what is left of a reservation.
+    // REQUIRES: no concurrent allocation in progress.
+    void SyncConcurrent();
+    //NoveLSM: Take bytes off the shared region for a group of concurrent
+    //inserts before any of them starts. Until SyncConcurrent(),
+    //AllocateShared() only carves from the reservation, so the group
+    //either fits as a whole or was never started. Returns false,
+    //reserving nothing, if fewer than bytes are left.
+    //REQUIRES: no concurrent allocation in progress.
+    bool ReserveConcurrent(size_t bytes);
+
+    //NoveLSM: Slab mode for AllocateConcurrent(). Each writer thread
+    //owns one of kNumSlabSlots slots and bump-allocates from a
+    //slab_size_ chunk reserved from the shared region, so the shared
+    //pointer is touched once per chunk instead of once per allocation.
+    //Every reservation is recorded in a persisted slab table of
+    //SlabTableSize() bytes placed at the first cache line boundary at or
+    //after "where", and recorded in the Layout. On recovery a recorded
+    //table ("where" is ignored) moves the allocation frontier past all
+    //recorded slabs, so it must be consulted even when slab_size_ is 0.
+    //Set slab_size_ before calling.
+    enum { kNumSlabSlots = 64 };
+    static size_t SlabTableSize();
+    void InitSlabs(char* where, bool recovery);
+
+    //NoveLSM: Persisted redo slot of update_slot_size_ bytes for
+    //UpdateInPlace(), placed at the first cache line boundary at or after
+    //"where" (past the slab table, if any), and recorded in the Layout.
+    //On recovery the recorded slot is used ("where" is ignored) and an
+    //interrupted update is replayed.
+    //Set update_slot_size_ before calling on creation.
+    enum { kUpdateSlotSize = 4096 };
+    void InitUpdateSlot(char* where, bool recovery);
+    //Crash-atomically overwrite n bytes at dst, which must lie in the
+    //mapped region. The bytes are first persisted in the redo slot and
+    //an 8-byte commit word is flipped, so after a crash dst holds either
+    //the old or the new bytes. Returns false if n does not fit the slot.
+    bool UpdateInPlace(char* dst, const char* src, size_t n);
+
+    //NoveLSM: Region for a hash index of hash_index_buckets_ (a power of
+    //2) buckets at the first cache line boundary at or after "where"
+    //(past the slab table and update slot, if any). Buckets hold entry
+    //offsets from map_start_, 0 meaning empty, and are maintained by the
+    //MemTable. They are never flushed: an index recorded in the Layout
+    //is found there on recovery ("where" is ignored) and has to be
+    //rebuilt from the skiplist before use.
+    //Set hash_index_buckets_ before calling on creation.
+    static size_t HashIndexSize(size_t buckets);
+    void InitHashIndex(char* where, bool recovery);
+
     // Returns an estimate of the total memory usage of data allocated
     // by the arena.
     size_t MemoryUsage() const {
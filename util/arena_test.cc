@@ -4,6 +4,8 @@
 
 #include "util/arena.h"
 
+#include <string.h>
+#include <unistd.h>
 #include "util/random.h"
 #include "util/testharness.h"
 
@@ -61,6 +63,173 @@ TEST(ArenaTest, Simple) {
   }
 }
 
+#ifdef ENABLE_RECOVERY
+static const long kMapSize = 1 << 20;
+static const size_t kHeadBytes = 64;
+
+static std::string MapFile(const char* name) {
+  std::string fname = test::TmpDir() + "/arena_test_" + name;
+  unlink(fname.c_str());
+  return fname;
+}
+
+// Sets up the map header the way SkipList does, with kHeadBytes standing
+// in for the head node, and returns where the optional regions may start
+static char* StartMap(ArenaNVM* arena) {
+  const size_t header = ArenaNVM::kLayoutOffset + sizeof(ArenaNVM::Layout);
+  char* mem = arena->AllocateAlignedNVM(header + kHeadBytes);
+  ASSERT_TRUE(arena->getMapStart() != NULL);
+  *(size_t*)arena->getMapStart() = arena->getAllocRem();
+  arena->InitLayout();
+  return mem + header + kHeadBytes;
+}
+
+static size_t Offset(ArenaNVM* arena, const void* p) {
+  return (const char*)p - (const char*)arena->getMapStart();
+}
+
+TEST(ArenaTest, SlabRecovery) {
+  std::string fname = MapFile("slabs");
+  size_t slab_end;
+  {
+    ArenaNVM arena(kMapSize, &fname, false);
+    arena.slab_size_ = 4096;
+    arena.InitSlabs(StartMap(&arena), false);
+    ASSERT_TRUE(arena.slab_table_ != NULL);
+    char* p = arena.AllocateConcurrent(100, 8);
+    ASSERT_TRUE(p != NULL);
+    slab_end = Offset(&arena, p) + arena.slab_size_;
+  }
+  ArenaNVM arena(kMapSize, &fname, true);
+  arena.InitSlabs(NULL, true);
+  ASSERT_TRUE(arena.slab_table_ != NULL);
+  // The rest of the reserved slab is never handed out again
+  ASSERT_GE(Offset(&arena, arena.alloc_ptr_), slab_end);
+  unlink(fname.c_str());
+}
+
+TEST(ArenaTest, ReserveConcurrent) {
+  std::string fname = MapFile("reserve");
+  ArenaNVM arena(kMapSize, &fname, false);
+  StartMap(&arena);
+  const size_t before = arena.AllocRemConcurrent();
+  ASSERT_TRUE(!arena.ReserveConcurrent(before + 1));
+  ASSERT_EQ(arena.AllocRemConcurrent(), before);
+
+  ASSERT_TRUE(arena.ReserveConcurrent(1000));
+  ASSERT_EQ(arena.AllocRemConcurrent(), before - 1000);
+  char* first = arena.AllocateConcurrent(600, 8);
+  ASSERT_TRUE(first != NULL);
+  // Only the reservation is handed out, never the rest of the region
+  ASSERT_TRUE(arena.AllocateConcurrent(600, 8) == NULL);
+  char* second = arena.AllocateConcurrent(300, 8);
+  ASSERT_TRUE(second != NULL);
+  ASSERT_GE(second, first + 600);
+
+  // The unused tail goes back to the region
+  arena.SyncConcurrent();
+  ASSERT_EQ(arena.alloc_ptr_, second + 300);
+  ASSERT_EQ(arena.AllocRemConcurrent(),
+            arena.kSize - Offset(&arena, arena.alloc_ptr_));
+  ASSERT_TRUE(arena.AllocateConcurrent(600, 8) != NULL);
+  unlink(fname.c_str());
+}
+
+TEST(ArenaTest, UpdateSlotRecovery) {
+  std::string fname = MapFile("slot");
+  size_t target;
+  {
+    ArenaNVM arena(kMapSize, &fname, false);
+    arena.update_slot_size_ = ArenaNVM::kUpdateSlotSize;
+    arena.InitUpdateSlot(StartMap(&arena), false);
+    ASSERT_TRUE(arena.update_slot_ != NULL);
+    char* dst = arena.AllocateAlignedNVM(16);
+    memcpy(dst, "old value", 10);
+    *(size_t*)arena.getMapStart() = arena.getAllocRem();
+    ASSERT_TRUE(arena.UpdateInPlace(dst, "new value", 10));
+    target = Offset(&arena, dst);
+  }
+  ArenaNVM arena(kMapSize, &fname, true);
+  arena.InitUpdateSlot(NULL, true);
+  ASSERT_TRUE(arena.update_slot_ != NULL);
+  ASSERT_EQ(arena.update_slot_size_, ArenaNVM::kUpdateSlotSize);
+  char* dst = (char*)arena.getMapStart() + target;
+  ASSERT_EQ(std::string(dst), "new value");
+  ASSERT_TRUE(arena.UpdateInPlace(dst, "newer one", 10));
+  ASSERT_EQ(std::string(dst), "newer one");
+  unlink(fname.c_str());
+}
+
+TEST(ArenaTest, HashIndexRecovery) {
+  std::string fname = MapFile("index");
+  size_t index_start;
+  {
+    ArenaNVM arena(kMapSize, &fname, false);
+    arena.hash_index_buckets_ = 64;
+    arena.InitHashIndex(StartMap(&arena), false);
+    ASSERT_TRUE(arena.hash_index_ != NULL);
+    index_start = Offset(&arena, arena.hash_index_);
+  }
+  ArenaNVM arena(kMapSize, &fname, true);
+  arena.InitHashIndex(NULL, true);
+  ASSERT_TRUE(arena.hash_index_ != NULL);
+  ASSERT_EQ(arena.hash_index_buckets_, 64);
+  ASSERT_EQ(Offset(&arena, arena.hash_index_), index_start);
+  unlink(fname.c_str());
+}
+
+TEST(ArenaTest, RegionsOnlyFromLayout) {
+  // Copy the regions of a map that has them...
+  std::string full = MapFile("full");
+  std::string image;
+  size_t image_start, slot_start, index_start;
+  {
+    ArenaNVM arena(kMapSize, &full, false);
+    arena.slab_size_ = 4096;
+    arena.update_slot_size_ = ArenaNVM::kUpdateSlotSize;
+    char* where = StartMap(&arena);
+    arena.InitSlabs(where, false);
+    arena.InitUpdateSlot((char*)arena.slab_table_ + ArenaNVM::SlabTableSize(),
+                         false);
+    slot_start = Offset(&arena, arena.update_slot_);
+    arena.hash_index_buckets_ = 64;
+    arena.InitHashIndex((char*)arena.update_slot_ + arena.update_slot_size_,
+                        false);
+    ASSERT_TRUE(arena.hash_index_ != NULL);
+    index_start = Offset(&arena, arena.hash_index_) - ArenaNVM::HashIndexSize(0);
+    ASSERT_TRUE(arena.AllocateConcurrent(100, 8) != NULL);
+    image_start = Offset(&arena, where);
+    image.assign(where, Offset(&arena, arena.alloc_ptr_) - image_start);
+  }
+  unlink(full.c_str());
+
+  // ...into the data area of one that was created without them
+  std::string fname = MapFile("plain");
+  size_t frontier;
+  {
+    ArenaNVM arena(kMapSize, &fname, false);
+    char* where = StartMap(&arena);
+    ASSERT_EQ(Offset(&arena, where), image_start);
+    memcpy(arena.AllocateAlignedNVM(image.size()), image.data(), image.size());
+    *(size_t*)arena.getMapStart() = arena.getAllocRem();
+    frontier = Offset(&arena, arena.alloc_ptr_);
+  }
+  ArenaNVM arena(kMapSize, &fname, true);
+  char* where = (char*)arena.getMapStart() + image_start;
+  arena.InitSlabs(where, true);
+  ASSERT_TRUE(arena.slab_table_ == NULL);
+  ASSERT_EQ(arena.slab_size_, 0);
+  ASSERT_EQ(Offset(&arena, arena.alloc_ptr_), frontier);
+  arena.InitUpdateSlot((char*)arena.getMapStart() + slot_start, true);
+  ASSERT_TRUE(arena.update_slot_ == NULL);
+  ASSERT_EQ(arena.update_slot_size_, 0);
+  arena.InitHashIndex((char*)arena.getMapStart() + index_start, true);
+  ASSERT_TRUE(arena.hash_index_ == NULL);
+  ASSERT_EQ(arena.hash_index_buckets_, 0);
+  unlink(fname.c_str());
+}
+#endif
+
 }  // namespace novelsm
 
 int main(int argc, char** argv) {
@@ -4,6 +4,9 @@
 
 #include "novelsm/filter_policy.h"
 
+#include "novelsm/env.h"
+#include "port/port.h"
+#include "util/BloomFilter.h"
 #include "util/coding.h"
 #include "util/logging.h"
 #include "util/testharness.h"
@@ -155,6 +158,101 @@ TEST(BloomTest, VaryingLengths) {
 
 // Different bits-per-byte
 
+// The memtables' prediction filter (util/BloomFilter.h)
+class MemTableBloomTest { };
+
+static double PredictionFalsePositiveRate(const BloomFilter& filter) {
+  char buffer[sizeof(int)];
+  int result = 0;
+  for (int i = 0; i < 10000; i++) {
+    Slice key = Key(i + 1000000000, buffer);
+    if (filter.possiblyContains((const uint8_t*)key.data(), key.size())) {
+      result++;
+    }
+  }
+  return result / 10000.0;
+}
+
+TEST(MemTableBloomTest, PredictionVaryingLengths) {
+  char buffer[sizeof(int)];
+  for (int length = 1; length <= 100000; length = NextLength(length)) {
+    BloomFilter filter(length);
+    for (int i = 0; i < length; i++) {
+      Slice key = Key(i, buffer);
+      filter.add((const uint8_t*)key.data(), key.size());
+    }
+    ASSERT_LE(filter.memoryUsage(),
+              static_cast<size_t>((length * 10 / 8) + 32)) << length;
+
+    // All added keys must match
+    for (int i = 0; i < length; i++) {
+      Slice key = Key(i, buffer);
+      ASSERT_TRUE(filter.possiblyContains((const uint8_t*)key.data(),
+                                          key.size()))
+          << "Length " << length << "; key " << i;
+    }
+
+    double rate = PredictionFalsePositiveRate(filter);
+    if (kVerbose >= 1) {
+      fprintf(stderr, "False positives: %5.2f%% @ length = %6d ; bytes = %6d\n",
+              rate*100.0, length, static_cast<int>(filter.memoryUsage()));
+    }
+    ASSERT_LE(rate, 0.03);   // Blocking costs a little over the 1% ideal
+  }
+}
+
+TEST(MemTableBloomTest, BufferSizing) {
+  // One key per 64 buffer bytes at 10 bits each
+  BloomFilter filter(BloomFilter::KeysForBuffer(40 << 20));
+  ASSERT_GE(filter.memoryUsage(), static_cast<size_t>((40 << 20) / 64 * 10 / 8));
+  ASSERT_LE(filter.memoryUsage(), static_cast<size_t>((40 << 20) / 50));
+}
+
+namespace {
+struct AdderState {
+  BloomFilter* filter;
+  int id;
+  port::AtomicPointer done;
+};
+
+static const int kAdders = 4;
+static const int kKeysPerAdder = 20000;
+
+static void AdderBody(void* arg) {
+  AdderState* state = reinterpret_cast<AdderState*>(arg);
+  char buffer[sizeof(int)];
+  for (int i = state->id; i < kAdders * kKeysPerAdder; i += kAdders) {
+    Slice key = Key(i, buffer);
+    state->filter->addConcurrently((const uint8_t*)key.data(), key.size());
+  }
+  state->done.Release_Store(state);
+}
+}  // namespace
+
+TEST(MemTableBloomTest, ConcurrentAdds) {
+  // Adders interleave their keys so that they share blocks
+  BloomFilter filter(kAdders * kKeysPerAdder);
+  AdderState state[kAdders];
+  for (int id = 0; id < kAdders; id++) {
+    state[id].filter = &filter;
+    state[id].id = id;
+    state[id].done.Release_Store(NULL);
+    Env::Default()->StartThread(AdderBody, &state[id]);
+  }
+  for (int id = 0; id < kAdders; id++) {
+    while (state[id].done.Acquire_Load() == NULL) {
+      Env::Default()->SleepForMicroseconds(1000);
+    }
+  }
+  char buffer[sizeof(int)];
+  for (int i = 0; i < kAdders * kKeysPerAdder; i++) {
+    Slice key = Key(i, buffer);
+    ASSERT_TRUE(filter.possiblyContains((const uint8_t*)key.data(),
+                                        key.size())) << i;
+  }
+  ASSERT_LE(PredictionFalsePositiveRate(filter), 0.03);
+}
+
 }  // namespace novelsm
 
 int main(int argc, char** argv) {
@@ -32,6 +32,7 @@ struct LRUHandle {
   size_t key_length;
   uint32_t refs;
   uint32_t hash;      // Hash of key(); used for fast sharding and comparisons
+  bool high_pri;      // NoveLSM: On lru_high_ rather than lru_
   char key_data[1];   // Beginning of key
 
   Slice key() const {
@@ -143,7 +144,8 @@ class LRUCache {
   // Like Cache methods, but with an extra "hash" parameter.
   Cache::Handle* Insert(const Slice& key, uint32_t hash,
                         void* value, size_t charge,
-                        void (*deleter)(const Slice& key, void* value));
+                        void (*deleter)(const Slice& key, void* value),
+                        bool high_pri);
   Cache::Handle* Lookup(const Slice& key, uint32_t hash);
   void Release(Cache::Handle* handle);
   void Erase(const Slice& key, uint32_t hash);
@@ -157,6 +159,7 @@ class LRUCache {
   void LRU_Remove(LRUHandle* e);
   void LRU_Append(LRUHandle* e);
   void Unref(LRUHandle* e);
+  LRUHandle* Victim();
 
   // Initialized before use.
   size_t capacity_;
@@ -164,27 +167,37 @@ class LRUCache {
   // mutex_ protects the following state.
   mutable port::Mutex mutex_;
   size_t usage_;
+  size_t high_usage_;   // NoveLSM: Charge of the entries on lru_high_
 
   // Dummy head of LRU list.
   // lru.prev is newest entry, lru.next is oldest entry.
   LRUHandle lru_;
 
+  // NoveLSM: Dummy head of the LRU list of high priority entries
+  LRUHandle lru_high_;
+
   HandleTable table_;
 };
 
 LRUCache::LRUCache()
-    : usage_(0) {
-  // Make empty circular linked list
+    : usage_(0),
+      high_usage_(0) {
+  // Make empty circular linked lists
   lru_.next = &lru_;
   lru_.prev = &lru_;
+  lru_high_.next = &lru_high_;
+  lru_high_.prev = &lru_high_;
 }
 
 LRUCache::~LRUCache() {
-  for (LRUHandle* e = lru_.next; e != &lru_; ) {
-    LRUHandle* next = e->next;
-    assert(e->refs == 1);  // Error if caller has an unreleased handle
-    Unref(e);
-    e = next;
+  LRUHandle* lists[2] = { &lru_, &lru_high_ };
+  for (int i = 0; i < 2; i++) {
+    for (LRUHandle* e = lists[i]->next; e != lists[i]; ) {
+      LRUHandle* next = e->next;
+      assert(e->refs == 1);  // Error if caller has an unreleased handle
+      Unref(e);
+      e = next;
+    }
   }
 }
 
@@ -201,16 +214,37 @@ void LRUCache::Unref(LRUHandle* e) {
 void LRUCache::LRU_Remove(LRUHandle* e) {
   e->next->prev = e->prev;
   e->prev->next = e->next;
+  if (e->high_pri) {
+    high_usage_ -= e->charge;
+  }
 }
 
 void LRUCache::LRU_Append(LRUHandle* e) {
-  // Make "e" newest entry by inserting just before lru_
-  e->next = &lru_;
-  e->prev = lru_.prev;
+  // Make "e" newest entry by inserting just before the list head
+  LRUHandle* list = &lru_;
+  if (e->high_pri) {
+    list = &lru_high_;
+    high_usage_ += e->charge;
+  }
+  e->next = list;
+  e->prev = list->prev;
   e->prev->next = e;
   e->next->prev = e;
 }
 
+// NoveLSM: Oldest low priority entry, unless there is none or the high
+// priority ones take more than half of the capacity.  NULL if empty.
+LRUHandle* LRUCache::Victim() {
+  const bool high_first = (high_usage_ > capacity_ / 2);
+  if (lru_.next != &lru_ && !high_first) {
+    return lru_.next;
+  }
+  if (lru_high_.next != &lru_high_) {
+    return lru_high_.next;
+  }
+  return (lru_.next != &lru_) ? lru_.next : NULL;
+}
+
 Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash) {
   MutexLock l(&mutex_);
   LRUHandle* e = table_.Lookup(key, hash);
@@ -229,7 +263,7 @@ void LRUCache::Release(Cache::Handle* handle) {
 
 Cache::Handle* LRUCache::Insert(
     const Slice& key, uint32_t hash, void* value, size_t charge,
-    void (*deleter)(const Slice& key, void* value)) {
+    void (*deleter)(const Slice& key, void* value), bool high_pri) {
   MutexLock l(&mutex_);
 
   LRUHandle* e = reinterpret_cast<LRUHandle*>(
@@ -240,6 +274,7 @@ Cache::Handle* LRUCache::Insert(
   e->key_length = key.size();
   e->hash = hash;
   e->refs = 2;  // One from LRUCache, one for the returned handle
+  e->high_pri = high_pri;
   memcpy(e->key_data, key.data(), key.size());
   LRU_Append(e);
   usage_ += charge;
@@ -250,8 +285,9 @@ Cache::Handle* LRUCache::Insert(
     Unref(old);
   }
 
-  while (usage_ > capacity_ && lru_.next != &lru_) {
-    LRUHandle* old = lru_.next;
+  LRUHandle* victim;
+  while (usage_ > capacity_ && (victim = Victim()) != NULL) {
+    LRUHandle* old = victim;
     LRU_Remove(old);
     table_.Remove(old->key(), old->hash);
     Unref(old);
@@ -271,14 +307,17 @@ void LRUCache::Erase(const Slice& key, uint32_t hash) {
 
 void LRUCache::Prune() {
   MutexLock l(&mutex_);
-  for (LRUHandle* e = lru_.next; e != &lru_; ) {
-    LRUHandle* next = e->next;
-    if (e->refs == 1) {
-      table_.Remove(e->key(), e->hash);
-      LRU_Remove(e);
-      Unref(e);
+  LRUHandle* lists[2] = { &lru_, &lru_high_ };
+  for (int i = 0; i < 2; i++) {
+    for (LRUHandle* e = lists[i]->next; e != lists[i]; ) {
+      LRUHandle* next = e->next;
+      if (e->refs == 1) {
+        table_.Remove(e->key(), e->hash);
+        LRU_Remove(e);
+        Unref(e);
+      }
+      e = next;
     }
-    e = next;
   }
 }
 
@@ -311,7 +350,15 @@ class ShardedLRUCache : public Cache {
   virtual Handle* Insert(const Slice& key, void* value, size_t charge,
                          void (*deleter)(const Slice& key, void* value)) {
     const uint32_t hash = HashSlice(key);
-    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter);
+    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter,
+                                      false);
+  }
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value),
+                         Priority priority) {
+    const uint32_t hash = HashSlice(key);
+    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter,
+                                      priority == kHigh);
   }
   virtual Handle* Lookup(const Slice& key) {
     const uint32_t hash = HashSlice(key);
@@ -5,7 +5,11 @@
 #include "novelsm/cache.h"
 
 #include <vector>
+#include "novelsm/env.h"
+#include "port/port.h"
 #include "util/coding.h"
+#include "util/mutexlock.h"
+#include "util/random.h"
 #include "util/testharness.h"
 
 namespace novelsm {
@@ -23,6 +27,9 @@ static int DecodeKey(const Slice& k) {
 static void* EncodeValue(uintptr_t v) { return reinterpret_cast<void*>(v); }
 static int DecodeValue(void* v) { return reinterpret_cast<uintptr_t>(v); }
 
+// The cache under test; main() runs every test once per implementation
+static Cache* (*NewCache)(size_t capacity) = NewLRUCache;
+
 class CacheTest {
  public:
   static CacheTest* current_;
@@ -37,7 +44,7 @@ class CacheTest {
   std::vector<int> deleted_values_;
   Cache* cache_;
 
-  CacheTest() : cache_(NewLRUCache(kCacheSize)) {
+  CacheTest() : cache_(NewCache(kCacheSize)) {
     current_ = this;
   }
 
@@ -173,6 +180,32 @@ TEST(CacheTest, HeavyEntries) {
   ASSERT_LE(cached_weight, kCacheSize + kCacheSize/10);
 }
 
+TEST(CacheTest, AdmitsOverCapacityWhenReferenced) {
+  // No referenced entry is deleted to make room, so the new entry is
+  // charged over the capacity
+  std::vector<Cache::Handle*> handles;
+  for (int i = 0; i < 10; i++) {
+    handles.push_back(cache_->Insert(EncodeKey(i), EncodeValue(1000+i),
+                                     kCacheSize / 10, &CacheTest::Deleter));
+  }
+  Cache::Handle* h = cache_->Insert(EncodeKey(100), EncodeValue(1100),
+                                    kCacheSize / 10, &CacheTest::Deleter);
+  ASSERT_EQ(1100, DecodeValue(cache_->Value(h)));
+  ASSERT_EQ(0, deleted_keys_.size());
+  ASSERT_EQ(kCacheSize + kCacheSize / 10, cache_->TotalCharge());
+  cache_->Release(h);
+  for (int i = 0; i < 10; i++) {
+    ASSERT_EQ(1000+i, DecodeValue(cache_->Value(handles[i])));
+  }
+
+  for (size_t i = 0; i < handles.size(); i++) {
+    cache_->Release(handles[i]);
+  }
+  cache_->Prune();
+  ASSERT_EQ(0, cache_->TotalCharge());
+  ASSERT_EQ(11, deleted_keys_.size());
+}
+
 TEST(CacheTest, NewId) {
   uint64_t a = cache_->NewId();
   uint64_t b = cache_->NewId();
@@ -192,8 +225,136 @@ TEST(CacheTest, Prune) {
   ASSERT_EQ(-1, Lookup(2));
 }
 
+// Concurrent Insert/Lookup/Release/Erase.  Values stay allocated after
+// their deleter ran, so a handle whose value was deleted while it was
+// still referenced is caught by the value's "live" flag.
+namespace {
+
+static const int kStressThreads = 4;
+static const int kStressOps = 20000;
+static const int kStressKeys = 200;
+
+struct StressValue {
+  int key;
+  size_t charge;
+  bool live;
+};
+
+struct StressState {
+  Cache* cache;
+  port::Mutex mu;
+  std::vector<StressValue*> deleted;   // Guarded by mu
+  size_t live_charge;                  // Guarded by mu
+  int errors;                          // Guarded by mu
+  int done;                            // Guarded by mu
+};
+static StressState* stress;
+
+static void StressDeleter(const Slice& key, void* v) {
+  StressValue* value = reinterpret_cast<StressValue*>(v);
+  MutexLock l(&stress->mu);
+  if (!value->live || value->key != DecodeKey(key)) stress->errors++;
+  value->live = false;
+  stress->live_charge -= value->charge;
+  stress->deleted.push_back(value);
+}
+
+static void StressBody(void* arg) {
+  Random rnd(reinterpret_cast<uintptr_t>(arg));
+  Cache* cache = stress->cache;
+  std::vector<Cache::Handle*> held;
+  int errors = 0;
+  for (int i = 0; i < kStressOps; i++) {
+    const int key = rnd.Uniform(kStressKeys);
+    const std::string k = EncodeKey(key);
+    switch (rnd.Uniform(4)) {
+      case 0: {
+        StressValue* value = new StressValue;
+        value->key = key;
+        value->charge = 1 + rnd.Uniform(20);
+        value->live = true;
+        {
+          MutexLock l(&stress->mu);
+          stress->live_charge += value->charge;
+        }
+        held.push_back(cache->Insert(k, value, value->charge,
+                                     &StressDeleter));
+        break;
+      }
+      case 1:
+      case 2: {
+        Cache::Handle* h = cache->Lookup(k);
+        if (h != NULL) {
+          StressValue* value =
+              reinterpret_cast<StressValue*>(cache->Value(h));
+          if (!value->live || value->key != key) errors++;
+          held.push_back(h);
+        }
+        break;
+      }
+      case 3:
+        cache->Erase(k);
+        break;
+    }
+    // Hold a few handles across other threads' operations
+    while (held.size() > 4 || (!held.empty() && rnd.OneIn(2))) {
+      const size_t j = rnd.Uniform(held.size());
+      StressValue* value =
+          reinterpret_cast<StressValue*>(cache->Value(held[j]));
+      if (!value->live) errors++;
+      cache->Release(held[j]);
+      held[j] = held.back();
+      held.pop_back();
+    }
+  }
+  for (size_t j = 0; j < held.size(); j++) cache->Release(held[j]);
+  MutexLock l(&stress->mu);
+  stress->errors += errors;
+  stress->done++;
+}
+
+}  // namespace
+
+TEST(CacheTest, ConcurrentStress) {
+  StressState state;
+  state.cache = cache_;
+  state.live_charge = 0;
+  state.errors = 0;
+  state.done = 0;
+  stress = &state;
+  for (int i = 0; i < kStressThreads; i++) {
+    Env::Default()->StartThread(&StressBody,
+                                reinterpret_cast<void*>(test::RandomSeed() + i));
+  }
+  for (;;) {
+    state.mu.Lock();
+    const int done = state.done;
+    state.mu.Unlock();
+    if (done == kStressThreads) break;
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+
+  // The cache charges exactly the entries whose deleter has not run
+  ASSERT_EQ(0, state.errors);
+  ASSERT_EQ(state.live_charge, cache_->TotalCharge());
+
+  // Nothing is referenced any more, so everything can go
+  cache_->Prune();
+  ASSERT_EQ(0, cache_->TotalCharge());
+  ASSERT_EQ(0, state.live_charge);
+  ASSERT_EQ(0, state.errors);
+  for (size_t i = 0; i < state.deleted.size(); i++) delete state.deleted[i];
+  stress = NULL;
+}
+
 }  // namespace novelsm
 
 int main(int argc, char** argv) {
+  novelsm::NewCache = novelsm::NewLRUCache;
+  fprintf(stderr, "==== LRU cache\n");
+  int result = novelsm::test::RunAllTests();
+  if (result != 0) return result;
+  novelsm::NewCache = novelsm::NewClockCache;
+  fprintf(stderr, "==== CLOCK cache\n");
   return novelsm::test::RunAllTests();
 }
@@ -0,0 +1,393 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// NoveLSM: CLOCK cache whose Lookup() and Release() take no lock.
+//
+// Entries live in one open-addressed table of slots that is allocated up
+// front and never resized, so a slot stays valid memory for as long as
+// the cache.  Everything about a slot that threads race on sits in one
+// 64-bit word, "meta":
+//
+//   bits  0..29  references held by handles and by probes in flight
+//   bits 32..33  CLOCK counter, set on a hit, counted down by the hand
+//   bits 40..41  state: empty, under construction, visible, invisible
+//
+// A probe takes a reference with one fetch-and-add and only then looks
+// at the state.  A slot leaves the visible or invisible state only by a
+// compare-and-swap that requires zero references, so a referenced
+// visible entry cannot change under its reader; a probe that lands on
+// any other state just drops its reference again.  Key and value are
+// written only by the thread that moved the slot into construction.
+//
+// Probing is linear.  Each slot counts the entries whose probe sequence
+// passes over it, and a lookup stops at the first slot that neither
+// matches nor has entries displaced past it.
+
+#include <assert.h>
+#include <string.h>
+
+#include "novelsm/cache.h"
+#include "util/hash.h"
+
+namespace novelsm {
+
+namespace {
+
+static const uint64_t kRefsMask = (static_cast<uint64_t>(1) << 30) - 1;
+static const int kClockShift = 32;
+static const uint64_t kClockMask = static_cast<uint64_t>(3) << kClockShift;
+static const uint64_t kMaxClock = 3;
+static const int kStateShift = 40;
+static const uint64_t kStateMask = static_cast<uint64_t>(3) << kStateShift;
+
+enum SlotState {
+  kEmpty = 0,
+  kConstruction = 1,
+  kVisible = 2,
+  kInvisible = 3      // Erased or replaced, freed by its last Release()
+};
+
+static inline uint64_t StateBits(SlotState s) {
+  return static_cast<uint64_t>(s) << kStateShift;
+}
+static inline SlotState State(uint64_t meta) {
+  return static_cast<SlotState>((meta & kStateMask) >> kStateShift);
+}
+static inline uint64_t Refs(uint64_t meta) { return meta & kRefsMask; }
+static inline uint64_t Clock(uint64_t meta) {
+  return (meta & kClockMask) >> kClockShift;
+}
+
+// The table is sized for entries of about this charge, the default
+// block size.  Much smaller entries fill the table before the capacity.
+static const size_t kEstimatedCharge = 4096;
+static const uint32_t kMinSlots = 256;
+
+// Most slots one Insert() moves the CLOCK hand over
+static const uint64_t kMaxEvictSteps = 4096;
+
+// Keys up to this length, such as block cache keys, are stored inline
+static const size_t kInlineKey = 24;
+
+struct ClockHandle {
+  uint64_t meta;
+  uint32_t displacements;   // Entries whose probe passes this slot
+  uint32_t hash;
+  void* value;
+  void (*deleter)(const Slice&, void* value);
+  size_t charge;
+  size_t key_length;
+  char* key_data;           // key_inline, or a heap copy of longer keys
+  bool standalone;          // Not in the table; see ClockCache::Insert()
+  char key_inline[kInlineKey];
+
+  Slice key() const { return Slice(key_data, key_length); }
+};
+
+class ClockCache : public Cache {
+ public:
+  explicit ClockCache(size_t capacity);
+  virtual ~ClockCache();
+
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value)) {
+    return Insert(key, value, charge, deleter, kLow);
+  }
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value),
+                         Priority priority);
+  virtual Handle* Lookup(const Slice& key);
+  virtual void Release(Handle* handle);
+  virtual void* Value(Handle* handle) {
+    return reinterpret_cast<ClockHandle*>(handle)->value;
+  }
+  virtual void Erase(const Slice& key);
+  virtual uint64_t NewId() {
+    return __atomic_add_fetch(&last_id_, 1, __ATOMIC_RELAXED);
+  }
+  virtual void Prune();
+  virtual size_t TotalCharge() const {
+    return __atomic_load_n(&usage_, __ATOMIC_RELAXED);
+  }
+
+ private:
+  static inline uint32_t HashSlice(const Slice& s) {
+    return Hash(s.data(), s.size(), 0);
+  }
+
+  ClockHandle* Slot(uint32_t hash, uint32_t probe) const {
+    return &slots_[(hash + probe) & mask_];
+  }
+
+  ClockHandle* Claim(uint32_t hash);
+  void EraseKey(const Slice& key, uint32_t hash);
+  void Evict(size_t charge);
+  void Unref(ClockHandle* h);
+  void TryFree(ClockHandle* h);
+  void Free(ClockHandle* h);
+
+  const size_t capacity_;
+  uint32_t length_;
+  uint32_t mask_;
+  uint32_t max_occupancy_;
+  ClockHandle* slots_;
+
+  // Updated atomically
+  uint32_t occupancy_;      // Slots not empty
+  size_t usage_;            // Charge of all live entries
+  uint32_t clock_hand_;
+  uint64_t last_id_;
+
+  // No copying allowed
+  ClockCache(const ClockCache&);
+  void operator=(const ClockCache&);
+};
+
+ClockCache::ClockCache(size_t capacity)
+    : capacity_(capacity),
+      occupancy_(0),
+      usage_(0),
+      clock_hand_(0),
+      last_id_(0) {
+  // Aim for a table at most half full when the capacity is reached
+  const size_t want = capacity / kEstimatedCharge * 2;
+  length_ = kMinSlots;
+  while (length_ < want && length_ < (1u << 30)) {
+    length_ *= 2;
+  }
+  mask_ = length_ - 1;
+  max_occupancy_ = length_ - length_ / 4;
+  slots_ = new ClockHandle[length_];
+  for (uint32_t i = 0; i < length_; i++) {
+    slots_[i].meta = StateBits(kEmpty);
+    slots_[i].displacements = 0;
+  }
+}
+
+ClockCache::~ClockCache() {
+  for (uint32_t i = 0; i < length_; i++) {
+    ClockHandle* h = &slots_[i];
+    SlotState s = State(h->meta);
+    if (s == kVisible || s == kInvisible) {
+      assert(Refs(h->meta) == 0);  // Error if caller has an unreleased handle
+      h->meta = StateBits(kConstruction);
+      Free(h);
+    }
+  }
+  delete[] slots_;
+}
+
+// Take the first empty slot on hash's probe sequence into construction
+// and count the displacement on every slot passed.  Returns NULL if the
+// table has no empty slot.
+ClockHandle* ClockCache::Claim(uint32_t hash) {
+  for (uint32_t probe = 0; probe < length_; probe++) {
+    ClockHandle* h = Slot(hash, probe);
+    uint64_t m = __atomic_load_n(&h->meta, __ATOMIC_ACQUIRE);
+    while (State(m) == kEmpty) {
+      // Keep the references of probes in flight
+      if (__atomic_compare_exchange_n(&h->meta, &m,
+                                      Refs(m) | StateBits(kConstruction),
+                                      false, __ATOMIC_ACQUIRE,
+                                      __ATOMIC_ACQUIRE)) {
+        __atomic_fetch_add(&occupancy_, 1, __ATOMIC_RELAXED);
+        h->hash = hash;
+        return h;
+      }
+    }
+    __atomic_fetch_add(&h->displacements, 1, __ATOMIC_RELAXED);
+  }
+  for (uint32_t probe = 0; probe < length_; probe++) {
+    __atomic_fetch_sub(&Slot(hash, probe)->displacements, 1,
+                       __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+// Free unreferenced entries in CLOCK order until "charge" more fits in
+// the capacity and the table has a slot to spare.  Gives up after
+// kMaxEvictSteps slots, or once the hand has gone round often enough to
+// clear every counter, whichever is less; the entry is then admitted
+// over the capacity, as with the LRU cache, and later inserts carry on
+// from where the hand stopped.
+void ClockCache::Evict(size_t charge) {
+  uint64_t max_steps = static_cast<uint64_t>(length_) * (kMaxClock + 1);
+  if (max_steps > kMaxEvictSteps) max_steps = kMaxEvictSteps;
+  for (uint64_t step = 0; step < max_steps; step++) {
+    if (__atomic_load_n(&usage_, __ATOMIC_RELAXED) + charge <= capacity_ &&
+        __atomic_load_n(&occupancy_, __ATOMIC_RELAXED) < max_occupancy_) {
+      break;
+    }
+    uint32_t hand = __atomic_fetch_add(&clock_hand_, 1, __ATOMIC_RELAXED);
+    ClockHandle* h = &slots_[hand & mask_];
+    uint64_t m = __atomic_load_n(&h->meta, __ATOMIC_RELAXED);
+    if (State(m) != kVisible || Refs(m) != 0) continue;
+    if (Clock(m) > 0) {
+      // Recently used: one more round before it goes
+      const uint64_t older = m - (static_cast<uint64_t>(1) << kClockShift);
+      __atomic_compare_exchange_n(&h->meta, &m, older, false,
+                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    } else if (__atomic_compare_exchange_n(&h->meta, &m,
+                                           StateBits(kConstruction), false,
+                                           __ATOMIC_ACQUIRE,
+                                           __ATOMIC_RELAXED)) {
+      Free(h);
+    }
+  }
+}
+
+// Drop one reference and free h if it was the last one to an entry that
+// is no longer visible.
+void ClockCache::Unref(ClockHandle* h) {
+  uint64_t old = __atomic_fetch_sub(&h->meta, 1, __ATOMIC_ACQ_REL);
+  assert(Refs(old) > 0);
+  if (Refs(old) == 1 && State(old) == kInvisible) {
+    TryFree(h);
+  }
+}
+
+void ClockCache::TryFree(ClockHandle* h) {
+  uint64_t m = __atomic_load_n(&h->meta, __ATOMIC_ACQUIRE);
+  while (State(m) == kInvisible && Refs(m) == 0) {
+    if (__atomic_compare_exchange_n(&h->meta, &m, StateBits(kConstruction),
+                                    false, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_ACQUIRE)) {
+      Free(h);
+      return;
+    }
+  }
+}
+
+// REQUIRES: h is under construction and owned by the caller
+void ClockCache::Free(ClockHandle* h) {
+  (*h->deleter)(h->key(), h->value);
+  __atomic_fetch_sub(&usage_, h->charge, __ATOMIC_RELAXED);
+  if (h->key_data != h->key_inline) {
+    delete[] h->key_data;
+  }
+  if (h->standalone) {
+    delete h;
+    return;
+  }
+  for (uint32_t probe = 0; Slot(h->hash, probe) != h; probe++) {
+    __atomic_fetch_sub(&Slot(h->hash, probe)->displacements, 1,
+                       __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_sub(&occupancy_, 1, __ATOMIC_RELAXED);
+  // Probes that arrived meanwhile still hold their references
+  __atomic_fetch_sub(&h->meta, StateBits(kConstruction), __ATOMIC_RELEASE);
+}
+
+Cache::Handle* ClockCache::Insert(
+    const Slice& key, void* value, size_t charge,
+    void (*deleter)(const Slice& key, void* value), Priority priority) {
+  const uint32_t hash = HashSlice(key);
+  EraseKey(key, hash);
+  Evict(charge);
+
+  ClockHandle* h = NULL;
+  if (__atomic_load_n(&occupancy_, __ATOMIC_RELAXED) < max_occupancy_) {
+    h = Claim(hash);
+  }
+  if (h == NULL) {
+    // Everything is referenced: hand out an entry that lives outside the
+    // table until it is released, as if it had been evicted at once
+    h = new ClockHandle;
+    h->meta = StateBits(kConstruction);
+    h->hash = hash;
+    h->standalone = true;
+  } else {
+    h->standalone = false;
+  }
+  h->value = value;
+  h->deleter = deleter;
+  h->charge = charge;
+  h->key_length = key.size();
+  h->key_data = (key.size() <= kInlineKey) ? h->key_inline
+                                           : new char[key.size()];
+  memcpy(h->key_data, key.data(), key.size());
+  __atomic_fetch_add(&usage_, charge, __ATOMIC_RELAXED);
+
+  // Publish with the returned handle's reference
+  uint64_t delta = 1;
+  if (h->standalone) {
+    delta += StateBits(kInvisible) - StateBits(kConstruction);
+  } else {
+    // One CLOCK round of grace before the first hit; high priority
+    // entries start out as if just hit
+    const uint64_t clock = (priority == kHigh) ? kMaxClock : 1;
+    delta += StateBits(kVisible) - StateBits(kConstruction) +
+             (clock << kClockShift);
+  }
+  __atomic_fetch_add(&h->meta, delta, __ATOMIC_RELEASE);
+  return reinterpret_cast<Cache::Handle*>(h);
+}
+
+Cache::Handle* ClockCache::Lookup(const Slice& key) {
+  const uint32_t hash = HashSlice(key);
+  for (uint32_t probe = 0; probe < length_; probe++) {
+    ClockHandle* h = Slot(hash, probe);
+    uint64_t m = __atomic_fetch_add(&h->meta, 1, __ATOMIC_ACQUIRE);
+    if (State(m) == kVisible && h->hash == hash && h->key() == key) {
+      if (Clock(m) < kMaxClock) {
+        __atomic_fetch_or(&h->meta, kClockMask, __ATOMIC_RELAXED);
+      }
+      return reinterpret_cast<Cache::Handle*>(h);
+    }
+    Unref(h);
+    if (__atomic_load_n(&h->displacements, __ATOMIC_RELAXED) == 0) break;
+  }
+  return NULL;
+}
+
+void ClockCache::Release(Handle* handle) {
+  Unref(reinterpret_cast<ClockHandle*>(handle));
+}
+
+// Make every visible entry for key invisible.  Those not referenced are
+// freed at once, the others by their last Release().
+void ClockCache::EraseKey(const Slice& key, uint32_t hash) {
+  for (uint32_t probe = 0; probe < length_; probe++) {
+    ClockHandle* h = Slot(hash, probe);
+    uint64_t m = __atomic_fetch_add(&h->meta, 1, __ATOMIC_ACQUIRE);
+    if (State(m) == kVisible && h->hash == hash && h->key() == key) {
+      // Our reference keeps the slot out of everyone else's hands, so
+      // only another erase can race with this
+      uint64_t cur = m + 1;
+      while (State(cur) == kVisible &&
+             !__atomic_compare_exchange_n(
+                 &h->meta, &cur,
+                 cur - StateBits(kVisible) + StateBits(kInvisible),
+                 false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      }
+    }
+    Unref(h);
+    if (__atomic_load_n(&h->displacements, __ATOMIC_RELAXED) == 0) break;
+  }
+}
+
+void ClockCache::Erase(const Slice& key) {
+  EraseKey(key, HashSlice(key));
+}
+
+void ClockCache::Prune() {
+  for (uint32_t i = 0; i < length_; i++) {
+    ClockHandle* h = &slots_[i];
+    uint64_t m = __atomic_load_n(&h->meta, __ATOMIC_RELAXED);
+    if (State(m) == kVisible && Refs(m) == 0 &&
+        __atomic_compare_exchange_n(&h->meta, &m, StateBits(kConstruction),
+                                    false, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_RELAXED)) {
+      Free(h);
+    }
+  }
+}
+
+}  // end anonymous namespace
+
+Cache* NewClockCache(size_t capacity) {
+  return new ClockCache(capacity);
+}
+
+}  // namespace novelsm
@@ -13,6 +13,26 @@ Status Env::NewAppendableFile(const std::string& fname, WritableFile** result) {
   return Status::NotSupported("NewAppendableFile", fname);
 }
 
+void Env::Schedule(void (*function)(void*), void* arg, Priority pri) {
+  Schedule(function, arg);
+}
+
+void Env::SetBackgroundThreads(int number, Priority pri) {
+}
+
+void Env::SubmitReads(ReadRequest* reqs, int n) {
+  for (int i = 0; i < n; i++) {
+    reqs[i].file->Prefetch(reqs[i].offset, reqs[i].n);
+  }
+}
+
+void Env::WaitForReads(ReadRequest* reqs, int n) {
+  for (int i = 0; i < n; i++) {
+    ReadRequest* r = &reqs[i];
+    r->status = r->file->Read(r->offset, r->n, &r->result, r->scratch);
+  }
+}
+
 SequentialFile::~SequentialFile() {
 }
 
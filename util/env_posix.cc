@@ -20,6 +20,7 @@
 #include "novelsm/env.h"
 #include "novelsm/slice.h"
 #include "port/port.h"
+#include "util/io_ring.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
 #include "util/posix_logger.h"
@@ -112,6 +113,12 @@ public:
         }
         return s;
     }
+
+    virtual void Prefetch(uint64_t offset, size_t n) const {
+        posix_fadvise(fd_, static_cast<off_t>(offset), n, POSIX_FADV_WILLNEED);
+    }
+
+    int fd() const { return fd_; }
 };
 
 // Helper class to limit mmap file usage so that we do not end up
@@ -198,6 +205,17 @@ public:
         }
         return s;
     }
+
+    // Start faulting the pages in, so Read() does not wait for them
+    virtual void Prefetch(uint64_t offset, size_t n) const {
+        if (offset >= length_) return;
+        if (offset + n > length_) n = length_ - offset;
+        const uintptr_t page = static_cast<uintptr_t>(getpagesize());
+        uintptr_t start = reinterpret_cast<uintptr_t>(mmapped_region_) + offset;
+        uintptr_t aligned = start & ~(page - 1);
+        madvise(reinterpret_cast<void*>(aligned), n + (start - aligned),
+                MADV_WILLNEED);
+    }
 };
 
 class PosixWritableFile : public WritableFile {
@@ -509,6 +527,8 @@ public:
     }
 
     virtual void Schedule(void (*function)(void*), void* arg);
+    virtual void Schedule(void (*function)(void*), void* arg, Priority pri);
+    virtual void SetBackgroundThreads(int number, Priority pri);
 
     virtual void StartThread(void (*function)(void* arg), void* arg);
 
@@ -554,6 +574,9 @@ public:
         usleep(micros);
     }
 
+    virtual void SubmitReads(ReadRequest* reqs, int n);
+    virtual void WaitForReads(ReadRequest* reqs, int n);
+
 private:
     void PthreadCall(const char* label, int result) {
         if (result != 0) {
@@ -562,68 +585,217 @@ private:
         }
     }
 
-    // BGThread() is the body of the background thread
-    void BGThread();
+    // Entry per Schedule() call
+    struct BGItem { void* arg; void (*function)(void*); };
+    typedef std::deque<BGItem> BGQueue;
+
+    //NoveLSM: Threads and queue of one priority. Threads are started as
+    //work is queued, up to max_threads.
+    struct BGPool {
+        PosixEnv* env;
+        pthread_cond_t bgsignal;
+        int threads;
+        int max_threads;
+        int idle;
+        BGQueue queue;
+    };
+
+    // BGThread() is the body of the background threads
+    void BGThread(BGPool* pool);
     static void* BGThreadWrapper(void* arg) {
-        reinterpret_cast<PosixEnv*>(arg)->BGThread();
+        BGPool* pool = reinterpret_cast<BGPool*>(arg);
+        pool->env->BGThread(pool);
         return NULL;
     }
 
     pthread_mutex_t mu_;
-    pthread_cond_t bgsignal_;
-    pthread_t bgthread_;
-    bool started_bgthread_;
-
-    // Entry per Schedule() call
-    struct BGItem { void* arg; void (*function)(void*); };
-    typedef std::deque<BGItem> BGQueue;
-    BGQueue queue_;
+    BGPool pools_[2];           // Indexed by Priority
 
     PosixLockTable locks_;
     MmapLimiter mmap_limit_;
 };
 
-PosixEnv::PosixEnv() : started_bgthread_(false) {
+#ifdef HAVE_IO_URING
+//NoveLSM: Reads go through a ring owned by the submitting thread. The
+//first thread that fails to set one up, or whose io_uring_enter() fails,
+//turns io_uring off for the process, and reads quietly fall back to
+//Prefetch() followed by Read().
+static const unsigned kIoRingDepth = 64;
+static pthread_once_t io_ring_once = PTHREAD_ONCE_INIT;
+static pthread_key_t io_ring_key;
+static int io_ring_disabled = 0;
+
+static void DeleteIoRing(void* ring) {
+    delete reinterpret_cast<IoRing*>(ring);
+}
+
+static void InitIoRingKey() {
+    pthread_key_create(&io_ring_key, &DeleteIoRing);
+}
+
+static void DisableIoRing() {
+    __atomic_store_n(&io_ring_disabled, 1, __ATOMIC_RELAXED);
+}
+
+static IoRing* ThreadIoRing() {
+    if (__atomic_load_n(&io_ring_disabled, __ATOMIC_RELAXED)) return NULL;
+    pthread_once(&io_ring_once, &InitIoRingKey);
+    IoRing* ring = reinterpret_cast<IoRing*>(pthread_getspecific(io_ring_key));
+    if (ring == NULL) {
+        ring = new IoRing;
+        if (!ring->Init(kIoRingDepth)) {
+            delete ring;
+            DisableIoRing();
+            return NULL;
+        }
+        pthread_setspecific(io_ring_key, ring);
+    }
+    return ring;
+}
+#endif
+
+void PosixEnv::SubmitReads(ReadRequest* reqs, int n) {
+#ifdef HAVE_IO_URING
+    IoRing* ring = ThreadIoRing();
+    bool queued = false;
+#endif
+    for (int i = 0; i < n; i++) {
+        ReadRequest* r = &reqs[i];
+        r->env_state = NULL;
+#ifdef HAVE_IO_URING
+        // Only pread()-backed files are read through the ring; mmapped
+        // ones are served from memory once Prefetch() has faulted them in
+        const PosixRandomAccessFile* file =
+                dynamic_cast<const PosixRandomAccessFile*>(r->file);
+        if (ring != NULL && file != NULL &&
+                ring->PrepareRead(file->fd(), r->scratch, r->n, r->offset, r)) {
+            r->env_state = ring;
+            queued = true;
+            continue;
+        }
+#endif
+        r->file->Prefetch(r->offset, r->n);
+    }
+#ifdef HAVE_IO_URING
+    if (queued && !ring->Enter(false)) {
+        // Reads the kernel did not take are done by WaitForReads() with
+        // Read(); those it took are still reaped from the ring
+        DisableIoRing();
+        void* tag;
+        while (ring->Unqueue(&tag)) {
+            ReadRequest* r = reinterpret_cast<ReadRequest*>(tag);
+            r->env_state = NULL;
+            r->file->Prefetch(r->offset, r->n);
+        }
+    }
+#endif
+}
+
+void PosixEnv::WaitForReads(ReadRequest* reqs, int n) {
+    // Reads outside the ring first, while the ring's are in flight
+    int in_ring = 0;
+    void* ring_state = NULL;
+    for (int i = 0; i < n; i++) {
+        ReadRequest* r = &reqs[i];
+        if (r->env_state != NULL) {
+            ring_state = r->env_state;
+            in_ring++;
+        } else {
+            r->status = r->file->Read(r->offset, r->n, &r->result, r->scratch);
+        }
+    }
+#ifdef HAVE_IO_URING
+    IoRing* ring = reinterpret_cast<IoRing*>(ring_state);
+    bool can_wait = true;
+    while (in_ring > 0) {
+        void* tag;
+        int res;
+        if (!ring->Reap(&tag, &res)) {
+            // The kernel still owns the buffers of submitted reads, so
+            // without io_uring_enter() their completions are polled for
+            if (can_wait && !ring->Enter(true)) {
+                DisableIoRing();
+                can_wait = false;
+            }
+            if (!can_wait) SleepForMicroseconds(10);
+            continue;
+        }
+        ReadRequest* r = reinterpret_cast<ReadRequest*>(tag);
+        r->env_state = NULL;
+        in_ring--;
+        if (res >= 0) {
+            r->result = Slice(r->scratch, res);
+            r->status = Status::OK();
+        } else {
+            // E.g. a kernel without IORING_OP_READ; Read() reports real errors
+            r->status = r->file->Read(r->offset, r->n, &r->result, r->scratch);
+        }
+    }
+#endif
+}
+
+PosixEnv::PosixEnv() {
     PthreadCall("mutex_init", pthread_mutex_init(&mu_, NULL));
-    PthreadCall("cvar_init", pthread_cond_init(&bgsignal_, NULL));
+    for (int i = 0; i < 2; i++) {
+        pools_[i].env = this;
+        PthreadCall("cvar_init", pthread_cond_init(&pools_[i].bgsignal, NULL));
+        pools_[i].threads = 0;
+        pools_[i].max_threads = 1;
+        pools_[i].idle = 0;
+    }
 }
 
 void PosixEnv::Schedule(void (*function)(void*), void* arg) {
+    Schedule(function, arg, kLow);
+}
+
+void PosixEnv::Schedule(void (*function)(void*), void* arg, Priority pri) {
     PthreadCall("lock", pthread_mutex_lock(&mu_));
+    BGPool* pool = &pools_[pri];
 
-    // Start background thread if necessary
-    if (!started_bgthread_) {
-        started_bgthread_ = true;
+    // Start another background thread if none is free to take the item
+    if (pool->queue.size() >= static_cast<size_t>(pool->idle) &&
+            pool->threads < pool->max_threads) {
+        pool->threads++;
+        pthread_t t;
         PthreadCall(
                 "create thread",
-                pthread_create(&bgthread_, NULL,  &PosixEnv::BGThreadWrapper, this));
-    }
-
-    // If the queue is currently empty, the background thread may currently be
-    // waiting.
-    if (queue_.empty()) {
-        PthreadCall("signal", pthread_cond_signal(&bgsignal_));
+                pthread_create(&t, NULL,  &PosixEnv::BGThreadWrapper, pool));
+        PthreadCall("detach thread", pthread_detach(t));
     }
 
     // Add to priority queue
-    queue_.push_back(BGItem());
-    queue_.back().function = function;
-    queue_.back().arg = arg;
+    pool->queue.push_back(BGItem());
+    pool->queue.back().function = function;
+    pool->queue.back().arg = arg;
 
+    // An idle background thread may currently be waiting
+    PthreadCall("signal", pthread_cond_signal(&pool->bgsignal));
+
+    PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+}
+
+void PosixEnv::SetBackgroundThreads(int number, Priority pri) {
+    PthreadCall("lock", pthread_mutex_lock(&mu_));
+    if (number > pools_[pri].max_threads) {
+        pools_[pri].max_threads = number;
+    }
     PthreadCall("unlock", pthread_mutex_unlock(&mu_));
 }
 
-void PosixEnv::BGThread() {
+void PosixEnv::BGThread(BGPool* pool) {
     while (true) {
         // Wait until there is an item that is ready to run
         PthreadCall("lock", pthread_mutex_lock(&mu_));
-        while (queue_.empty()) {
-            PthreadCall("wait", pthread_cond_wait(&bgsignal_, &mu_));
+        while (pool->queue.empty()) {
+            pool->idle++;
+            PthreadCall("wait", pthread_cond_wait(&pool->bgsignal, &mu_));
+            pool->idle--;
         }
 
-        void (*function)(void*) = queue_.front().function;
-        void* arg = queue_.front().arg;
-        queue_.pop_front();
+        void (*function)(void*) = pool->queue.front().function;
+        void* arg = pool->queue.front().arg;
+        pool->queue.pop_front();
 
         PthreadCall("unlock", pthread_mutex_unlock(&mu_));
         (*function)(arg);
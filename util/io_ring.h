@@ -0,0 +1,189 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// NoveLSM: Minimal io_uring submission/completion ring for batched file
+// reads.  It drives the raw system calls from the kernel headers, so no
+// liburing is needed.  Only built with HAVE_IO_URING; Init() still fails
+// at run time where the kernel lacks io_uring or policy disables it.
+
+#ifndef STORAGE_NOVELSM_UTIL_IO_RING_H_
+#define STORAGE_NOVELSM_UTIL_IO_RING_H_
+
+#ifdef HAVE_IO_URING
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace novelsm {
+
+// Not thread-safe: each thread uses its own ring.
+class IoRing {
+ public:
+  IoRing()
+      : fd_(-1), sq_ring_(MAP_FAILED), cq_ring_(MAP_FAILED),
+        sqes_(reinterpret_cast<io_uring_sqe*>(MAP_FAILED)),
+        sq_ring_size_(0), cq_ring_size_(0), sqes_size_(0),
+        unsubmitted_(0) { }
+
+  ~IoRing() {
+    if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_size_);
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != MAP_FAILED) munmap(sq_ring_, sq_ring_size_);
+    if (fd_ >= 0) close(fd_);
+  }
+
+  // Set up a ring of at least "entries" slots.  Returns false if the
+  // kernel does not provide one.
+  bool Init(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd_ = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd_ < 0) return false;
+
+    sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap && cq_ring_size_ > sq_ring_size_) {
+      sq_ring_size_ = cq_ring_size_;
+    }
+    sq_ring_ = mmap(NULL, sq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) return false;
+    if (single_mmap) {
+      cq_ring_ = sq_ring_;
+    } else {
+      cq_ring_ = mmap(NULL, cq_ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+      if (cq_ring_ == MAP_FAILED) return false;
+    }
+    sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return false;
+    sqes_ = reinterpret_cast<io_uring_sqe*>(sqes);
+
+    char* sq = reinterpret_cast<char*>(sq_ring_);
+    char* cq = reinterpret_cast<char*>(cq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    sq_entries_ = p.sq_entries;
+    cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    return true;
+  }
+
+  // Queue a read of n bytes at offset of fd into buf, tagged with tag.
+  // Returns false if the submission queue is full.
+  bool PrepareRead(int fd, char* buf, size_t n, uint64_t offset, void* tag) {
+    const unsigned tail = *sq_tail_;
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+      return false;
+    }
+    const unsigned index = tail & sq_mask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uintptr_t>(buf);
+    sqe->len = n;
+    sqe->off = offset;
+    sqe->user_data = reinterpret_cast<uintptr_t>(tag);
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    unsubmitted_++;
+    return true;
+  }
+
+  // Hand the queued reads to the kernel and, if wait is set, block until
+  // at least one completion is available.  Interrupted calls are retried,
+  // and so are a few ones the kernel lacked resources for.  Returns false
+  // on failure, with errno set; reads it did not take stay queued.
+  bool Enter(bool wait) {
+    int busy = 0;
+    for (;;) {
+      int r = syscall(__NR_io_uring_enter, fd_, unsubmitted_, wait ? 1 : 0,
+                      wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+      if (r >= 0) {
+        unsubmitted_ -= r;
+        if (unsubmitted_ == 0 || wait) return true;
+      } else if (errno == EINTR) {
+        continue;
+      } else if ((errno == EAGAIN || errno == EBUSY) && busy < kMaxBusy) {
+        busy++;
+        sched_yield();
+      } else {
+        return false;
+      }
+    }
+  }
+
+  // Take back the most recently queued read the kernel has not taken yet
+  // and return its tag in *tag.  Returns false if there is none.
+  bool Unqueue(void** tag) {
+    if (unsubmitted_ == 0) return false;
+    const unsigned tail = *sq_tail_ - 1;
+    *tag = reinterpret_cast<void*>(
+        static_cast<uintptr_t>(sqes_[sq_array_[tail & sq_mask_]].user_data));
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+    unsubmitted_--;
+    return true;
+  }
+
+  // Pop one completion into *tag and *res (bytes read or -errno).
+  // Returns false if none is ready.
+  bool Reap(void** tag, int* res) {
+    const unsigned head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) return false;
+    const io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+    *tag = reinterpret_cast<void*>(static_cast<uintptr_t>(cqe->user_data));
+    *res = cqe->res;
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+ private:
+  // io_uring_enter() calls retried on EAGAIN/EBUSY before giving up
+  static const int kMaxBusy = 100;
+
+  int fd_;
+  void* sq_ring_;
+  void* cq_ring_;
+  io_uring_sqe* sqes_;
+  size_t sq_ring_size_;
+  size_t cq_ring_size_;
+  size_t sqes_size_;
+
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned sq_mask_;
+  unsigned* sq_array_;
+  unsigned sq_entries_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  io_uring_cqe* cqes_;
+  unsigned unsubmitted_;
+
+  // No copying allowed
+  IoRing(const IoRing&);
+  void operator=(const IoRing&);
+};
+
+}  // namespace novelsm
+
+#endif  // HAVE_IO_URING
+
+#endif  // STORAGE_NOVELSM_UTIL_IO_RING_H_
@@ -0,0 +1,132 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/learned_index.h"
+
+#include <math.h>
+#include <string.h>
+
+namespace novelsm {
+
+static Slice StripSuffix(const Slice& key, size_t suffix_len) {
+  return Slice(key.data(), key.size() > suffix_len ? key.size() - suffix_len : 0);
+}
+
+uint64_t LearnedIndex::Project(const Slice& key) const {
+  Slice k = StripSuffix(key, suffix_len_);
+  const size_t p = prefix_.size();
+  if (p > 0) {
+    const size_t n = (k.size() < p) ? k.size() : p;
+    int r = memcmp(k.data(), prefix_.data(), n);
+    if (r < 0 || (r == 0 && k.size() < p)) return 0;
+    if (r > 0) return ~static_cast<uint64_t>(0);
+  }
+  uint64_t x = 0;
+  for (size_t i = 0; i < 8; i++) {
+    x <<= 8;
+    if (p + i < k.size()) {
+      x |= static_cast<unsigned char>(k[p + i]);
+    }
+  }
+  return x;
+}
+
+void LearnedIndex::Clear() {
+  prefix_.clear();
+  segments_.clear();
+  num_keys_ = 0;
+}
+
+void LearnedIndex::Build(const std::vector<Slice>& keys, size_t suffix_len) {
+  Clear();
+  if (keys.size() < kMinKeys) return;
+  suffix_len_ = suffix_len;
+  num_keys_ = keys.size();
+
+  // Sorted keys share the common prefix of the first and the last one
+  Slice first = StripSuffix(keys.front(), suffix_len);
+  Slice last = StripSuffix(keys.back(), suffix_len);
+  size_t p = 0;
+  while (p < first.size() && p < last.size() && first[p] == last[p]) p++;
+  prefix_.assign(first.data(), p);
+
+  // Greedily extend each segment while one line stays within kMaxError
+  // of every point so far.  [lo, hi] is the range of such slopes.  Keys
+  // that project to the same value are modelled by the first of them,
+  // and the segment of that one notes how many follow it.
+  Segment cur;
+  double lo = 0, hi = HUGE_VAL;
+  uint64_t prev = 0;
+  uint32_t prev_position = 0;
+  for (uint32_t i = 0; i < num_keys_; i++) {
+    uint64_t x = Project(keys[i]);
+    if (i > 0 && x == prev) continue;
+    if (i > 0 && i - prev_position - 1 > cur.duplicates) {
+      cur.duplicates = i - prev_position - 1;
+    }
+    prev = x;
+    prev_position = i;
+    if (i > 0) {
+      double dx = static_cast<double>(x - cur.first);
+      double smin = (i - cur.position - kMaxError) / dx;
+      double smax = (i - cur.position + kMaxError) / dx;
+      if (smin <= hi && smax >= lo) {
+        if (smin > lo) lo = smin;
+        if (smax < hi) hi = smax;
+        continue;
+      }
+      cur.slope = (hi == HUGE_VAL) ? 0 : (lo + hi) / 2;
+      segments_.push_back(cur);
+    }
+    cur.first = x;
+    cur.position = i;
+    cur.duplicates = 0;
+    lo = 0;
+    hi = HUGE_VAL;
+  }
+  if (num_keys_ - prev_position - 1 > cur.duplicates) {
+    cur.duplicates = num_keys_ - prev_position - 1;
+  }
+  cur.slope = (hi == HUGE_VAL) ? 0 : (lo + hi) / 2;
+  segments_.push_back(cur);
+}
+
+void LearnedIndex::Predict(const Slice& key, uint32_t* lo,
+                           uint32_t* hi) const {
+  const uint64_t x = Project(key);
+
+  // Last segment starting at or before x
+  uint32_t left = 0;
+  uint32_t right = segments_.size();
+  while (left < right) {
+    uint32_t mid = (left + right) / 2;
+    if (segments_[mid].first <= x) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+
+  double pos = 0;
+  uint32_t duplicates = 0;
+  if (left > 0) {
+    const Segment& s = segments_[left - 1];
+    duplicates = s.duplicates;
+    pos = s.position + s.slope * static_cast<double>(x - s.first);
+    // Past its last key a segment's line is only an extrapolation; the
+    // answer is then where the next segment starts
+    double limit = (left < segments_.size()) ? segments_[left].position
+                                              : num_keys_;
+    if (pos > limit) pos = limit;
+  }
+  // pos lies in [0, num_keys_], so only one side of each bound can clip.
+  // The first key >= key may be any of those that project like the
+  // modelled one.
+  double l = floor(pos) - kMaxError;
+  double h = ceil(pos) + kMaxError + 1 + duplicates;
+  *lo = (l <= 0) ? 0 : static_cast<uint32_t>(l);
+  *hi = (h >= num_keys_) ? num_keys_ : static_cast<uint32_t>(h);
+}
+
+}  // namespace novelsm
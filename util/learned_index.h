@@ -0,0 +1,67 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// NoveLSM: Piecewise-linear model of where a key falls in a sorted array
+// of keys.  Keys are projected to the 8 bytes that follow their common
+// prefix, read as a big-endian integer, which preserves bytewise order.
+// A prediction is only a hint: callers check that the returned range
+// brackets the key and otherwise run their ordinary search.
+
+#ifndef STORAGE_NOVELSM_UTIL_LEARNED_INDEX_H_
+#define STORAGE_NOVELSM_UTIL_LEARNED_INDEX_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "novelsm/slice.h"
+
+namespace novelsm {
+
+class LearnedIndex {
+ public:
+  // Maximum distance between a predicted and an actual position
+  static const uint32_t kMaxError = 4;
+
+  // Arrays shorter than this are searched faster without a model
+  static const uint32_t kMinKeys = 16;
+
+  LearnedIndex() : num_keys_(0), suffix_len_(0) { }
+
+  // Fit the model to keys[0..n-1], which are sorted bytewise once their
+  // last suffix_len bytes are dropped (8 for internal keys).  Leaves the
+  // model empty when n < kMinKeys.
+  void Build(const std::vector<Slice>& keys, size_t suffix_len);
+
+  void Clear();
+
+  bool empty() const { return segments_.empty(); }
+
+  // Store in [*lo, *hi] the positions that should hold the first key
+  // >= key.  The range grows with the number of keys that project to
+  // the same value.  REQUIRES: !empty()
+  void Predict(const Slice& key, uint32_t* lo, uint32_t* hi) const;
+
+  size_t ApproximateMemoryUsage() const {
+    return prefix_.size() + segments_.size() * sizeof(Segment);
+  }
+
+ private:
+  struct Segment {
+    uint64_t first;      // Smallest projected key covered
+    double position;     // Predicted position of first
+    double slope;        // Positions per unit of projected key
+    uint32_t duplicates; // Most keys after the first of a projected key
+  };
+
+  uint64_t Project(const Slice& key) const;
+
+  std::string prefix_;              // Common prefix of all keys
+  std::vector<Segment> segments_;   // Ordered by first
+  uint32_t num_keys_;
+  size_t suffix_len_;
+};
+
+}  // namespace novelsm
+
+#endif  // STORAGE_NOVELSM_UTIL_LEARNED_INDEX_H_
@@ -0,0 +1,214 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/learned_index.h"
+
+#include <algorithm>
+#include "db/dbformat.h"
+#include "novelsm/comparator.h"
+#include "util/random.h"
+#include "util/testharness.h"
+
+namespace novelsm {
+
+static std::string NumberKey(const std::string& prefix, uint64_t n) {
+  char buf[100];
+  snprintf(buf, sizeof(buf), "%016llu", (unsigned long long) n);
+  return prefix + buf;
+}
+
+// The 8 bytes of n, most significant first
+static std::string BigEndian(uint64_t n) {
+  std::string result;
+  for (int i = 7; i >= 0; i--) {
+    result.push_back(static_cast<char>((n >> (8 * i)) & 0xff));
+  }
+  return result;
+}
+
+class LearnedIndexTest {
+ public:
+  std::vector<std::string> keys_;
+  const Comparator* cmp_;
+  size_t suffix_len_;
+  LearnedIndex index_;
+
+  LearnedIndexTest() : cmp_(BytewiseComparator()), suffix_len_(0) { }
+
+  void Build() {
+    std::vector<Slice> keys;
+    for (size_t i = 0; i < keys_.size(); i++) {
+      if (i > 0) {
+        ASSERT_LT(cmp_->Compare(keys_[i - 1], keys_[i]), 0);
+      }
+      keys.push_back(keys_[i]);
+    }
+    index_.Build(keys, suffix_len_);
+  }
+
+  // Position of the first key >= target
+  uint32_t LowerBound(const Slice& target) {
+    uint32_t left = 0;
+    uint32_t right = keys_.size();
+    while (left < right) {
+      uint32_t mid = (left + right) / 2;
+      if (cmp_->Compare(keys_[mid], target) < 0) {
+        left = mid + 1;
+      } else {
+        right = mid;
+      }
+    }
+    return left;
+  }
+
+  // The prediction brackets the position of the first key >= target, in
+  // a window no wider than "width"
+  void Check(const Slice& target, uint32_t width) {
+    uint32_t lo, hi;
+    index_.Predict(target, &lo, &hi);
+    uint32_t pos = LowerBound(target);
+    ASSERT_LE(lo, pos);
+    ASSERT_LE(pos, hi);
+    ASSERT_LE(hi, keys_.size());
+    ASSERT_LE(hi - lo, width);
+  }
+
+  // Every key, and targets just below and just above each of them, below
+  // all and above all
+  void CheckAll(uint32_t width) {
+    ASSERT_TRUE(!index_.empty());
+    for (size_t i = 0; i < keys_.size(); i++) {
+      const std::string& k = keys_[i];
+      Check(k, width);
+      Check(k + '\0', width);
+      Check(k.substr(0, k.size() - 1), width);
+      if (k[k.size() - 1] != '\0') {
+        std::string below = k;
+        below[below.size() - 1]--;
+        below.append(20, '\xff');
+        Check(below, width);
+      }
+    }
+    Check("", width);
+    Check(std::string(40, '\xff'), width);
+  }
+};
+
+static const uint32_t kWidth = 2 * LearnedIndex::kMaxError + 2;
+
+TEST(LearnedIndexTest, MinKeys) {
+  for (uint32_t i = 0; i + 1 < LearnedIndex::kMinKeys; i++) {
+    keys_.push_back(NumberKey("key", i));
+  }
+  Build();
+  ASSERT_TRUE(index_.empty());
+  ASSERT_EQ(0, index_.ApproximateMemoryUsage());
+
+  keys_.push_back(NumberKey("key", LearnedIndex::kMinKeys));
+  Build();
+  CheckAll(kWidth);
+  ASSERT_GT(index_.ApproximateMemoryUsage(), 0);
+
+  index_.Clear();
+  ASSERT_TRUE(index_.empty());
+}
+
+TEST(LearnedIndexTest, LongCommonPrefix) {
+  // Only the digits after the shared prefix tell the keys apart
+  const std::string prefix(200, 'p');
+  for (int i = 0; i < 5000; i++) {
+    keys_.push_back(NumberKey(prefix, 3 * i));
+  }
+  Build();
+  CheckAll(kWidth);
+  Check(prefix, kWidth);
+  Check(std::string(100, 'p'), kWidth);
+  Check(std::string(100, 'p') + "q", kWidth);
+  Check("o", kWidth);
+  Check("q", kWidth);
+}
+
+TEST(LearnedIndexTest, Skewed) {
+  Random rnd(301);
+  uint64_t n = 0;
+  for (int i = 0; i < 5000; i++) {
+    // Mostly close together, now and then far apart
+    n += rnd.Skewed(30) + 1;
+    keys_.push_back(BigEndian(n));
+  }
+  Build();
+  CheckAll(kWidth);
+  for (int i = 0; i < 5000; i++) {
+    Check(BigEndian(rnd.Next() % (n + 10)), kWidth);
+  }
+}
+
+TEST(LearnedIndexTest, Clustered) {
+  // Dense runs of keys far apart from each other
+  Random rnd(301);
+  for (int c = 0; c < 20; c++) {
+    const uint64_t base = static_cast<uint64_t>(c) << 56;
+    for (int i = 0; i < 100 + c * 20; i++) {
+      keys_.push_back(BigEndian(base + i * (c + 1)));
+    }
+  }
+  Build();
+  CheckAll(kWidth);
+  for (int i = 0; i < 5000; i++) {
+    Check(BigEndian((static_cast<uint64_t>(rnd.Uniform(21)) << 56) +
+                    rnd.Uniform(1000)), kWidth);
+  }
+}
+
+TEST(LearnedIndexTest, DuplicateProjections) {
+  // Keys that only differ past the projected 8 bytes project to the
+  // same value; the window grows to cover each such run
+  const int kRun = 40;
+  for (int i = 0; i < 50; i++) {
+    const std::string head = "k" + BigEndian(i * 1000);
+    const int n = (i % 5 == 0) ? kRun : 1 + i % 3;
+    for (int j = 0; j < n; j++) {
+      keys_.push_back(head + NumberKey("", j));
+    }
+  }
+  Build();
+  CheckAll(kWidth + kRun);
+  Check("k" + BigEndian(10 * 1000), kWidth + kRun);
+  Check("k" + BigEndian(10 * 1000) + "x", kWidth + kRun);
+  Check("k" + BigEndian(49 * 1000) + "x", kWidth + kRun);
+}
+
+TEST(LearnedIndexTest, InternalKeys) {
+  // Entries of one user key differ only in the dropped tag
+  cmp_ = new InternalKeyComparator(BytewiseComparator());
+  suffix_len_ = 8;
+  for (int i = 0; i < 500; i++) {
+    const std::string user_key = NumberKey("user", i * 7);
+    const int versions = (i % 50 == 0) ? 20 : 1;
+    for (int v = versions; v > 0; v--) {
+      std::string ikey;
+      AppendInternalKey(&ikey, ParsedInternalKey(user_key, 100 + v,
+                                                 kTypeValue));
+      keys_.push_back(ikey);
+    }
+  }
+  Build();
+  for (int i = -1; i <= 500 * 7; i++) {
+    const std::string user_key =
+        (i < 0) ? std::string("user") : NumberKey("user", i);
+    for (SequenceNumber seq = 99; seq <= 122; seq++) {
+      std::string target;
+      AppendInternalKey(&target, ParsedInternalKey(user_key, seq,
+                                                   kValueTypeForSeek));
+      Check(target, kWidth + 20);
+    }
+  }
+  delete cmp_;
+}
+
+}  // namespace novelsm
+
+int main(int argc, char** argv) {
+  return novelsm::test::RunAllTests();
+}
@@ -0,0 +1,327 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/nvm_block_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "port/cache_flush.h"
+#include "util/coding.h"
+#include "util/crc32c.h"
+#include "util/hash.h"
+#include "util/mutexlock.h"
+
+namespace novelsm {
+
+namespace {
+
+static const uint64_t kMagic = 0x4e564d424c4b4332ull;  // "NVMBLKC2"
+
+// The header gets a page of its own; records start cache line aligned
+static const size_t kHeaderSize = 4096;
+static const size_t kAlign = CACHE_LINE_SIZE;
+
+// Record size marking the unused end of a lap of the log
+static const uint32_t kPad = 0xffffffffu;
+
+// File number of erased records; no table has it
+static const uint64_t kErased = 0;
+
+// Smallest file that leaves room for a useful number of blocks
+static const size_t kMinSize = kHeaderSize + (1 << 20);
+
+}  // namespace
+
+// Persistent header at the start of the file.  Records live between
+// tail and head.
+struct NvmBlockCache::Super {
+  uint64_t magic;
+  uint64_t capacity;
+  uint64_t db_id;         // Database the blocks belong to
+  uint64_t head;
+  uint64_t tail;
+};
+
+// Header of one cached block; the raw block bytes follow it
+struct NvmBlockCache::Record {
+  uint64_t position;      // Where it was written, to tell it from stale bytes
+  uint64_t file_number;   // kErased once the block is forgotten
+  uint64_t offset;
+  uint32_t size;          // Bytes of the block, or kPad
+  uint32_t crc;           // Masked crc32c of the fields above
+};
+
+static uint32_t RecordCrc(const void* rec, size_t n) {
+  return crc32c::Mask(crc32c::Value(reinterpret_cast<const char*>(rec), n));
+}
+
+uint64_t NvmBlockCache::RecordSize(size_t block_size) {
+  const uint64_t n = sizeof(Record) + block_size;
+  return (n + kAlign - 1) & ~static_cast<uint64_t>(kAlign - 1);
+}
+
+Status NvmBlockCache::Open(const std::string& fname, size_t size,
+                           uint64_t db_id, NvmBlockCache** result) {
+  *result = NULL;
+  if (size < kMinSize) {
+    return Status::InvalidArgument(fname, "NVM block cache is too small");
+  }
+  int fd = open(fname.c_str(), O_RDWR | O_CREAT, 0664);
+  if (fd < 0) {
+    return Status::IOError(fname, strerror(errno));
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      (static_cast<size_t>(st.st_size) != size && ftruncate(fd, size) != 0)) {
+    Status s = Status::IOError(fname, strerror(errno));
+    close(fd);
+    return s;
+  }
+  void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    Status s = Status::IOError(fname, strerror(errno));
+    close(fd);
+    return s;
+  }
+  NvmBlockCache* cache =
+      new NvmBlockCache(fd, reinterpret_cast<char*>(base), size, db_id);
+  cache->Recover();
+  *result = cache;
+  return Status::OK();
+}
+
+NvmBlockCache::NvmBlockCache(int fd, char* base, size_t size,
+                             uint64_t db_id)
+    : fd_(fd),
+      base_(base),
+      mapped_size_(size),
+      super_(reinterpret_cast<Super*>(base)),
+      log_(base + kHeaderSize),
+      capacity_((size - kHeaderSize) & ~static_cast<uint64_t>(kAlign - 1)),
+      db_id_(db_id),
+      head_(0),
+      tail_(0),
+      samples_(0) {
+  // About two counters per block the cache can hold
+  size_t counters = 4096;
+  while (counters < capacity_ / 2048) {
+    counters *= 2;
+  }
+  counts_.resize(counters, 0);
+}
+
+NvmBlockCache::~NvmBlockCache() {
+  munmap(base_, mapped_size_);
+  close(fd_);
+}
+
+// Rebuild the index from the records between the persisted tail and
+// head.  A record that does not check out ends the log: it is an append
+// that did not complete.  The blocks of another database are dropped.
+void NvmBlockCache::Recover() {
+  if (super_->magic != kMagic || super_->capacity != capacity_ ||
+      super_->db_id != db_id_ || super_->tail > super_->head ||
+      super_->head - super_->tail > capacity_) {
+    head_ = tail_ = 0;
+    PersistSuper();
+    return;
+  }
+  tail_ = super_->tail;
+  uint64_t p = tail_;
+  Record rec;
+  while (p < super_->head && ValidRecord(p, &rec)) {
+    if (rec.size == kPad) {
+      p += capacity_ - p % capacity_;
+      continue;
+    }
+    if (rec.file_number != kErased) {
+      Entry e;
+      e.position = p;
+      e.size = rec.size;
+      index_[Key(rec.file_number, rec.offset)] = e;
+    }
+    p += RecordSize(rec.size);
+  }
+  head_ = p;
+  if (head_ != super_->head) {
+    PersistSuper();
+  }
+}
+
+bool NvmBlockCache::ValidRecord(uint64_t position, Record* rec) const {
+  memcpy(rec, At(position), sizeof(Record));
+  if (rec->position != position ||
+      rec->crc != RecordCrc(rec, offsetof(Record, crc))) {
+    return false;
+  }
+  return rec->size == kPad ||
+         position % capacity_ + RecordSize(rec->size) <= capacity_;
+}
+
+// Forget the oldest record.  REQUIRES: mu_ held, tail_ < head_
+void NvmBlockCache::DropOldest() {
+  Record rec;
+  uint64_t tail = tail_;
+  if (!ValidRecord(tail, &rec) || rec.size == kPad) {
+    // Skip the rest of the lap; a bad record cannot be walked over
+    tail += capacity_ - tail % capacity_;
+    if (tail > head_) tail = head_;
+  } else {
+    std::map<Key, Entry>::iterator it =
+        index_.find(Key(rec.file_number, rec.offset));
+    if (it != index_.end() && it->second.position == tail) {
+      index_.erase(it);
+    }
+    tail += RecordSize(rec.size);
+  }
+  __atomic_store_n(&tail_, tail, __ATOMIC_RELEASE);
+}
+
+void NvmBlockCache::PersistSuper() {
+  super_->magic = kMagic;
+  super_->capacity = capacity_;
+  super_->db_id = db_id_;
+  super_->head = head_;
+  super_->tail = tail_;
+  flush_range(super_, sizeof(Super));
+  persist_fence();
+}
+
+// Count one disk read of the block and tell whether it is due for
+// admission.  REQUIRES: mu_ held
+bool NvmBlockCache::Sample(uint64_t file_number, uint64_t offset) {
+  char buf[16];
+  EncodeFixed64(buf, file_number);
+  EncodeFixed64(buf + 8, offset);
+  const size_t slot = Hash(buf, sizeof(buf), 0) & (counts_.size() - 1);
+
+  if (++samples_ >= counts_.size() * 4) {
+    for (size_t i = 0; i < counts_.size(); i++) {
+      counts_[i] >>= 1;
+    }
+    samples_ = 0;
+  }
+  if (counts_[slot] < 255) {
+    counts_[slot]++;
+  }
+  if (counts_[slot] < kAdmitReads) {
+    return false;
+  }
+  counts_[slot] = 0;
+  return true;
+}
+
+bool NvmBlockCache::Lookup(uint64_t file_number, uint64_t offset, size_t n,
+                           char* scratch) {
+  Entry e;
+  {
+    MutexLock l(&mu_);
+    std::map<Key, Entry>::const_iterator it =
+        index_.find(Key(file_number, offset));
+    if (it == index_.end()) {
+      return false;
+    }
+    e = it->second;
+  }
+  if (e.size != n) {
+    return false;
+  }
+  memcpy(scratch, At(e.position) + sizeof(Record), n);
+
+  // Admit() moves tail_ past a record before it overwrites it, so the
+  // copy is intact if the record is still live now
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return e.position >= __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+}
+
+void NvmBlockCache::Admit(uint64_t file_number, uint64_t offset,
+                          const Slice& raw) {
+  const uint64_t len = RecordSize(raw.size());
+  if (len > capacity_ / 8) {
+    return;
+  }
+
+  MutexLock l(&mu_);
+  const Key key(file_number, offset);
+  if (index_.find(key) != index_.end() || !Sample(file_number, offset)) {
+    return;
+  }
+
+  // Records do not wrap around the end of the area
+  uint64_t p = head_;
+  if (p % capacity_ + len > capacity_) {
+    p += capacity_ - p % capacity_;
+  }
+  const uint64_t old_tail = tail_;
+  while (p + len - tail_ > capacity_) {
+    DropOldest();
+  }
+  if (tail_ != old_tail) {
+    // Durable, and visible to Lookup(), before the space is reused
+    PersistSuper();
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  }
+
+  Record rec;
+  if (p != head_) {
+    rec.position = head_;
+    rec.file_number = 0;
+    rec.offset = 0;
+    rec.size = kPad;
+    rec.crc = RecordCrc(&rec, offsetof(Record, crc));
+    memcpy_flush(At(head_), &rec, sizeof(rec));
+  }
+  rec.position = p;
+  rec.file_number = file_number;
+  rec.offset = offset;
+  rec.size = static_cast<uint32_t>(raw.size());
+  rec.crc = RecordCrc(&rec, offsetof(Record, crc));
+  char* dst = At(p);
+  memcpy(dst, &rec, sizeof(rec));
+  memcpy(dst + sizeof(rec), raw.data(), raw.size());
+  flush_range(dst, sizeof(rec) + raw.size());
+  persist_fence();
+
+  head_ = p + len;
+  PersistSuper();
+
+  Entry e;
+  e.position = p;
+  e.size = rec.size;
+  index_[key] = e;
+}
+
+void NvmBlockCache::EraseFiles(uint64_t first, uint64_t last) {
+  MutexLock l(&mu_);
+  std::map<Key, Entry>::iterator it = index_.lower_bound(Key(first, 0));
+  bool erased = false;
+  while (it != index_.end() && it->first.first < last) {
+    // Only the header changes, so a Lookup() copying the block meanwhile
+    // still gets intact bytes
+    Record rec;
+    if (ValidRecord(it->second.position, &rec)) {
+      rec.file_number = kErased;
+      rec.crc = RecordCrc(&rec, offsetof(Record, crc));
+      memcpy_flush(At(it->second.position), &rec, sizeof(rec));
+      erased = true;
+    }
+    index_.erase(it++);
+  }
+  if (erased) {
+    persist_fence();
+  }
+}
+
+size_t NvmBlockCache::Usage() const {
+  MutexLock l(&mu_);
+  return head_ - tail_;
+}
+
+}  // namespace novelsm
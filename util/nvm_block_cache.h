@@ -0,0 +1,115 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// NoveLSM: Second block cache tier in a file mapped from NVM.  It holds
+// raw table blocks, trailer included, keyed by table file number and
+// block offset, so a copy is checked by the block's own crc when it is
+// read back.  Blocks are appended to a circular log and the oldest are
+// overwritten first.  The log records describe themselves, and the
+// header of the file tells where the live ones are, so the cache is
+// found again when the database is reopened.  Table file numbers start
+// over in a new database, so the header also records the identity of the
+// database the blocks came from, and a cache file found with another one
+// starts out empty.
+//
+// Only blocks that keep coming back from the table files are stored: a
+// block is admitted on its kAdmitReads-th read from disk within the
+// recent past.  A block read that often was dropped by the DRAM block
+// cache in between, so this tier ends up holding what the DRAM cache
+// evicts but the workload still wants.
+
+#ifndef STORAGE_NOVELSM_UTIL_NVM_BLOCK_CACHE_H_
+#define STORAGE_NOVELSM_UTIL_NVM_BLOCK_CACHE_H_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "novelsm/slice.h"
+#include "novelsm/status.h"
+#include "port/port.h"
+
+namespace novelsm {
+
+class NvmBlockCache {
+ public:
+  // Disk reads of a block that get it admitted
+  static const int kAdmitReads = 2;
+
+  // Map the cache file "fname" of "size" bytes, creating or resizing it
+  // as needed, and pick up the blocks it still holds if they were cached
+  // for the database identified by "db_id".
+  static Status Open(const std::string& fname, size_t size, uint64_t db_id,
+                     NvmBlockCache** result);
+
+  ~NvmBlockCache();
+
+  // Copy the n raw bytes of the block at "offset" of table "file_number"
+  // into scratch and return true, or return false if it is not cached.
+  // Safe to call concurrently with everything else.
+  bool Lookup(uint64_t file_number, uint64_t offset, size_t n,
+              char* scratch);
+
+  // Note that the raw block at "offset" of table "file_number" was read
+  // from disk, and store it once it was read kAdmitReads times.
+  void Admit(uint64_t file_number, uint64_t offset, const Slice& raw);
+
+  // Forget the blocks of tables numbered in [first, last), for good:
+  // they are not picked up again when the cache is reopened.
+  void EraseFiles(uint64_t first, uint64_t last);
+
+  // Bytes of cached blocks, record headers included
+  size_t Usage() const;
+
+ private:
+  struct Super;
+  struct Record;
+  struct Entry {
+    uint64_t position;
+    uint32_t size;
+  };
+  typedef std::pair<uint64_t, uint64_t> Key;  // File number and offset
+
+  NvmBlockCache(int fd, char* base, size_t size, uint64_t db_id);
+
+  // Bytes a record of a block of block_size bytes takes up in the log
+  static uint64_t RecordSize(size_t block_size);
+
+  void Recover();
+  char* At(uint64_t position) const { return log_ + position % capacity_; }
+  bool ValidRecord(uint64_t position, Record* rec) const;
+  void DropOldest();
+  void PersistSuper();
+  bool Sample(uint64_t file_number, uint64_t offset);
+
+  const int fd_;
+  char* const base_;           // Start of the mapping
+  const size_t mapped_size_;
+  Super* const super_;
+  char* const log_;            // Record area behind the header
+  const uint64_t capacity_;    // Bytes of the record area
+  const uint64_t db_id_;
+
+  // Logical positions grow without wrapping; At() maps them into the
+  // record area.  tail_ is also read without mu_ by Lookup().
+  uint64_t head_;              // Where the next record goes
+  uint64_t tail_;              // Oldest live record
+
+  mutable port::Mutex mu_;
+  std::map<Key, Entry> index_;
+
+  // Read counts of blocks not stored yet, halved now and then so that
+  // only recent reads count
+  std::vector<uint8_t> counts_;
+  uint64_t samples_;
+
+  // No copying allowed
+  NvmBlockCache(const NvmBlockCache&);
+  void operator=(const NvmBlockCache&);
+};
+
+}  // namespace novelsm
+
+#endif  // STORAGE_NOVELSM_UTIL_NVM_BLOCK_CACHE_H_
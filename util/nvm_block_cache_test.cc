@@ -0,0 +1,147 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/nvm_block_cache.h"
+
+#include "novelsm/env.h"
+#include "util/testharness.h"
+
+namespace novelsm {
+
+static const size_t kCacheSize = 2 << 20;
+
+class NvmBlockCacheTest {
+ public:
+  std::string fname_;
+  NvmBlockCache* cache_;
+
+  NvmBlockCacheTest() : cache_(NULL) {
+    fname_ = test::TmpDir() + "/nvm_block_cache_test";
+    Env::Default()->DeleteFile(fname_);
+  }
+
+  ~NvmBlockCacheTest() {
+    delete cache_;
+    Env::Default()->DeleteFile(fname_);
+  }
+
+  void Open(uint64_t db_id) {
+    delete cache_;
+    cache_ = NULL;
+    ASSERT_OK(NvmBlockCache::Open(fname_, kCacheSize, db_id, &cache_));
+  }
+
+  // Read the block from "disk" often enough to get it admitted
+  void Fill(uint64_t file_number, uint64_t offset, const std::string& raw) {
+    for (int i = 0; i < NvmBlockCache::kAdmitReads; i++) {
+      cache_->Admit(file_number, offset, raw);
+    }
+  }
+
+  std::string Lookup(uint64_t file_number, uint64_t offset, size_t n) {
+    std::string buf(n, '\0');
+    if (!cache_->Lookup(file_number, offset, n, &buf[0])) {
+      return "MISS";
+    }
+    return buf;
+  }
+};
+
+TEST(NvmBlockCacheTest, AdmitAfterRepeatedReads) {
+  Open(1);
+  cache_->Admit(5, 0, "block-a");
+  ASSERT_EQ("MISS", Lookup(5, 0, 7));
+  cache_->Admit(5, 0, "block-a");
+  ASSERT_EQ("block-a", Lookup(5, 0, 7));
+  ASSERT_EQ("MISS", Lookup(5, 4096, 7));
+  ASSERT_EQ("MISS", Lookup(6, 0, 7));
+  ASSERT_EQ("MISS", Lookup(5, 0, 8));     // Other size
+}
+
+TEST(NvmBlockCacheTest, Reopen) {
+  Open(1);
+  Fill(5, 0, "block-a");
+  Fill(5, 100, "block-b");
+  Fill(7, 0, "block-c");
+
+  // The same database finds its blocks again
+  Open(1);
+  ASSERT_EQ("block-a", Lookup(5, 0, 7));
+  ASSERT_EQ("block-b", Lookup(5, 100, 7));
+  ASSERT_EQ("block-c", Lookup(7, 0, 7));
+  ASSERT_GT(cache_->Usage(), 0);
+}
+
+TEST(NvmBlockCacheTest, OtherDatabase) {
+  Open(1);
+  Fill(5, 0, "block-a");
+
+  // A new database numbers its tables from scratch; its table 5 is not
+  // the old one
+  Open(2);
+  ASSERT_EQ("MISS", Lookup(5, 0, 7));
+  ASSERT_EQ(0, cache_->Usage());
+  Fill(5, 0, "block-x");
+  ASSERT_EQ("block-x", Lookup(5, 0, 7));
+
+  Open(1);
+  ASSERT_EQ("MISS", Lookup(5, 0, 7));
+}
+
+TEST(NvmBlockCacheTest, EraseFiles) {
+  Open(1);
+  Fill(4, 0, "block-a");
+  Fill(5, 0, "block-b");
+  Fill(5, 100, "block-c");
+  Fill(6, 0, "block-d");
+
+  cache_->EraseFiles(5, 6);
+  ASSERT_EQ("block-a", Lookup(4, 0, 7));
+  ASSERT_EQ("MISS", Lookup(5, 0, 7));
+  ASSERT_EQ("MISS", Lookup(5, 100, 7));
+  ASSERT_EQ("block-d", Lookup(6, 0, 7));
+
+  // Erased blocks stay gone after a reopen, and later ones still count
+  Fill(7, 0, "block-e");
+  Open(1);
+  ASSERT_EQ("block-a", Lookup(4, 0, 7));
+  ASSERT_EQ("MISS", Lookup(5, 0, 7));
+  ASSERT_EQ("MISS", Lookup(5, 100, 7));
+  ASSERT_EQ("block-d", Lookup(6, 0, 7));
+  ASSERT_EQ("block-e", Lookup(7, 0, 7));
+
+  // Open-ended ranges
+  cache_->EraseFiles(6, ~static_cast<uint64_t>(0));
+  ASSERT_EQ("block-a", Lookup(4, 0, 7));
+  ASSERT_EQ("MISS", Lookup(6, 0, 7));
+  ASSERT_EQ("MISS", Lookup(7, 0, 7));
+
+  // A table number that is handed out again caches afresh
+  Fill(5, 0, "block-f");
+  Open(1);
+  ASSERT_EQ("block-f", Lookup(5, 0, 7));
+}
+
+TEST(NvmBlockCacheTest, Wraparound) {
+  // Far more than fits: the oldest blocks go, the newest stay
+  Open(1);
+  const std::string raw(16 << 10, 'x');
+  const int kBlocks = 4 * static_cast<int>(kCacheSize / raw.size());
+  for (int i = 0; i < kBlocks; i++) {
+    Fill(10, i * raw.size(), raw);
+  }
+  ASSERT_LE(cache_->Usage(), kCacheSize);
+  ASSERT_EQ("MISS", Lookup(10, 0, raw.size()));
+  ASSERT_EQ(raw, Lookup(10, (kBlocks - 1) * raw.size(), raw.size()));
+
+  Open(1);
+  ASSERT_EQ("MISS", Lookup(10, 0, raw.size()));
+  ASSERT_EQ(raw, Lookup(10, (kBlocks - 1) * raw.size(), raw.size()));
+}
+
+}  // namespace novelsm
+
+int main(int argc, char** argv) {
+  return novelsm::test::RunAllTests();
+}
@@ -25,7 +25,32 @@ Options::Options()
       block_restart_interval(16),
       compression(kSnappyCompression),
       reuse_logs(false),
-      filter_policy(NULL) {
+      filter_policy(NULL),
+      num_read_threads(0),
+      sec_diskpath(NULL),
+      concurrent_nvm_writes(false),
+      nvm_slab_size(0),
+      num_immutable_memtables(1),
+      nvm_inplace_updates(false),
+      nvm_hash_index(false),
+#ifdef _ENABLE_PREDICTION
+      nvm_hit_prediction(true),
+#else
+      nvm_hit_prediction(false),
+#endif
+      learned_index(false),
+      async_block_reads(false),
+      nvm_block_cache_size(0),
+      cache_index_and_filter_blocks(false),
+      pin_index_and_filter_levels(0),
+      max_subcompactions(1),
+      max_background_compactions(1),
+      max_background_flushes(0),
+      flush_partitions(1),
+      flush_to_level1(false),
+      compaction_style(kCompactionStyleLeveled),
+      universal_size_ratio(1),
+      universal_max_sorted_runs(4) {
 }
 
 }  // namespace novelsm
@@ -0,0 +1,263 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/read_pool.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "util/affinity.h"
+#include "util/cpumap.h"
+
+namespace novelsm {
+
+namespace {
+
+// Idle polls of a worker, or of a waiting caller, before it sleeps.
+// Roughly 20-50us with the pause instruction.
+static const int kSpinLimit = 512;
+
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __asm__ __volatile__("pause" ::: "memory");
+#else
+  __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+static inline void FutexWait(int* addr, int val) {
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static inline void FutexWakeAll(int* addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline void SpinLock(int* lock) {
+  while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(lock, __ATOMIC_RELAXED)) CpuRelax();
+  }
+}
+
+static inline void SpinUnlock(int* lock) {
+  __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+}  // namespace
+
+struct ReadPool::Worker {
+  ReadPool* pool;
+  int id;
+  int cpu;                // Pinned core, -1 if not pinned
+  pthread_t thread;
+
+  // FIFO of submitted jobs, guarded by lock
+  int lock;
+  Job* head;
+  Job* tail;
+
+  // Set while the worker runs a job
+  int running;
+
+  // Set while the worker sleeps on cv
+  int sleeping;
+  port::Mutex mu;
+  port::CondVar cv;
+
+  // Keep neighbouring workers' queues off this cache line
+  char pad[64];
+
+  Worker() : pool(NULL), id(0), cpu(-1), lock(0), head(NULL), tail(NULL),
+             running(0), sleeping(0), cv(&mu) { }
+
+  bool Empty() const {
+    return __atomic_load_n(&head, __ATOMIC_RELAXED) == NULL;
+  }
+
+  void Push(Job* job) {
+    job->next_ = NULL;
+    SpinLock(&lock);
+    if (tail != NULL) {
+      tail->next_ = job;
+    } else {
+      __atomic_store_n(&head, job, __ATOMIC_RELAXED);
+    }
+    tail = job;
+    SpinUnlock(&lock);
+  }
+
+  Job* Pop() {
+    if (Empty()) return NULL;
+    SpinLock(&lock);
+    Job* job = head;
+    if (job != NULL) {
+      __atomic_store_n(&head, job->next_, __ATOMIC_RELAXED);
+      if (head == NULL) tail = NULL;
+    }
+    SpinUnlock(&lock);
+    return job;
+  }
+};
+
+void ReadPool::Job::Run() {
+  (*function_)(arg_);
+  // The submitter may free the job as soon as it sees kDone, so only
+  // the futex word's address is used after the exchange
+  if (__atomic_exchange_n(&state_, kDone, __ATOMIC_ACQ_REL) == kParked) {
+    FutexWakeAll(&state_);
+  }
+}
+
+void ReadPool::Job::Wait() {
+  for (int i = 0; i < spins_; i++) {
+    if (__atomic_load_n(&state_, __ATOMIC_ACQUIRE) == kDone) return;
+    CpuRelax();
+  }
+  int expected = kPending;
+  __atomic_compare_exchange_n(&state_, &expected, kParked, false,
+                              __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+  while (__atomic_load_n(&state_, __ATOMIC_ACQUIRE) != kDone) {
+    FutexWait(&state_, kParked);
+  }
+}
+
+ReadPool::ReadPool(int num_threads, bool pin_and_spin)
+    : workers_(NULL),
+      num_workers_(num_threads < 1 ? 1 : num_threads),
+      spins_(pin_and_spin && sysconf(_SC_NPROCESSORS_ONLN) > 1 ?
+             kSpinLimit : 0),
+      next_worker_(0),
+      shutting_down_(0) {
+  // Cores are handed out by get_free_core(); workers beyond the free
+  // cores, or every worker without NUMA information, are left unpinned
+  bool have_cpus = pin_and_spin && (fill_cpumap_info() == 0);
+
+  workers_ = new Worker[num_workers_];
+  for (int i = 0; i < num_workers_; i++) {
+    Worker* w = &workers_[i];
+    w->pool = this;
+    w->id = i;
+    w->cpu = have_cpus ? get_free_core() : -1;
+    if (pthread_create(&w->thread, NULL, &WorkerMain, w) != 0) {
+      fprintf(stderr, "ReadPool: cannot create read thread %d\n", i);
+      abort();
+    }
+  }
+}
+
+ReadPool::~ReadPool() {
+  __atomic_store_n(&shutting_down_, 1, __ATOMIC_SEQ_CST);
+  for (int i = 0; i < num_workers_; i++) {
+    Wake(&workers_[i]);
+  }
+  for (int i = 0; i < num_workers_; i++) {
+    pthread_join(workers_[i].thread, NULL);
+  }
+  delete[] workers_;
+}
+
+void ReadPool::Submit(Job* job, void (*function)(void*), void* arg) {
+  job->function_ = function;
+  job->arg_ = arg;
+  job->spins_ = spins_;
+  job->state_ = Job::kPending;
+
+  unsigned n = __atomic_fetch_add(&next_worker_, 1, __ATOMIC_RELAXED);
+  Worker* w = &workers_[n % num_workers_];
+  w->Push(job);
+
+  // Pairs with the fence in Park(): either the worker sees the job or
+  // this thread sees it asleep.  A job queued behind a running one is
+  // left to a sleeping worker to steal; the fence in WorkerMain() makes
+  // sure that this thread or the worker wakes one.
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&w->sleeping, __ATOMIC_RELAXED)) {
+    Wake(w);
+  } else if (__atomic_load_n(&w->running, __ATOMIC_RELAXED)) {
+    WakeOne(w->id);
+  }
+}
+
+void ReadPool::Wake(Worker* w) {
+  w->mu.Lock();
+  w->cv.Signal();
+  w->mu.Unlock();
+}
+
+void ReadPool::WakeOne(int busy) {
+  for (int i = 1; i < num_workers_; i++) {
+    Worker* w = &workers_[(busy + i) % num_workers_];
+    if (__atomic_load_n(&w->sleeping, __ATOMIC_RELAXED)) {
+      Wake(w);
+      return;
+    }
+  }
+}
+
+// Own queue first, then the other workers' in turn
+ReadPool::Job* ReadPool::Take(Worker* w) {
+  Job* job = w->Pop();
+  for (int i = 1; job == NULL && i < num_workers_; i++) {
+    job = workers_[(w->id + i) % num_workers_].Pop();
+  }
+  return job;
+}
+
+bool ReadPool::Queued() const {
+  for (int i = 0; i < num_workers_; i++) {
+    if (!workers_[i].Empty()) return true;
+  }
+  return false;
+}
+
+// Sleep until a job is queued anywhere, since a woken worker steals
+void ReadPool::Park(Worker* w) {
+  w->mu.Lock();
+  __atomic_store_n(&w->sleeping, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  while (!Queued() &&
+         !__atomic_load_n(&shutting_down_, __ATOMIC_ACQUIRE)) {
+    w->cv.Wait();
+  }
+  __atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+  w->mu.Unlock();
+}
+
+void* ReadPool::WorkerMain(void* arg) {
+  Worker* w = reinterpret_cast<Worker*>(arg);
+  ReadPool* pool = w->pool;
+  if (w->cpu >= 0 && setaffinity(w->cpu) != 0) {
+    w->cpu = -1;
+  }
+
+  int idle = 0;
+  for (;;) {
+    Job* job = pool->Take(w);
+    if (job != NULL) {
+      __atomic_store_n(&w->running, 1, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if (!w->Empty()) {
+        pool->WakeOne(w->id);
+      }
+      job->Run();
+      __atomic_store_n(&w->running, 0, __ATOMIC_RELAXED);
+      idle = 0;
+    } else if (__atomic_load_n(&pool->shutting_down_, __ATOMIC_ACQUIRE)) {
+      break;
+    } else if (idle < pool->spins_) {
+      idle++;
+      CpuRelax();
+    } else {
+      pool->Park(w);
+      idle = 0;
+    }
+  }
+  return NULL;
+}
+
+}  // namespace novelsm
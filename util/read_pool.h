@@ -0,0 +1,91 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// NoveLSM: Pool of reader threads serving the memtable half of a parallel
+// Get(). Every worker owns a job queue and is pinned to its own core; an
+// idle worker steals from the others, spins for a short while and only
+// then goes to sleep. Each job carries its own completion handle, so a
+// caller waits for its lookup alone rather than for the whole pool.
+//
+// The same pool without pinning or spinning runs background work, such
+// as the pieces of a split compaction or flush.
+
+#ifndef STORAGE_NOVELSM_UTIL_READ_POOL_H_
+#define STORAGE_NOVELSM_UTIL_READ_POOL_H_
+
+#include <pthread.h>
+#include "port/port.h"
+
+namespace novelsm {
+
+class ReadPool {
+ public:
+  // Completion handle of one job.  The submitter owns it and must keep it
+  // alive until Wait() has returned.  A Job can be reused after that.
+  class Job {
+   public:
+    Job() : function_(NULL), arg_(NULL), next_(NULL), spins_(0),
+            state_(kDone) { }
+
+    // Block until the job has run.  Spins first, then sleeps.
+    void Wait();
+
+   private:
+    friend class ReadPool;
+
+    enum { kPending = 0, kParked = 1, kDone = 2 };
+
+    void Run();
+
+    void (*function_)(void*);
+    void* arg_;
+    Job* next_;       // Next job in a worker queue
+    int spins_;
+    int state_;       // Futex word
+
+    // No copying allowed
+    Job(const Job&);
+    void operator=(const Job&);
+  };
+
+  // Start num_threads workers.  If pin_and_spin, they are pinned to the
+  // cores of the NUMA node named by $NUMA_AFFINITY (0 by default) while
+  // free cores remain, and workers and waiters spin before they sleep.
+  // Otherwise workers float and sleep as soon as they are idle, which
+  // suits jobs that run for milliseconds or more.
+  explicit ReadPool(int num_threads, bool pin_and_spin = true);
+
+  // Run the jobs still queued, then stop the workers.
+  ~ReadPool();
+
+  // Queue (*function)(arg) and return at once.  job->Wait() returns after
+  // it has run.  Safe to call from any thread.
+  void Submit(Job* job, void (*function)(void*), void* arg);
+
+  int NumThreads() const { return num_workers_; }
+
+ private:
+  struct Worker;
+
+  static void* WorkerMain(void* arg);
+  Job* Take(Worker* w);
+  bool Queued() const;
+  void Park(Worker* w);
+  void Wake(Worker* w);
+  void WakeOne(int busy);
+
+  Worker* workers_;
+  int num_workers_;
+  int spins_;             // Idle polls before sleeping, 0 on one CPU
+  unsigned next_worker_;  // Round-robin cursor of Submit()
+  int shutting_down_;
+
+  // No copying allowed
+  ReadPool(const ReadPool&);
+  void operator=(const ReadPool&);
+};
+
+}  // namespace novelsm
+
+#endif  // STORAGE_NOVELSM_UTIL_READ_POOL_H_
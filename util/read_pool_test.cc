@@ -0,0 +1,145 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/read_pool.h"
+
+#include "novelsm/env.h"
+#include "port/port.h"
+#include "util/testharness.h"
+
+namespace novelsm {
+
+class ReadPoolTest { };
+
+static void Increment(void* arg) {
+  __atomic_fetch_add(reinterpret_cast<int*>(arg), 1, __ATOMIC_RELAXED);
+}
+
+// A job that blocks its worker until Open() is called
+struct Gate {
+  port::Mutex mu;
+  port::CondVar cv;
+  bool open;
+  Gate() : cv(&mu), open(false) { }
+
+  void Open() {
+    mu.Lock();
+    open = true;
+    cv.SignalAll();
+    mu.Unlock();
+  }
+
+  static void Pass(void* arg) {
+    Gate* g = reinterpret_cast<Gate*>(arg);
+    g->mu.Lock();
+    while (!g->open) g->cv.Wait();
+    g->mu.Unlock();
+  }
+};
+
+TEST(ReadPoolTest, RunsEachJob) {
+  ReadPool pool(2);
+  int count = 0;
+  ReadPool::Job job;
+  for (int i = 0; i < 1000; i++) {
+    pool.Submit(&job, &Increment, &count);
+    job.Wait();
+    ASSERT_EQ(i + 1, __atomic_load_n(&count, __ATOMIC_RELAXED));
+  }
+}
+
+TEST(ReadPoolTest, UnpinnedPool) {
+  // Background pools neither pin nor spin, but run jobs all the same
+  ReadPool pool(2, false);
+  Gate gate;
+  int count = 0;
+  ReadPool::Job blocked, job;
+  pool.Submit(&blocked, &Gate::Pass, &gate);
+  for (int i = 0; i < 100; i++) {
+    pool.Submit(&job, &Increment, &count);
+    job.Wait();
+  }
+  ASSERT_EQ(100, count);
+  gate.Open();
+  blocked.Wait();
+}
+
+static const int kSubmitters = 4;
+static const int kJobsPerSubmitter = 2000;
+
+struct Submitter {
+  ReadPool* pool;
+  int count;
+  port::Mutex* mu;
+  int* done;
+};
+
+static void SubmitterBody(void* arg) {
+  Submitter* s = reinterpret_cast<Submitter*>(arg);
+  ReadPool::Job jobs[4];
+  for (int i = 0; i < kJobsPerSubmitter; i += 4) {
+    for (int j = 0; j < 4; j++) s->pool->Submit(&jobs[j], &Increment, &s->count);
+    for (int j = 0; j < 4; j++) jobs[j].Wait();
+  }
+  s->mu->Lock();
+  (*s->done)++;
+  s->mu->Unlock();
+}
+
+TEST(ReadPoolTest, ConcurrentSubmitters) {
+  ReadPool pool(3);
+  port::Mutex mu;
+  int done = 0;
+  Submitter submitters[kSubmitters];
+  for (int i = 0; i < kSubmitters; i++) {
+    submitters[i].pool = &pool;
+    submitters[i].count = 0;
+    submitters[i].mu = &mu;
+    submitters[i].done = &done;
+    Env::Default()->StartThread(&SubmitterBody, &submitters[i]);
+  }
+  for (;;) {
+    mu.Lock();
+    int n = done;
+    mu.Unlock();
+    if (n == kSubmitters) break;
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  for (int i = 0; i < kSubmitters; i++) {
+    ASSERT_EQ(kJobsPerSubmitter, submitters[i].count);
+  }
+}
+
+TEST(ReadPoolTest, WaitIsPerJob) {
+  // One worker is held by the gate; a second job still completes
+  ReadPool pool(2);
+  Gate gate;
+  int count = 0;
+  ReadPool::Job blocked, job;
+  pool.Submit(&blocked, &Gate::Pass, &gate);
+  pool.Submit(&job, &Increment, &count);
+  job.Wait();
+  ASSERT_EQ(1, count);
+  gate.Open();
+  blocked.Wait();
+}
+
+TEST(ReadPoolTest, DestructorRunsQueuedJobs) {
+  ReadPool* pool = new ReadPool(1);
+  Gate gate;
+  int count = 0;
+  ReadPool::Job blocked;
+  ReadPool::Job jobs[10];
+  pool->Submit(&blocked, &Gate::Pass, &gate);
+  for (int i = 0; i < 10; i++) pool->Submit(&jobs[i], &Increment, &count);
+  gate.Open();
+  delete pool;
+  ASSERT_EQ(10, count);
+}
+
+}  // namespace novelsm
+
+int main(int argc, char** argv) {
+  return novelsm::test::RunAllTests();
+}